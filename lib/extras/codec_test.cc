@@ -7,6 +7,7 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <algorithm>
 #include <sstream>
@@ -14,6 +15,9 @@
 #include <utility>
 #include <vector>
 
+#if JPEGXL_ENABLE_APNG
+#include "lib/extras/dec/apng.h"
+#endif
 #include "lib/extras/dec/pgx.h"
 #include "lib/extras/dec/pnm.h"
 #include "lib/extras/enc/encode.h"
@@ -565,6 +569,79 @@ TEST(CodecTest, TestWideGamut) {
 
 TEST(CodecTest, TestPNM) { TestCodecPNM(); }
 
+TEST(CodecTest, PNMNoCopy) {
+  const size_t xsize = 7, ysize = 3;
+  std::string header = "P6\n7 3\n255\n";
+  std::vector<uint8_t> bytes(header.begin(), header.end());
+  for (size_t i = 0; i < xsize * ysize * 3; ++i) {
+    bytes.push_back(static_cast<uint8_t>(i * 11));
+  }
+  const Span<const uint8_t> span(bytes.data(), bytes.size());
+
+  PackedPixelFile copied;
+  ASSERT_TRUE(DecodeImagePNM(span, ColorHints(), SizeConstraints(), &copied));
+  PackedPixelFile view;
+  ASSERT_TRUE(
+      DecodeImagePNMNoCopy(span, ColorHints(), SizeConstraints(), &view));
+  ASSERT_EQ(1u, view.frames.size());
+  const PackedImage& image = view.frames[0].color;
+  EXPECT_EQ(xsize, image.xsize);
+  EXPECT_EQ(ysize, image.ysize);
+  // The pixels are the raster of the input, not a copy.
+  EXPECT_EQ(bytes.data() + header.size(),
+            reinterpret_cast<const uint8_t*>(image.pixels()));
+  ASSERT_EQ(copied.frames[0].color.pixels_size, image.pixels_size);
+  EXPECT_EQ(0, memcmp(copied.frames[0].color.pixels(), image.pixels(),
+                      image.pixels_size));
+}
+
+TEST(CodecTest, ChunkedPNM) {
+  const size_t xsize = 5, ysize = 7;
+  const std::vector<std::string> headers = {
+      "P5\n5 7\n255\n",
+      "P6\n5 7\n65535\n",
+      "PF\n5 7\n-1.0\n",
+      "P7\nWIDTH 5\nHEIGHT 7\nDEPTH 5\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\n"
+      "TUPLTYPE Depth\nENDHDR\n",
+  };
+  const std::vector<size_t> pixel_sizes = {1, 6, 12, 5};
+  for (size_t i = 0; i < headers.size(); ++i) {
+    std::vector<uint8_t> bytes(headers[i].begin(), headers[i].end());
+    for (size_t j = 0; j < xsize * ysize * pixel_sizes[i]; ++j) {
+      bytes.push_back(static_cast<uint8_t>(j * 7));
+    }
+    PackedPixelFile expected;
+    ASSERT_TRUE(DecodeImagePNM(Span<const uint8_t>(bytes.data(), bytes.size()),
+                               ColorHints(), SizeConstraints(), &expected));
+
+    FILE* f = tmpfile();
+    ASSERT_TRUE(f != nullptr);
+    ASSERT_EQ(bytes.size(), fwrite(bytes.data(), 1, bytes.size(), f));
+    rewind(f);
+    ChunkedPNMDecoder decoder;
+    PackedPixelFile ppf;
+    ASSERT_TRUE(decoder.Init(f, ColorHints(), SizeConstraints(), &ppf));
+    EXPECT_EQ(expected.info.num_extra_channels, ppf.info.num_extra_channels);
+    EXPECT_EQ(ysize, decoder.remaining_rows());
+    ASSERT_TRUE(decoder.ReadFrame(/*strip_rows=*/3, &ppf));
+    fclose(f);
+
+    ASSERT_EQ(1u, ppf.frames.size());
+    const PackedFrame& frame = ppf.frames[0];
+    const PackedFrame& expected_frame = expected.frames[0];
+    ASSERT_EQ(expected_frame.color.pixels_size, frame.color.pixels_size);
+    EXPECT_EQ(0, memcmp(expected_frame.color.pixels(), frame.color.pixels(),
+                        frame.color.pixels_size));
+    ASSERT_EQ(expected_frame.extra_channels.size(),
+              frame.extra_channels.size());
+    for (size_t ec = 0; ec < frame.extra_channels.size(); ++ec) {
+      EXPECT_EQ(0, memcmp(expected_frame.extra_channels[ec].pixels(),
+                          frame.extra_channels[ec].pixels(),
+                          frame.extra_channels[ec].pixels_size));
+    }
+  }
+}
+
 TEST(CodecTest, FormatNegotiation) {
   const std::vector<JxlPixelFormat> accepted_formats = {
       {/*num_channels=*/4,
@@ -600,6 +677,94 @@ TEST(CodecTest, FormatNegotiation) {
   EXPECT_EQ(format.data_type, JXL_TYPE_UINT16);
 }
 
+TEST(CodecTest, RowSinkMatchesEncode) {
+  for (const char* extension : {".png", ".ppm", ".pgm"}) {
+    std::unique_ptr<Encoder> encoder = Encoder::FromExtension(extension);
+    ASSERT_THAT(encoder, NotNull());
+    TestImageParams params;
+    params.codec = CodecFromExtension(extension);
+    params.xsize = 11;
+    params.ysize = 7;
+    params.bits_per_sample = 16;
+    params.is_gray = strcmp(extension, ".pgm") == 0;
+    params.add_alpha = false;
+    params.big_endian = true;
+    params.add_extra_channels = false;
+    PackedPixelFile ppf;
+    CreateTestImage(params, &ppf);
+    const PackedImage& color = ppf.frames[0].color;
+    EncodedImage encoded;
+    ASSERT_TRUE(encoder->Encode(ppf, &encoded));
+
+    FILE* f = tmpfile();
+    ASSERT_TRUE(f != nullptr);
+    std::unique_ptr<RowSink> sink =
+        encoder->CreateRowSink(ppf, color.format, f);
+    ASSERT_THAT(sink, NotNull());
+    // Uneven strips.
+    const uint8_t* pixels = reinterpret_cast<const uint8_t*>(color.pixels());
+    for (size_t y = 0; y < color.ysize; y += 3) {
+      const size_t num_rows = std::min<size_t>(3, color.ysize - y);
+      ASSERT_TRUE(
+          sink->WriteRows(pixels + y * color.stride, num_rows, color.stride));
+    }
+    ASSERT_TRUE(sink->Finish(ppf));
+    std::vector<uint8_t> written(ftell(f));
+    rewind(f);
+    ASSERT_EQ(written.size(), fread(written.data(), 1, written.size(), f));
+    fclose(f);
+    EXPECT_EQ(encoded.bitstreams[0], written) << extension;
+  }
+}
+
+#if JPEGXL_ENABLE_APNG
+TEST(CodecTest, ParallelAPNG) {
+  ThreadPoolInternal pool(4);
+  TestImageParams params;
+  params.codec = Codec::kPNG;
+  // Large enough for the rows to be deflated in several bands.
+  params.xsize = 301;
+  params.ysize = 257;
+  params.bits_per_sample = 16;
+  params.is_gray = false;
+  params.add_alpha = true;
+  params.big_endian = false;
+  params.add_extra_channels = false;
+  PackedPixelFile ppf;
+  CreateTestImage(params, &ppf);
+  ppf.info.have_animation = true;
+  ppf.info.animation.tps_numerator = 1000;
+  ppf.info.animation.tps_denominator = 1;
+  for (size_t i = 1; i < 3; ++i) {
+    PackedFrame frame(params.xsize, params.ysize, params.PixelFormat());
+    FillPackedImage(params.bits_per_sample, &frame.color);
+    uint8_t* pixels = static_cast<uint8_t*>(frame.color.pixels());
+    std::rotate(pixels, pixels + 8 * i, pixels + frame.color.pixels_size);
+    ppf.frames.emplace_back(std::move(frame));
+  }
+  for (PackedFrame& frame : ppf.frames) frame.frame_info.duration = 100;
+  ppf.frames.back().frame_info.is_last = true;
+
+  std::unique_ptr<Encoder> encoder = Encoder::FromExtension(".png");
+  ASSERT_THAT(encoder, NotNull());
+  for (ThreadPool* encode_pool : {static_cast<ThreadPool*>(nullptr),
+                                  static_cast<ThreadPool*>(&pool)}) {
+    EncodedImage encoded;
+    ASSERT_TRUE(encoder->Encode(ppf, &encoded, encode_pool));
+    ASSERT_THAT(encoded.bitstreams, SizeIs(1));
+    PackedPixelFile decoded;
+    ASSERT_TRUE(DecodeImageAPNG(Span<const uint8_t>(encoded.bitstreams[0]),
+                                ColorHints(), SizeConstraints(), &decoded,
+                                pool.runner(), pool.runner_opaque()));
+    ASSERT_EQ(decoded.frames.size(), ppf.frames.size());
+    for (size_t i = 0; i < ppf.frames.size(); ++i) {
+      VerifySameImage(ppf.frames[i].color, ppf.info.bits_per_sample,
+                      decoded.frames[i].color, decoded.info.bits_per_sample);
+    }
+  }
+}
+#endif
+
 TEST(CodecTest, EncodeToPNG) {
   ThreadPool* const pool = nullptr;
 
@@ -45,6 +45,7 @@
 
 #include "jxl/codestream_header.h"
 #include "jxl/encode.h"
+#include "lib/extras/run_parallel.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/scope_guard.h"
@@ -427,10 +428,9 @@ constexpr uint32_t kId_gAMA = 0x414D4167;
 constexpr uint32_t kId_cHRM = 0x4D524863;
 constexpr uint32_t kId_eXIf = 0x66495865;
 
+// Where libpng writes the rows of a frame.
 struct APNGFrame {
-  std::vector<uint8_t> pixels;
   std::vector<uint8_t*> rows;
-  unsigned int w, h, delay_num, delay_den;
 };
 
 struct Reader {
@@ -462,7 +462,6 @@ void row_fn(png_structp png_ptr, png_bytep new_row, png_uint_32 row_num,
   APNGFrame* frame = (APNGFrame*)png_get_progressive_ptr(png_ptr);
   JXL_CHECK(frame);
   JXL_CHECK(row_num < frame->rows.size());
-  JXL_CHECK(frame->rows[row_num] < frame->pixels.data() + frame->pixels.size());
   png_progressive_combine_row(png_ptr, frame->rows[row_num], new_row);
 }
 
@@ -485,8 +484,8 @@ inline unsigned int read_chunk(Reader* r, std::vector<uint8_t>* pChunk) {
 }
 
 int processing_start(png_structp& png_ptr, png_infop& info_ptr, void* frame_ptr,
-                     bool hasInfo, std::vector<uint8_t>& chunkIHDR,
-                     std::vector<std::vector<uint8_t>>& chunksInfo) {
+                     bool hasInfo, const std::vector<uint8_t>& chunkIHDR,
+                     const std::vector<std::vector<uint8_t>>& chunksInfo) {
   unsigned char header[8] = {137, 80, 78, 71, 13, 10, 26, 10};
 
   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -504,11 +503,14 @@ int processing_start(png_structp& png_ptr, png_infop& info_ptr, void* frame_ptr,
   png_set_progressive_read_fn(png_ptr, frame_ptr, info_fn, row_fn, NULL);
 
   png_process_data(png_ptr, info_ptr, header, 8);
-  png_process_data(png_ptr, info_ptr, chunkIHDR.data(), chunkIHDR.size());
+  // libpng doesn't modify the data, but its API isn't const-correct.
+  png_process_data(png_ptr, info_ptr, const_cast<uint8_t*>(chunkIHDR.data()),
+                   chunkIHDR.size());
 
   if (hasInfo) {
     for (unsigned int i = 0; i < chunksInfo.size(); i++) {
-      png_process_data(png_ptr, info_ptr, chunksInfo[i].data(),
+      png_process_data(png_ptr, info_ptr,
+                       const_cast<uint8_t*>(chunksInfo[i].data()),
                        chunksInfo[i].size());
     }
   }
@@ -549,15 +551,77 @@ int processing_finish(png_structp png_ptr, png_infop info_ptr,
   return 0;
 }
 
+// The chunks of one frame, kept until all frames are known and decoded in
+// parallel.
+struct FrameChunks {
+  // IHDR with the size of the frame.
+  std::vector<uint8_t> ihdr;
+  // Its IDAT (or fdAT rewritten as IDAT) chunks and any other chunks after
+  // the first of them, in file order.
+  std::vector<std::vector<uint8_t>> chunks;
+};
+
+// Decodes `frame` with a libpng instance of its own into `image`, which may be
+// smaller than the IHDR of the frame (the default image of an APNG is cropped
+// to its fcTL), and its text chunks into `metadata`.
+Status DecodeFrame(const FrameChunks& frame,
+                   const std::vector<std::vector<uint8_t>>& chunks_info,
+                   size_t bytes_per_pixel, PackedImage* image,
+                   PackedMetadata* metadata) {
+  png_structp png_ptr = nullptr;
+  png_infop info_ptr = nullptr;
+  auto scope_guard = MakeScopeGuard([&]() {
+    png_destroy_read_struct(&png_ptr, &info_ptr, 0);
+  });
+  const size_t xsize = png_get_uint_32(frame.ihdr.data() + 8);
+  const size_t ysize = png_get_uint_32(frame.ihdr.data() + 12);
+  if (xsize < image->xsize || ysize < image->ysize) {
+    return JXL_FAILURE("Frame larger than its image data");
+  }
+  APNGFrame rows;
+  std::vector<uint8_t> pixels;
+  uint8_t* out = static_cast<uint8_t*>(image->pixels());
+  size_t stride = image->stride;
+  if (xsize != image->xsize || ysize != image->ysize) {
+    stride = xsize * bytes_per_pixel;
+    pixels.resize(ysize * stride);
+    out = pixels.data();
+  }
+  rows.rows.resize(ysize);
+  for (size_t y = 0; y < ysize; ++y) rows.rows[y] = out + y * stride;
+
+  if (processing_start(png_ptr, info_ptr, &rows, /*hasInfo=*/true, frame.ihdr,
+                       chunks_info)) {
+    return JXL_FAILURE("Failed to start decoding a frame");
+  }
+  for (const std::vector<uint8_t>& chunk : frame.chunks) {
+    if (processing_data(png_ptr, info_ptr, const_cast<uint8_t*>(chunk.data()),
+                        chunk.size())) {
+      return JXL_FAILURE("Failed to decode a frame");
+    }
+  }
+  if (processing_finish(png_ptr, info_ptr, metadata)) {
+    return JXL_FAILURE("Failed to finish decoding a frame");
+  }
+  if (!pixels.empty()) {
+    const size_t row_size = image->xsize * bytes_per_pixel;
+    for (size_t y = 0; y < image->ysize; ++y) {
+      memcpy(static_cast<uint8_t*>(image->pixels()) + y * image->stride,
+             pixels.data() + y * stride, row_size);
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
 Status DecodeImageAPNG(const Span<const uint8_t> bytes,
                        const ColorHints& color_hints,
-                       const SizeConstraints& constraints,
-                       PackedPixelFile* ppf) {
+                       const SizeConstraints& constraints, PackedPixelFile* ppf,
+                       JxlParallelRunner runner, void* runner_opaque) {
   Reader r;
-  unsigned int id, j, w, h, w0, h0, x0, y0;
-  unsigned int delay_num, delay_den, dop, bop, rowbytes, imagesize;
+  unsigned int id, w, h, w0, h0, x0, y0;
+  unsigned int delay_num, delay_den, dop, bop;
   unsigned char sig[8];
   png_structp png_ptr = nullptr;
   png_infop info_ptr = nullptr;
@@ -566,7 +630,8 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
   std::vector<std::vector<uint8_t>> chunksInfo;
   bool isAnimated = false;
   bool hasInfo = false;
-  APNGFrame frameRaw = {};
+  // Chunks of the frame being read; `png_ptr` only reads the header.
+  FrameChunks frameChunks;
   uint32_t num_channels;
   JxlPixelFormat format;
   unsigned int bytes_per_pixel = 0;
@@ -581,6 +646,7 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
   };
 
   std::vector<FrameInfo> frames;
+  std::vector<FrameChunks> chunksOfFrames;
 
   // Make sure png memory is released in any case.
   auto scope_guard = MakeScopeGuard([&]() {
@@ -628,8 +694,8 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
     ppf->color_encoding.transfer_function = JXL_TRANSFER_FUNCTION_SRGB;
     ppf->color_encoding.rendering_intent = JXL_RENDERING_INTENT_RELATIVE;
 
-    if (!processing_start(png_ptr, info_ptr, (void*)&frameRaw, hasInfo,
-                          chunkIHDR, chunksInfo)) {
+    if (!processing_start(png_ptr, info_ptr, nullptr, hasInfo, chunkIHDR,
+                          chunksInfo)) {
       while (!r.Eof()) {
         id = read_chunk(&r, &chunk);
         if (!id) break;
@@ -642,19 +708,12 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
         } else if (id == kId_IEND ||
                    (id == kId_fcTL && (!hasInfo || isAnimated))) {
           if (hasInfo) {
-            if (!processing_finish(png_ptr, info_ptr, &ppf->metadata)) {
-              // Allocates the frame buffer.
-              uint32_t duration = delay_num * 1000 / delay_den;
-              frames.push_back(FrameInfo{PackedImage(w0, h0, format), duration,
-                                         x0, w0, y0, h0, dop, bop});
-              auto& frame = frames.back().data;
-              for (size_t y = 0; y < h0; ++y) {
-                memcpy(static_cast<uint8_t*>(frame.pixels()) + frame.stride * y,
-                       frameRaw.rows[y], bytes_per_pixel * w0);
-              }
-            } else {
-              break;
-            }
+            // Allocates the frame buffer, decoded into after the last frame.
+            uint32_t duration = delay_num * 1000 / delay_den;
+            frames.push_back(FrameInfo{PackedImage(w0, h0, format), duration,
+                                       x0, w0, y0, h0, dop, bop});
+            chunksOfFrames.push_back(std::move(frameChunks));
+            frameChunks = FrameChunks();
           }
 
           if (id == kId_IEND) {
@@ -686,11 +745,10 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
 
           if (hasInfo) {
             memcpy(chunkIHDR.data() + 8, chunk.data() + 12, 8);
-            if (processing_start(png_ptr, info_ptr, (void*)&frameRaw, hasInfo,
-                                 chunkIHDR, chunksInfo)) {
-              break;
-            }
+            frameChunks.ihdr = chunkIHDR;
           }
+        } else if (id == kId_IDAT && hasInfo) {
+          frameChunks.chunks.push_back(std::move(chunk));
         } else if (id == kId_IDAT) {
           // First IDAT chunk means we now have all header info
           hasInfo = true;
@@ -745,23 +803,13 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
           };
           bytes_per_pixel =
               num_channels * (format.data_type == JXL_TYPE_UINT16 ? 2 : 1);
-          rowbytes = w * bytes_per_pixel;
-          imagesize = h * rowbytes;
-          frameRaw.pixels.resize(imagesize);
-          frameRaw.rows.resize(h);
-          for (j = 0; j < h; j++)
-            frameRaw.rows[j] = frameRaw.pixels.data() + j * rowbytes;
-
-          if (processing_data(png_ptr, info_ptr, chunk.data(), chunk.size())) {
-            break;
-          }
+          frameChunks.ihdr = chunkIHDR;
+          frameChunks.chunks.push_back(std::move(chunk));
         } else if (id == kId_fdAT && isAnimated) {
+          if (!hasInfo) break;
           png_save_uint_32(chunk.data() + 4, chunk.size() - 16);
           memcpy(chunk.data() + 8, "IDAT", 4);
-          if (processing_data(png_ptr, info_ptr, chunk.data() + 4,
-                              chunk.size() - 4)) {
-            break;
-          }
+          frameChunks.chunks.emplace_back(chunk.begin() + 4, chunk.end());
         } else if (id == kId_cICP) {
           // Color profile chunks: cICP has the highest priority, followed by
           // iCCP and sRGB (which shouldn't co-exist, but if they do, we use
@@ -772,6 +820,9 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
             have_color = true;
             ppf->icc.clear();
           }
+        } else if (!have_cicp && id == kId_iCCP && hasInfo) {
+          // Out of place; left to the decoder of the frame, like below.
+          frameChunks.chunks.push_back(std::move(chunk));
         } else if (!have_cicp && id == kId_iCCP) {
           if (processing_data(png_ptr, info_ptr, chunk.data(), chunk.size())) {
             JXL_WARNING("Corrupt iCCP chunk");
@@ -813,14 +864,14 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
         } else if (!isAbc(chunk[4]) || !isAbc(chunk[5]) || !isAbc(chunk[6]) ||
                    !isAbc(chunk[7])) {
           break;
+        } else if (hasInfo) {
+          // E.g. text chunks after the image data.
+          frameChunks.chunks.push_back(std::move(chunk));
         } else {
           if (processing_data(png_ptr, info_ptr, chunk.data(), chunk.size())) {
             break;
           }
-          if (!hasInfo) {
-            chunksInfo.push_back(chunk);
-            continue;
-          }
+          chunksInfo.push_back(chunk);
         }
       }
     }
@@ -831,6 +882,29 @@ Status DecodeImageAPNG(const Span<const uint8_t> bytes,
 
   if (errorstate) return false;
 
+  // Each frame is a separate zlib stream, so frames can be inflated and
+  // unfiltered in parallel; compositing is left to the JPEG XL frames.
+  JXL_ASSERT(chunksOfFrames.size() == frames.size());
+  std::vector<uint8_t> frame_ok(frames.size());
+  std::vector<PackedMetadata> frame_metadata(frames.size());
+  JXL_RETURN_IF_ERROR(RunParallel(
+      runner, runner_opaque, 0, frames.size(),
+      [&](const uint32_t i, size_t /*thread*/) {
+        frame_ok[i] = DecodeFrame(chunksOfFrames[i], chunksInfo,
+                                  bytes_per_pixel, &frames[i].data,
+                                  &frame_metadata[i]);
+      }));
+  for (size_t i = 0; i < frames.size(); ++i) {
+    if (!frame_ok[i]) return false;
+    // As if the text chunks of all frames were read in order.
+    if (!frame_metadata[i].exif.empty()) {
+      ppf->metadata.exif = std::move(frame_metadata[i].exif);
+    }
+    if (!frame_metadata[i].xmp.empty()) {
+      ppf->metadata.xmp = std::move(frame_metadata[i].xmp);
+    }
+  }
+
   bool has_nontrivial_background = false;
   bool previous_frame_should_be_cleared = false;
   enum {
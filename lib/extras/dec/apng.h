@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 
+#include "jxl/parallel_runner.h"
 #include "lib/extras/dec/color_hints.h"
 #include "lib/extras/packed_image.h"
 #include "lib/jxl/base/data_parallel.h"
@@ -21,10 +22,12 @@
 namespace jxl {
 namespace extras {
 
-// Decodes `bytes` into `ppf`.
+// Decodes `bytes` into `ppf`. The frames of an APNG are decoded in parallel
+// on `runner`, if not null.
 Status DecodeImageAPNG(Span<const uint8_t> bytes, const ColorHints& color_hints,
-                       const SizeConstraints& constraints,
-                       PackedPixelFile* ppf);
+                       const SizeConstraints& constraints, PackedPixelFile* ppf,
+                       JxlParallelRunner runner = nullptr,
+                       void* runner_opaque = nullptr);
 
 }  // namespace extras
 }  // namespace jxl
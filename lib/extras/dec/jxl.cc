@@ -5,6 +5,9 @@
 
 #include "lib/extras/dec/jxl.h"
 
+#include <map>
+#include <mutex>
+
 #include "jxl/decode.h"
 #include "jxl/decode_cxx.h"
 #include "jxl/types.h"
@@ -102,13 +105,111 @@ void UpdateBitDepth(JxlBitDepth bit_depth, JxlDataType data_type, T* info) {
   }
 }
 
+// Passes the pixels of the image out callback, which arrive from several
+// threads in the order the groups are decoded, to a RowSink in row order.
+// Only the rows between the next one to write and the furthest one started
+// are buffered. The thread that completes the next row writes it, and any rows
+// that follow it, while the other threads keep decoding; nothing holds them
+// back, so if the sink is slower than decoding, or a group that the next row
+// needs is decoded late, up to the whole image may be buffered, as without a
+// sink. Blocking the decoding threads instead could deadlock when the group
+// that completes the next row has no thread left to run on.
+class RowReassembler {
+ public:
+  RowReassembler(size_t xsize, size_t ysize, const JxlPixelFormat& format,
+                 RowSink* sink)
+      : xsize_(xsize),
+        ysize_(ysize),
+        pixel_size_(PackedImage::BitsPerChannel(format.data_type) *
+                    format.num_channels / kBitsPerByte),
+        sink_(sink) {}
+
+  static void Callback(void* opaque, size_t x, size_t y, size_t num_pixels,
+                       const void* pixels) {
+    static_cast<RowReassembler*>(opaque)->Add(x, y, num_pixels, pixels);
+  }
+
+  // Whether all rows were written to the sink.
+  bool Done() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ok_ && next_row_ == ysize_;
+  }
+
+ private:
+  struct Row {
+    std::vector<uint8_t> pixels;
+    size_t num_pixels = 0;
+  };
+
+  void Add(size_t x, size_t y, size_t num_pixels, const void* pixels) {
+    uint8_t* row_pixels;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      Row& row = rows_[y];
+      if (row.pixels.empty()) {
+        if (free_.empty()) {
+          row.pixels.resize(xsize_ * pixel_size_);
+        } else {
+          row.pixels = std::move(free_.back());
+          free_.pop_back();
+        }
+      }
+      row_pixels = row.pixels.data();
+    }
+    // The row buffer doesn't move until the row is complete, and callbacks
+    // never overlap, so the copy needs no lock.
+    memcpy(row_pixels + x * pixel_size_, pixels, num_pixels * pixel_size_);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    rows_[y].num_pixels += num_pixels;
+    if (writing_) return;  // The writing thread will pick up this row.
+    writing_ = true;
+    for (;;) {
+      auto it = rows_.begin();
+      if (it == rows_.end() || it->first != next_row_ ||
+          it->second.num_pixels != xsize_) {
+        break;
+      }
+      std::vector<uint8_t> row = std::move(it->second.pixels);
+      rows_.erase(it);
+      lock.unlock();
+      const bool ok = sink_->WriteRows(row.data(), 1, row.size());
+      lock.lock();
+      ok_ = ok_ && ok;
+      free_.push_back(std::move(row));
+      ++next_row_;
+    }
+    writing_ = false;
+  }
+
+  const size_t xsize_;
+  const size_t ysize_;
+  const size_t pixel_size_;
+  RowSink* const sink_;
+
+  std::mutex mutex_;
+  // Rows started but not yet written, by y.
+  std::map<size_t, Row> rows_;
+  // Buffers of written rows, for reuse.
+  std::vector<std::vector<uint8_t>> free_;
+  size_t next_row_ = 0;
+  bool writing_ = false;
+  bool ok_ = true;
+};
+
 }  // namespace
 
 bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
                     const JXLDecompressParams& dparams, size_t* decoded_bytes,
                     PackedPixelFile* ppf, std::vector<uint8_t>* jpeg_bytes) {
-  auto decoder = JxlDecoderMake(/*memory_manager=*/nullptr);
-  JxlDecoder* dec = decoder.get();
+  JxlDecoderPtr decoder;
+  JxlDecoder* dec = dparams.decoder;
+  if (dec) {
+    JxlDecoderReset(dec);
+  } else {
+    decoder = JxlDecoderMake(/*memory_manager=*/nullptr);
+    dec = decoder.get();
+  }
   ppf->frames.clear();
 
   if (dparams.runner_opaque != nullptr &&
@@ -117,6 +218,12 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
     fprintf(stderr, "JxlEncoderSetParallelRunner failed\n");
     return false;
   }
+  // JxlDecoderReset detached the context, if any.
+  if (dparams.context != nullptr &&
+      JXL_DEC_SUCCESS != JxlDecoderSetContext(dec, dparams.context)) {
+    fprintf(stderr, "JxlDecoderSetContext failed\n");
+    return false;
+  }
 
   JxlPixelFormat format;
   std::vector<JxlPixelFormat> accepted_formats = dparams.accepted_formats;
@@ -201,6 +308,8 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
   uint32_t progression_index = 0;
   bool codestream_done = false;
   BoxProcessor boxes(dec);
+  std::unique_ptr<RowSink> row_sink;
+  std::unique_ptr<RowReassembler> reassembler;
   for (;;) {
     JxlDecoderStatus status = JxlDecoderProcessInput(dec);
     if (status == JXL_DEC_ERROR) {
@@ -385,6 +494,18 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
         return false;
       }
       frame.name.resize(frame.frame_info.name_length);
+      if (dparams.row_sink_factory && ppf->frames.empty() &&
+          frame.frame_info.is_last && ppf->extra_channels_info.empty() &&
+          dparams.use_image_callback && !dparams.allow_partial_input &&
+          !max_passes_defined && dparams.max_downsampling <= 1) {
+        row_sink = dparams.row_sink_factory(*ppf, format);
+      }
+      if (row_sink) {
+        // The rows go to the sink, so the frame doesn't need its own.
+        frame.color = PackedImage(ppf->info.xsize, 0, format);
+        reassembler = jxl::make_unique<RowReassembler>(
+            ppf->info.xsize, ppf->info.ysize, format, row_sink.get());
+      }
       ppf->frames.emplace_back(std::move(frame));
       progression_index = 0;
     } else if (status == JXL_DEC_FRAME_PROGRESSION) {
@@ -436,13 +557,21 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
         return false;
       }
       jxl::extras::PackedFrame& frame = ppf->frames.back();
-      if (buffer_size != frame.color.pixels_size) {
+      if (!reassembler && buffer_size != frame.color.pixels_size) {
         fprintf(stderr, "Invalid out buffer size %" PRIuS " %" PRIuS "\n",
                 buffer_size, frame.color.pixels_size);
         return false;
       }
 
-      if (dparams.use_image_callback) {
+      if (reassembler) {
+        if (JXL_DEC_SUCCESS !=
+            JxlDecoderSetImageOutCallback(dec, &format,
+                                          &RowReassembler::Callback,
+                                          reassembler.get())) {
+          fprintf(stderr, "JxlDecoderSetImageOutCallback failed\n");
+          return false;
+        }
+      } else if (dparams.use_image_callback) {
         auto callback = [](void* opaque, size_t x, size_t y, size_t num_pixels,
                            const void* pixels) {
           auto* ppf = reinterpret_cast<jxl::extras::PackedPixelFile*>(opaque);
@@ -543,6 +672,16 @@ bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
               ppf->metadata.exif.size());
     }
   }
+  if (row_sink) {
+    if (!reassembler->Done()) {
+      fprintf(stderr, "Writing the decoded rows failed\n");
+      return false;
+    }
+    if (!row_sink->Finish(*ppf)) {
+      fprintf(stderr, "Finishing the output failed\n");
+      return false;
+    }
+  }
   if (jpeg_bytes != nullptr) {
     if (!can_reconstruct_jpeg) return false;
     size_t used_jpeg_output =
@@ -10,10 +10,13 @@
 
 #include <stdint.h>
 
+#include <functional>
 #include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "jxl/decode.h"
 #include "jxl/parallel_runner.h"
 #include "jxl/types.h"
 #include "lib/extras/packed_image.h"
@@ -21,6 +24,11 @@
 namespace jxl {
 namespace extras {
 
+// Returns the sink for the rows of an image with the info and color encoding
+// of `ppf`, or null to decode into `ppf` instead.
+using RowSinkFactory = std::function<std::unique_ptr<RowSink>(
+    const PackedPixelFile& ppf, const JxlPixelFormat& format)>;
+
 struct JXLDecompressParams {
   // If empty, little endian float formats will be accepted.
   std::vector<JxlPixelFormat> accepted_formats;
@@ -38,6 +46,14 @@ struct JXLDecompressParams {
   JxlParallelRunner runner;
   void* runner_opaque = nullptr;
 
+  // If set, this decoder is reset and used instead of creating a new one, e.g.
+  // to keep one warm decoder across the images of a batch.
+  JxlDecoder* decoder = nullptr;
+
+  // If set, attached to the decoder so that tables computed for one image are
+  // reused by the next ones.
+  JxlDecoderContext* context = nullptr;
+
   // Whether truncated input should be treated as an error.
   bool allow_partial_input = false;
 
@@ -56,6 +72,14 @@ struct JXLDecompressParams {
 
   // Controls the effective bit depth of the output pixels.
   JxlBitDepth output_bitdepth = {JXL_BIT_DEPTH_FROM_PIXEL_FORMAT, 0, 0};
+
+  // If set, called when the frame of a single-frame image without extra
+  // channels (other than interleaved alpha) starts, with the basic info and
+  // color encoding of the PackedPixelFile set. If it returns a sink, the
+  // color rows are passed to it in order while the frame is decoded, instead
+  // of being stored in the frame, whose color image then has no rows. Not
+  // used with use_image_callback = false, progressive or partial decoding.
+  RowSinkFactory row_sink_factory;
 };
 
 bool DecodeImageJXL(const uint8_t* bytes, size_t bytes_size,
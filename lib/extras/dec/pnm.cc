@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/status.h"
@@ -321,16 +323,12 @@ Span<const uint8_t> MakeSpan(const char* str) {
                              strlen(str));
 }
 
-}  // namespace
-
-Status DecodeImagePNM(const Span<const uint8_t> bytes,
-                      const ColorHints& color_hints,
-                      const SizeConstraints& constraints,
-                      PackedPixelFile* ppf) {
-  Parser parser(bytes);
-  HeaderPNM header = {};
-  const uint8_t* pos = nullptr;
-  if (!parser.ParseHeader(&header, &pos)) return false;
+// Sets the info, color encoding and extra channel info of `ppf` for an image
+// with the given header, and the format of its interleaved raster.
+Status InitPackedPixelFile(const HeaderPNM& header,
+                           const ColorHints& color_hints,
+                           const SizeConstraints& constraints,
+                           PackedPixelFile* ppf, JxlPixelFormat* format) {
   JXL_RETURN_IF_ERROR(
       VerifyDimensions(&constraints, header.xsize, header.ysize));
 
@@ -365,6 +363,7 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
       ppf->info.num_color_channels + num_alpha_channels;
   ppf->info.num_extra_channels = num_alpha_channels + header.ec_types.size();
 
+  ppf->extra_channels_info.clear();
   for (auto type : header.ec_types) {
     PackedExtraChannel pec;
     pec.ec_info.bits_per_sample = ppf->info.bits_per_sample;
@@ -384,31 +383,90 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
     }
   }
 
-  const JxlPixelFormat format{
+  *format = JxlPixelFormat{
       /*num_channels=*/num_interleaved_channels,
       /*data_type=*/data_type,
       /*endianness=*/header.big_endian ? JXL_BIG_ENDIAN : JXL_LITTLE_ENDIAN,
       /*align=*/0,
   };
+  return true;
+}
+
+// Appends a frame of the given size and formats to `ppf`.
+void AddFrame(size_t xsize, size_t ysize, const JxlPixelFormat& format,
+              size_t num_extra_channels, PackedPixelFile* ppf) {
   const JxlPixelFormat ec_format{1, format.data_type, format.endianness, 0};
+  ppf->frames.emplace_back(xsize, ysize, format);
+  PackedFrame* frame = &ppf->frames.back();
+  for (size_t i = 0; i < num_extra_channels; ++i) {
+    frame->extra_channels.emplace_back(xsize, ysize, ec_format);
+  }
+}
+
+// Copies `num_rows` rows of an interleaved raster with extra channels from
+// `in` to the rows starting at `y` of `frame`.
+void DeinterleaveRows(const uint8_t* in, size_t y, size_t num_rows,
+                      PackedFrame* frame) {
+  const PackedImage& color = frame->color;
+  const size_t pixel_stride = color.pixel_stride();
+  const size_t pwidth = PackedImage::BitsPerChannel(color.format.data_type) / 8;
+  for (size_t iy = y; iy < y + num_rows; ++iy) {
+    uint8_t* out = reinterpret_cast<uint8_t*>(color.pixels()) +
+                   iy * color.stride;
+    std::vector<uint8_t*> ec_out(frame->extra_channels.size());
+    for (size_t i = 0; i < ec_out.size(); ++i) {
+      const PackedImage& ec = frame->extra_channels[i];
+      ec_out[i] = reinterpret_cast<uint8_t*>(ec.pixels()) + iy * ec.stride;
+    }
+    for (size_t x = 0; x < color.xsize; ++x) {
+      memcpy(out, in, pixel_stride);
+      out += pixel_stride;
+      in += pixel_stride;
+      for (auto& p : ec_out) {
+        memcpy(p, in, pwidth);
+        in += pwidth;
+        p += pwidth;
+      }
+    }
+  }
+}
+
+Status DecodeImagePNMImpl(const Span<const uint8_t> bytes,
+                          const ColorHints& color_hints,
+                          const SizeConstraints& constraints, bool no_copy,
+                          PackedPixelFile* ppf) {
+  Parser parser(bytes);
+  HeaderPNM header = {};
+  const uint8_t* pos = nullptr;
+  if (!parser.ParseHeader(&header, &pos)) return false;
+  JxlPixelFormat format;
+  JXL_RETURN_IF_ERROR(
+      InitPackedPixelFile(header, color_hints, constraints, ppf, &format));
+
+  const bool flipped_y = header.bits_per_sample == 32;  // PFMs are flipped
   ppf->frames.clear();
-  ppf->frames.emplace_back(header.xsize, header.ysize, format);
-  auto* frame = &ppf->frames.back();
-  for (size_t i = 0; i < header.ec_types.size(); ++i) {
-    frame->extra_channels.emplace_back(header.xsize, header.ysize, ec_format);
+  if (no_copy && !flipped_y && header.ec_types.empty()) {
+    // The raster is already an interleaved, top-to-bottom image.
+    ppf->frames.emplace_back(
+        PackedImage::View(header.xsize, header.ysize, format,
+                          const_cast<uint8_t*>(pos)));
+  } else {
+    AddFrame(header.xsize, header.ysize, format, header.ec_types.size(), ppf);
   }
+  auto* frame = &ppf->frames.back();
   size_t pnm_remaining_size = bytes.data() + bytes.size() - pos;
-  if (pnm_remaining_size < frame->color.pixels_size) {
+  size_t raster_size = frame->color.pixels_size;
+  for (const PackedImage& ec : frame->extra_channels) {
+    raster_size += ec.pixels_size;
+  }
+  if (pnm_remaining_size < raster_size) {
+    ppf->frames.clear();
     return JXL_FAILURE("PNM file too small");
   }
+  if (frame->color.pixels() == pos) return true;
 
   uint8_t* out = reinterpret_cast<uint8_t*>(frame->color.pixels());
-  std::vector<uint8_t*> ec_out(header.ec_types.size());
-  for (size_t i = 0; i < ec_out.size(); ++i) {
-    ec_out[i] = reinterpret_cast<uint8_t*>(frame->extra_channels[i].pixels());
-  }
-  if (ec_out.empty()) {
-    const bool flipped_y = header.bits_per_sample == 32;  // PFMs are flipped
+  if (frame->extra_channels.empty()) {
     for (size_t y = 0; y < header.ysize; ++y) {
       size_t y_in = flipped_y ? header.ysize - 1 - y : y;
       const uint8_t* row_in = &pos[y_in * frame->color.stride];
@@ -416,20 +474,114 @@ Status DecodeImagePNM(const Span<const uint8_t> bytes,
       memcpy(row_out, row_in, frame->color.stride);
     }
   } else {
-    size_t pwidth = PackedImage::BitsPerChannel(data_type) / 8;
-    for (size_t y = 0; y < header.ysize; ++y) {
-      for (size_t x = 0; x < header.xsize; ++x) {
-        memcpy(out, pos, frame->color.pixel_stride());
-        out += frame->color.pixel_stride();
-        pos += frame->color.pixel_stride();
-        for (auto& p : ec_out) {
-          memcpy(p, pos, pwidth);
-          pos += pwidth;
-          p += pwidth;
-        }
-      }
+    DeinterleaveRows(pos, 0, header.ysize, frame);
+  }
+  return true;
+}
+
+}  // namespace
+
+Status DecodeImagePNM(const Span<const uint8_t> bytes,
+                      const ColorHints& color_hints,
+                      const SizeConstraints& constraints,
+                      PackedPixelFile* ppf) {
+  return DecodeImagePNMImpl(bytes, color_hints, constraints,
+                            /*no_copy=*/false, ppf);
+}
+
+Status DecodeImagePNMNoCopy(const Span<const uint8_t> bytes,
+                            const ColorHints& color_hints,
+                            const SizeConstraints& constraints,
+                            PackedPixelFile* ppf) {
+  return DecodeImagePNMImpl(bytes, color_hints, constraints,
+                            /*no_copy=*/true, ppf);
+}
+
+constexpr size_t ChunkedPNMDecoder::kMaxHeaderSize;
+
+Status ChunkedPNMDecoder::Init(FILE* f, const ColorHints& color_hints,
+                               const SizeConstraints& constraints,
+                               PackedPixelFile* ppf) {
+  f_ = f;
+  // The header is parsed from the first bytes of the file; whatever follows
+  // it in `pending_` is the start of the raster.
+  pending_.resize(kMaxHeaderSize);
+  pending_.resize(fread(pending_.data(), 1, pending_.size(), f_));
+  if (pending_.size() < 2) return JXL_FAILURE("PNM: file too small");
+
+  Parser parser(Span<const uint8_t>(pending_.data(), pending_.size()));
+  HeaderPNM header = {};
+  const uint8_t* pos = nullptr;
+  if (!parser.ParseHeader(&header, &pos)) return false;
+  JXL_RETURN_IF_ERROR(
+      InitPackedPixelFile(header, color_hints, constraints, ppf, &format_));
+  pending_pos_ = pos - pending_.data();
+
+  xsize_ = header.xsize;
+  ysize_ = header.ysize;
+  num_extra_channels_ = header.ec_types.size();
+  flipped_y_ = header.bits_per_sample == 32;  // PFMs are flipped
+  next_row_ = 0;
+  return true;
+}
+
+Status ChunkedPNMDecoder::ReadBytes(uint8_t* out, size_t size) {
+  const size_t from_pending = std::min(size, pending_.size() - pending_pos_);
+  memcpy(out, pending_.data() + pending_pos_, from_pending);
+  pending_pos_ += from_pending;
+  if (pending_pos_ == pending_.size()) {
+    // Only the start of the raster is ever pending.
+    pending_.clear();
+    pending_.shrink_to_fit();
+    pending_pos_ = 0;
+  }
+  size -= from_pending;
+  if (size != 0 && fread(out + from_pending, 1, size, f_) != size) {
+    return JXL_FAILURE("PNM file too small");
+  }
+  return true;
+}
+
+Status ChunkedPNMDecoder::ReadRows(size_t num_rows, PackedFrame* frame) {
+  JXL_ASSERT(next_row_ + num_rows <= ysize_);
+  PackedImage& color = frame->color;
+  uint8_t* pixels = reinterpret_cast<uint8_t*>(color.pixels());
+  if (num_extra_channels_ != 0) {
+    size_t pixel_size = color.pixel_stride();
+    for (const PackedImage& ec : frame->extra_channels) {
+      pixel_size += ec.pixel_stride();
+    }
+    strip_.resize(num_rows * xsize_ * pixel_size);
+    JXL_RETURN_IF_ERROR(ReadBytes(strip_.data(), strip_.size()));
+    DeinterleaveRows(strip_.data(), next_row_, num_rows, frame);
+  } else if (!flipped_y_) {
+    // Without alignment, the rows of the frame are contiguous like in the
+    // file.
+    JXL_RETURN_IF_ERROR(ReadBytes(pixels + next_row_ * color.stride,
+                                  num_rows * color.stride));
+  } else {
+    for (size_t y = next_row_; y < next_row_ + num_rows; ++y) {
+      JXL_RETURN_IF_ERROR(
+          ReadBytes(pixels + (ysize_ - 1 - y) * color.stride, color.stride));
+    }
+  }
+  next_row_ += num_rows;
+  return true;
+}
+
+Status ChunkedPNMDecoder::ReadFrame(size_t strip_rows, PackedPixelFile* ppf) {
+  JXL_ASSERT(strip_rows != 0);
+  ppf->frames.clear();
+  AddFrame(xsize_, ysize_, format_, num_extra_channels_, ppf);
+  while (next_row_ < ysize_) {
+    const size_t num_rows = std::min(strip_rows, ysize_ - next_row_);
+    if (!ReadRows(num_rows, &ppf->frames.back())) {
+      ppf->frames.clear();
+      return false;
     }
   }
+  strip_.clear();
+  strip_.shrink_to_fit();
   return true;
 }
 
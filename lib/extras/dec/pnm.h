@@ -6,10 +6,13 @@
 #ifndef LIB_EXTRAS_DEC_PNM_H_
 #define LIB_EXTRAS_DEC_PNM_H_
 
-// Decodes PBM/PGM/PPM/PFM pixels in memory.
+// Decodes PBM/PGM/PPM/PFM pixels in memory or in strips from a file.
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
 
 // TODO(janwas): workaround for incorrect Win64 codegen (cause unknown)
 #include <hwy/highway.h>
@@ -30,6 +33,63 @@ namespace extras {
 Status DecodeImagePNM(Span<const uint8_t> bytes, const ColorHints& color_hints,
                       const SizeConstraints& constraints, PackedPixelFile* ppf);
 
+// Same as DecodeImagePNM, but if the raster can be used as it is (PGM, PPM and
+// PAM without extra channels), the pixels of `ppf` point into `bytes` instead
+// of being copied. `bytes` must then outlive `ppf`, and be writable if the
+// pixels of `ppf` are modified.
+Status DecodeImagePNMNoCopy(Span<const uint8_t> bytes,
+                            const ColorHints& color_hints,
+                            const SizeConstraints& constraints,
+                            PackedPixelFile* ppf);
+
+// Decodes a PGM/PPM/PAM/PFM file in strips of rows read directly from the
+// file, so that the raster is never held in memory next to the decoded
+// pixels, e.g. when it comes from a pipe. Strips are written straight into
+// their rows of the frame; only PAM files with extra channels use a buffer of
+// one strip to separate the channels.
+class ChunkedPNMDecoder {
+ public:
+  // Reads and parses the header from `f`, which must stay open while rows
+  // are read, and sets the info, color encoding and extra channel info of
+  // `ppf` but not its frames.
+  Status Init(FILE* f, const ColorHints& color_hints,
+              const SizeConstraints& constraints, PackedPixelFile* ppf);
+
+  size_t xsize() const { return xsize_; }
+  size_t ysize() const { return ysize_; }
+  // Of the interleaved color and alpha channels.
+  const JxlPixelFormat& format() const { return format_; }
+  // Rows that have not been read yet.
+  size_t remaining_rows() const { return ysize_ - next_row_; }
+
+  // Reads the next `num_rows` rows of the file into `frame`, which must have
+  // the size and formats of the image. PFM stores rows bottom to top, so its
+  // strips fill the frame from the bottom.
+  Status ReadRows(size_t num_rows, PackedFrame* frame);
+
+  // Replaces the frames of `ppf` by one frame and reads the remaining rows
+  // into it, `strip_rows` at a time.
+  Status ReadFrame(size_t strip_rows, PackedPixelFile* ppf);
+
+ private:
+  // Longest header that can be parsed.
+  static constexpr size_t kMaxHeaderSize = 1 << 16;
+
+  Status ReadBytes(uint8_t* out, size_t size);
+
+  FILE* f_ = nullptr;
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  size_t num_extra_channels_ = 0;
+  bool flipped_y_ = false;
+  JxlPixelFormat format_ = {};
+  size_t next_row_ = 0;
+  // Bytes read together with the header, consumed before reading from `f_`.
+  std::vector<uint8_t> pending_;
+  size_t pending_pos_ = 0;
+  std::vector<uint8_t> strip_;
+};
+
 void TestCodecPNM();
 
 }  // namespace extras
@@ -39,13 +39,18 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <stdlib.h>
+
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "lib/extras/exif.h"
+#include "lib/extras/run_parallel.h"
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "png.h" /* original (unpatched) libpng is ok */
+#include "zlib.h"
 
 namespace jxl {
 namespace extras {
@@ -78,6 +83,10 @@ class APNGEncoder : public Encoder {
                                        &encoded_image->bitstreams.front());
   }
 
+  std::unique_ptr<RowSink> CreateRowSink(const PackedPixelFile& ppf,
+                                         const JxlPixelFormat& format,
+                                         FILE* out) const override;
+
  private:
   Status EncodePackedPixelFileToAPNG(const PackedPixelFile& ppf,
                                      ThreadPool* pool,
@@ -90,6 +99,209 @@ static void PngWrite(png_structp png_ptr, png_bytep data, png_size_t length) {
   bytes->insert(bytes->end(), data, data + length);
 }
 
+static void PngWriteFile(png_structp png_ptr, png_bytep data,
+                         png_size_t length) {
+  // Errors are checked with ferror() when the file is finished.
+  fwrite(data, 1, length, static_cast<FILE*>(png_get_io_ptr(png_ptr)));
+}
+
+size_t PNGBitDepth(const JxlPixelFormat& format) {
+  return PackedImage::BitsPerChannel(format.data_type) > 8 ? 16 : 8;
+}
+
+// Converts samples of `format` with `bits_per_sample` significant bits to the
+// 8 or 16 bit big endian samples of PNG.
+void ConvertToPNGSamples(const uint8_t* in, size_t num_samples,
+                         const JxlPixelFormat& format, size_t bits_per_sample,
+                         uint8_t* out) {
+  if (format.data_type == JXL_TYPE_UINT8) {
+    if (bits_per_sample < 8) {
+      float mul = 255.0 / ((1u << bits_per_sample) - 1);
+      for (size_t i = 0; i < num_samples; ++i) {
+        out[i] = static_cast<uint8_t>(in[i] * mul + 0.5);
+      }
+    } else {
+      memcpy(out, in, num_samples);
+    }
+  } else if (format.data_type == JXL_TYPE_UINT16) {
+    if (bits_per_sample < 16 || format.endianness != JXL_BIG_ENDIAN) {
+      float mul = 65535.0 / ((1u << bits_per_sample) - 1);
+      const uint8_t* p_in = in;
+      uint8_t* p_out = out;
+      for (size_t i = 0; i < num_samples; ++i, p_in += 2, p_out += 2) {
+        uint32_t val = (format.endianness == JXL_BIG_ENDIAN ? LoadBE16(p_in)
+                                                            : LoadLE16(p_in));
+        StoreBE16(static_cast<uint32_t>(val * mul + 0.5), p_out);
+      }
+    } else {
+      memcpy(out, in, num_samples * 2);
+    }
+  }
+}
+
+// Rows of image data are filtered and deflated in parallel in bands of about
+// this many bytes; smaller images are left to libpng.
+constexpr size_t kPNGBandSize = 256 << 10;
+// The deflate window, with which each band is primed from the previous one.
+constexpr size_t kDeflateWindowSize = 32 << 10;
+constexpr size_t kMaxIDATSize = 1 << 20;
+
+uint8_t PaethPredictor(uint8_t a, uint8_t b, uint8_t c) {
+  const int p = a + b - c;
+  const int pa = abs(p - a);
+  const int pb = abs(p - b);
+  const int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  return pb <= pc ? b : c;
+}
+
+// Writes filter type `filter` and the filtered `row` to `out`; `prev` is the
+// previous row, all zeros for the first one.
+void FilterRow(int filter, const uint8_t* row, const uint8_t* prev,
+               size_t row_size, size_t bytes_per_pixel, uint8_t* out) {
+  out[0] = filter;
+  ++out;
+  for (size_t i = 0; i < row_size; ++i) {
+    const uint8_t left = i < bytes_per_pixel ? 0 : row[i - bytes_per_pixel];
+    const uint8_t up_left = i < bytes_per_pixel ? 0 : prev[i - bytes_per_pixel];
+    uint8_t pred = 0;
+    switch (filter) {
+      case PNG_FILTER_VALUE_SUB:
+        pred = left;
+        break;
+      case PNG_FILTER_VALUE_UP:
+        pred = prev[i];
+        break;
+      case PNG_FILTER_VALUE_AVG:
+        pred = (left + prev[i]) / 2;
+        break;
+      case PNG_FILTER_VALUE_PAETH:
+        pred = PaethPredictor(left, prev[i], up_left);
+        break;
+    }
+    out[i] = row[i] - pred;
+  }
+}
+
+// Filters a row with the heuristic of libpng: the filter with the smallest
+// sum of the filtered bytes taken as signed values. `scratch` holds a filtered
+// row.
+void FilterRowAdaptive(const uint8_t* row, const uint8_t* prev,
+                       size_t row_size, size_t bytes_per_pixel, uint8_t* out,
+                       uint8_t* scratch) {
+  size_t best_sum = ~size_t(0);
+  for (int filter = PNG_FILTER_VALUE_NONE; filter < PNG_FILTER_VALUE_LAST;
+       ++filter) {
+    FilterRow(filter, row, prev, row_size, bytes_per_pixel, scratch);
+    size_t sum = 0;
+    for (size_t i = 1; i <= row_size; ++i) {
+      sum += scratch[i] < 128 ? scratch[i] : 256 - scratch[i];
+    }
+    if (sum < best_sum) {
+      best_sum = sum;
+      memcpy(out, scratch, row_size + 1);
+    }
+  }
+}
+
+// Deflates `size` bytes of `data` to a raw deflate stream in `out`, which ends
+// at a byte boundary unless `last`, so that the streams of consecutive bands
+// can be concatenated. The preceding `dict_size` bytes are used as dictionary
+// so that the band compresses as if it were not split from the previous one.
+bool DeflateBand(const uint8_t* data, size_t size, size_t dict_size, bool last,
+                 std::vector<uint8_t>* out) {
+  z_stream strm = {};
+  // The parameters that libpng uses for filtered rows.
+  if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                   Z_FILTERED) != Z_OK) {
+    return false;
+  }
+  bool ok = true;
+  if (dict_size != 0) {
+    ok = deflateSetDictionary(&strm, data - dict_size, dict_size) == Z_OK;
+  }
+  out->resize(deflateBound(&strm, size) + 16);
+  strm.next_in = const_cast<Bytef*>(data);
+  strm.avail_in = size;
+  strm.next_out = out->data();
+  strm.avail_out = out->size();
+  int ret = Z_OK;
+  while (ok && (ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH)) == Z_OK &&
+         strm.avail_out == 0) {
+    const size_t used = out->size();
+    out->resize(2 * used);
+    strm.next_out = out->data() + used;
+    strm.avail_out = out->size() - used;
+  }
+  ok = ok && ret == (last ? Z_STREAM_END : Z_OK);
+  out->resize(strm.total_out);
+  deflateEnd(&strm);
+  return ok;
+}
+
+// Filters and deflates the `ysize` rows of `row_size` bytes of `samples` to
+// the zlib stream of the IDAT chunks, in bands of rows in parallel, joined the
+// way pigz does. Leaves `zdata` empty if the image is a single band.
+Status CompressRows(const uint8_t* samples, size_t ysize, size_t row_size,
+                    size_t bytes_per_pixel, JxlParallelRunner runner,
+                    void* runner_opaque, std::vector<uint8_t>* zdata) {
+  zdata->clear();
+  const size_t rows_per_band =
+      std::max<size_t>(1, kPNGBandSize / (row_size + 1));
+  const size_t num_bands = DivCeil(ysize, rows_per_band);
+  if (num_bands < 2) return true;
+
+  // Bands are filtered first, since each band is deflated with the end of the
+  // previous one as dictionary.
+  std::vector<uint8_t> filtered(ysize * (row_size + 1));
+  const std::vector<uint8_t> zeros(row_size);
+  JXL_RETURN_IF_ERROR(RunParallel(
+      runner, runner_opaque, 0, num_bands,
+      [&](const uint32_t band, size_t /*thread*/) {
+        std::vector<uint8_t> scratch(row_size + 1);
+        const size_t y_end = std::min(ysize, (band + 1) * rows_per_band);
+        for (size_t y = band * rows_per_band; y < y_end; ++y) {
+          const uint8_t* row = samples + y * row_size;
+          FilterRowAdaptive(row, y == 0 ? zeros.data() : row - row_size,
+                            row_size, bytes_per_pixel,
+                            filtered.data() + y * (row_size + 1),
+                            scratch.data());
+        }
+      }));
+
+  const size_t band_size = rows_per_band * (row_size + 1);
+  std::vector<std::vector<uint8_t>> deflated(num_bands);
+  std::vector<uLong> adler(num_bands);
+  std::vector<uint8_t> band_ok(num_bands);
+  JXL_RETURN_IF_ERROR(RunParallel(
+      runner, runner_opaque, 0, num_bands,
+      [&](const uint32_t band, size_t /*thread*/) {
+        const size_t begin = band * band_size;
+        const size_t size = std::min(filtered.size() - begin, band_size);
+        const uint8_t* data = filtered.data() + begin;
+        band_ok[band] = DeflateBand(data, size,
+                                    std::min(begin, kDeflateWindowSize),
+                                    band + 1 == num_bands, &deflated[band]);
+        adler[band] = adler32(adler32(0, nullptr, 0), data, size);
+      }));
+
+  // zlib header for a 32 KiB window and the default compression level.
+  *zdata = {0x78, 0x9C};
+  uLong checksum = adler[0];
+  for (size_t band = 0; band < num_bands; ++band) {
+    if (!band_ok[band]) return JXL_FAILURE("Failed to deflate PNG rows");
+    zdata->insert(zdata->end(), deflated[band].begin(), deflated[band].end());
+    if (band != 0) {
+      const size_t size =
+          std::min(filtered.size() - band * band_size, band_size);
+      checksum = adler32_combine(checksum, adler[band], size);
+    }
+  }
+  zdata->resize(zdata->size() + 4);
+  StoreBE32(checksum, zdata->data() + zdata->size() - 4);
+  return true;
+}
+
 // Stores XMP and EXIF/IPTC into key/value strings for PNG
 class BlobsWriterPNG {
  public:
@@ -204,7 +416,8 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
   bool is_gray = ppf.info.num_color_channels == 1;
   size_t color_channels = ppf.info.num_color_channels;
   size_t num_channels = color_channels + (has_alpha ? 1 : 0);
-  size_t num_samples = num_channels * xsize * ysize;
+  JxlParallelRunner runner = this->runner(pool);
+  void* runner_opaque = this->runner_opaque(pool);
 
   if (!ppf.info.have_animation && ppf.frames.size() != 1) {
     return JXL_FAILURE("Invalid number of frames");
@@ -219,37 +432,25 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
     const PackedImage& color = frame.color;
     const JxlPixelFormat format = color.format;
     const uint8_t* in = reinterpret_cast<const uint8_t*>(color.pixels());
-    size_t data_bits_per_sample = PackedImage::BitsPerChannel(format.data_type);
-    size_t bytes_per_sample = data_bits_per_sample / 8;
-    size_t out_bytes_per_sample = bytes_per_sample > 1 ? 2 : 1;
+    size_t out_bytes_per_sample = PNGBitDepth(format) / 8;
     size_t out_stride = xsize * num_channels * out_bytes_per_sample;
     size_t out_size = ysize * out_stride;
     std::vector<uint8_t> out(out_size);
-
-    if (format.data_type == JXL_TYPE_UINT8) {
-      if (ppf.info.bits_per_sample < 8) {
-        float mul = 255.0 / ((1u << ppf.info.bits_per_sample) - 1);
-        for (size_t i = 0; i < num_samples; ++i) {
-          out[i] = static_cast<uint8_t>(in[i] * mul + 0.5);
-        }
-      } else {
-        memcpy(&out[0], in, out_size);
-      }
-    } else if (format.data_type == JXL_TYPE_UINT16) {
-      if (ppf.info.bits_per_sample < 16 ||
-          format.endianness != JXL_BIG_ENDIAN) {
-        float mul = 65535.0 / ((1u << ppf.info.bits_per_sample) - 1);
-        const uint8_t* p_in = in;
-        uint8_t* p_out = out.data();
-        for (size_t i = 0; i < num_samples; ++i, p_in += 2, p_out += 2) {
-          uint32_t val = (format.endianness == JXL_BIG_ENDIAN ? LoadBE16(p_in)
-                                                              : LoadLE16(p_in));
-          StoreBE16(static_cast<uint32_t>(val * mul + 0.5), p_out);
-        }
-      } else {
-        memcpy(&out[0], in, out_size);
-      }
+    JXL_RETURN_IF_ERROR(RunParallel(
+        runner, runner_opaque, 0, ysize,
+        [&](const uint32_t y, size_t /*thread*/) {
+          ConvertToPNGSamples(in + y * color.stride, xsize * num_channels,
+                              format, ppf.info.bits_per_sample,
+                              out.data() + y * out_stride);
+        }));
+    // Without a runner, libpng compresses the rows itself.
+    std::vector<uint8_t> zdata;
+    if (runner != nullptr) {
+      JXL_RETURN_IF_ERROR(CompressRows(out.data(), ysize, out_stride,
+                                       num_channels * out_bytes_per_sample,
+                                       runner, runner_opaque, &zdata));
     }
+
     png_structp png_ptr;
     png_infop info_ptr;
 
@@ -328,7 +529,15 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
 
     png_write_flush(png_ptr);
     const size_t pos = bytes->size();
-    png_write_image(png_ptr, &rows[0]);
+    if (zdata.empty()) {
+      png_write_image(png_ptr, &rows[0]);
+    } else {
+      png_byte idat[5] = "IDAT";
+      for (size_t i = 0; i < zdata.size(); i += kMaxIDATSize) {
+        png_write_chunk(png_ptr, idat, zdata.data() + i,
+                        std::min(kMaxIDATSize, zdata.size() - i));
+      }
+    }
     png_write_flush(png_ptr);
     if (count > 0) {
       std::vector<uint8_t> fdata(4);
@@ -352,7 +561,13 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
 
     count++;
     if (count == ppf.frames.size() || !ppf.info.have_animation) {
-      png_write_end(png_ptr, NULL);
+      if (zdata.empty()) {
+        png_write_end(png_ptr, NULL);
+      } else {
+        // libpng refuses to end a PNG without IDAT chunks of its own.
+        png_byte iend[5] = "IEND";
+        png_write_chunk(png_ptr, iend, nullptr, 0);
+      }
     }
 
     png_destroy_write_struct(&png_ptr, &info_ptr);
@@ -361,6 +576,99 @@ Status APNGEncoder::EncodePackedPixelFileToAPNG(
   return true;
 }
 
+// Writes a non-animated PNG to a file row by row. The text chunks with the
+// metadata are written after the image data, since boxes may follow the
+// codestream and are only known once the whole file has been decoded.
+class PNGRowSink : public RowSink {
+ public:
+  PNGRowSink(const PackedPixelFile& ppf, const JxlPixelFormat& format,
+             FILE* out)
+      : format_(format),
+        bits_per_sample_(ppf.info.bits_per_sample),
+        num_samples_(ppf.info.xsize * format.num_channels),
+        out_(out) {
+    png_ptr_ = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr_) return;
+    info_ptr_ = png_create_info_struct(png_ptr_);
+    if (!info_ptr_) return;
+    png_set_write_fn(png_ptr_, out, PngWriteFile, NULL);
+    png_set_flush(png_ptr_, 0);
+
+    const size_t bit_depth = PNGBitDepth(format);
+    png_byte color_type = (ppf.info.num_color_channels == 1
+                               ? PNG_COLOR_TYPE_GRAY
+                               : PNG_COLOR_TYPE_RGB);
+    if (ppf.info.alpha_bits != 0) color_type |= PNG_COLOR_MASK_ALPHA;
+    png_set_IHDR(png_ptr_, info_ptr_, ppf.info.xsize, ppf.info.ysize,
+                 bit_depth, color_type, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    MaybeAddCICP(ppf.color_encoding, png_ptr_, info_ptr_);
+    if (!ppf.icc.empty()) {
+      png_set_benign_errors(png_ptr_, 1);
+      png_set_iCCP(png_ptr_, info_ptr_, "1", 0, ppf.icc.data(),
+                   ppf.icc.size());
+    }
+    png_write_info(png_ptr_, info_ptr_);
+    // Same sequence as EncodePackedPixelFileToAPNG, for identical output.
+    png_write_flush(png_ptr_);
+    row_.resize(num_samples_ * bit_depth / 8);
+  }
+
+  ~PNGRowSink() override {
+    if (png_ptr_) png_destroy_write_struct(&png_ptr_, &info_ptr_);
+  }
+
+  bool ok() const { return png_ptr_ != nullptr && info_ptr_ != nullptr; }
+
+  Status WriteRows(const uint8_t* rows, size_t num_rows,
+                   size_t stride) override {
+    for (size_t y = 0; y < num_rows; ++y) {
+      ConvertToPNGSamples(rows + y * stride, num_samples_, format_,
+                          bits_per_sample_, row_.data());
+      png_write_row(png_ptr_, row_.data());
+    }
+    return true;
+  }
+
+  Status Finish(const PackedPixelFile& ppf) override {
+    std::vector<std::string> textstrings;
+    JXL_RETURN_IF_ERROR(BlobsWriterPNG::Encode(ppf.metadata, &textstrings));
+    for (size_t kk = 0; kk + 1 < textstrings.size(); kk += 2) {
+      png_text text;
+      text.key = const_cast<png_charp>(textstrings[kk].c_str());
+      text.text = const_cast<png_charp>(textstrings[kk + 1].c_str());
+      text.compression = PNG_TEXT_COMPRESSION_zTXt;
+      png_set_text(png_ptr_, info_ptr_, &text, 1);
+    }
+    png_write_end(png_ptr_, info_ptr_);
+    if (fflush(out_) != 0 || ferror(out_)) {
+      return JXL_FAILURE("Failed to write PNG file");
+    }
+    return true;
+  }
+
+ private:
+  const JxlPixelFormat format_;
+  const size_t bits_per_sample_;
+  const size_t num_samples_;  // per row
+  FILE* out_;
+  png_structp png_ptr_ = nullptr;
+  png_infop info_ptr_ = nullptr;
+  std::vector<uint8_t> row_;
+};
+
+std::unique_ptr<RowSink> APNGEncoder::CreateRowSink(
+    const PackedPixelFile& ppf, const JxlPixelFormat& format,
+    FILE* out) const {
+  if (!VerifyBasicInfo(ppf.info) || !VerifyFormat(format) ||
+      ppf.info.have_animation) {
+    return nullptr;
+  }
+  auto sink = jxl::make_unique<PNGRowSink>(ppf, format, out);
+  if (!sink->ok()) return nullptr;
+  return std::move(sink);
+}
+
 }  // namespace
 
 std::unique_ptr<Encoder> GetAPNGEncoder() {
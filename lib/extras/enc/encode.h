@@ -8,6 +8,9 @@
 
 // Facade for image encoders.
 
+#include <stdio.h>
+
+#include <memory>
 #include <string>
 #include <unordered_map>
 
@@ -49,15 +52,41 @@ class Encoder {
   virtual Status Encode(const PackedPixelFile& ppf, EncodedImage* encoded_image,
                         ThreadPool* pool = nullptr) const = 0;
 
+  // Returns a sink that writes a single-frame image with the info, color
+  // encoding and pixel `format` of `ppf` to `out` as its rows arrive, or null
+  // if this encoder can't write the image row by row. `out` must stay open
+  // until the sink is finished.
+  virtual std::unique_ptr<RowSink> CreateRowSink(const PackedPixelFile& ppf,
+                                                 const JxlPixelFormat& format,
+                                                 FILE* out) const {
+    return nullptr;
+  }
+
   void SetOption(std::string name, std::string value) {
     options_[std::move(name)] = std::move(value);
   }
 
+  // Runner for encoders that can use threads when Encode() is called without
+  // a pool, e.g. from the tools, which can't create a ThreadPool.
+  void SetParallelRunner(JxlParallelRunner runner, void* runner_opaque) {
+    runner_ = runner;
+    runner_opaque_ = runner_opaque;
+  }
+
  protected:
   const std::unordered_map<std::string, std::string>& options() const {
     return options_;
   }
 
+  // The runner of `pool` if there is one, otherwise the one set with
+  // SetParallelRunner(), if any.
+  JxlParallelRunner runner(ThreadPool* pool) const {
+    return pool ? pool->runner() : runner_;
+  }
+  void* runner_opaque(ThreadPool* pool) const {
+    return pool ? pool->runner_opaque() : runner_opaque_;
+  }
+
   Status VerifyBasicInfo(const JxlBasicInfo& info) const;
 
   Status VerifyFormat(const JxlPixelFormat& format) const;
@@ -70,6 +99,8 @@ class Encoder {
 
  private:
   std::unordered_map<std::string, std::string> options_;
+  JxlParallelRunner runner_ = nullptr;
+  void* runner_opaque_ = nullptr;
 };
 
 // TODO(sboukortt): consider exposing this as part of the C API.
@@ -5,12 +5,138 @@
 
 #include "lib/extras/enc/jxl.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
 #include "jxl/encode_cxx.h"
 #include "lib/jxl/exif.h"
 
 namespace jxl {
 namespace extras {
 
+namespace {
+
+bool SameLayout(const PackedImage& a, const PackedImage& b) {
+  return a.xsize == b.xsize && a.ysize == b.ysize &&
+         a.format.num_channels == b.format.num_channels &&
+         a.format.data_type == b.format.data_type;
+}
+
+// Returns true if ppf is an animation in which every frame covers the whole
+// canvas and replaces it, so no frame depends on previously decoded frames.
+bool CanCropUnchangedRegions(const PackedPixelFile& ppf) {
+  if (!ppf.info.have_animation || ppf.frames.size() < 2) return false;
+  const PackedFrame& first = ppf.frames[0];
+  for (const PackedFrame& frame : ppf.frames) {
+    const JxlLayerInfo& layer_info = frame.frame_info.layer_info;
+    if (layer_info.have_crop ||
+        layer_info.blend_info.blendmode != JXL_BLEND_REPLACE) {
+      return false;
+    }
+    if (frame.color.xsize != ppf.info.xsize ||
+        frame.color.ysize != ppf.info.ysize ||
+        !SameLayout(frame.color, first.color) ||
+        frame.extra_channels.size() != first.extra_channels.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < frame.extra_channels.size(); ++i) {
+      if (!SameLayout(frame.extra_channels[i], first.extra_channels[i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Extends the rectangle [x0, x1) x [y0, y1) to contain all the pixels that
+// differ between a and b.
+void ExtendChangedRect(const PackedImage& a, const PackedImage& b, size_t* x0,
+                       size_t* y0, size_t* x1, size_t* y1) {
+  const size_t bytes_per_pixel = a.pixel_stride();
+  const size_t row_bytes = a.xsize * bytes_per_pixel;
+  for (size_t y = 0; y < a.ysize; ++y) {
+    const uint8_t* row_a =
+        static_cast<const uint8_t*>(a.pixels()) + y * a.stride;
+    const uint8_t* row_b =
+        static_cast<const uint8_t*>(b.pixels()) + y * b.stride;
+    if (memcmp(row_a, row_b, row_bytes) == 0) continue;
+    size_t first = 0;
+    while (memcmp(row_a + first * bytes_per_pixel,
+                  row_b + first * bytes_per_pixel, bytes_per_pixel) == 0) {
+      ++first;
+    }
+    size_t last = a.xsize;
+    while (memcmp(row_a + (last - 1) * bytes_per_pixel,
+                  row_b + (last - 1) * bytes_per_pixel, bytes_per_pixel) == 0) {
+      --last;
+    }
+    *x0 = std::min(*x0, first);
+    *x1 = std::max(*x1, last);
+    *y0 = std::min(*y0, y);
+    *y1 = std::max(*y1, y + 1);
+  }
+}
+
+PackedImage CropImage(const PackedImage& image, size_t x0, size_t y0,
+                      size_t xsize, size_t ysize) {
+  PackedImage cropped(xsize, ysize, image.format);
+  const size_t bytes_per_pixel = image.pixel_stride();
+  for (size_t y = 0; y < ysize; ++y) {
+    memcpy(static_cast<uint8_t*>(cropped.pixels()) + y * cropped.stride,
+           static_cast<const uint8_t*>(image.pixels()) +
+               (y0 + y) * image.stride + x0 * bytes_per_pixel,
+           xsize * bytes_per_pixel);
+  }
+  return cropped;
+}
+
+// Returns frame `index` of ppf cropped to the region that differs from the
+// previous frame, to be blended on top of it, or nullptr if the whole frame
+// changed. Requires CanCropUnchangedRegions(ppf).
+std::unique_ptr<PackedFrame> CropUnchangedRegions(const PackedPixelFile& ppf,
+                                                  size_t index) {
+  if (index == 0) return nullptr;
+  const PackedFrame& frame = ppf.frames[index];
+  const PackedFrame& prev = ppf.frames[index - 1];
+  size_t x0 = frame.color.xsize;
+  size_t y0 = frame.color.ysize;
+  size_t x1 = 0;
+  size_t y1 = 0;
+  ExtendChangedRect(frame.color, prev.color, &x0, &y0, &x1, &y1);
+  for (size_t i = 0; i < frame.extra_channels.size(); ++i) {
+    ExtendChangedRect(frame.extra_channels[i], prev.extra_channels[i], &x0,
+                      &y0, &x1, &y1);
+  }
+  if (x1 == 0) {
+    // Identical frames: a single unchanged pixel is enough.
+    x0 = y0 = 0;
+    x1 = y1 = 1;
+  }
+  const size_t xsize = x1 - x0;
+  const size_t ysize = y1 - y0;
+  if (xsize == frame.color.xsize && ysize == frame.color.ysize) {
+    return nullptr;
+  }
+  auto cropped = jxl::make_unique<PackedFrame>(
+      CropImage(frame.color, x0, y0, xsize, ysize));
+  for (const PackedImage& ec : frame.extra_channels) {
+    cropped->extra_channels.emplace_back(CropImage(ec, x0, y0, xsize, ysize));
+  }
+  cropped->name = frame.name;
+  cropped->frame_info = frame.frame_info;
+  JxlLayerInfo& layer_info = cropped->frame_info.layer_info;
+  layer_info.have_crop = JXL_TRUE;
+  layer_info.crop_x0 = x0;
+  layer_info.crop_y0 = y0;
+  layer_info.xsize = xsize;
+  layer_info.ysize = ysize;
+  return cropped;
+}
+
+}  // namespace
+
 JxlEncoderStatus SetOption(const JXLOption& opt,
                            JxlEncoderFrameSettings* settings) {
   return opt.is_float
@@ -37,8 +163,14 @@ bool SetFrameOptions(const std::vector<JXLOption>& options, size_t frame_index,
 bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
                     const std::vector<uint8_t>* jpeg_bytes,
                     std::vector<uint8_t>* compressed) {
-  auto encoder = JxlEncoderMake(/*memory_manager=*/nullptr);
-  JxlEncoder* enc = encoder.get();
+  JxlEncoderPtr encoder;
+  JxlEncoder* enc = params.encoder;
+  if (enc) {
+    JxlEncoderReset(enc);
+  } else {
+    encoder = JxlEncoderMake(/*memory_manager=*/nullptr);
+    enc = encoder.get();
+  }
 
   if (params.runner_opaque != nullptr &&
       JXL_ENC_SUCCESS != JxlEncoderSetParallelRunner(enc, params.runner,
@@ -165,12 +297,24 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
       JxlEncoderCloseBoxes(enc);
     }
 
+    const bool crop_frames =
+        params.crop_unchanged_regions && CanCropUnchangedRegions(ppf);
     for (size_t num_frame = 0; num_frame < ppf.frames.size(); ++num_frame) {
-      const jxl::extras::PackedFrame& pframe = ppf.frames[num_frame];
+      std::unique_ptr<PackedFrame> cropped_frame;
+      JxlFrameHeader frame_info = ppf.frames[num_frame].frame_info;
+      if (crop_frames) {
+        cropped_frame = CropUnchangedRegions(ppf, num_frame);
+        if (cropped_frame) frame_info = cropped_frame->frame_info;
+        // Every frame is kept as a reference for the next one; with kReplace,
+        // the area outside the crop is taken from that reference.
+        frame_info.layer_info.save_as_reference = 1;
+        frame_info.layer_info.blend_info.source = 1;
+      }
+      const jxl::extras::PackedFrame& pframe =
+          cropped_frame ? *cropped_frame : ppf.frames[num_frame];
       const jxl::extras::PackedImage& pimage = pframe.color;
       JxlPixelFormat ppixelformat = pimage.format;
-      if (JXL_ENC_SUCCESS !=
-          JxlEncoderSetFrameHeader(settings, &pframe.frame_info)) {
+      if (JXL_ENC_SUCCESS != JxlEncoderSetFrameHeader(settings, &frame_info)) {
         fprintf(stderr, "JxlEncoderSetFrameHeader() failed.\n");
         return false;
       }
@@ -198,7 +342,7 @@ bool EncodeImageJXL(const JXLCompressParams& params, const PackedPixelFile& ppf,
         // We take the extra channel blend info frame_info, but don't do
         // clamping.
         JxlBlendInfo extra_channel_blend_info =
-            pframe.frame_info.layer_info.blend_info;
+            frame_info.layer_info.blend_info;
         extra_channel_blend_info.clamp = JXL_FALSE;
         JxlEncoderSetExtraChannelBlendInfo(settings, 0,
                                            &extra_channel_blend_info);
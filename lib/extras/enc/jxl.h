@@ -44,6 +44,10 @@ struct JXLCompressParams {
   bool jpeg_store_metadata = true;
   // Whether to create brob boxes.
   bool compress_boxes = true;
+  // If true, frames of an animation made only of full-size kReplace frames
+  // are cropped to the region that changed since the previous frame and
+  // encoded on top of it.
+  bool crop_unchanged_regions = false;
   // Upper bound on the intensity level present in the image in nits (zero means
   // that the library chooses a default).
   float intensity_target = 0;
@@ -56,6 +60,9 @@ struct JXLCompressParams {
   // If runner_opaque is set, the decoder uses this parallel runner.
   JxlParallelRunner runner = JxlThreadParallelRunner;
   void* runner_opaque = nullptr;
+  // If set, this encoder is reset and used instead of creating a new one, e.g.
+  // to keep one warm encoder across the images of a batch.
+  JxlEncoder* encoder = nullptr;
 
   void AddOption(JxlEncoderFrameSettingId id, int64_t val) {
     options.emplace_back(JXLOption(id, val, 0));
@@ -32,6 +32,43 @@ namespace {
 
 constexpr size_t kMaxHeaderSize = 200;
 
+// Writes the header given at construction and then the rows to a file.
+class PNMRowSink : public RowSink {
+ public:
+  PNMRowSink(std::string header, size_t row_size, FILE* out)
+      : header_(std::move(header)), row_size_(row_size), out_(out) {}
+
+  Status WriteRows(const uint8_t* rows, size_t num_rows,
+                   size_t stride) override {
+    if (!header_.empty()) {
+      if (fwrite(header_.data(), 1, header_.size(), out_) != header_.size()) {
+        return JXL_FAILURE("Failed to write PNM header");
+      }
+      header_.clear();
+    }
+    for (size_t y = 0; y < num_rows; ++y) {
+      if (fwrite(rows + y * stride, 1, row_size_, out_) != row_size_) {
+        return JXL_FAILURE("Failed to write PNM row");
+      }
+    }
+    return true;
+  }
+
+  Status Finish(const PackedPixelFile& ppf) override {
+    if (!ppf.metadata.exif.empty() || !ppf.metadata.iptc.empty() ||
+        !ppf.metadata.jumbf.empty() || !ppf.metadata.xmp.empty()) {
+      JXL_WARNING("PNM encoder ignoring metadata - use a different codec");
+    }
+    return fflush(out_) == 0;
+  }
+
+
+ private:
+  std::string header_;  // Not yet written.
+  const size_t row_size_;
+  FILE* out_;
+};
+
 class PNMEncoder : public Encoder {
  public:
   Status Encode(const PackedPixelFile& ppf, EncodedImage* encoded_image,
@@ -87,20 +124,42 @@ class PPMEncoder : public PNMEncoder {
                             std::vector<uint8_t>* bytes) const override {
     return EncodeImage(image, bits_per_sample, bytes);
   }
+  std::unique_ptr<RowSink> CreateRowSink(const PackedPixelFile& ppf,
+                                         const JxlPixelFormat& format,
+                                         FILE* out) const override {
+    std::string header;
+    if (!VerifyBasicInfo(ppf.info) || !VerifyFormat(format) ||
+        !Header(format, ppf.info.xsize, ppf.info.ysize,
+                ppf.info.bits_per_sample, &header)) {
+      return nullptr;
+    }
+    return jxl::make_unique<PNMRowSink>(
+        std::move(header), PackedImage(ppf.info.xsize, 1, format).stride, out);
+  }
 
  private:
-  Status EncodeImage(const PackedImage& image, size_t bits_per_sample,
-                     std::vector<uint8_t>* bytes) const {
+  static Status Header(const JxlPixelFormat& format, size_t xsize,
+                       size_t ysize, size_t bits_per_sample,
+                       std::string* header) {
     uint32_t maxval = (1u << bits_per_sample) - 1;
-    char type = image.format.num_channels == 1 ? '5' : '6';
-    char header[kMaxHeaderSize];
+    char type = format.num_channels == 1 ? '5' : '6';
+    char buf[kMaxHeaderSize];
     size_t header_size =
-        snprintf(header, kMaxHeaderSize, "P%c\n%" PRIuS " %" PRIuS "\n%u\n",
-                 type, image.xsize, image.ysize, maxval);
+        snprintf(buf, kMaxHeaderSize, "P%c\n%" PRIuS " %" PRIuS "\n%u\n",
+                 type, xsize, ysize, maxval);
     JXL_RETURN_IF_ERROR(header_size < kMaxHeaderSize);
-    bytes->resize(header_size + image.pixels_size);
-    memcpy(bytes->data(), header, header_size);
-    memcpy(bytes->data() + header_size,
+    header->assign(buf, header_size);
+    return true;
+  }
+
+  Status EncodeImage(const PackedImage& image, size_t bits_per_sample,
+                     std::vector<uint8_t>* bytes) const {
+    std::string header;
+    JXL_RETURN_IF_ERROR(Header(image.format, image.xsize, image.ysize,
+                               bits_per_sample, &header));
+    bytes->resize(header.size() + image.pixels_size);
+    memcpy(bytes->data(), header.data(), header.size());
+    memcpy(bytes->data() + header.size(),
            reinterpret_cast<uint8_t*>(image.pixels()), image.pixels_size);
     return true;
   }
@@ -22,6 +22,7 @@
 #include "jxl/codestream_header.h"
 #include "jxl/encode.h"
 #include "jxl/types.h"
+#include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
 
 namespace jxl {
@@ -33,6 +34,15 @@ class PackedImage {
   PackedImage(size_t xsize, size_t ysize, const JxlPixelFormat& format)
       : PackedImage(xsize, ysize, format, CalcStride(format, xsize)) {}
 
+  // Wraps `pixels`, which must hold ysize rows of CalcStride() bytes and
+  // outlive the returned image, without copying them; e.g. the raster of a
+  // memory-mapped input file.
+  static PackedImage View(size_t xsize, size_t ysize,
+                          const JxlPixelFormat& format, void* pixels) {
+    return PackedImage(xsize, ysize, format, CalcStride(format, xsize),
+                       pixels);
+  }
+
   PackedImage Copy() const {
     PackedImage copy(xsize, ysize, format);
     memcpy(reinterpret_cast<uint8_t*>(copy.pixels()),
@@ -84,6 +94,17 @@ class PackedImage {
         pixels_size(ysize * stride),
         pixels_(malloc(std::max<size_t>(1, pixels_size)), free) {}
 
+  PackedImage(size_t xsize, size_t ysize, const JxlPixelFormat& format,
+              size_t stride, void* pixels)
+      : xsize(xsize),
+        ysize(ysize),
+        stride(stride),
+        format(format),
+        pixels_size(ysize * stride),
+        pixels_(pixels, NoFree) {}
+
+  static void NoFree(void* /*pixels*/) {}
+
   static size_t CalcStride(const JxlPixelFormat& format, size_t xsize) {
     size_t stride = xsize * (BitsPerChannel(format.data_type) *
                              format.num_channels / jxl::kBitsPerByte);
@@ -164,6 +185,22 @@ class PackedPixelFile {
   PackedPixelFile() { JxlEncoderInitBasicInfo(&info); };
 };
 
+// Receives the color rows of a single-frame image in order, top to bottom,
+// e.g. to write the output file while the image is still being decoded.
+class RowSink {
+ public:
+  virtual ~RowSink() = default;
+
+  // `rows` holds `num_rows` rows `stride` bytes apart, in the pixel format the
+  // sink was created for.
+  virtual Status WriteRows(const uint8_t* rows, size_t num_rows,
+                           size_t stride) = 0;
+
+  // Called after the last row with the complete image metadata, which may
+  // only be known once the whole file has been decoded.
+  virtual Status Finish(const PackedPixelFile& ppf) = 0;
+};
+
 }  // namespace extras
 }  // namespace jxl
 
@@ -0,0 +1,53 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_EXTRAS_RUN_PARALLEL_H_
+#define LIB_EXTRAS_RUN_PARALLEL_H_
+
+// Data-parallel loops for the image codecs in extras/, which are also linked
+// into cjxl and djxl. Those only link the public library, so unlike
+// jxl::RunOnPool this calls a JxlParallelRunner directly and needs nothing
+// from the internals of libjxl.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jxl/parallel_runner.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace extras {
+
+// Runs data_func(task, thread) for every task in [begin, end) on `runner`, or
+// on the calling thread if `runner` is null. data_func can't fail; tasks
+// record their errors for the caller to check afterwards.
+template <class DataFunc>
+Status RunParallel(JxlParallelRunner runner, void* runner_opaque,
+                   uint32_t begin, uint32_t end, const DataFunc& data_func) {
+  if (runner == nullptr) {
+    for (uint32_t task = begin; task < end; ++task) data_func(task, 0);
+    return true;
+  }
+  struct CallState {
+    static JxlParallelRetCode Init(void* /*opaque*/, size_t /*num_threads*/) {
+      return 0;
+    }
+    static void Data(void* opaque, uint32_t task, size_t thread) {
+      (*static_cast<const DataFunc*>(opaque))(task, thread);
+    }
+  };
+  if (begin == end) return true;
+  void* opaque = const_cast<void*>(static_cast<const void*>(&data_func));
+  if ((*runner)(runner_opaque, opaque, &CallState::Init, &CallState::Data,
+                begin, end) != 0) {
+    return JXL_FAILURE("Parallel runner failed");
+  }
+  return true;
+}
+
+}  // namespace extras
+}  // namespace jxl
+
+#endif  // LIB_EXTRAS_RUN_PARALLEL_H_
@@ -89,7 +89,9 @@ typedef struct JxlDecoderStruct JxlDecoder;
  *
  * @p memory_manager will be used for all the library dynamic allocations made
  * from this instance. The parameter may be NULL, in which case the default
- * allocator will be used. See jxl/memory_manager.h for details.
+ * allocator will be used. See jxl/memory_manager.h for details. The
+ * process-wide cache of default dequantization tables, see @ref
+ * JxlDecoderContext, is not allocated through it.
  *
  * @param memory_manager custom allocator function. It may be NULL. The memory
  *        manager will be copied internally.
@@ -114,6 +116,49 @@ JXL_EXPORT void JxlDecoderReset(JxlDecoder* dec);
  */
 JXL_EXPORT void JxlDecoderDestroy(JxlDecoder* dec);
 
+/**
+ * Opaque structure that holds tables which decoders derive from the image
+ * data, such as the dequantization matrices, so that decoders attached to it
+ * with @ref JxlDecoderSetContext compute them only once instead of for every
+ * image. Decoders without a context use a process-wide cache that all
+ * encoders and decoders share, so a context is not needed for speed alone.
+ * That cache only holds the tables of the default encodings, about 3 MB at
+ * most; custom tables signaled by an image are computed per decoder and freed
+ * with it. A context also keeps custom tables, up to a size limit of its own,
+ * and isolates its decoders from the process-wide cache. Use one per tenant or
+ * per stream of images that share custom tables. Neither cache is allocated
+ * through a @ref JxlMemoryManager.
+ *
+ * The cached tables are computed on first use and never change afterwards, so
+ * a context can be attached to any number of decoders, also ones running on
+ * different threads.
+ *
+ * Allocated and initialized with @ref JxlDecoderContextCreate().
+ * Released with @ref JxlDecoderContextDestroy().
+ */
+typedef struct JxlDecoderContextStruct JxlDecoderContext;
+
+/**
+ * Creates an empty @ref JxlDecoderContext.
+ *
+ * @param memory_manager custom allocator function used for the context
+ *     itself. It may be NULL, in which case the default allocator will be
+ *     used. The memory manager will be copied internally.
+ * @return @c NULL if the instance can not be allocated or initialized
+ * @return pointer to initialized @ref JxlDecoderContext otherwise
+ */
+JXL_EXPORT JxlDecoderContext* JxlDecoderContextCreate(
+    const JxlMemoryManager* memory_manager);
+
+/**
+ * Releases the reference to @p context obtained from @ref
+ * JxlDecoderContextCreate. Decoders the context is attached to keep using
+ * it; it is deallocated once it is no longer attached to any decoder.
+ *
+ * @param context instance to be released. May be NULL.
+ */
+JXL_EXPORT void JxlDecoderContextDestroy(JxlDecoderContext* context);
+
 /**
  * Return value for @ref JxlDecoderProcessInput.
  * The values from @ref JXL_DEC_BASIC_INFO onwards are optional informative
@@ -269,8 +314,10 @@ typedef enum {
    * after getting the JPEG reconstruction data. If a JPEG reconstruction buffer
    * is set a byte stream identical to the JPEG codestream used to encode the
    * image will be written to the JPEG reconstruction buffer instead of pixels
-   * to the image out buffer. This event occurs max once per image and always
-   * before @ref JXL_DEC_FULL_IMAGE.
+   * to the image out buffer. Alternatively, @ref
+   * JxlDecoderSetJPEGCoefficientsOutput may be used to get the quantized DCT
+   * coefficients of the JPEG instead. This event occurs max once per image and
+   * always before @ref JXL_DEC_FULL_IMAGE.
    * In this case, @ref JxlDecoderReleaseInput will return all bytes from the
    * end of the 'jbrd' box as unprocessed.
    */
@@ -344,6 +391,8 @@ typedef enum {
  * The difference to @ref JxlDecoderReset is that some state is kept, namely
  * settings set by a call to
  *  - @ref JxlDecoderSetCoalescing,
+ *  - @ref JxlDecoderSetCollectStageStats,
+ *  - @ref JxlDecoderSetContext,
  *  - @ref JxlDecoderSetDesiredIntensityTarget,
  *  - @ref JxlDecoderSetDecompressBoxes,
  *  - @ref JxlDecoderSetKeepOrientation,
@@ -423,6 +472,21 @@ JXL_EXPORT JxlDecoderStatus
 JxlDecoderSetParallelRunner(JxlDecoder* dec, JxlParallelRunner parallel_runner,
                             void* parallel_runner_opaque);
 
+/**
+ * Attaches @p context to the decoder, which from then on takes tables from the
+ * context instead of computing its own. Decoded images are identical with and
+ * without a context. May only be set before starting decoding. The decoder
+ * holds a reference to the context until another one is attached, or until
+ * @ref JxlDecoderReset or @ref JxlDecoderDestroy.
+ *
+ * @param dec decoder object
+ * @param context context to attach, or NULL to detach the current one.
+ * @return @ref JXL_DEC_SUCCESS if the context was attached, @ref JXL_DEC_ERROR
+ *     otherwise (the previous context remains attached).
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetContext(JxlDecoder* dec,
+                                                 JxlDecoderContext* context);
+
 /**
  * Returns a hint indicating how many more bytes the decoder is expected to
  * need to make @ref JxlDecoderGetBasicInfo available after the next @ref
@@ -536,6 +600,47 @@ JxlDecoderSetRenderSpotcolors(JxlDecoder* dec, JXL_BOOL render_spotcolors);
 JXL_EXPORT JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec,
                                                     JXL_BOOL coalescing);
 
+/** Enables or disables collecting timing and counters of the internal
+ * processing stages of the decoder, such as header parsing, DC and AC groups
+ * and each stage of the rendering pipeline. By default, no stage statistics
+ * are collected. Collection adds a small overhead, mostly from reading the
+ * clock, and is meant for monitoring and profiling.
+ *
+ * The statistics accumulate over all frames decoded since the last call to
+ * this function, @ref JxlDecoderRewind or @ref JxlDecoderReset, and can be
+ * read at any time with @ref JxlDecoderGetStageStats.
+ *
+ * @param dec decoder object
+ * @param collect JXL_TRUE to enable, JXL_FALSE to disable (default).
+ * @return @ref JXL_DEC_SUCCESS if no error, @ref JXL_DEC_ERROR otherwise.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetCollectStageStats(JxlDecoder* dec,
+                                                           JXL_BOOL collect);
+
+/** Returns the number of stages for which statistics were collected so far,
+ * see @ref JxlDecoderSetCollectStageStats. The set of stages depends on the
+ * image and on the decoder version, and stages are reported in the order they
+ * were first run.
+ *
+ * @param dec decoder object
+ * @return number of stages, 0 if collection is disabled.
+ */
+JXL_EXPORT size_t JxlDecoderGetNumStageStats(const JxlDecoder* dec);
+
+/** Outputs the statistics of one stage, see @ref
+ * JxlDecoderSetCollectStageStats.
+ *
+ * @param dec decoder object
+ * @param index index of the stage, smaller than @ref
+ *     JxlDecoderGetNumStageStats.
+ * @param stats struct to copy the statistics to.
+ * @return @ref JXL_DEC_SUCCESS if the value is available, @ref JXL_DEC_ERROR
+ *     if the index is out of range.
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetStageStats(const JxlDecoder* dec,
+                                                    size_t index,
+                                                    JxlStageStats* stats);
+
 /**
  * Decodes JPEG XL file using the available bytes. Requires input has been
  * set with @ref JxlDecoderSetInput. After @ref JxlDecoderProcessInput, input
@@ -1226,6 +1331,96 @@ JXL_EXPORT JxlDecoderStatus JxlDecoderSetJPEGBuffer(JxlDecoder* dec,
  */
 JXL_EXPORT size_t JxlDecoderReleaseJPEGBuffer(JxlDecoder* dec);
 
+/**
+ * Information about one component of the JPEG stored in the JPEG
+ * reconstruction data, available after the quantized DCT coefficients were
+ * decoded with @ref JxlDecoderSetJPEGCoefficientsOutput.
+ */
+typedef struct {
+  /** Width of the component, in 8x8 blocks.
+   */
+  uint32_t width_in_blocks;
+
+  /** Height of the component, in 8x8 blocks.
+   */
+  uint32_t height_in_blocks;
+
+  /** Horizontal and vertical sampling factors of the component, as signaled
+   * in the JPEG frame header.
+   */
+  uint32_t h_samp_factor;
+  uint32_t v_samp_factor;
+
+  /** Quantization table of the component, in natural (not zig-zag) order.
+   */
+  uint16_t quant_table[64];
+} JxlJPEGComponentInfo;
+
+/**
+ * Requests that the quantized DCT coefficients of the JPEG stored in the
+ * JPEG reconstruction data are decoded, instead of pixels or a reconstructed
+ * JPEG codestream. Neither pixels are rendered nor is a JPEG codestream
+ * serialized, making this the fastest way to get at the coefficients of a
+ * recompressed JPEG, e.g. for use with libjpeg's jpeg_write_coefficients.
+ *
+ * Must be called after @ref JXL_DEC_JPEG_RECONSTRUCTION and before the frame
+ * is decoded, and cannot be combined with @ref JxlDecoderSetJPEGBuffer. The
+ * coefficients are available through @ref JxlDecoderGetJPEGComponentInfo and
+ * @ref JxlDecoderGetJPEGCoefficients after @ref JXL_DEC_FULL_IMAGE, or after
+ * @ref JXL_DEC_SUCCESS if that event is not subscribed to, until the decoder
+ * is rewound, reset or destroyed.
+ *
+ * @param dec decoder object
+ * @return @ref JXL_DEC_ERROR if a JPEG buffer was already set or JPEG
+ *     reconstruction is not supported, @ref JXL_DEC_SUCCESS otherwise
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderSetJPEGCoefficientsOutput(JxlDecoder* dec);
+
+/**
+ * Outputs the number of components of the JPEG whose coefficients were
+ * decoded, 1 for grayscale or 3 for color JPEGs.
+ *
+ * @param dec decoder object
+ * @param num_components output number of components
+ * @return @ref JXL_DEC_ERROR if the coefficients are not available yet, @ref
+ *     JXL_DEC_SUCCESS otherwise
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetJPEGNumComponents(
+    const JxlDecoder* dec, size_t* num_components);
+
+/**
+ * Outputs information about a component of the JPEG whose coefficients were
+ * decoded. Components are in the order in which they appear in the JPEG frame
+ * header, e.g. Y, Cb, Cr.
+ *
+ * @param dec decoder object
+ * @param index index of the component, smaller than the number of components
+ *     given by @ref JxlDecoderGetJPEGNumComponents
+ * @param info struct to copy the information into
+ * @return @ref JXL_DEC_ERROR if the coefficients are not available yet or the
+ *     index is invalid, @ref JXL_DEC_SUCCESS otherwise
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetJPEGComponentInfo(
+    const JxlDecoder* dec, size_t index, JxlJPEGComponentInfo* info);
+
+/**
+ * Copies the quantized DCT coefficients of a component of the JPEG. The
+ * coefficients are laid out block by block in raster order, with the 64
+ * coefficients of each block in natural (not zig-zag) order, which is the
+ * layout of libjpeg's JBLOCK rows. The buffer must hold at least
+ * width_in_blocks * height_in_blocks * 64 values of type int16_t.
+ *
+ * @param dec decoder object
+ * @param index index of the component
+ * @param coefficients buffer to copy the coefficients into
+ * @param size size of the buffer in bytes
+ * @return @ref JXL_DEC_ERROR if the coefficients are not available yet, the
+ *     index is invalid or the buffer is too small, @ref JXL_DEC_SUCCESS
+ *     otherwise
+ */
+JXL_EXPORT JxlDecoderStatus JxlDecoderGetJPEGCoefficients(
+    const JxlDecoder* dec, size_t index, int16_t* coefficients, size_t size);
+
 /**
  * Sets output buffer for box output codestream.
  *
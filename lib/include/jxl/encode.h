@@ -346,6 +346,13 @@ typedef enum {
    */
   JXL_ENC_FRAME_SETTING_JPEG_COMPRESS_BOXES = 33,
 
+  /** Maximum number of positions the LZ77 match finder visits per symbol when
+   * entropy coding modular images. Lower values encode faster at some cost in
+   * density; this only has an effect at efforts that use LZ77. -1 = default
+   * (256), or 1 to 1048576.
+   */
+  JXL_ENC_FRAME_SETTING_MODULAR_LZ77_CHAIN_LENGTH = 34,
+
   /** Enum value not to be used as an option. This value is added to force the
    * C compiler to have the enum to take a known size.
    */
@@ -358,7 +365,10 @@ typedef enum {
  *
  * @p memory_manager will be used for all the library dynamic allocations made
  * from this instance. The parameter may be NULL, in which case the default
- * allocator will be used. See jpegxl/memory_manager.h for details.
+ * allocator will be used. See jpegxl/memory_manager.h for details. The
+ * exception is a process-wide cache of the default dequantization tables,
+ * shared by all encoders and decoders and never freed, of about 3 MB at most.
+ * Custom tables are computed per encoder and freed with it.
  *
  * @param memory_manager custom allocator function. It may be NULL. The memory
  *        manager will be copied internally.
@@ -370,7 +380,9 @@ JXL_EXPORT JxlEncoder* JxlEncoderCreate(const JxlMemoryManager* memory_manager);
 /**
  * Re-initializes a JxlEncoder instance, so it can be re-used for encoding
  * another image. All state and settings are reset as if the object was
- * newly created with JxlEncoderCreate, but the memory manager is kept.
+ * newly created with JxlEncoderCreate, but the memory manager and the limit set
+ * with @ref JxlEncoderSetRetainedMemoryLimit are kept, as are the working
+ * buffers of previous frames within that limit.
  *
  * @param enc instance to be re-initialized.
  */
@@ -1058,6 +1070,68 @@ JXL_EXPORT JxlEncoderStatus JxlEncoderSetCodestreamLevel(JxlEncoder* enc,
  */
 JXL_EXPORT int JxlEncoderGetRequiredCodestreamLevel(const JxlEncoder* enc);
 
+/** Enables or disables collecting timing and counters of the internal
+ * processing stages of the encoder, such as color transforms, the lossy
+ * heuristics phases, and the encoding of DC and AC groups. By default, no
+ * stage statistics are collected. Collection adds a small overhead, mostly
+ * from reading the clock, and is meant for monitoring and profiling.
+ *
+ * The statistics accumulate over all frames encoded since the last call to
+ * this function or @ref JxlEncoderReset, and can be read at any time with
+ * @ref JxlEncoderGetStageStats.
+ *
+ * @param enc encoder object.
+ * @param collect JXL_TRUE to enable, JXL_FALSE to disable (default).
+ * @return JXL_ENC_SUCCESS if the operation was successful, JXL_ENC_ERROR
+ * otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetCollectStageStats(JxlEncoder* enc,
+                                                           JXL_BOOL collect);
+
+/** Returns the number of stages for which statistics were collected so far,
+ * see @ref JxlEncoderSetCollectStageStats. The set of stages depends on the
+ * image, the encoder settings and the encoder version, and stages are reported
+ * in the order they were first run.
+ *
+ * @param enc encoder object.
+ * @return number of stages, 0 if collection is disabled.
+ */
+JXL_EXPORT size_t JxlEncoderGetNumStageStats(const JxlEncoder* enc);
+
+/** Outputs the statistics of one stage, see @ref
+ * JxlEncoderSetCollectStageStats.
+ *
+ * @param enc encoder object.
+ * @param index index of the stage, smaller than @ref
+ * JxlEncoderGetNumStageStats.
+ * @param stats struct to copy the statistics to.
+ * @return JXL_ENC_SUCCESS if the value is available, JXL_ENC_ERROR if the
+ * index is out of range.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderGetStageStats(const JxlEncoder* enc,
+                                                    size_t index,
+                                                    JxlStageStats* stats);
+
+/** Sets how much memory the encoder may keep between frames for reuse. The
+ * working buffers of the lossy encoder whose size depends on the frame size,
+ * such as the quantized coefficients and their tokens, are kept after each
+ * frame and reused by the following frames, also of the next image after
+ * @ref JxlEncoderReset, instead of being allocated again. This speeds up
+ * encoding sequences of frames or images of similar size. After a frame
+ * which leaves more than @p max_bytes of such buffers, they are freed.
+ *
+ * Unlike other settings, this one is kept by @ref JxlEncoderReset.
+ *
+ * @param enc encoder object.
+ * @param max_bytes maximum number of bytes to keep, 0 to free the buffers
+ * after every frame, which is the default. SIZE_MAX keeps the buffers of the
+ * largest frame encoded so far.
+ * @return JXL_ENC_SUCCESS if the operation was successful, JXL_ENC_ERROR
+ * otherwise.
+ */
+JXL_EXPORT JxlEncoderStatus JxlEncoderSetRetainedMemoryLimit(JxlEncoder* enc,
+                                                             size_t max_bytes);
+
 /**
  * Enables lossless encoding.
  *
@@ -0,0 +1,67 @@
+/* Copyright (c) the JPEG XL Project Authors. All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/** @addtogroup libjxl_common
+ * @{
+ * @file parallel_trace.h
+ * @brief Tracing of the parallel regions run by the encoder and decoder.
+ */
+
+#ifndef JXL_PARALLEL_TRACE_H_
+#define JXL_PARALLEL_TRACE_H_
+
+#include <stddef.h>
+
+#include "jxl/jxl_export.h"
+#include "jxl/types.h"
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/**
+ * Enables or disables the process-wide recording of the parallel regions that
+ * all encoder and decoder instances run through their @ref JxlParallelRunner
+ * (or sequentially, without one). For every region the library records its
+ * name, e.g. "DecodeGroup", the number of tasks, the time each thread spent
+ * running tasks and the time it was idle, and the length of the longest task.
+ *
+ * Disabled by default. Recording adds a small overhead per task and memory
+ * proportional to the number of tasks; it is meant for profiling, not for
+ * production use. Disabling keeps the regions recorded so far.
+ *
+ * @param enable whether to record regions that start from now on.
+ */
+JXL_EXPORT void JxlParallelTraceEnable(JXL_BOOL enable);
+
+/**
+ * Discards all recorded regions that have completed.
+ */
+JXL_EXPORT void JxlParallelTraceClear(void);
+
+/**
+ * Writes the completed regions recorded so far as a JSON document in the Chrome
+ * trace event format, which can be loaded in chrome://tracing or Perfetto.
+ * Each region is a complete event on the thread that started it, with its
+ * statistics as arguments, and each task is a complete event on the thread
+ * that ran it. Times are in microseconds.
+ *
+ * @param buffer buffer to write the nul-terminated JSON to, or NULL to only
+ *     query the size. The output is truncated if the buffer is too small.
+ * @param size size of @p buffer in bytes.
+ * @return the size in bytes needed for the whole JSON including the nul
+ *     terminator. This may grow while encoders or decoders are running, so
+ *     a caller that sees a result larger than @p size should retry.
+ */
+JXL_EXPORT size_t JxlParallelTraceGetJSON(char* buffer, size_t size);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* JXL_PARALLEL_TRACE_H_ */
+
+/** @}*/
@@ -178,6 +178,35 @@ typedef enum {
   kGroups = 6,
 } JxlProgressiveDetail;
 
+/** Accumulated timing and counters of one named processing stage of the
+ * decoder or encoder, see @ref JxlDecoderGetStageStats and @ref
+ * JxlEncoderGetStageStats. Stages that run in parallel on several threads sum
+ * their time over all threads, so the total may exceed the wall time of the
+ * whole operation.
+ */
+typedef struct {
+  /** Name of the stage, e.g. "AC group". The string is owned by the library
+   * and remains valid for the lifetime of the process. */
+  const char* name;
+
+  /** Number of times the stage was run, e.g. the number of groups. */
+  uint64_t count;
+
+  /** Total elapsed time spent in the stage, in seconds. */
+  double wall_seconds;
+
+  /** Total CPU time of the running threads spent in the stage, in seconds, or
+   * 0 if not available on this platform. */
+  double cpu_seconds;
+
+  /** Number of compressed bytes consumed (decoder) or produced (encoder) by
+   * the stage, or 0 if not applicable. */
+  uint64_t bytes;
+
+  /** Number of pixels processed by the stage, or 0 if not applicable. */
+  uint64_t pixels;
+} JxlStageStats;
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
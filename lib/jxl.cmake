@@ -35,6 +35,8 @@ set(JPEGXL_INTERNAL_SOURCES_DEC
   jxl/base/override.h
   jxl/base/padded_bytes.cc
   jxl/base/padded_bytes.h
+  jxl/base/parallel_trace.cc
+  jxl/base/parallel_trace.h
   jxl/base/printf_macros.h
   jxl/base/profiler.h
   jxl/base/random.cc
@@ -219,6 +221,8 @@ set(JPEGXL_INTERNAL_SOURCES_DEC
   jxl/size_constraints.h
   jxl/splines.cc
   jxl/splines.h
+  jxl/stage_stats.cc
+  jxl/stage_stats.h
   jxl/toc.cc
   jxl/toc.h
   jxl/transfer_functions-inl.h
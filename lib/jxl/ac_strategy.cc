@@ -87,6 +87,7 @@ void AcStrategy::ComputeNaturalCoeffOrderLut(coeff_order_t* lut) const {
 constexpr size_t AcStrategy::kMaxCoeffBlocks;
 constexpr size_t AcStrategy::kMaxBlockDim;
 constexpr size_t AcStrategy::kMaxCoeffArea;
+constexpr size_t AcStrategy::kDCT8BatchSize;
 
 AcStrategyImage::AcStrategyImage(size_t xsize, size_t ysize)
     : layers_(xsize, ysize) {
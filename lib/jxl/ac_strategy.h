@@ -37,6 +37,9 @@ class AcStrategy {
   static constexpr size_t kMaxCoeffArea = kMaxBlockDim * kMaxBlockDim;
   static_assert((kMaxCoeffArea * sizeof(float)) % hwy::kMaxVectorSize == 0,
                 "Coefficient area is not a multiple of vector size");
+  // Number of horizontally adjacent DCT blocks that the batched transforms
+  // process at once.
+  static constexpr size_t kDCT8BatchSize = 4;
 
   // Raw strategy types.
   enum Type : uint32_t {
@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -13,10 +14,12 @@
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/base/span.h"
+#include "lib/jxl/base/thread_pool_internal.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/enc_cluster.h"
 
 namespace jxl {
 namespace {
@@ -274,5 +277,244 @@ TEST(ANSTest, TestCheckpointingPrefixLZ77) {
   TestCheckpointing(/*ans=*/false, /*lz77=*/true);
 }
 
+void TestBatchRead(bool ans, bool lz77) {
+  std::vector<std::vector<Token>> input_values(1);
+  Rng rng(0);
+  Rng::GeometricDistribution dist(0.3f);
+  for (size_t i = 0; i < 100000; i++) {
+    // Mostly short codes, with occasional values that need extra bits.
+    uint32_t value = rng.Bernoulli(0.05f) ? rng.UniformU(16, 1 << 16)
+                                           : rng.Geometric(dist) % 16;
+    input_values[0].push_back(Token(0, value));
+  }
+
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  HistogramParams params;
+  params.lz77_method = lz77 ? HistogramParams::LZ77Method::kLZ77
+                            : HistogramParams::LZ77Method::kNone;
+  params.force_huffman = !ans;
+
+  BitWriter writer;
+  {
+    auto input_values_copy = input_values;
+    BuildAndEncodeHistograms(params, 1, input_values_copy, &codes, &context_map,
+                             &writer, 0, nullptr);
+    WriteTokens(input_values_copy[0], codes, context_map, &writer, 0, nullptr);
+    writer.ZeroPadToByte();
+  }
+
+  BitReader br(writer.GetSpan());
+  Status status = true;
+  {
+    BitReaderScopedCloser bc(&br, &status);
+
+    std::vector<uint8_t> dec_context_map;
+    ANSCode decoded_codes;
+    ASSERT_TRUE(DecodeHistograms(&br, 1, &decoded_codes, &dec_context_map));
+    decoded_codes.BuildMultiSymbolTables();
+    ANSSymbolReader reader(&decoded_codes, &br);
+
+    // Uneven batch sizes, so that batches end in the middle of table entries.
+    std::vector<uint32_t> values(input_values[0].size());
+    size_t pos = 0;
+    for (size_t batch = 1; pos < values.size(); batch = batch * 3 % 1021) {
+      size_t count = std::min(batch, values.size() - pos);
+      reader.ReadHybridUintClusteredBatch(dec_context_map[0], &br,
+                                          values.data() + pos, count);
+      pos += count;
+    }
+    for (size_t i = 0; i < values.size(); i++) {
+      ASSERT_EQ(values[i], input_values[0][i].value) << "i = " << i;
+    }
+    ASSERT_TRUE(reader.CheckANSFinalState());
+  }
+  EXPECT_TRUE(status);
+}
+
+TEST(ANSTest, TestBatchReadANS) { TestBatchRead(/*ans=*/true, /*lz77=*/false); }
+
+TEST(ANSTest, TestBatchReadPrefix) {
+  TestBatchRead(/*ans=*/false, /*lz77=*/false);
+}
+
+TEST(ANSTest, TestBatchReadPrefixLZ77) {
+  TestBatchRead(/*ans=*/false, /*lz77=*/true);
+}
+
+// Encodes several streams with repeated content and checks that the output
+// does not depend on the thread pool, and that it decodes correctly.
+void TestParallelLZ77(HistogramParams::LZ77Method method,
+                      uint32_t max_chain_length) {
+  constexpr size_t kNumStreams = 5;
+  std::vector<std::vector<Token>> input_values(kNumStreams);
+  Rng rng(0);
+  Rng::GeometricDistribution dist(0.3f);
+  for (size_t stream = 0; stream < kNumStreams; stream++) {
+    std::vector<uint32_t> pattern(48);
+    for (uint32_t& v : pattern) v = rng.Geometric(dist) % 32;
+    for (size_t i = 0; i < 20000; i++) {
+      uint32_t value = rng.Bernoulli(0.1f) ? rng.Geometric(dist) % 32
+                                           : pattern[i % pattern.size()];
+      input_values[stream].push_back(Token(stream % 2, value));
+    }
+  }
+
+  HistogramParams params;
+  params.lz77_method = method;
+  params.lz77_max_chain_length = max_chain_length;
+
+  ThreadPoolInternal pool(4);
+  PaddedBytes compressed[2];
+  for (size_t use_pool = 0; use_pool < 2; use_pool++) {
+    params.pool = use_pool ? &pool : nullptr;
+    std::vector<uint8_t> context_map;
+    EntropyEncodingData codes;
+    BitWriter writer;
+    auto input_values_copy = input_values;
+    BuildAndEncodeHistograms(params, 2, input_values_copy, &codes,
+                             &context_map, &writer, 0, nullptr);
+    EXPECT_TRUE(codes.lz77.enabled);
+    for (const auto& stream : input_values_copy) {
+      WriteTokens(stream, codes, context_map, &writer, 0, nullptr);
+    }
+    writer.ZeroPadToByte();
+    compressed[use_pool] = std::move(writer).TakeBytes();
+  }
+  ASSERT_EQ(compressed[0].size(), compressed[1].size());
+  EXPECT_TRUE(std::equal(compressed[0].begin(), compressed[0].end(),
+                         compressed[1].begin()));
+
+  BitReader br(Span<const uint8_t>(compressed[1].data(), compressed[1].size()));
+  Status status = true;
+  {
+    BitReaderScopedCloser bc(&br, &status);
+    std::vector<uint8_t> dec_context_map;
+    ANSCode decoded_codes;
+    ASSERT_TRUE(DecodeHistograms(&br, 2, &decoded_codes, &dec_context_map));
+    for (const auto& stream : input_values) {
+      ANSSymbolReader reader(&decoded_codes, &br);
+      for (size_t i = 0; i < stream.size(); i++) {
+        ASSERT_EQ(reader.ReadHybridUint(stream[i].context, &br,
+                                        dec_context_map),
+                  stream[i].value)
+            << "i = " << i;
+      }
+      ASSERT_TRUE(reader.CheckANSFinalState());
+    }
+  }
+  EXPECT_TRUE(status);
+}
+
+TEST(ANSTest, ParallelLZ77) {
+  TestParallelLZ77(HistogramParams::LZ77Method::kLZ77, 256);
+}
+
+TEST(ANSTest, ParallelLZ77ShortChains) {
+  TestParallelLZ77(HistogramParams::LZ77Method::kLZ77, 8);
+}
+
+TEST(ANSTest, ParallelLZ77Optimal) {
+  TestParallelLZ77(HistogramParams::LZ77Method::kOptimal, 32);
+}
+
+// Pins the greedy LZ77 parse of streams made of a block of distinct values
+// repeated many times: the first block is stored as literals and the rest is
+// a single copy at the distance of one block.
+TEST(ANSTest, LZ77ParseOfRepeatedBlock) {
+  constexpr size_t kNumStreams = 2;
+  constexpr size_t kBlockSize = 200;
+  constexpr size_t kNumBlocks = 20;
+  for (uint32_t max_chain_length : {1u, 8u, 256u}) {
+    for (bool use_pool : {false, true}) {
+      std::vector<std::vector<Token>> tokens(kNumStreams);
+      Rng rng(max_chain_length);
+      for (size_t stream = 0; stream < kNumStreams; stream++) {
+        std::vector<uint32_t> block(kBlockSize);
+        for (size_t i = 0; i < kBlockSize; i++) block[i] = i;
+        rng.Shuffle(block.data(), block.size());
+        for (size_t i = 0; i < kBlockSize * kNumBlocks; i++) {
+          tokens[stream].push_back(Token(stream, block[i % kBlockSize]));
+        }
+      }
+      const std::vector<std::vector<Token>> input = tokens;
+
+      ThreadPoolInternal pool(4);
+      HistogramParams params;
+      params.lz77_method = HistogramParams::LZ77Method::kLZ77;
+      params.lz77_max_chain_length = max_chain_length;
+      params.pool = use_pool ? &pool : nullptr;
+      std::vector<uint8_t> context_map;
+      EntropyEncodingData codes;
+      BuildAndEncodeHistograms(params, kNumStreams, tokens, &codes,
+                               &context_map, /*writer=*/nullptr, 0, nullptr);
+
+      // BuildAndEncodeHistograms replaces the tokens by the LZ77 ones.
+      ASSERT_TRUE(codes.lz77.enabled);
+      for (size_t stream = 0; stream < kNumStreams; stream++) {
+        const std::vector<Token>& out = tokens[stream];
+        ASSERT_EQ(kBlockSize + 2, out.size());
+        for (size_t i = 0; i < kBlockSize; i++) {
+          EXPECT_FALSE(out[i].is_lz77_length);
+          EXPECT_EQ(stream, out[i].context);
+          EXPECT_EQ(input[stream][i].value, out[i].value);
+        }
+        const Token& length = out[kBlockSize];
+        EXPECT_TRUE(length.is_lz77_length);
+        EXPECT_EQ(stream, length.context);
+        EXPECT_EQ(kBlockSize * (kNumBlocks - 1) - codes.lz77.min_length,
+                  length.value);
+        const Token& distance = out[kBlockSize + 1];
+        EXPECT_FALSE(distance.is_lz77_length);
+        EXPECT_EQ(kNumStreams, distance.context);
+        // Without image widths there are no special distances.
+        EXPECT_EQ(kBlockSize - 1, distance.value);
+      }
+    }
+  }
+}
+
+TEST(ANSTest, ClusterHistogramsThreadPool) {
+  // Many small histograms drawn from a few distinct distributions.
+  Rng rng(0);
+  std::vector<std::vector<uint32_t>> symbol_maps(40);
+  for (auto& map : symbol_maps) {
+    map.resize(16);
+    for (uint32_t& s : map) s = rng.UniformU(0, 40);
+  }
+  std::vector<Histogram> histograms(3000);
+  for (Histogram& histogram : histograms) {
+    const auto& map = symbol_maps[rng.UniformU(0, symbol_maps.size())];
+    const size_t count = rng.UniformU(0, 200);
+    for (size_t i = 0; i < count; i++) {
+      size_t s = 0;
+      while (s + 1 < map.size() && rng.Bernoulli(0.6f)) s++;
+      histogram.Add(map[s]);
+    }
+  }
+
+  ThreadPoolInternal pool(4);
+  for (auto clustering : {HistogramParams::ClusteringType::kFast,
+                          HistogramParams::ClusteringType::kBest}) {
+    HistogramParams params;
+    params.clustering = clustering;
+    std::vector<Histogram> clustered;
+    std::vector<uint32_t> symbols;
+    ClusterHistograms(params, histograms, 128, &clustered, &symbols);
+
+    params.pool = &pool;
+    std::vector<Histogram> clustered_parallel;
+    std::vector<uint32_t> symbols_parallel;
+    ClusterHistograms(params, histograms, 128, &clustered_parallel,
+                      &symbols_parallel);
+
+    EXPECT_EQ(symbols, symbols_parallel);
+    ASSERT_EQ(clustered.size(), clustered_parallel.size());
+    for (size_t i = 0; i < clustered.size(); i++) {
+      EXPECT_EQ(clustered[i].data_, clustered_parallel[i].data_);
+    }
+  }
+}
+
 }  // namespace
 }  // namespace jxl
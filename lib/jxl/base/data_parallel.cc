@@ -7,6 +7,53 @@
 
 namespace jxl {
 
+namespace {
+
+// Wraps the init and data functions of a Run call to record them in a
+// ParallelTrace::Region.
+struct TracedCallState {
+  void* jpegxl_opaque;
+  JxlParallelRunInit init;
+  JxlParallelRunFunction func;
+  ParallelTrace::Region* region;
+
+  static int CallInitFunc(void* opaque, size_t num_threads) {
+    auto* self = static_cast<TracedCallState*>(opaque);
+    // Runners call init once before any data function.
+    self->region->tasks.resize(num_threads);
+    return (*self->init)(self->jpegxl_opaque, num_threads);
+  }
+
+  static void CallDataFunc(void* opaque, uint32_t value, size_t thread_id) {
+    auto* self = static_cast<TracedCallState*>(opaque);
+    ParallelTrace::Task task;
+    task.value = value;
+    task.os_thread = ParallelTrace::OSThread();
+    task.begin = ParallelTrace::Now();
+    (*self->func)(self->jpegxl_opaque, value, thread_id);
+    task.end = ParallelTrace::Now();
+    if (thread_id < self->region->tasks.size()) {
+      self->region->tasks[thread_id].push_back(task);
+    }
+  }
+};
+
+}  // namespace
+
+Status ThreadPool::RunTraced(void* jpegxl_opaque, JxlParallelRunInit init,
+                             JxlParallelRunFunction func, uint32_t begin,
+                             uint32_t end, const char* caller) {
+  ParallelTrace* trace = ParallelTrace::Get();
+  TracedCallState call_state{jpegxl_opaque, init, func,
+                             trace->BeginRegion(caller)};
+  const JxlParallelRetCode ret =
+      (*runner_)(runner_opaque_, static_cast<void*>(&call_state),
+                 &TracedCallState::CallInitFunc,
+                 &TracedCallState::CallDataFunc, begin, end);
+  trace->EndRegion(call_state.region);
+  return ret == 0;
+}
+
 // static
 JxlParallelRetCode ThreadPool::SequentialRunnerStatic(
     void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
@@ -14,6 +14,8 @@
 
 #include "jxl/parallel_runner.h"
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/parallel_trace.h"
 #include "lib/jxl/base/status.h"
 #if JXL_COMPILER_MSVC
 // suppress warnings about the const & applied to function types
@@ -48,6 +50,11 @@ class ThreadPool {
     JXL_ASSERT(begin <= end);
     if (begin == end) return true;
     RunCallState<InitFunc, DataFunc> call_state(init_func, data_func);
+    if (JXL_UNLIKELY(ParallelTrace::Enabled())) {
+      return RunTraced(static_cast<void*>(&call_state),
+                       &call_state.CallInitFunc, &call_state.CallDataFunc,
+                       begin, end, caller);
+    }
     // The runner_ uses the C convention and returns 0 in case of error, so we
     // convert it to a Status.
     return (*runner_)(runner_opaque_, static_cast<void*>(&call_state),
@@ -89,6 +96,12 @@ class ThreadPool {
     const DataFunc& data_func_;
   };
 
+  // Same as the runner_ call in Run, but records the region in the
+  // ParallelTrace.
+  Status RunTraced(void* jpegxl_opaque, JxlParallelRunInit init,
+                   JxlParallelRunFunction func, uint32_t begin, uint32_t end,
+                   const char* caller);
+
   // Default JxlParallelRunner used when no runner is provided by the
   // caller. This runner doesn't use any threading and thread_id is always 0.
   static JxlParallelRetCode SequentialRunnerStatic(
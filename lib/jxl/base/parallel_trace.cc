@@ -0,0 +1,239 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/base/parallel_trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "jxl/parallel_trace.h"
+
+namespace jxl {
+
+namespace {
+
+const std::chrono::steady_clock::time_point kOrigin =
+    std::chrono::steady_clock::now();
+
+void AppendF(std::string* out, const char* format, double value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), format, value);
+  *out += buf;
+}
+
+void AppendU(std::string* out, uint64_t value) {
+  *out += std::to_string(value);
+}
+
+// Caller names are string literals, but escape them anyway.
+void AppendString(std::string* out, const char* s) {
+  *out += '"';
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') {
+      *out += '\\';
+      *out += *s;
+    } else if (static_cast<unsigned char>(*s) >= 0x20) {
+      *out += *s;
+    }
+  }
+  *out += '"';
+}
+
+void AppendSummaryArgs(std::string* out, const ParallelTrace::Summary& s) {
+  *out += "\"tasks\":";
+  AppendU(out, s.tasks);
+  *out += ",\"threads\":";
+  AppendU(out, s.threads);
+  *out += ",\"wall_us\":";
+  AppendF(out, "%.3f", s.wall);
+  *out += ",\"busy_us\":";
+  AppendF(out, "%.3f", s.busy);
+  *out += ",\"idle_us\":";
+  AppendF(out, "%.3f", s.idle);
+  *out += ",\"critical_path_us\":";
+  AppendF(out, "%.3f", s.critical_path);
+  *out += ",\"max_thread_busy_us\":";
+  AppendF(out, "%.3f", s.max_thread_busy);
+  *out += ",\"utilization\":";
+  const double capacity = s.busy + s.idle;
+  AppendF(out, "%.4f", capacity > 0 ? s.busy / capacity : 0.0);
+}
+
+}  // namespace
+
+std::atomic<bool> ParallelTrace::enabled_{false};
+
+// static
+ParallelTrace* ParallelTrace::Get() {
+  static ParallelTrace* trace = new ParallelTrace();
+  return trace;
+}
+
+// static
+double ParallelTrace::Now() {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - kOrigin)
+      .count();
+}
+
+// static
+uint32_t ParallelTrace::OSThread() {
+  static std::atomic<uint32_t> next{1};
+  static thread_local uint32_t id = next.fetch_add(1);
+  return id;
+}
+
+void ParallelTrace::SetEnabled(bool enabled) {
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void ParallelTrace::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  regions_.erase(std::remove_if(regions_.begin(), regions_.end(),
+                                [](const std::unique_ptr<Region>& r) {
+                                  return r->end != 0.0;
+                                }),
+                 regions_.end());
+}
+
+ParallelTrace::Region* ParallelTrace::BeginRegion(const char* caller) {
+  std::unique_ptr<Region> region(new Region());
+  region->caller = (caller && *caller) ? caller : "(unnamed)";
+  region->os_thread = OSThread();
+  region->begin = Now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  regions_.push_back(std::move(region));
+  return regions_.back().get();
+}
+
+void ParallelTrace::EndRegion(Region* region) {
+  const double end = Now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Never 0, which marks running regions.
+  region->end = std::max(end, region->begin + 1E-3);
+}
+
+// static
+ParallelTrace::Summary ParallelTrace::SummarizeRegion(const Region& region) {
+  Summary s;
+  s.caller = region.caller;
+  s.regions = 1;
+  s.threads = region.tasks.size();
+  s.wall = region.end - region.begin;
+  for (const std::vector<Task>& thread_tasks : region.tasks) {
+    double thread_busy = 0.0;
+    for (const Task& task : thread_tasks) {
+      const double duration = task.end - task.begin;
+      thread_busy += duration;
+      s.critical_path = std::max(s.critical_path, duration);
+    }
+    s.tasks += thread_tasks.size();
+    s.busy += thread_busy;
+    s.idle += std::max(0.0, s.wall - thread_busy);
+    s.max_thread_busy = std::max(s.max_thread_busy, thread_busy);
+  }
+  return s;
+}
+
+std::vector<ParallelTrace::Summary> ParallelTrace::Summarize() const {
+  std::vector<Summary> summaries;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::unique_ptr<Region>& region : regions_) {
+    if (region->end == 0.0) continue;
+    const Summary s = SummarizeRegion(*region);
+    auto it = std::find_if(summaries.begin(), summaries.end(),
+                           [&s](const Summary& other) {
+                             return strcmp(other.caller, s.caller) == 0;
+                           });
+    if (it == summaries.end()) {
+      summaries.push_back(s);
+      continue;
+    }
+    it->regions++;
+    it->tasks += s.tasks;
+    it->threads = std::max(it->threads, s.threads);
+    it->wall += s.wall;
+    it->busy += s.busy;
+    it->idle += s.idle;
+    it->critical_path += s.critical_path;
+    it->max_thread_busy += s.max_thread_busy;
+  }
+  return summaries;
+}
+
+std::string ParallelTrace::ToJSON() const {
+  // Chrome trace event format: one complete ("X") event per region on the
+  // calling thread, with its statistics as arguments, and one per task on the
+  // worker thread that ran it.
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  const auto begin_event = [&](const char* name, const char* category,
+                               uint32_t tid, double ts, double dur) {
+    if (!first) out += ",";
+    first = false;
+    out += "\n{\"name\":";
+    AppendString(&out, name);
+    out += ",\"cat\":\"";
+    out += category;
+    out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+    AppendU(&out, tid);
+    out += ",\"ts\":";
+    AppendF(&out, "%.3f", ts);
+    out += ",\"dur\":";
+    AppendF(&out, "%.3f", dur);
+    out += ",\"args\":{";
+  };
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::unique_ptr<Region>& region : regions_) {
+    if (region->end == 0.0) continue;
+    begin_event(region->caller, "region", region->os_thread, region->begin,
+                region->end - region->begin);
+    AppendSummaryArgs(&out, SummarizeRegion(*region));
+    out += ",\"thread_busy_us\":[";
+    for (size_t t = 0; t < region->tasks.size(); ++t) {
+      double thread_busy = 0.0;
+      for (const Task& task : region->tasks[t]) {
+        thread_busy += task.end - task.begin;
+      }
+      if (t != 0) out += ",";
+      AppendF(&out, "%.3f", thread_busy);
+    }
+    out += "]}}";
+    for (size_t t = 0; t < region->tasks.size(); ++t) {
+      for (const Task& task : region->tasks[t]) {
+        begin_event(region->caller, "task", task.os_thread, task.begin,
+                    task.end - task.begin);
+        out += "\"task\":";
+        AppendU(&out, task.value);
+        out += ",\"thread\":";
+        AppendU(&out, t);
+        out += "}}";
+      }
+    }
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+}  // namespace jxl
+
+void JxlParallelTraceEnable(JXL_BOOL enable) {
+  jxl::ParallelTrace::Get()->SetEnabled(enable != JXL_FALSE);
+}
+
+void JxlParallelTraceClear(void) { jxl::ParallelTrace::Get()->Clear(); }
+
+size_t JxlParallelTraceGetJSON(char* buffer, size_t size) {
+  const std::string json = jxl::ParallelTrace::Get()->ToJSON();
+  if (buffer && size > 0) {
+    const size_t copied = std::min(json.size(), size - 1);
+    memcpy(buffer, json.data(), copied);
+    buffer[copied] = '\0';
+  }
+  return json.size() + 1;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_BASE_PARALLEL_TRACE_H_
+#define LIB_JXL_BASE_PARALLEL_TRACE_H_
+
+// Process-wide recording of the parallel regions run with ThreadPool::Run (and
+// therefore RunOnPool), exported as Chrome trace event JSON through
+// JxlParallelTraceGetJSON. Unlike the PROFILER_ZONE machinery this is always
+// compiled in; while disabled, ThreadPool::Run only pays for a relaxed atomic
+// load.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace jxl {
+
+class ParallelTrace {
+ public:
+  // One call of the data function of a region.
+  struct Task {
+    uint32_t value;
+    uint32_t os_thread;  // see OSThread()
+    double begin;        // microseconds since the trace origin
+    double end;
+  };
+
+  // One ThreadPool::Run call.
+  struct Region {
+    const char* caller;
+    uint32_t os_thread;  // of the thread that called Run
+    double begin;
+    double end = 0.0;  // 0 while the region is still running.
+    // Indexed by the thread argument of the data function; each entry is
+    // only written by the worker that currently owns that thread index.
+    std::vector<std::vector<Task>> tasks;
+  };
+
+  // Statistics of one region, or of all regions with the same caller.
+  struct Summary {
+    const char* caller = "";
+    size_t regions = 0;
+    size_t tasks = 0;
+    size_t threads = 0;  // maximum over the regions
+    double wall = 0.0;   // microseconds, summed over the regions
+    double busy = 0.0;   // summed over all threads
+    // Time each thread of the region spent outside of tasks: waiting for work,
+    // for other threads to finish, or in the runner itself.
+    double idle = 0.0;
+    // The longest task; no schedule can finish a region faster than this.
+    double critical_path = 0.0;
+    // Busy time of the busiest thread; close to `wall` when the region is
+    // bound by the load imbalance rather than by the number of threads.
+    double max_thread_busy = 0.0;
+  };
+
+  static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // The process-wide instance.
+  static ParallelTrace* Get();
+
+  // Microseconds since the trace origin.
+  static double Now();
+  // Small integer identifying the calling OS thread, stable for its lifetime.
+  static uint32_t OSThread();
+
+  void SetEnabled(bool enabled);
+  // Removes all completed regions.
+  void Clear();
+
+  // Called by ThreadPool::Run; the returned region stays valid at least until
+  // the matching EndRegion.
+  Region* BeginRegion(const char* caller);
+  void EndRegion(Region* region);
+
+  // Per-caller summaries of the completed regions, in order of first use.
+  std::vector<Summary> Summarize() const;
+  std::string ToJSON() const;
+
+ private:
+  ParallelTrace() = default;
+
+  static Summary SummarizeRegion(const Region& region);
+
+  static std::atomic<bool> enabled_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Region>> regions_;
+};
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_BASE_PARALLEL_TRACE_H_
@@ -5,7 +5,15 @@
 
 #include "lib/jxl/base/data_parallel.h"
 
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
+#include "jxl/parallel_trace.h"
+#include "lib/jxl/base/parallel_trace.h"
 #include "lib/jxl/base/thread_pool_internal.h"
 #include "lib/jxl/test_utils.h"
 
@@ -86,4 +94,54 @@ TEST_F(DataParallelTest, RunnerNotCalledOnEmptyRange) {
   EXPECT_EQ(0, runner_called_);
 }
 
+TEST(DataParallelTraceTest, RecordsRegions) {
+  ParallelTrace* trace = ParallelTrace::Get();
+  trace->Clear();
+  ThreadPoolInternal pool(4);
+  std::atomic<uint32_t> sum{0};
+  JxlParallelTraceEnable(JXL_TRUE);
+  for (int i = 0; i < 2; i++) {
+    EXPECT_TRUE(RunOnPool(
+        &pool, 0, 64, ThreadPool::NoInit,
+        [&](uint32_t task, size_t /* thread */) { sum += task; },
+        "TraceTest"));
+  }
+  EXPECT_TRUE(RunOnPool(
+      nullptr, 0, 3, ThreadPool::NoInit,
+      [&](uint32_t task, size_t /* thread */) { sum += task; },
+      "TraceTestSequential"));
+  JxlParallelTraceEnable(JXL_FALSE);
+  // Not recorded.
+  EXPECT_TRUE(RunOnPool(
+      &pool, 0, 8, ThreadPool::NoInit,
+      [&](uint32_t task, size_t /* thread */) { sum += task; },
+      "TraceTestDisabled"));
+  EXPECT_EQ(2 * 2016u + 3u + 28u, sum.load());
+
+  const std::vector<ParallelTrace::Summary> summaries = trace->Summarize();
+  ASSERT_EQ(2u, summaries.size());
+  EXPECT_STREQ("TraceTest", summaries[0].caller);
+  EXPECT_EQ(2u, summaries[0].regions);
+  EXPECT_EQ(128u, summaries[0].tasks);
+  EXPECT_EQ(4u, summaries[0].threads);
+  EXPECT_LE(summaries[0].critical_path, summaries[0].max_thread_busy);
+  EXPECT_LE(summaries[0].max_thread_busy, summaries[0].wall + 1E-3);
+  EXPECT_STREQ("TraceTestSequential", summaries[1].caller);
+  EXPECT_EQ(3u, summaries[1].tasks);
+  EXPECT_EQ(1u, summaries[1].threads);
+
+  const size_t size = JxlParallelTraceGetJSON(nullptr, 0);
+  std::vector<char> json(size);
+  EXPECT_EQ(size, JxlParallelTraceGetJSON(json.data(), json.size()));
+  EXPECT_EQ(size - 1, strlen(json.data()));
+  const std::string str(json.data());
+  EXPECT_NE(std::string::npos, str.find("\"traceEvents\""));
+  EXPECT_NE(std::string::npos, str.find("\"name\":\"TraceTest\""));
+  EXPECT_NE(std::string::npos, str.find("\"critical_path_us\""));
+  EXPECT_EQ(std::string::npos, str.find("TraceTestDisabled"));
+
+  JxlParallelTraceClear();
+  EXPECT_TRUE(trace->Summarize().empty());
+}
+
 }  // namespace jxl
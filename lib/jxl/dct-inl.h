@@ -13,6 +13,7 @@
 #endif
 
 #include <stddef.h>
+#include <string.h>
 
 #include <hwy/highway.h>
 
@@ -302,6 +303,36 @@ struct ComputeScaledDCT {
     }
   }
 };
+// Computes ComputeScaledDCT<N, N> of BATCH horizontally adjacent blocks at
+// once: the blocks lie side by side in the vector lanes, so that each 1D DCT
+// pass runs on N * BATCH columns and small blocks use full vectors. The result
+// is the same as that of ComputeScaledDCT for each block; the coefficients of
+// block i are stored at to + i * N * N.
+template <size_t N, size_t BATCH>
+struct ComputeScaledDCTBatch {
+  // scratch_space must be aligned, and should have space for 2*BATCH*N*N
+  // floats.
+  template <class From>
+  HWY_MAYBE_UNUSED void operator()(const From& from, float* to,
+                                   float* JXL_RESTRICT scratch_space) {
+    constexpr size_t kCols = N * BATCH;
+    float* JXL_RESTRICT rows = scratch_space;
+    float* JXL_RESTRICT cols = scratch_space + N * kCols;
+    DCT1D<N, kCols>()(from, DCTTo(rows, kCols));
+    for (size_t i = 0; i < BATCH; i++) {
+      Transpose<N, N>::Run(DCTFrom(rows + i * N, kCols),
+                           DCTTo(cols + i * N, kCols));
+    }
+    DCT1D<N, kCols>()(DCTFrom(cols, kCols), DCTTo(rows, kCols));
+    for (size_t i = 0; i < BATCH; i++) {
+      for (size_t y = 0; y < N; y++) {
+        memcpy(to + i * N * N + y * N, rows + y * kCols + i * N,
+               N * sizeof(float));
+      }
+    }
+  }
+};
+
 // Computes the maybe-transposed, scaled IDCT of a block, that needs to be
 // HWY_ALIGN'ed.
 template <size_t ROWS, size_t COLS>
@@ -326,6 +357,35 @@ struct ComputeScaledIDCT {
   }
 };
 
+// Inverse of ComputeScaledDCTBatch: computes ComputeScaledIDCT<N, N> of BATCH
+// blocks, the coefficients of block i being at from + i * from_block_stride,
+// and stores the pixels of the blocks side by side in `to`.
+template <size_t N, size_t BATCH>
+struct ComputeScaledIDCTBatch {
+  // scratch_space must be aligned, and should have space for 2*BATCH*N*N
+  // floats.
+  template <class To>
+  HWY_MAYBE_UNUSED void operator()(const float* JXL_RESTRICT from,
+                                   size_t from_block_stride, const To& to,
+                                   float* JXL_RESTRICT scratch_space) {
+    constexpr size_t kCols = N * BATCH;
+    float* JXL_RESTRICT rows = scratch_space;
+    float* JXL_RESTRICT cols = scratch_space + N * kCols;
+    for (size_t i = 0; i < BATCH; i++) {
+      for (size_t y = 0; y < N; y++) {
+        memcpy(rows + y * kCols + i * N, from + i * from_block_stride + y * N,
+               N * sizeof(float));
+      }
+    }
+    IDCT1D<N, kCols>()(DCTFrom(rows, kCols), DCTTo(cols, kCols));
+    for (size_t i = 0; i < BATCH; i++) {
+      Transpose<N, N>::Run(DCTFrom(cols + i * N, kCols),
+                           DCTTo(rows + i * N, kCols));
+    }
+    IDCT1D<N, kCols>()(DCTFrom(rows, kCols), to);
+  }
+};
+
 }  // namespace
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
@@ -0,0 +1,169 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/image.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/dct_gbench.cc"
+#include <hwy/aligned_allocator.h>
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/dct-inl.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+namespace {
+
+// Size of the transformed image, that of a group.
+constexpr size_t kDim = 256;
+
+ImageF MakeInput() {
+  ImageF in(kDim, kDim);
+  for (size_t y = 0; y < kDim; y++) {
+    float* JXL_RESTRICT row = in.Row(y);
+    for (size_t x = 0; x < kDim; x++) {
+      row[x] = static_cast<float>((x * 7 + y * 13) % 256) / 255.0f;
+    }
+  }
+  return in;
+}
+
+// Transforms the image with BATCH NxN blocks at a time; BATCH = 1 is the
+// per-block path of TransformFromPixels.
+template <size_t N, size_t BATCH>
+void RunDCT(benchmark::State& state) {
+  const ImageF in = MakeInput();
+  auto coeffs = hwy::AllocateAligned<float>(kDim * kDim);
+  auto scratch_space = hwy::AllocateAligned<float>(2 * N * N * BATCH);
+  for (auto _ : state) {
+    float* JXL_RESTRICT out = coeffs.get();
+    for (size_t y = 0; y < kDim; y += N) {
+      const float* JXL_RESTRICT row = in.ConstRow(y);
+      for (size_t x = 0; x < kDim; x += N * BATCH) {
+        if (BATCH == 1) {
+          ComputeScaledDCT<N, N>()(DCTFrom(row + x, in.PixelsPerRow()), out,
+                                   scratch_space.get());
+        } else {
+          ComputeScaledDCTBatch<N, BATCH>()(
+              DCTFrom(row + x, in.PixelsPerRow()), out, scratch_space.get());
+        }
+        out += N * N * BATCH;
+      }
+    }
+    benchmark::DoNotOptimize(coeffs[0]);
+  }
+  state.SetItemsProcessed(kDim * kDim * state.iterations());
+}
+
+// Inverse of RunDCT.
+template <size_t N, size_t BATCH>
+void RunIDCT(benchmark::State& state) {
+  ImageF out = MakeInput();
+  auto coeffs = hwy::AllocateAligned<float>(kDim * kDim);
+  auto scratch_space = hwy::AllocateAligned<float>(2 * N * N * BATCH);
+  for (size_t i = 0; i < kDim * kDim; i++) {
+    coeffs[i] = static_cast<float>(i % 256) / 255.0f;
+  }
+  for (auto _ : state) {
+    float* JXL_RESTRICT in = coeffs.get();
+    for (size_t y = 0; y < kDim; y += N) {
+      float* JXL_RESTRICT row = out.Row(y);
+      for (size_t x = 0; x < kDim; x += N * BATCH) {
+        if (BATCH == 1) {
+          ComputeScaledIDCT<N, N>()(in, DCTTo(row + x, out.PixelsPerRow()),
+                                    scratch_space.get());
+        } else {
+          ComputeScaledIDCTBatch<N, BATCH>()(
+              in, N * N, DCTTo(row + x, out.PixelsPerRow()),
+              scratch_space.get());
+        }
+        in += N * N * BATCH;
+      }
+    }
+    benchmark::DoNotOptimize(out.Row(0)[0]);
+  }
+  state.SetItemsProcessed(kDim * kDim * state.iterations());
+}
+
+HWY_NOINLINE void BM_DCT8(benchmark::State& state) { RunDCT<8, 1>(state); }
+HWY_NOINLINE void BM_DCT8Batch2(benchmark::State& state) {
+  RunDCT<8, 2>(state);
+}
+HWY_NOINLINE void BM_DCT8Batch4(benchmark::State& state) {
+  RunDCT<8, 4>(state);
+}
+HWY_NOINLINE void BM_DCT16(benchmark::State& state) { RunDCT<16, 1>(state); }
+HWY_NOINLINE void BM_DCT16Batch2(benchmark::State& state) {
+  RunDCT<16, 2>(state);
+}
+HWY_NOINLINE void BM_DCT32(benchmark::State& state) { RunDCT<32, 1>(state); }
+HWY_NOINLINE void BM_DCT64(benchmark::State& state) { RunDCT<64, 1>(state); }
+HWY_NOINLINE void BM_IDCT8(benchmark::State& state) { RunIDCT<8, 1>(state); }
+HWY_NOINLINE void BM_IDCT8Batch4(benchmark::State& state) {
+  RunIDCT<8, 4>(state);
+}
+
+}  // namespace
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+namespace {
+
+HWY_EXPORT(BM_DCT8);
+HWY_EXPORT(BM_DCT8Batch2);
+HWY_EXPORT(BM_DCT8Batch4);
+HWY_EXPORT(BM_DCT16);
+HWY_EXPORT(BM_DCT16Batch2);
+HWY_EXPORT(BM_DCT32);
+HWY_EXPORT(BM_DCT64);
+HWY_EXPORT(BM_IDCT8);
+HWY_EXPORT(BM_IDCT8Batch4);
+
+void BM_DCT8(benchmark::State& state) { HWY_DYNAMIC_DISPATCH(BM_DCT8)(state); }
+void BM_DCT8Batch2(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_DCT8Batch2)(state);
+}
+void BM_DCT8Batch4(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_DCT8Batch4)(state);
+}
+void BM_DCT16(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_DCT16)(state);
+}
+void BM_DCT16Batch2(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_DCT16Batch2)(state);
+}
+void BM_DCT32(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_DCT32)(state);
+}
+void BM_DCT64(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_DCT64)(state);
+}
+void BM_IDCT8(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_IDCT8)(state);
+}
+void BM_IDCT8Batch4(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_IDCT8Batch4)(state);
+}
+
+BENCHMARK(BM_DCT8);
+BENCHMARK(BM_DCT8Batch2);
+BENCHMARK(BM_DCT8Batch4);
+BENCHMARK(BM_DCT16);
+BENCHMARK(BM_DCT16Batch2);
+BENCHMARK(BM_DCT32);
+BENCHMARK(BM_DCT64);
+BENCHMARK(BM_IDCT8);
+BENCHMARK(BM_IDCT8Batch4);
+
+}  // namespace
+}  // namespace jxl
+#endif
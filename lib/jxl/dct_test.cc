@@ -261,6 +261,64 @@ void TestRectInverse() {
   TestRectInverseT<2, 1>(1e-6f);
 }
 
+template <size_t N, size_t BATCH>
+void TestDctBatchT() {
+  constexpr size_t kCols = N * BATCH;
+  HWY_ALIGN float pixels[N * kCols];
+  for (size_t i = 0; i < N * kCols; ++i) {
+    pixels[i] = static_cast<float>((i * 7919) % 256) / 255.0f - 0.5f;
+  }
+  HWY_ALIGN float coeffs[N * kCols];
+  HWY_ALIGN float scratch_space[2 * N * kCols];
+  ComputeScaledDCTBatch<N, BATCH>()(DCTFrom(pixels, kCols), coeffs,
+                                    scratch_space);
+  for (size_t i = 0; i < BATCH; ++i) {
+    HWY_ALIGN float expected[N * N];
+    ComputeScaledDCT<N, N>()(DCTFrom(pixels + i * N, kCols), expected,
+                             scratch_space);
+    for (size_t k = 0; k < N * N; ++k) {
+      EXPECT_EQ(expected[k], coeffs[i * N * N + k])
+          << "N = " << N << ", i = " << i << ", k = " << k;
+    }
+  }
+}
+
+template <size_t N, size_t BATCH>
+void TestIdctBatchT() {
+  constexpr size_t kCols = N * BATCH;
+  // Leaves a gap between the blocks.
+  constexpr size_t kBlockStride = 2 * N * N;
+  HWY_ALIGN float coeffs[kBlockStride * BATCH];
+  for (size_t i = 0; i < kBlockStride * BATCH; ++i) {
+    coeffs[i] = static_cast<float>((i * 7919) % 256) / 255.0f - 0.5f;
+  }
+  HWY_ALIGN float pixels[N * kCols];
+  HWY_ALIGN float expected[N * kCols];
+  HWY_ALIGN float scratch_space[2 * N * kCols];
+  ComputeScaledIDCTBatch<N, BATCH>()(coeffs, kBlockStride,
+                                     DCTTo(pixels, kCols), scratch_space);
+  for (size_t i = 0; i < BATCH; ++i) {
+    HWY_ALIGN float block[N * N];
+    memcpy(block, coeffs + i * kBlockStride, sizeof(block));
+    ComputeScaledIDCT<N, N>()(block, DCTTo(expected + i * N, kCols),
+                              scratch_space);
+  }
+  for (size_t k = 0; k < N * kCols; ++k) {
+    EXPECT_EQ(expected[k], pixels[k]) << "N = " << N << ", k = " << k;
+  }
+}
+
+void TestDctBatch() {
+  TestDctBatchT<8, 1>();
+  TestDctBatchT<8, 2>();
+  TestDctBatchT<8, 4>();
+  TestDctBatchT<16, 2>();
+  TestDctBatchT<32, 2>();
+  TestIdctBatchT<8, 1>();
+  TestIdctBatchT<8, 4>();
+  TestIdctBatchT<16, 2>();
+}
+
 template <size_t ROWS, size_t COLS>
 void TestRectTransposeT(float accuracy) {
   constexpr size_t kBlockSize = ROWS * COLS;
@@ -363,6 +421,7 @@ HWY_EXPORT_AND_TEST_P(TransposeTest, InverseTest);
 HWY_EXPORT_AND_TEST_P(TransposeTest, ColumnDctRoundtrip);
 HWY_EXPORT_AND_TEST_P(TransposeTest, TestRectInverse);
 HWY_EXPORT_AND_TEST_P(TransposeTest, TestRectTranspose);
+HWY_EXPORT_AND_TEST_P(TransposeTest, TestDctBatch);
 
 // Tests in the DctShardedTest class are sharded for N=32.
 class DctShardedTest : public ::hwy::TestWithParamTargetAndT<uint32_t> {};
@@ -42,6 +42,7 @@ class ACImage {
   virtual ACPtr PlaneRow(size_t c, size_t y, size_t xbase) = 0;
   virtual ConstACPtr PlaneRow(size_t c, size_t y, size_t xbase) const = 0;
   virtual size_t PixelsPerRow() const = 0;
+  virtual size_t ysize() const = 0;
   virtual void ZeroFill() = 0;
   virtual void ZeroFillPlane(size_t c) = 0;
   virtual bool IsEmpty() const = 0;
@@ -69,6 +70,8 @@ class ACImageT final : public ACImage {
 
   size_t PixelsPerRow() const override { return img_.PixelsPerRow(); }
 
+  size_t ysize() const override { return img_.ysize(); }
+
   void ZeroFill() override { ZeroFillImage(&img_); }
 
   void ZeroFillPlane(size_t c) override { ZeroFillImage(&img_.Plane(c)); }
@@ -304,6 +304,14 @@ Status LZ77Params::VisitFields(Visitor* JXL_RESTRICT visitor) {
   return true;
 }
 
+void ANSCode::BuildMultiSymbolTables() {
+  // With LZ77, the batch decoding falls back to single symbols.
+  if (!use_prefix_code || lz77.enabled) return;
+  for (HuffmanDecodingData& data : huffman_data) {
+    if (data.multi_table_.empty()) data.BuildMultiSymbolTable();
+  }
+}
+
 void ANSCode::UpdateMaxNumBits(size_t ctx, size_t symbol) {
   HybridUintConfig* cfg = &uint_config[ctx];
   // LZ77 symbols use a different uint config.
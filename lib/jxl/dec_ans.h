@@ -12,6 +12,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <cstring>
 #include <vector>
 
@@ -146,6 +147,9 @@ struct ANSCode {
   // ReadHybridUint call done with this ANSCode.
   size_t max_num_bits = 0;
   void UpdateMaxNumBits(size_t ctx, size_t symbol);
+  // Prepares prefix codes for ANSSymbolReader::ReadHybridUintClusteredBatch;
+  // must be called before decoding with it.
+  void BuildMultiSymbolTables();
 };
 
 class ANSSymbolReader {
@@ -346,6 +350,53 @@ class ANSSymbolReader {
     return ret;
   }
 
+  // Takes a *clustered* idx. Equivalent to `count` calls to
+  // ReadHybridUintClustered, but hoists the per-symbol mode checks and, for
+  // prefix codes, decodes up to kHuffmanMaxMultiSymbols short codes per table
+  // lookup. Requires ANSCode::BuildMultiSymbolTables.
+  void ReadHybridUintClusteredBatch(size_t ctx, BitReader* JXL_RESTRICT br,
+                                    uint32_t* JXL_RESTRICT out, size_t count) {
+    if (JXL_UNLIKELY(lz77_window_ != nullptr)) {
+      for (size_t i = 0; i < count; i++) {
+        out[i] = ReadHybridUintClustered(ctx, br);
+      }
+      return;
+    }
+    const HybridUintConfig& config = configs[ctx];
+    if (!use_prefix_code_) {
+      for (size_t i = 0; i < count; i++) {
+        br->Refill();  // covers ReadSymbolANSWithoutRefill + PeekBits
+        size_t token = ReadSymbolANSWithoutRefill(ctx, br);
+        out[i] = ReadHybridUintConfig(config, token, br);
+      }
+      return;
+    }
+    const HuffmanDecodingData& huff = huffman_data_[ctx];
+    size_t i = 0;
+    while (i < count) {
+      br->Refill();  // covers kHuffmanTableBits + ReadSymbol + PeekBits
+      const HuffmanMultiCode& entry = huff.PeekMultiSymbol(br);
+      const size_t n = std::min<size_t>(entry.num_symbols, count - i);
+      size_t k = 0;
+      while (k < n && entry.symbols[k] < config.split_token) {
+        out[i + k] = entry.symbols[k];
+        k++;
+      }
+      if (k < n) {
+        // Symbol k has extra bits, which follow its code.
+        br->Consume(entry.bits[k]);
+        out[i + k] = ReadHybridUintConfig(config, entry.symbols[k], br);
+        i += k + 1;
+      } else if (n != 0) {
+        br->Consume(entry.bits[n - 1]);
+        i += n;
+      } else {
+        size_t token = huff.ReadSymbol(br);
+        out[i++] = ReadHybridUintConfig(config, token, br);
+      }
+    }
+  }
+
   JXL_INLINE size_t ReadHybridUint(size_t ctx, BitReader* JXL_RESTRICT br,
                                    const std::vector<uint8_t>& context_map) {
     return ReadHybridUintClustered(context_map[ctx], br);
@@ -0,0 +1,85 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/dec_ans.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/enc_ans.h"
+#include "lib/jxl/enc_bit_writer.h"
+
+namespace jxl {
+namespace {
+
+constexpr size_t kNumSymbols = 1 << 20;
+
+// Encodes kNumSymbols small residual-like values in a single context, using
+// prefix codes if `prefix` is set and ANS otherwise.
+PaddedBytes EncodeTestStream(bool prefix) {
+  std::vector<std::vector<Token>> tokens(1);
+  Rng rng(0);
+  Rng::GeometricDistribution dist(0.4f);
+  for (size_t i = 0; i < kNumSymbols; i++) {
+    tokens[0].push_back(Token(0, rng.Geometric(dist) % 64));
+  }
+  HistogramParams params;
+  params.lz77_method = HistogramParams::LZ77Method::kNone;
+  params.force_huffman = prefix;
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  BitWriter writer;
+  BuildAndEncodeHistograms(params, 1, tokens, &codes, &context_map, &writer, 0,
+                           nullptr);
+  WriteTokens(tokens[0], codes, context_map, &writer, 0, nullptr);
+  writer.ZeroPadToByte();
+  return std::move(writer).TakeBytes();
+}
+
+void BM_DecodeHybridUint(benchmark::State& state) {
+  const PaddedBytes data = EncodeTestStream(state.range(0));
+  std::vector<uint32_t> values(kNumSymbols);
+  for (auto _ : state) {
+    BitReader br(Span<const uint8_t>(data.data(), data.size()));
+    std::vector<uint8_t> context_map;
+    ANSCode code;
+    JXL_CHECK(DecodeHistograms(&br, 1, &code, &context_map));
+    ANSSymbolReader reader(&code, &br);
+    for (size_t i = 0; i < kNumSymbols; i++) {
+      values[i] = reader.ReadHybridUintClustered(context_map[0], &br);
+    }
+    JXL_CHECK(reader.CheckANSFinalState());
+    JXL_CHECK(br.Close());
+    benchmark::DoNotOptimize(values.data());
+  }
+  state.SetItemsProcessed(kNumSymbols * state.iterations());
+}
+
+void BM_DecodeHybridUintBatch(benchmark::State& state) {
+  const PaddedBytes data = EncodeTestStream(state.range(0));
+  std::vector<uint32_t> values(kNumSymbols);
+  for (auto _ : state) {
+    BitReader br(Span<const uint8_t>(data.data(), data.size()));
+    std::vector<uint8_t> context_map;
+    ANSCode code;
+    JXL_CHECK(DecodeHistograms(&br, 1, &code, &context_map));
+    code.BuildMultiSymbolTables();
+    ANSSymbolReader reader(&code, &br);
+    reader.ReadHybridUintClusteredBatch(context_map[0], &br, values.data(),
+                                        kNumSymbols);
+    JXL_CHECK(reader.CheckANSFinalState());
+    JXL_CHECK(br.Close());
+    benchmark::DoNotOptimize(values.data());
+  }
+  state.SetItemsProcessed(kNumSymbols * state.iterations());
+}
+
+// Argument: 1 for prefix codes, 0 for ANS.
+BENCHMARK(BM_DecodeHybridUint)->Arg(0)->Arg(1);
+BENCHMARK(BM_DecodeHybridUintBatch)->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace jxl
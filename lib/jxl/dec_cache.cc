@@ -223,6 +223,7 @@ Status PassesDecoderState::PreparePipeline(ImageBundle* decoded,
     }
   }
   render_pipeline = std::move(builder).Finalize(shared->frame_dim);
+  render_pipeline->SetStageStats(stage_stats);
   return render_pipeline->IsInitialized();
 }
 
@@ -25,6 +25,7 @@
 #include "lib/jxl/render_pipeline/render_pipeline.h"
 #include "lib/jxl/render_pipeline/stage_upsampling.h"
 #include "lib/jxl/sanitizers.h"
+#include "lib/jxl/stage_stats.h"
 
 namespace jxl {
 
@@ -135,6 +136,13 @@ struct PassesDecoderState {
   // Information for colour conversions.
   OutputEncodingInfo output_encoding_info;
 
+  // Per-stage timing and counters, or nullptr if not collected.
+  StageStats* stage_stats = nullptr;
+
+  // Dequantization tables shared with the other decoders of a
+  // JxlDecoderContext, or nullptr to use the process-wide cache.
+  DequantTableCache* dequant_table_cache = nullptr;
+
   // Initializes decoder-specific structures using information from *shared.
   Status Init() {
     x_dm_multiplier =
@@ -223,6 +231,15 @@ struct GroupDecCache {
     scratch_space = dec_group_block + max_block_area_ * 3;
     dec_group_qblock = int32_memory_.get();
     dec_group_qblock16 = int16_memory_.get();
+
+    if ((used_acs & (1 << AcStrategy::Type::DCT)) != 0 && !batch_memory_) {
+      // 3x float blocks for each of the batched blocks, and 2x that for
+      // scratch space.
+      constexpr size_t kBatchArea = AcStrategy::kDCT8BatchSize * kDCTBlockSize;
+      batch_memory_ = hwy::AllocateAligned<float>(kBatchArea * 5);
+      dec_group_batch = batch_memory_.get();
+      batch_scratch_space = dec_group_batch + kBatchArea * 3;
+    }
   }
 
   void InitDCBufferOnce() {
@@ -239,6 +256,12 @@ struct GroupDecCache {
 
   // For TransformToPixels.
   float* scratch_space;
+
+  // Dequantized coefficients of DCT8 blocks waiting for a batched
+  // TransformToPixelsDCT8Batch, 3 * kDCTBlockSize floats per block, and its
+  // scratch space. Only allocated if DCT8 is used.
+  float* dec_group_batch = nullptr;
+  float* batch_scratch_space = nullptr;
   // Note that scratch_space is never used at the same time as dec_group_qblock.
   // Moreover, only one of dec_group_qblock16 is ever used.
   // TODO(veluca): figure out if we can save allocations.
@@ -253,6 +276,7 @@ struct GroupDecCache {
   hwy::AlignedFreeUniquePtr<float[]> float_memory_;
   hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
   hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
+  hwy::AlignedFreeUniquePtr<float[]> batch_memory_;
   size_t max_block_area_ = 0;
 };
 
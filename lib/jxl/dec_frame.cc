@@ -48,6 +48,7 @@
 #include "lib/jxl/loop_filter.h"
 #include "lib/jxl/luminance.h"
 #include "lib/jxl/passes_state.h"
+#include "lib/jxl/stage_stats.h"
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer.h"
 #include "lib/jxl/sanitizers.h"
@@ -133,6 +134,10 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
 
   // Reset the dequantization matrices to their default values.
   dec_state_->shared_storage.matrices = DequantMatrices();
+  if (dec_state_->dequant_table_cache != nullptr) {
+    dec_state_->shared_storage.matrices.SetCache(
+        dec_state_->dequant_table_cache);
+  }
 
   frame_header_.nonserialized_is_preview = is_preview;
   JXL_ASSERT(frame_header_.nonserialized_metadata != nullptr);
@@ -251,6 +256,7 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
 
 Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
   PROFILER_FUNC;
+  StageScope stage(dec_state_->stage_stats, "DC global");
   PassesSharedState& shared = dec_state_->shared_storage;
   if (shared.frame_header.flags & FrameHeader::kPatches) {
     bool uses_extra_channels = false;
@@ -295,11 +301,13 @@ Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
   if (dec_status) {
     decoded_dc_global_ = true;
   }
+  stage.SetBytes(br->TotalBitsConsumed() / kBitsPerByte);
   return dec_status;
 }
 
 Status FrameDecoder::ProcessDCGroup(size_t dc_group_id, BitReader* br) {
   PROFILER_FUNC;
+  StageScope stage(dec_state_->stage_stats, "DC group");
   const size_t gx = dc_group_id % frame_dim_.xsize_dc_groups;
   const size_t gy = dc_group_id / frame_dim_.xsize_dc_groups;
   const LoopFilter& lf = dec_state_->shared->frame_header.loop_filter;
@@ -321,6 +329,7 @@ Status FrameDecoder::ProcessDCGroup(size_t dc_group_id, BitReader* br) {
     FillImage(kInvSigmaNum / lf.epf_sigma_for_modular, &dec_state_->sigma);
   }
   decoded_dc_groups_[dc_group_id] = uint8_t{true};
+  stage.SetBytes(br->TotalBitsConsumed() / kBitsPerByte);
   return true;
 }
 
@@ -330,6 +339,7 @@ void FrameDecoder::FinalizeDC() {
   if (frame_header_.encoding == FrameEncoding::kVarDCT &&
       !(frame_header_.flags & FrameHeader::kSkipAdaptiveDCSmoothing) &&
       !(frame_header_.flags & FrameHeader::kUseDcFrame)) {
+    StageScope stage(dec_state_->stage_stats, "DC smoothing");
     AdaptiveDCSmoothing(dec_state_->shared->quantizer.MulDC(),
                         &dec_state_->shared_storage.dc_storage, pool_);
   }
@@ -348,6 +358,7 @@ Status FrameDecoder::AllocateOutput() {
 
 Status FrameDecoder::ProcessACGlobal(BitReader* br) {
   JXL_CHECK(finalized_dc_);
+  StageScope stage(dec_state_->stage_stats, "AC global");
 
   // Decode AC group.
   if (frame_header_.encoding == FrameEncoding::kVarDCT) {
@@ -442,6 +453,7 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
     }
   }
   decoded_ac_global_ = true;
+  stage.SetBytes(br->TotalBitsConsumed() / kBitsPerByte);
   return true;
 }
 
@@ -461,6 +473,10 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
               ac_group_id, gx, gy, group_dim,
               decoded_passes_per_ac_group_[ac_group_id], num_passes);
 
+  // Covers decoding of the group up to (excluding) the render pipeline, whose
+  // stages are timed separately.
+  StageScope stage(dec_state_->stage_stats, "AC group");
+
   RenderPipelineInput render_pipeline_input =
       dec_state_->render_pipeline->GetInputBuffers(ac_group_id, thread);
 
@@ -530,6 +546,18 @@ Status FrameDecoder::ProcessACGroup(size_t ac_group_id,
     }
   }
 
+  if (dec_state_->stage_stats) {
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < num_passes; i++) {
+      bytes += br[i]->TotalBitsConsumed() / kBitsPerByte;
+    }
+    const Rect group_rect(x, y, group_dim, group_dim, frame_dim_.xsize,
+                          frame_dim_.ysize);
+    stage.SetBytes(bytes);
+    stage.SetPixels(group_rect.xsize() * group_rect.ysize());
+  }
+  stage.Finish();
+
   if (!modular_frame_decoder_.UsesFullImage() && !decoded_->IsJPEG()) {
     if (should_run_pipeline && modular_ready) {
       render_pipeline_input.Done();
@@ -248,6 +248,13 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
     }
   }
 
+  // When all channels have the same block positions, runs of DCT8 blocks are
+  // inverse transformed kBatch at a time.
+  constexpr size_t kBatch = AcStrategy::kDCT8BatchSize;
+  const bool batch_idct = cs.Is444() && !decoded->IsJPEG() && draw == kDraw &&
+                          group_dec_cache->dec_group_batch != nullptr;
+  float* JXL_RESTRICT batch_block = group_dec_cache->dec_group_batch;
+
   for (size_t by = 0; by < ysize_blocks; ++by) {
     get_block->StartRow(by);
     size_t sby[3] = {by >> vshift[0], by >> vshift[1], by >> vshift[2]};
@@ -284,6 +291,30 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
       }
     }
 
+    // Blocks [batch_bx, batch_bx + batch_size) of this row are waiting in
+    // batch_block.
+    size_t batch_bx = 0;
+    size_t batch_size = 0;
+    const auto flush_batch = [&]() {
+      for (size_t c = 0; c < 3; c++) {
+        float* JXL_RESTRICT idct_pos = idct_row[c] + batch_bx * kBlockDim;
+        if (batch_size == kBatch) {
+          TransformToPixelsDCT8Batch(batch_block + c * kDCTBlockSize,
+                                     3 * kDCTBlockSize, idct_pos,
+                                     idct_stride[c],
+                                     group_dec_cache->batch_scratch_space);
+          continue;
+        }
+        for (size_t i = 0; i < batch_size; i++) {
+          TransformToPixels(AcStrategy::Type::DCT,
+                            batch_block + (3 * i + c) * kDCTBlockSize,
+                            idct_pos + i * kBlockDim, idct_stride[c],
+                            group_dec_cache->scratch_space);
+        }
+      }
+      batch_size = 0;
+    };
+
     size_t bx = 0;
     for (size_t tx = 0; tx < DivCeil(xsize_blocks, kColorTileDimInBlocks);
          tx++) {
@@ -397,7 +428,17 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
                 Clamp1<float>(dc_rows[c][sbx[c]] - dcoff[c], -2047, 2047);
           }
         } else {
-          HWY_ALIGN float* const block = group_dec_cache->dec_group_block;
+          const bool batched =
+              batch_idct && acs.Strategy() == AcStrategy::Type::DCT;
+          if (batched) {
+            if (batch_size != 0 && bx != batch_bx + batch_size) {
+              flush_batch();
+            }
+            if (batch_size == 0) batch_bx = bx;
+          }
+          HWY_ALIGN float* const block =
+              batched ? batch_block + batch_size * 3 * kDCTBlockSize
+                      : group_dec_cache->dec_group_block;
           // Dequantize and add predictions.
           dequant_block(
               acs, inv_global_scale, row_quant[bx], dec_state->x_dm_multiplier,
@@ -408,6 +449,12 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
               dec_state->output_encoding_info.opsin_params.quant_biases, qblock,
               block);
 
+          if (batched) {
+            if (++batch_size == kBatch) flush_batch();
+            bx += llf_x;
+            continue;
+          }
+
           for (size_t c : {1, 0, 2}) {
             if ((sbx[c] << hshift[c] != bx) || (sby[c] << vshift[c] != by)) {
               continue;
@@ -421,6 +468,7 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
         bx += llf_x;
       }
     }
+    if (batch_size != 0) flush_batch();
   }
   if (draw == kDontDraw) {
     return true;
@@ -233,7 +233,28 @@ bool HuffmanDecodingData::ReadFromBitStream(size_t alphabet_size,
       BuildHuffmanTable(table_.data(), kHuffmanTableBits, &code_lengths[0],
                         alphabet_size, &counts[0]);
   table_.resize(table_size);
-  return (table_size > 0);
+  return table_size != 0;
+}
+
+void HuffmanDecodingData::BuildMultiSymbolTable() {
+  multi_table_.resize(1u << kHuffmanTableBits);
+  for (size_t i = 0; i < multi_table_.size(); i++) {
+    HuffmanMultiCode& entry = multi_table_[i];
+    entry.num_symbols = 0;
+    size_t used_bits = 0;
+    while (entry.num_symbols < kHuffmanMaxMultiSymbols) {
+      // Bits beyond the index are unknown (zero here), so a code only counts
+      // if it fits in the remaining known bits.
+      const HuffmanCode& code = table_[(i >> used_bits)];
+      if (code.bits > kHuffmanTableBits - used_bits || code.value >= 256) {
+        break;
+      }
+      used_bits += code.bits;
+      entry.bits[entry.num_symbols] = used_bits;
+      entry.symbols[entry.num_symbols] = code.value;
+      entry.num_symbols++;
+    }
+  }
 }
 
 // Decodes the next Huffman coded symbol from the bit-stream.
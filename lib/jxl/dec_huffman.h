@@ -16,6 +16,19 @@ namespace jxl {
 
 static constexpr size_t kHuffmanTableBits = 8u;
 
+// Maximum number of symbols decoded by a single multi-symbol table lookup.
+static constexpr size_t kHuffmanMaxMultiSymbols = 3u;
+
+// Entry of the multi-symbol decoding table: the symbols whose codes are fully
+// contained in the kHuffmanTableBits bits used as the index, and the total
+// number of bits consumed after each of them. Only symbols below 256 are
+// stored; num_symbols is 0 if the first code is longer than the index.
+struct HuffmanMultiCode {
+  uint8_t num_symbols;
+  uint8_t bits[kHuffmanMaxMultiSymbols];
+  uint8_t symbols[kHuffmanMaxMultiSymbols];
+};
+
 struct HuffmanDecodingData {
   // Decodes the Huffman code lengths from the bit-stream and fills in the
   // pre-allocated table with the corresponding 2-level Huffman decoding table.
@@ -24,7 +37,18 @@ struct HuffmanDecodingData {
 
   uint16_t ReadSymbol(BitReader* br) const;
 
+  // Fills multi_table_ from the first level of table_, which PeekMultiSymbol
+  // requires.
+  void BuildMultiSymbolTable();
+
+  // Returns the multi-symbol table entry for the next kHuffmanTableBits bits;
+  // does not consume any bits.
+  JXL_INLINE const HuffmanMultiCode& PeekMultiSymbol(BitReader* br) const {
+    return multi_table_[br->PeekFixedBits<kHuffmanTableBits>()];
+  }
+
   std::vector<HuffmanCode> table_;
+  std::vector<HuffmanMultiCode> multi_table_;
 };
 
 }  // namespace jxl
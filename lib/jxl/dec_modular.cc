@@ -198,6 +198,7 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
       JXL_RETURN_IF_ERROR(DecodeTree(reader, &tree, tree_size_limit));
       JXL_RETURN_IF_ERROR(
           DecodeHistograms(reader, (tree.size() + 1) / 2, &code, &context_map));
+      if (UsesBatchDecoding(tree)) code.BuildMultiSymbolTables();
     }
   }
   if (!do_color) nb_chans = 0;
@@ -716,6 +716,21 @@ HWY_MAYBE_UNUSED void TransformToPixels(const AcStrategy::Type strategy,
   }
 }
 
+// Equivalent to TransformToPixels(AcStrategy::Type::DCT, ...) for the
+// AcStrategy::kDCT8BatchSize horizontally adjacent blocks starting at
+// `pixels`; the coefficients of block i are at
+// coefficients + i * coefficients_block_stride. scratch_space should have space
+// for 2 * AcStrategy::kDCT8BatchSize * kDCTBlockSize floats.
+HWY_MAYBE_UNUSED void TransformToPixelsDCT8Batch(
+    const float* JXL_RESTRICT coefficients, size_t coefficients_block_stride,
+    float* JXL_RESTRICT pixels, size_t pixels_stride,
+    float* JXL_RESTRICT scratch_space) {
+  PROFILER_ZONE("IDCT 8 batch");
+  ComputeScaledIDCTBatch<8, AcStrategy::kDCT8BatchSize>()(
+      coefficients, coefficients_block_stride, DCTTo(pixels, pixels_stride),
+      scratch_space);
+}
+
 HWY_MAYBE_UNUSED void LowestFrequenciesFromDC(const AcStrategy::Type strategy,
                                               const float* dc, size_t dc_stride,
                                               float* llf) {
@@ -5,6 +5,8 @@
 
 #include "jxl/decode.h"
 
+#include <atomic>
+
 #include "jxl/types.h"
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/span.h"
@@ -25,7 +27,9 @@
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/loop_filter.h"
 #include "lib/jxl/memory_manager_internal.h"
+#include "lib/jxl/quant_weights.h"
 #include "lib/jxl/sanitizers.h"
+#include "lib/jxl/stage_stats.h"
 #include "lib/jxl/toc.h"
 
 namespace {
@@ -327,6 +331,26 @@ typedef struct JxlDecoderFrameIndexBoxStruct {
 
 }  // namespace jxl
 
+struct JxlDecoderContextStruct {
+  JxlMemoryManager memory_manager;
+  // One for the caller until JxlDecoderContextDestroy, plus one per decoder
+  // the context is attached to.
+  std::atomic<size_t> references{1};
+  jxl::DequantTableCache dequant_table_cache;
+};
+
+namespace {
+
+void ReleaseDecoderContext(JxlDecoderContext* context) {
+  if (!context) return;
+  if (context->references.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+  JxlMemoryManager local_memory_manager = context->memory_manager;
+  context->~JxlDecoderContext();
+  jxl::MemoryManagerFree(&local_memory_manager, context);
+}
+
+}  // namespace
+
 // NOLINTNEXTLINE(clang-analyzer-optin.performance.Padding)
 struct JxlDecoderStruct {
   JxlDecoderStruct() = default;
@@ -395,6 +419,16 @@ struct JxlDecoderStruct {
   bool render_spotcolors;
   bool coalescing;
   float desired_intensity_target;
+  bool collect_stage_stats;
+
+  // Per-stage timing and counters, see JxlDecoderGetStageStats.
+  jxl::StageStats stage_stats;
+  jxl::StageStats* GetStageStats() {
+    return collect_stage_stats ? &stage_stats : nullptr;
+  }
+
+  // Holds a reference, see JxlDecoderSetContext.
+  JxlDecoderContext* context = nullptr;
 
   // Bitfield, for which informative events (JXL_DEC_BASIC_INFO, etc...) the
   // decoder returns a status. By default, do not return for any of the events,
@@ -528,6 +562,9 @@ struct JxlDecoderStruct {
   size_t recon_exif_size;  // Expected exif size as read from the jbrd box
   size_t recon_xmp_size;   // Expected exif size as read from the jbrd box
   JpegReconStage recon_output_jpeg;
+  // Decoded JPEG data holding the quantized DCT coefficients, if those were
+  // requested with JxlDecoderSetJPEGCoefficientsOutput.
+  std::unique_ptr<jxl::jpeg::JPEGData> jpeg_coefficients;
 
   bool JbrdNeedMoreBoxes() const {
     // jbrd box wants exif but exif box not yet seen
@@ -713,6 +750,8 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->recon_exif_size = 0;
   dec->recon_xmp_size = 0;
   dec->recon_output_jpeg = JpegReconStage::kNone;
+  dec->jpeg_coefficients.reset();
+  dec->jpeg_decoder.SetCoefficientsOutput(false);
 #endif
 
   dec->events_wanted = 0;
@@ -757,17 +796,22 @@ void JxlDecoderRewindDecodingState(JxlDecoder* dec) {
   dec->skipping_frame = false;
   dec->internal_frames = 0;
   dec->external_frames = 0;
+
+  dec->stage_stats.Clear();
 }
 
 void JxlDecoderReset(JxlDecoder* dec) {
   JxlDecoderRewindDecodingState(dec);
 
   dec->thread_pool.reset();
+  ReleaseDecoderContext(dec->context);
+  dec->context = nullptr;
   dec->keep_orientation = false;
   dec->unpremul_alpha = false;
   dec->render_spotcolors = true;
   dec->coalescing = true;
   dec->desired_intensity_target = 0;
+  dec->collect_stage_stats = false;
   dec->orig_events_wanted = 0;
   dec->frame_references.clear();
   dec->frame_saved_as.clear();
@@ -806,12 +850,43 @@ JxlDecoder* JxlDecoderCreate(const JxlMemoryManager* memory_manager) {
 void JxlDecoderDestroy(JxlDecoder* dec) {
   if (dec) {
     JxlMemoryManager local_memory_manager = dec->memory_manager;
+    ReleaseDecoderContext(dec->context);
     // Call destructor directly since custom free function is used.
     dec->~JxlDecoder();
     jxl::MemoryManagerFree(&local_memory_manager, dec);
   }
 }
 
+JxlDecoderContext* JxlDecoderContextCreate(
+    const JxlMemoryManager* memory_manager) {
+  JxlMemoryManager local_memory_manager;
+  if (!jxl::MemoryManagerInit(&local_memory_manager, memory_manager))
+    return nullptr;
+
+  void* alloc = jxl::MemoryManagerAlloc(&local_memory_manager,
+                                        sizeof(JxlDecoderContext));
+  if (!alloc) return nullptr;
+  // Placement new constructor on allocated memory
+  JxlDecoderContext* context = new (alloc) JxlDecoderContext();
+  context->memory_manager = local_memory_manager;
+  return context;
+}
+
+void JxlDecoderContextDestroy(JxlDecoderContext* context) {
+  ReleaseDecoderContext(context);
+}
+
+JxlDecoderStatus JxlDecoderSetContext(JxlDecoder* dec,
+                                      JxlDecoderContext* context) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("context must be set before starting");
+  }
+  if (context) context->references.fetch_add(1, std::memory_order_relaxed);
+  ReleaseDecoderContext(dec->context);
+  dec->context = context;
+  return JXL_DEC_SUCCESS;
+}
+
 void JxlDecoderRewind(JxlDecoder* dec) { JxlDecoderRewindDecodingState(dec); }
 
 void JxlDecoderSkipFrames(JxlDecoder* dec, size_t amount) {
@@ -919,6 +994,28 @@ JxlDecoderStatus JxlDecoderSetCoalescing(JxlDecoder* dec, JXL_BOOL coalescing) {
   return JXL_DEC_SUCCESS;
 }
 
+JxlDecoderStatus JxlDecoderSetCollectStageStats(JxlDecoder* dec,
+                                                JXL_BOOL collect) {
+  if (dec->stage != DecoderStage::kInited) {
+    return JXL_API_ERROR("Must set stage stats option before starting");
+  }
+  dec->collect_stage_stats = !!collect;
+  dec->stage_stats.Clear();
+  return JXL_DEC_SUCCESS;
+}
+
+size_t JxlDecoderGetNumStageStats(const JxlDecoder* dec) {
+  return dec->stage_stats.NumStages();
+}
+
+JxlDecoderStatus JxlDecoderGetStageStats(const JxlDecoder* dec, size_t index,
+                                         JxlStageStats* stats) {
+  if (!dec->stage_stats.Get(index, stats)) {
+    return JXL_API_ERROR("Stage index out of range");
+  }
+  return JXL_DEC_SUCCESS;
+}
+
 namespace {
 // helper function to get the dimensions of the current image buffer
 void GetCurrentDimensions(const JxlDecoder* dec, size_t& xsize, size_t& ysize) {
@@ -1087,6 +1184,9 @@ JxlDecoderStatus JxlDecoderReadAllHeaders(JxlDecoder* dec) {
   if (!dec->passes_state) {
     dec->passes_state.reset(new jxl::PassesDecoderState());
   }
+  dec->passes_state->stage_stats = dec->GetStageStats();
+  dec->passes_state->dequant_table_cache =
+      dec->context ? &dec->context->dequant_table_cache : nullptr;
 
   JXL_API_RETURN_IF_ERROR(
       dec->passes_state->output_encoding_info.SetFromMetadata(dec->metadata));
@@ -1174,8 +1274,12 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
 
   // No matter what events are wanted, the basic info is always required.
   if (!dec->got_basic_info) {
+    jxl::StageScope stage(dec->GetStageStats(), "Basic info");
     JxlDecoderStatus status = JxlDecoderReadBasicInfo(dec);
-    if (status != JXL_DEC_SUCCESS) return status;
+    if (status != JXL_DEC_SUCCESS) {
+      stage.Discard();
+      return status;
+    }
   }
 
   if (dec->events_wanted & JXL_DEC_BASIC_INFO) {
@@ -1189,8 +1293,12 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
   }
 
   if (!dec->got_all_headers) {
+    jxl::StageScope stage(dec->GetStageStats(), "Headers");
     JxlDecoderStatus status = JxlDecoderReadAllHeaders(dec);
-    if (status != JXL_DEC_SUCCESS) return status;
+    if (status != JXL_DEC_SUCCESS) {
+      stage.Discard();
+      return status;
+    }
   }
 
   if (dec->events_wanted & JXL_DEC_COLOR_ENCODING) {
@@ -1247,6 +1355,7 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
       dec->frame_header.reset(new FrameHeader(&dec->metadata));
       Span<const uint8_t> span;
       JXL_API_RETURN_IF_ERROR(dec->GetCodestreamInput(&span));
+      StageScope stage(dec->GetStageStats(), "Frame header");
       auto reader = GetBitReader(span);
       bool output_needed =
           (dec->preview_frame ? (dec->events_wanted & JXL_DEC_PREVIEW_IMAGE)
@@ -1255,10 +1364,14 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
           reader.get(), dec->ib.get(), dec->preview_frame, output_needed);
       if (!reader->AllReadsWithinBounds() ||
           status.code() == StatusCode::kNotEnoughBytes) {
+        stage.Discard();
         return dec->RequestMoreInput();
       } else if (!status) {
+        stage.Discard();
         return JXL_API_ERROR("invalid frame header");
       }
+      stage.SetBytes(reader->TotalBitsConsumed() / kBitsPerByte);
+      stage.Finish();
       dec->AdvanceCodestream(reader->TotalBitsConsumed() / kBitsPerByte);
       *dec->frame_header = dec->frame_dec->GetFrameHeader();
       jxl::FrameDimensions frame_dim = dec->frame_header->ToFrameDimensions();
@@ -1398,7 +1511,7 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         }
         if (
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
-            (!dec->jpeg_decoder.IsOutputSet() ||
+            (!dec->jpeg_decoder.WantsJpegData() ||
              dec->ib->jpeg_data == nullptr) &&
 #endif
             dec->is_last_of_still && !dec->skipping_frame) {
@@ -1472,13 +1585,17 @@ JxlDecoderStatus JxlDecoderProcessCodestream(JxlDecoder* dec) {
         dec->frame_references[internal_index] = dec->frame_dec->References();
       }
 
-      if (!dec->frame_dec->FinalizeFrame()) {
-        return JXL_API_ERROR("decoding frame failed");
+      {
+        StageScope stage(dec->GetStageStats(), "Finalize frame");
+        if (!dec->frame_dec->FinalizeFrame()) {
+          stage.Discard();
+          return JXL_API_ERROR("decoding frame failed");
+        }
       }
 #if JPEGXL_ENABLE_TRANSCODE_JPEG
       // If jpeg output was requested, we merely return the JXL_DEC_FULL_IMAGE
       // status without outputting pixels.
-      if (dec->jpeg_decoder.IsOutputSet() && dec->ib->jpeg_data != nullptr) {
+      if (dec->jpeg_decoder.WantsJpegData() && dec->ib->jpeg_data != nullptr) {
         dec->frame_stage = FrameStage::kHeader;
         dec->recon_output_jpeg = JpegReconStage::kSettingMetadata;
         return JXL_DEC_FULL_IMAGE;
@@ -1550,6 +1667,9 @@ JxlDecoderStatus JxlDecoderSetJPEGBuffer(JxlDecoder* dec, uint8_t* data,
   if (dec->jpeg_decoder.IsOutputSet()) {
     return JXL_API_ERROR("Already set JPEG buffer");
   }
+  if (dec->jpeg_decoder.IsCoefficientsOutputSet()) {
+    return JXL_API_ERROR("Already requested JPEG coefficients output");
+  }
   return dec->jpeg_decoder.SetOutputBuffer(data, size);
 #else
   return JXL_API_ERROR("JPEG reconstruction is not supported.");
@@ -1564,6 +1684,87 @@ size_t JxlDecoderReleaseJPEGBuffer(JxlDecoder* dec) {
 #endif
 }
 
+JxlDecoderStatus JxlDecoderSetJPEGCoefficientsOutput(JxlDecoder* dec) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (dec->internal_frames > 1) {
+    return JXL_API_ERROR("JPEG reconstruction only works for the first frame");
+  }
+  if (dec->jpeg_decoder.IsOutputSet()) {
+    return JXL_API_ERROR("Already set JPEG buffer");
+  }
+  return dec->jpeg_decoder.SetCoefficientsOutput(true);
+#else
+  return JXL_API_ERROR("JPEG reconstruction is not supported.");
+#endif
+}
+
+JxlDecoderStatus JxlDecoderGetJPEGNumComponents(const JxlDecoder* dec,
+                                                size_t* num_components) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (!dec->jpeg_coefficients) {
+    return JXL_API_ERROR("JPEG coefficients not available");
+  }
+  *num_components = dec->jpeg_coefficients->components.size();
+  return JXL_DEC_SUCCESS;
+#else
+  return JXL_API_ERROR("JPEG reconstruction is not supported.");
+#endif
+}
+
+JxlDecoderStatus JxlDecoderGetJPEGComponentInfo(const JxlDecoder* dec,
+                                                size_t index,
+                                                JxlJPEGComponentInfo* info) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (!dec->jpeg_coefficients) {
+    return JXL_API_ERROR("JPEG coefficients not available");
+  }
+  const jxl::jpeg::JPEGData& jpeg_data = *dec->jpeg_coefficients;
+  if (index >= jpeg_data.components.size()) {
+    return JXL_API_ERROR("Invalid JPEG component index");
+  }
+  const jxl::jpeg::JPEGComponent& component = jpeg_data.components[index];
+  if (component.quant_idx >= jpeg_data.quant.size()) {
+    return JXL_API_ERROR("Invalid JPEG quantization table index");
+  }
+  info->width_in_blocks = component.width_in_blocks;
+  info->height_in_blocks = component.height_in_blocks;
+  info->h_samp_factor = component.h_samp_factor;
+  info->v_samp_factor = component.v_samp_factor;
+  const jxl::jpeg::JPEGQuantTable& quant = jpeg_data.quant[component.quant_idx];
+  for (size_t i = 0; i < jxl::kDCTBlockSize; i++) {
+    info->quant_table[i] = static_cast<uint16_t>(quant.values[i]);
+  }
+  return JXL_DEC_SUCCESS;
+#else
+  return JXL_API_ERROR("JPEG reconstruction is not supported.");
+#endif
+}
+
+JxlDecoderStatus JxlDecoderGetJPEGCoefficients(const JxlDecoder* dec,
+                                               size_t index,
+                                               int16_t* coefficients,
+                                               size_t size) {
+#if JPEGXL_ENABLE_TRANSCODE_JPEG
+  if (!dec->jpeg_coefficients) {
+    return JXL_API_ERROR("JPEG coefficients not available");
+  }
+  if (index >= dec->jpeg_coefficients->components.size()) {
+    return JXL_API_ERROR("Invalid JPEG component index");
+  }
+  const std::vector<jxl::jpeg::coeff_t>& coeffs =
+      dec->jpeg_coefficients->components[index].coeffs;
+  if (size < coeffs.size() * sizeof(int16_t)) {
+    return JXL_API_ERROR("Buffer too small for JPEG coefficients");
+  }
+  static_assert(sizeof(jxl::jpeg::coeff_t) == sizeof(int16_t),
+                "JPEG coefficients must be 16-bit");
+  memcpy(coefficients, coeffs.data(), coeffs.size() * sizeof(int16_t));
+  return JXL_DEC_SUCCESS;
+#else
+  return JXL_API_ERROR("JPEG reconstruction is not supported.");
+#endif
+}
+
 // Parses the header of the box, outputting the 4-character type and the box
 // size, including header size, as stored in the box header.
 // @param in current input bytes.
@@ -1698,9 +1899,15 @@ static JxlDecoderStatus HandleBoxes(JxlDecoder* dec) {
 
     if (dec->recon_output_jpeg == JpegReconStage::kOutputting &&
         !dec->JbrdNeedMoreBoxes()) {
-      JxlDecoderStatus status =
-          dec->jpeg_decoder.WriteOutput(*dec->ib->jpeg_data);
-      if (status != JXL_DEC_SUCCESS) return status;
+      if (dec->jpeg_decoder.IsCoefficientsOutputSet()) {
+        // The coefficients are already in place, keep them for the getters.
+        dec->jpeg_coefficients = std::move(dec->ib->jpeg_data);
+      } else {
+        JxlDecoderStatus status =
+            dec->jpeg_decoder.WriteOutput(*dec->ib->jpeg_data,
+                                          dec->thread_pool.get());
+        if (status != JXL_DEC_SUCCESS) return status;
+      }
       dec->recon_output_jpeg = JpegReconStage::kFinished;
       dec->ib.reset();
       if (dec->events_wanted & JXL_DEC_FULL_IMAGE) {
@@ -0,0 +1,106 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "jxl/decode.h"
+#include "jxl/encode.h"
+#include "lib/jxl/base/status.h"
+
+namespace jxl {
+namespace {
+
+std::vector<uint8_t> EncodeTestImage(size_t xsize, size_t ysize) {
+  std::vector<uint8_t> pixels(xsize * ysize * 3);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = static_cast<uint8_t>((i * 7 + (i / (xsize * 3)) * 13) & 0xFF);
+  }
+  JxlEncoder* enc = JxlEncoderCreate(nullptr);
+  JxlBasicInfo info;
+  JxlEncoderInitBasicInfo(&info);
+  info.xsize = xsize;
+  info.ysize = ysize;
+  JXL_CHECK(JxlEncoderSetBasicInfo(enc, &info) == JXL_ENC_SUCCESS);
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, /*is_gray=*/JXL_FALSE);
+  JXL_CHECK(JxlEncoderSetColorEncoding(enc, &color_encoding) ==
+            JXL_ENC_SUCCESS);
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  JXL_CHECK(JxlEncoderAddImageFrame(JxlEncoderFrameSettingsCreate(enc, nullptr),
+                                    &format, pixels.data(),
+                                    pixels.size()) == JXL_ENC_SUCCESS);
+  JxlEncoderCloseInput(enc);
+
+  std::vector<uint8_t> compressed(4096);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size();
+  JxlEncoderStatus status;
+  while ((status = JxlEncoderProcessOutput(enc, &next_out, &avail_out)) ==
+         JXL_ENC_NEED_MORE_OUTPUT) {
+    size_t offset = next_out - compressed.data();
+    compressed.resize(compressed.size() * 2);
+    next_out = compressed.data() + offset;
+    avail_out = compressed.size() - offset;
+  }
+  JXL_CHECK(status == JXL_ENC_SUCCESS);
+  compressed.resize(next_out - compressed.data());
+  JxlEncoderDestroy(enc);
+  return compressed;
+}
+
+// Time to first pixel of a small image with a fresh decoder, as in a service
+// that decodes many thumbnails. Such images are a single group, so the first
+// pixels are only available with the full image.
+// With `warm_tables`, all decoders share one context, so the dequantization
+// tables are only computed for the first image. Otherwise each decoder gets a
+// new context and computes them again, as without any table cache.
+void DecodeSmallImage(benchmark::State& state, bool warm_tables) {
+  const size_t size = state.range();
+  const std::vector<uint8_t> compressed = EncodeTestImage(size, size);
+  JxlDecoderContext* shared_context =
+      warm_tables ? JxlDecoderContextCreate(nullptr) : nullptr;
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+  std::vector<uint8_t> pixels(size * size * 3);
+
+  for (auto _ : state) {
+    JxlDecoder* dec = JxlDecoderCreate(nullptr);
+    JxlDecoderContext* context =
+        warm_tables ? shared_context : JxlDecoderContextCreate(nullptr);
+    JXL_CHECK(JxlDecoderSetContext(dec, context) == JXL_DEC_SUCCESS);
+    if (!warm_tables) JxlDecoderContextDestroy(context);
+    JXL_CHECK(JxlDecoderSubscribeEvents(dec, JXL_DEC_FULL_IMAGE) ==
+              JXL_DEC_SUCCESS);
+    JXL_CHECK(JxlDecoderSetInput(dec, compressed.data(), compressed.size()) ==
+              JXL_DEC_SUCCESS);
+    JxlDecoderCloseInput(dec);
+    JXL_CHECK(JxlDecoderProcessInput(dec) == JXL_DEC_NEED_IMAGE_OUT_BUFFER);
+    JXL_CHECK(JxlDecoderSetImageOutBuffer(dec, &format, pixels.data(),
+                                          pixels.size()) == JXL_DEC_SUCCESS);
+    JXL_CHECK(JxlDecoderProcessInput(dec) == JXL_DEC_FULL_IMAGE);
+    benchmark::DoNotOptimize(pixels.data());
+    JxlDecoderDestroy(dec);
+  }
+  JxlDecoderContextDestroy(shared_context);
+
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * compressed.size());
+}
+
+void BM_DecodeSmallImage(benchmark::State& state) {
+  DecodeSmallImage(state, /*warm_tables=*/true);
+}
+
+void BM_DecodeSmallImageColdTables(benchmark::State& state) {
+  DecodeSmallImage(state, /*warm_tables=*/false);
+}
+
+BENCHMARK(BM_DecodeSmallImage)->RangeMultiplier(2)->Range(8, 256);
+BENCHMARK(BM_DecodeSmallImageColdTables)->RangeMultiplier(2)->Range(8, 256);
+
+}  // namespace
+}  // namespace jxl
@@ -8,8 +8,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <algorithm>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -39,6 +41,7 @@
 #include "lib/jxl/icc_codec.h"
 #include "lib/jxl/image_metadata.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/jpeg/enc_jpeg_data_reader.h"
 #include "lib/jxl/progressive_split.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testdata.h"
@@ -1989,6 +1992,126 @@ TEST(DecodeTest, PixelTestOpaqueSrgbLossyNoise) {
   }
 }
 
+TEST(DecodeTest, StageStatsTest) {
+  JxlDecoder* dec = JxlDecoderCreate(NULL);
+
+  // Two AC groups side by side.
+  size_t xsize = 300, ysize = 200;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_LITTLE_ENDIAN, 0};
+
+  EXPECT_EQ(0u, JxlDecoderGetNumStageStats(dec));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetCollectStageStats(dec, JXL_TRUE));
+  jxl::DecodeWithAPI(
+      dec, jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+      format, /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+
+  size_t num_stages = JxlDecoderGetNumStageStats(dec);
+  EXPECT_GT(num_stages, 0u);
+  bool found_ac_group = false;
+  // Stages of the default render pipeline of a lossy frame.
+  bool found_gaborish = false;
+  bool found_xyb = false;
+  for (size_t i = 0; i < num_stages; i++) {
+    JxlStageStats stats;
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderGetStageStats(dec, i, &stats));
+    EXPECT_GT(stats.count, 0u);
+    EXPECT_GE(stats.wall_seconds, 0.0);
+    EXPECT_GE(stats.cpu_seconds, 0.0);
+    const std::string name = stats.name;
+    if (name == "AC group") {
+      found_ac_group = true;
+      EXPECT_EQ(2u, stats.count);
+      EXPECT_GT(stats.bytes, 0u);
+      EXPECT_EQ(xsize * ysize, stats.pixels);
+    } else if (name == "Gab") {
+      found_gaborish = true;
+      EXPECT_GE(stats.pixels, xsize * ysize);
+    } else if (name == "XYB" || name == "FastXYB") {
+      found_xyb = true;
+      EXPECT_GE(stats.pixels, xsize * ysize);
+    }
+  }
+  EXPECT_TRUE(found_ac_group);
+  EXPECT_TRUE(found_gaborish);
+  EXPECT_TRUE(found_xyb);
+  JxlStageStats stats;
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderGetStageStats(dec, num_stages, &stats));
+
+  // Rewinding starts over, resetting also disables collection.
+  JxlDecoderRewind(dec);
+  EXPECT_EQ(0u, JxlDecoderGetNumStageStats(dec));
+  JxlDecoderReset(dec);
+  jxl::DecodeWithAPI(
+      dec, jxl::Span<const uint8_t>(compressed.data(), compressed.size()),
+      format, /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  EXPECT_EQ(0u, JxlDecoderGetNumStageStats(dec));
+
+  JxlDecoderDestroy(dec);
+}
+
+TEST(DecodeTest, ContextTest) {
+  size_t xsize = 123, ysize = 77;
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  jxl::PaddedBytes compressed = jxl::CreateTestJXLCodestream(
+      jxl::Span<const uint8_t>(pixels.data(), pixels.size()), xsize, ysize, 3,
+      jxl::TestCodestreamParams());
+  jxl::Span<const uint8_t> span(compressed.data(), compressed.size());
+  JxlPixelFormat format = {3, JXL_TYPE_FLOAT, JXL_LITTLE_ENDIAN, 0};
+
+  JxlDecoder* dec = JxlDecoderCreate(NULL);
+  std::vector<uint8_t> expected = jxl::DecodeWithAPI(
+      dec, span, format, /*use_callback=*/false, /*set_buffer_early=*/false,
+      /*use_resizable_runner=*/false, /*require_boxes=*/false,
+      /*expect_success=*/true);
+  JxlDecoderDestroy(dec);
+
+  // The decoders keep the context alive after the caller released it, and
+  // share its tables also when running concurrently.
+  JxlDecoderContext* context = JxlDecoderContextCreate(NULL);
+  ASSERT_NE(nullptr, context);
+  JxlDecoder* decs[2];
+  for (JxlDecoder*& d : decs) {
+    d = JxlDecoderCreate(NULL);
+    EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetContext(d, context));
+  }
+  JxlDecoderContextDestroy(context);
+  std::vector<uint8_t> decoded[2];
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 2; i++) {
+    threads.emplace_back([&, i] {
+      decoded[i] = jxl::DecodeWithAPI(
+          decs[i], span, format, /*use_callback=*/false,
+          /*set_buffer_early=*/false, /*use_resizable_runner=*/false,
+          /*require_boxes=*/false, /*expect_success=*/true);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  EXPECT_EQ(expected, decoded[0]);
+  EXPECT_EQ(expected, decoded[1]);
+
+  // The context is kept on rewind, and can't be changed while decoding.
+  JxlDecoderRewind(decs[0]);
+  EXPECT_EQ(expected, jxl::DecodeWithAPI(decs[0], span, format,
+                                         /*use_callback=*/false,
+                                         /*set_buffer_early=*/false,
+                                         /*use_resizable_runner=*/false,
+                                         /*require_boxes=*/false,
+                                         /*expect_success=*/true));
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetContext(decs[0], nullptr));
+  JxlDecoderReset(decs[0]);
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetContext(decs[0], nullptr));
+
+  for (JxlDecoder* d : decs) JxlDecoderDestroy(d);
+}
+
 TEST(DecodeTest, ProcessEmptyInputWithBoxes) {
   size_t xsize = 123, ysize = 77;
   std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
@@ -4801,6 +4924,101 @@ void VerifyJPEGReconstruction(const jxl::PaddedBytes& container,
   EXPECT_EQ(0, memcmp(reconstructed_buffer.data(), jpeg_bytes.data(), used));
 }
 
+// Reconstructs the JPEG from `container` with a fresh decoder, optionally with
+// a thread pool, into output buffers of `chunk_size` bytes each. Small chunks
+// make the decoder stop with JXL_DEC_JPEG_NEED_MORE_OUTPUT in the middle of
+// the scans, and resume from there.
+void VerifyJPEGReconstructionInChunks(const jxl::PaddedBytes& container,
+                                      const jxl::PaddedBytes& jpeg_bytes,
+                                      bool use_pool, size_t chunk_size) {
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  JxlThreadParallelRunnerPtr runner;
+  if (use_pool) {
+    runner = JxlThreadParallelRunnerMake(nullptr, 4);
+    EXPECT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetParallelRunner(dec.get(), JxlThreadParallelRunner,
+                                          runner.get()));
+  }
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec.get(), JXL_DEC_JPEG_RECONSTRUCTION | JXL_DEC_FULL_IMAGE));
+  JxlDecoderSetInput(dec.get(), container.data(), container.size());
+  EXPECT_EQ(JXL_DEC_JPEG_RECONSTRUCTION, JxlDecoderProcessInput(dec.get()));
+  std::vector<uint8_t> reconstructed;
+  std::vector<uint8_t> chunk(chunk_size);
+  size_t num_chunks = 0;
+  JxlDecoderStatus process_result = JXL_DEC_JPEG_NEED_MORE_OUTPUT;
+  while (process_result == JXL_DEC_JPEG_NEED_MORE_OUTPUT) {
+    ASSERT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderSetJPEGBuffer(dec.get(), chunk.data(), chunk.size()));
+    process_result = JxlDecoderProcessInput(dec.get());
+    const size_t used = chunk.size() - JxlDecoderReleaseJPEGBuffer(dec.get());
+    reconstructed.insert(reconstructed.end(), chunk.data(),
+                         chunk.data() + used);
+    num_chunks++;
+  }
+  ASSERT_EQ(JXL_DEC_FULL_IMAGE, process_result);
+  if (chunk_size < jpeg_bytes.size()) EXPECT_GT(num_chunks, 1u);
+  ASSERT_EQ(jpeg_bytes.size(), reconstructed.size());
+  EXPECT_EQ(0, memcmp(reconstructed.data(), jpeg_bytes.data(),
+                      reconstructed.size()));
+}
+
+void VerifyJPEGCoefficients(const jxl::PaddedBytes& container,
+                            const jxl::PaddedBytes& jpeg_bytes) {
+  jxl::jpeg::JPEGData expected;
+  ASSERT_TRUE(jxl::jpeg::ReadJpeg(jpeg_bytes.data(), jpeg_bytes.size(),
+                                  jxl::jpeg::JpegReadMode::kReadAll,
+                                  &expected));
+  JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+  EXPECT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderSubscribeEvents(
+                dec.get(), JXL_DEC_JPEG_RECONSTRUCTION | JXL_DEC_FULL_IMAGE));
+  JxlDecoderSetInput(dec.get(), container.data(), container.size());
+  size_t num_components;
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderGetJPEGNumComponents(dec.get(), &num_components));
+  EXPECT_EQ(JXL_DEC_JPEG_RECONSTRUCTION, JxlDecoderProcessInput(dec.get()));
+  EXPECT_EQ(JXL_DEC_SUCCESS, JxlDecoderSetJPEGCoefficientsOutput(dec.get()));
+  uint8_t unused_buffer[16];
+  EXPECT_EQ(JXL_DEC_ERROR, JxlDecoderSetJPEGBuffer(dec.get(), unused_buffer,
+                                                   sizeof(unused_buffer)));
+  // No image out buffer is needed since no pixels are rendered.
+  ASSERT_EQ(JXL_DEC_FULL_IMAGE, JxlDecoderProcessInput(dec.get()));
+
+  ASSERT_EQ(JXL_DEC_SUCCESS,
+            JxlDecoderGetJPEGNumComponents(dec.get(), &num_components));
+  ASSERT_EQ(expected.components.size(), num_components);
+  for (size_t c = 0; c < num_components; c++) {
+    const jxl::jpeg::JPEGComponent& component = expected.components[c];
+    JxlJPEGComponentInfo info;
+    ASSERT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetJPEGComponentInfo(dec.get(), c, &info));
+    EXPECT_EQ(component.width_in_blocks, info.width_in_blocks);
+    EXPECT_EQ(component.height_in_blocks, info.height_in_blocks);
+    EXPECT_EQ(component.h_samp_factor, static_cast<int>(info.h_samp_factor));
+    EXPECT_EQ(component.v_samp_factor, static_cast<int>(info.v_samp_factor));
+    for (size_t i = 0; i < 64; i++) {
+      EXPECT_EQ(expected.quant[component.quant_idx].values[i],
+                info.quant_table[i]);
+    }
+    std::vector<int16_t> coefficients(component.coeffs.size());
+    EXPECT_EQ(JXL_DEC_ERROR,
+              JxlDecoderGetJPEGCoefficients(
+                  dec.get(), c, coefficients.data(),
+                  coefficients.size() * sizeof(int16_t) - 1));
+    ASSERT_EQ(JXL_DEC_SUCCESS,
+              JxlDecoderGetJPEGCoefficients(
+                  dec.get(), c, coefficients.data(),
+                  coefficients.size() * sizeof(int16_t)));
+    EXPECT_TRUE(std::equal(coefficients.begin(), coefficients.end(),
+                           component.coeffs.begin()));
+  }
+  JxlJPEGComponentInfo info;
+  EXPECT_EQ(JXL_DEC_ERROR,
+            JxlDecoderGetJPEGComponentInfo(dec.get(), num_components, &info));
+}
+
 #if JPEGXL_ENABLE_JPEG
 TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructTestCodestream)) {
   size_t xsize = 123;
@@ -4821,9 +5039,11 @@ TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructTestCodestream)) {
 }
 #endif  // JPEGXL_ENABLE_JPEG
 
-TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionTest)) {
-  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
-  const jxl::PaddedBytes orig = jxl::ReadTestData(jpeg_path);
+namespace {
+// Outputs a container with the JPEG recompressed as a codestream and its
+// reconstruction data.
+void RecompressJPEG(const jxl::PaddedBytes& orig,
+                    jxl::PaddedBytes* container) {
   jxl::CodecInOut orig_io;
   ASSERT_TRUE(
       jxl::jpeg::DecodeImageJPG(jxl::Span<const uint8_t>(orig), &orig_io));
@@ -4842,16 +5062,55 @@ TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionTest)) {
   jxl::PaddedBytes jpeg_data;
   ASSERT_TRUE(
       EncodeJPEGData(*orig_io.Main().jpeg_data.get(), &jpeg_data, cparams));
-  jxl::PaddedBytes container;
-  container.append(jxl::kContainerHeader,
-                   jxl::kContainerHeader + sizeof(jxl::kContainerHeader));
+  container->append(jxl::kContainerHeader,
+                    jxl::kContainerHeader + sizeof(jxl::kContainerHeader));
   jxl::AppendBoxHeader(jxl::MakeBoxType("jbrd"), jpeg_data.size(), false,
-                       &container);
-  container.append(jpeg_data.data(), jpeg_data.data() + jpeg_data.size());
-  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, &container);
+                       container);
+  container->append(jpeg_data.data(), jpeg_data.data() + jpeg_data.size());
+  jxl::AppendBoxHeader(jxl::MakeBoxType("jxlc"), 0, true, container);
   jxl::PaddedBytes codestream = std::move(writer).TakeBytes();
-  container.append(codestream.data(), codestream.data() + codestream.size());
+  container->append(codestream.data(), codestream.data() + codestream.size());
+}
+
+void VerifyJPEGReconstructionVariants(const std::string& jpeg_path) {
+  const jxl::PaddedBytes orig = jxl::ReadTestData(jpeg_path);
+  jxl::PaddedBytes container;
+  ASSERT_NO_FATAL_FAILURE(RecompressJPEG(orig, &container));
+  for (bool use_pool : {false, true}) {
+    for (size_t chunk_size : {size_t{1000}, orig.size()}) {
+      SCOPED_TRACE(::testing::Message() << "use_pool " << use_pool
+                                        << " chunk_size " << chunk_size);
+      VerifyJPEGReconstructionInChunks(container, orig, use_pool, chunk_size);
+    }
+  }
+}
+}  // namespace
+
+TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionTest)) {
+  const std::string jpeg_path = "jxl/flower/flower.png.im_q85_420.jpg";
+  const jxl::PaddedBytes orig = jxl::ReadTestData(jpeg_path);
+  jxl::PaddedBytes container;
+  ASSERT_NO_FATAL_FAILURE(RecompressJPEG(orig, &container));
   VerifyJPEGReconstruction(container, orig);
+  VerifyJPEGCoefficients(container, orig);
+}
+
+// The scans are large enough to be entropy coded in segments in parallel:
+// without restart markers into bit buffers stitched with the carried DC
+// predictors, with them at the restart intervals, and for progressive scans
+// with serial re-encoding after a pending end-of-band run.
+TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionSequentialTest)) {
+  VerifyJPEGReconstructionVariants("jxl/flower/flower.png.im_q85_420.jpg");
+}
+
+TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionRestartsTest)) {
+  VerifyJPEGReconstructionVariants(
+      "jxl/flower/flower.png.im_q85_420_R13B.jpg");
+}
+
+TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionProgressiveTest)) {
+  VerifyJPEGReconstructionVariants(
+      "jxl/flower/flower.png.im_q85_420_progr.jpg");
 }
 
 TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionMetadataTest)) {
@@ -4860,6 +5119,7 @@ TEST(DecodeTest, JXL_TRANSCODE_JPEG_TEST(JPEGReconstructionMetadataTest)) {
   const jxl::PaddedBytes jpeg = jxl::ReadTestData(jpeg_path);
   const jxl::PaddedBytes jxl = jxl::ReadTestData(jxl_path);
   VerifyJPEGReconstruction(jxl, jpeg);
+  VerifyJPEGCoefficients(jxl, jpeg);
 }
 
 TEST(DecodeTest, ContinueFinalNonEssentialBoxTest) {
@@ -17,6 +17,7 @@
 #include <vector>
 
 #include "jxl/decode.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"  // JPEGXL_ENABLE_TRANSCODE_JPEG
 #include "lib/jxl/image_bundle.h"
@@ -34,6 +35,16 @@ class JxlToJpegDecoder {
   // Returns whether an output buffer is set.
   bool IsOutputSet() const { return next_out_ != nullptr; }
 
+  // Returns whether the quantized DCT coefficients were requested instead of
+  // a JPEG bytestream.
+  bool IsCoefficientsOutputSet() const { return coefficients_output_; }
+
+  // Returns whether the frame should be decoded to the JPEGData, either for
+  // writing a JPEG bytestream or for outputting the coefficients.
+  bool WantsJpegData() const {
+    return IsOutputSet() || IsCoefficientsOutputSet();
+  }
+
   // Returns whether the decoder is parsing a boxa JPEG box was parsed.
   bool IsParsingBox() const { return inside_box_; }
 
@@ -53,9 +64,18 @@ class JxlToJpegDecoder {
     return result;
   }
 
+  // Requests (or cancels the request for) the quantized DCT coefficients
+  // instead of a JPEG bytestream. Cannot be combined with an output buffer.
+  JxlDecoderStatus SetCoefficientsOutput(bool enabled) {
+    if (enabled && next_out_) return JXL_DEC_ERROR;
+    coefficients_output_ = enabled;
+    return JXL_DEC_SUCCESS;
+  }
+
   void StartBox(bool box_until_eof, size_t contents_size) {
     // A new box implies that we clear the buffer.
     buffer_.clear();
+    serialization_state_.reset();
     inside_box_ = true;
     if (box_until_eof) {
       box_until_eof_ = true;
@@ -104,7 +124,7 @@ class JxlToJpegDecoder {
   // Sets the JpegData of the ImageBundle passed if there is anything to set.
   // Releases the JpegData from this decoder if set.
   Status SetImageBundleJpegData(ImageBundle* ib) {
-    if (IsOutputSet() && jpeg_data_ != nullptr) {
+    if (WantsJpegData() && jpeg_data_ != nullptr) {
       if (!jpeg::SetJPEGDataFromICC(ib->metadata()->color_encoding.ICC(),
                                     jpeg_data_.get())) {
         return false;
@@ -114,7 +134,14 @@ class JxlToJpegDecoder {
     return true;
   }
 
-  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& jpeg_data) {
+  // Writes the reconstructed JPEG to the output buffer. If the buffer is full,
+  // returns JXL_DEC_JPEG_NEED_MORE_OUTPUT with the buffer filled; calling it
+  // again after a new buffer was set continues with the remaining bytes.
+  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& jpeg_data,
+                               ThreadPool* pool) {
+    if (serialization_state_ == nullptr) {
+      serialization_state_ = jxl::make_unique<jpeg::SerializationState>();
+    }
     // Copy JPEG bytestream if desired.
     uint8_t* tmp_next_out = next_out_;
     size_t tmp_avail_size = avail_size_;
@@ -126,15 +153,18 @@ class JxlToJpegDecoder {
       tmp_avail_size -= to_write;
       return to_write;
     };
-    Status write_result = jpeg::WriteJpeg(jpeg_data, write);
+    Status write_result = jpeg::WriteJpeg(jpeg_data, write,
+                                          serialization_state_.get(), pool);
+    next_out_ = tmp_next_out;
+    avail_size_ = tmp_avail_size;
     if (!write_result) {
-      if (tmp_avail_size == 0) {
+      if (write_result.code() == StatusCode::kNotEnoughBytes) {
         return JXL_DEC_JPEG_NEED_MORE_OUTPUT;
       }
+      serialization_state_.reset();
       return JXL_DEC_ERROR;
     }
-    next_out_ = tmp_next_out;
-    avail_size_ = tmp_avail_size;
+    serialization_state_.reset();
     return JXL_DEC_SUCCESS;
   }
 
@@ -160,6 +190,14 @@ class JxlToJpegDecoder {
   uint8_t* next_out_ = nullptr;
   // Available bytes to write JPEG reconstruction to.
   size_t avail_size_ = 0;
+
+  // True if the quantized DCT coefficients are output instead of a JPEG
+  // bytestream.
+  bool coefficients_output_ = false;
+
+  // Progress of the JPEG reconstruction output, kept between WriteOutput
+  // calls that ran out of output space.
+  std::unique_ptr<jpeg::SerializationState> serialization_state_;
 };
 
 #else
@@ -168,12 +206,17 @@ class JxlToJpegDecoder {
 class JxlToJpegDecoder {
  public:
   bool IsOutputSet() const { return false; }
+  bool IsCoefficientsOutputSet() const { return false; }
+  bool WantsJpegData() const { return false; }
   bool IsParsingBox() const { return false; }
 
   JxlDecoderStatus SetOutputBuffer(uint8_t* /* data */, size_t /* size */) {
     return JXL_DEC_ERROR;
   }
   size_t ReleaseOutputBuffer() { return 0; }
+  JxlDecoderStatus SetCoefficientsOutput(bool /* enabled */) {
+    return JXL_DEC_ERROR;
+  }
 
   void StartBox(bool /* box_until_eof */, size_t /* contents_size */) {}
 
@@ -205,7 +248,8 @@ class JxlToJpegDecoder {
     return JXL_DEC_ERROR;
   }
 
-  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& /* jpeg_data */) {
+  JxlDecoderStatus WriteOutput(const jpeg::JPEGData& /* jpeg_data */,
+                               ThreadPool* /* pool */) {
     return JXL_DEC_SUCCESS;
   }
 };
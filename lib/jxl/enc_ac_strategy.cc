@@ -455,17 +455,82 @@ float EstimateEntropy(const AcStrategy& acs, size_t x, size_t y,
   return ret;
 }
 
+// Space for the 3 channels of a transform within a 64x64 rect.
+constexpr size_t kCandidateBlockSize = 3 * 64 * kDCTBlockSize;
+
+// Memoizes EstimateEntropy results within one 64x64 rect, where the merge
+// search evaluates some transforms at the same position more than once.
+struct EntropyMemo {
+  EntropyMemo() { memset(computed, 0, sizeof(computed)); }
+  float entropy[AcStrategy::kNumValidStrategies][64];
+  bool computed[AcStrategy::kNumValidStrategies][64];
+};
+
+// bx, by addresses the 64x64 block at 8x8 subresolution, cx, cy the
+// transform within it. Sets *has_coeffs to whether `block` was filled with the
+// transform, i.e. the entropy was not memoized.
+float EstimateEntropyMemo(const AcStrategy& acs, size_t bx, size_t by,
+                          size_t cx, size_t cy, const ACSConfig& config,
+                          const float* JXL_RESTRICT cmap_factors, float* block,
+                          float* scratch_space, uint32_t* quantized,
+                          EntropyMemo* memo, bool* has_coeffs) {
+  const size_t raw = acs.RawStrategy();
+  const size_t pos = cy * 8 + cx;
+  *has_coeffs = !memo->computed[raw][pos];
+  if (!memo->computed[raw][pos]) {
+    memo->entropy[raw][pos] =
+        EstimateEntropy(acs, (bx + cx) * 8, (by + cy) * 8, config, cmap_factors,
+                        block, scratch_space, quantized);
+    memo->computed[raw][pos] = true;
+  }
+  return memo->entropy[raw][pos];
+}
+
+// Coarse classification of the content of an 8x8 block.
+enum class BlockContent {
+  // Flat areas and gradients: only the lowest frequencies survive
+  // quantization.
+  kSmooth,
+  // Edges and textures.
+  kDetailed,
+};
+
+// Classifies the block at x, y from its DCT8 coefficients, as left in `block`
+// by EstimateEntropy.
+BlockContent ClassifyBlock(size_t x, size_t y, const ACSConfig& config,
+                           const float* JXL_RESTRICT cmap_factors,
+                           const float* JXL_RESTRICT block) {
+  const float q = config.Quant(x / 8, y / 8);
+  for (size_t c = 0; c < 3; c++) {
+    const float* inv_matrix =
+        config.dequant->InvMatrix(AcStrategy::Type::DCT, c);
+    for (size_t i = 0; i < kDCTBlockSize; i++) {
+      // Skip DC and the three lowest AC coefficients.
+      if (i < 2 || i == 8 || i == 9) continue;
+      const float coeff = block[c * kDCTBlockSize + i] -
+                          block[kDCTBlockSize + i] * cmap_factors[c];
+      if (std::abs(coeff * inv_matrix[i] * q) >= 0.5f) {
+        return BlockContent::kDetailed;
+      }
+    }
+  }
+  return BlockContent::kSmooth;
+}
+
 uint8_t FindBest8x8Transform(size_t x, size_t y, int encoding_speed_tier,
                              const ACSConfig& config,
                              const float* JXL_RESTRICT cmap_factors,
                              AcStrategyImage* JXL_RESTRICT ac_strategy,
                              float* block, float* scratch_space,
-                             uint32_t* quantized, float* entropy_out) {
+                             uint32_t* quantized, float* best_coeffs,
+                             float* entropy_out) {
   struct TransformTry8x8 {
     AcStrategy::Type type;
     int encoding_speed_tier_max_limit;
     float entropy_add;
     float entropy_mul;
+    // Whether to try this transform on BlockContent::kSmooth blocks.
+    bool try_on_smooth;
   };
   static const TransformTry8x8 kTransforms8x8[] = {
       {
@@ -473,75 +538,104 @@ uint8_t FindBest8x8Transform(size_t x, size_t y, int encoding_speed_tier,
           9,
           3.0f,
           0.745f,
+          true,
       },
       {
           AcStrategy::Type::DCT4X4,
           5,
           4.0f,
           1.0179946967008329f,
+          false,
       },
       {
           AcStrategy::Type::DCT2X2,
           4,
           4.0f,
           0.76721119707580943f,
+          false,
       },
       {
           AcStrategy::Type::DCT4X8,
           5,
           0.0f,
           0.700754622182473063f,
+          true,
       },
       {
           AcStrategy::Type::DCT8X4,
           5,
           0.0f,
           0.700754622182473063f,
+          true,
       },
       {
           AcStrategy::Type::IDENTITY,
           5,
           8.0f,
           0.81217614513585534f,
+          false,
       },
       {
           AcStrategy::Type::AFV0,
           4,
           3.0f,
           0.70086131125719425f,
+          false,
       },
       {
           AcStrategy::Type::AFV1,
           4,
           3.0f,
           0.70086131125719425f,
+          false,
       },
       {
           AcStrategy::Type::AFV2,
           4,
           3.0f,
           0.70086131125719425f,
+          false,
       },
       {
           AcStrategy::Type::AFV3,
           4,
           3.0f,
           0.70086131125719425f,
+          false,
       },
   };
+  // At the hare tier, the DCT8 coefficients (tried first) are used to skip the
+  // small transforms on smooth blocks. The time saved pays for trying the
+  // wombat tier transforms on detailed blocks. Slower tiers try all transforms
+  // on every block.
+  const bool classify =
+      encoding_speed_tier == static_cast<int>(SpeedTier::kHare);
+  BlockContent content = BlockContent::kDetailed;
+  int speed_tier = encoding_speed_tier;
   double best = 1e30;
   uint8_t best_tx = kTransforms8x8[0].type;
   for (auto tx : kTransforms8x8) {
-    if (tx.encoding_speed_tier_max_limit < encoding_speed_tier) {
+    if (tx.encoding_speed_tier_max_limit < speed_tier) {
+      continue;
+    }
+    if (content == BlockContent::kSmooth && !tx.try_on_smooth) {
       continue;
     }
     AcStrategy acs = AcStrategy::FromRawStrategy(tx.type);
     float entropy = EstimateEntropy(acs, x, y, config, cmap_factors, block,
                                     scratch_space, quantized);
+    if (classify && tx.type == AcStrategy::Type::DCT) {
+      content = ClassifyBlock(x, y, config, cmap_factors, block);
+      if (content == BlockContent::kDetailed &&
+          speed_tier == static_cast<int>(SpeedTier::kHare)) {
+        speed_tier = static_cast<int>(SpeedTier::kWombat);
+      }
+    }
     entropy = tx.entropy_add + tx.entropy_mul * entropy;
     if (entropy < best) {
       best_tx = tx.type;
       best = entropy;
+      memcpy(best_coeffs, block, 3 * kDCTBlockSize * sizeof(float));
     }
   }
   *entropy_out = best;
@@ -557,7 +651,8 @@ void TryMergeAcs(AcStrategy::Type acs_raw, size_t bx, size_t by, size_t cx,
                  AcStrategyImage* JXL_RESTRICT ac_strategy,
                  const float entropy_mul, const uint8_t candidate_priority,
                  uint8_t* priority, float* JXL_RESTRICT entropy_estimate,
-                 float* block, float* scratch_space, uint32_t* quantized) {
+                 float* block, float* scratch_space, uint32_t* quantized,
+                 EntropyMemo* memo, TransformCache* transform_cache) {
   AcStrategy acs = AcStrategy::FromRawStrategy(acs_raw);
   float entropy_current = 0;
   for (size_t iy = 0; iy < acs.covered_blocks_y(); ++iy) {
@@ -571,10 +666,11 @@ void TryMergeAcs(AcStrategy::Type acs_raw, size_t bx, size_t by, size_t cx,
       entropy_current += entropy_estimate[(cy + iy) * 8 + (cx + ix)];
     }
   }
+  bool has_coeffs;
   float entropy_candidate =
-      entropy_mul * EstimateEntropy(acs, (bx + cx) * 8, (by + cy) * 8, config,
-                                    cmap_factors, block, scratch_space,
-                                    quantized);
+      entropy_mul * EstimateEntropyMemo(acs, bx, by, cx, cy, config,
+                                        cmap_factors, block, scratch_space,
+                                        quantized, memo, &has_coeffs);
   if (entropy_candidate >= entropy_current) return;
   // Accept the candidate.
   for (size_t iy = 0; iy < acs.covered_blocks_y(); iy++) {
@@ -584,6 +680,7 @@ void TryMergeAcs(AcStrategy::Type acs_raw, size_t bx, size_t by, size_t cx,
     }
   }
   ac_strategy->Set(bx + cx, by + cy, acs_raw);
+  if (has_coeffs) transform_cache->Store(acs, bx + cx, by + cy, block);
   entropy_estimate[cy * 8 + cx] = entropy_candidate;
 }
 
@@ -641,7 +738,8 @@ void FindBestFirstLevelDivisionForSquare(
     size_t cy, const ACSConfig& config, const float* JXL_RESTRICT cmap_factors,
     AcStrategyImage* JXL_RESTRICT ac_strategy, const float entropy_mul_JXK,
     const float entropy_mul_JXJ, float* JXL_RESTRICT entropy_estimate,
-    float* block, float* scratch_space, uint32_t* quantized) {
+    float* candidate_blocks, float* scratch_space, uint32_t* quantized,
+    EntropyMemo* memo, TransformCache* transform_cache) {
   // We denote J for the larger dimension here, and K for the smaller.
   // For example, for 32x32 block splitting, J would be 32, K 16.
   const size_t blocks_half = blocks / 2;
@@ -683,6 +781,14 @@ void FindBestFirstLevelDivisionForSquare(
           entropy_estimate[(cy + dy) * 8 + (cx + dx)];
     }
   }
+  // Each candidate is transformed into its own block, so that the chosen ones
+  // can be kept in the transform cache.
+  enum { kJXKLeft, kJXKRight, kKXJTop, kKXJBottom, kJXJ, kNumCandidates };
+  float* block[kNumCandidates];
+  for (size_t i = 0; i < kNumCandidates; ++i) {
+    block[i] = candidate_blocks + i * kCandidateBlockSize;
+  }
+  bool has_coeffs[kNumCandidates] = {};
   float entropy_JXK_left = std::numeric_limits<float>::max();
   float entropy_JXK_right = std::numeric_limits<float>::max();
   float entropy_KXJ_top = std::numeric_limits<float>::max();
@@ -692,40 +798,43 @@ void FindBestFirstLevelDivisionForSquare(
     if (row0[bx + cx + 0].RawStrategy() != acs_rawJXK) {
       entropy_JXK_left =
           entropy_mul_JXK *
-          EstimateEntropy(acsJXK, (bx + cx + 0) * 8, (by + cy + 0) * 8, config,
-                          cmap_factors, block, scratch_space, quantized);
+          EstimateEntropyMemo(acsJXK, bx, by, cx + 0, cy + 0, config,
+                              cmap_factors, block[kJXKLeft], scratch_space,
+                              quantized, memo, &has_coeffs[kJXKLeft]);
     }
     if (row0[bx + cx + blocks_half].RawStrategy() != acs_rawJXK) {
       entropy_JXK_right =
-          entropy_mul_JXK * EstimateEntropy(acsJXK, (bx + cx + blocks_half) * 8,
-                                            (by + cy + 0) * 8, config,
-                                            cmap_factors, block, scratch_space,
-                                            quantized);
+          entropy_mul_JXK *
+          EstimateEntropyMemo(acsJXK, bx, by, cx + blocks_half, cy + 0, config,
+                              cmap_factors, block[kJXKRight], scratch_space,
+                              quantized, memo, &has_coeffs[kJXKRight]);
     }
   }
   if (allow_KXJ) {
     if (row0[bx + cx].RawStrategy() != acs_rawKXJ) {
       entropy_KXJ_top =
           entropy_mul_JXK *
-          EstimateEntropy(acsKXJ, (bx + cx + 0) * 8, (by + cy + 0) * 8, config,
-                          cmap_factors, block, scratch_space, quantized);
+          EstimateEntropyMemo(acsKXJ, bx, by, cx + 0, cy + 0, config,
+                              cmap_factors, block[kKXJTop], scratch_space,
+                              quantized, memo, &has_coeffs[kKXJTop]);
     }
     if (row1[bx + cx].RawStrategy() != acs_rawKXJ) {
       entropy_KXJ_bottom =
-          entropy_mul_JXK * EstimateEntropy(acsKXJ, (bx + cx + 0) * 8,
-                                            (by + cy + blocks_half) * 8, config,
-                                            cmap_factors, block, scratch_space,
-                                            quantized);
+          entropy_mul_JXK *
+          EstimateEntropyMemo(acsKXJ, bx, by, cx + 0, cy + blocks_half, config,
+                              cmap_factors, block[kKXJBottom], scratch_space,
+                              quantized, memo, &has_coeffs[kKXJBottom]);
     }
   }
   if (allow_square_transform) {
     // We control the exploration of the square transform separately so that
     // we can turn it off at high decoding speeds for 32x32, but still allow
     // exploring 16x32 and 32x16.
-    entropy_JXJ = entropy_mul_JXJ * EstimateEntropy(acsJXJ, (bx + cx + 0) * 8,
-                                                    (by + cy + 0) * 8, config,
-                                                    cmap_factors, block,
-                                                    scratch_space, quantized);
+    entropy_JXJ =
+        entropy_mul_JXJ *
+        EstimateEntropyMemo(acsJXJ, bx, by, cx + 0, cy + 0, config,
+                            cmap_factors, block[kJXJ], scratch_space, quantized,
+                            memo, &has_coeffs[kJXJ]);
   }
 
   // Test if this block should have JXK or KXJ transforms,
@@ -736,26 +845,43 @@ void FindBestFirstLevelDivisionForSquare(
                   std::min(entropy_KXJ_bottom, entropy[1][0] + entropy[1][1]);
   if (entropy_JXJ < costJxN && entropy_JXJ < costNxJ) {
     ac_strategy->Set(bx + cx, by + cy, acs_rawJXJ);
+    if (has_coeffs[kJXJ]) {
+      transform_cache->Store(acsJXJ, bx + cx, by + cy, block[kJXJ]);
+    }
     SetEntropyForTransform(cx, cy, acs_rawJXJ, entropy_JXJ, entropy_estimate);
   } else if (costJxN < costNxJ) {
     if (entropy_JXK_left < entropy[0][0] + entropy[1][0]) {
       ac_strategy->Set(bx + cx, by + cy, acs_rawJXK);
+      if (has_coeffs[kJXKLeft]) {
+        transform_cache->Store(acsJXK, bx + cx, by + cy, block[kJXKLeft]);
+      }
       SetEntropyForTransform(cx, cy, acs_rawJXK, entropy_JXK_left,
                              entropy_estimate);
     }
     if (entropy_JXK_right < entropy[0][1] + entropy[1][1]) {
       ac_strategy->Set(bx + cx + blocks_half, by + cy, acs_rawJXK);
+      if (has_coeffs[kJXKRight]) {
+        transform_cache->Store(acsJXK, bx + cx + blocks_half, by + cy,
+                               block[kJXKRight]);
+      }
       SetEntropyForTransform(cx + blocks_half, cy, acs_rawJXK,
                              entropy_JXK_right, entropy_estimate);
     }
   } else {
     if (entropy_KXJ_top < entropy[0][0] + entropy[0][1]) {
       ac_strategy->Set(bx + cx, by + cy, acs_rawKXJ);
+      if (has_coeffs[kKXJTop]) {
+        transform_cache->Store(acsKXJ, bx + cx, by + cy, block[kKXJTop]);
+      }
       SetEntropyForTransform(cx, cy, acs_rawKXJ, entropy_KXJ_top,
                              entropy_estimate);
     }
     if (entropy_KXJ_bottom < entropy[1][0] + entropy[1][1]) {
       ac_strategy->Set(bx + cx, by + cy + blocks_half, acs_rawKXJ);
+      if (has_coeffs[kKXJBottom]) {
+        transform_cache->Store(acsKXJ, bx + cx, by + cy + blocks_half,
+                               block[kKXJBottom]);
+      }
       SetEntropyForTransform(cx, cy + blocks_half, acs_rawKXJ,
                              entropy_KXJ_bottom, entropy_estimate);
     }
@@ -783,6 +909,9 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
   uint32_t* JXL_RESTRICT quantized = qmem.get();
   float* JXL_RESTRICT block = mem.get();
   float* JXL_RESTRICT scratch_space = mem.get() + 3 * AcStrategy::kMaxCoeffArea;
+  auto candidate_mem = hwy::AllocateAligned<float>(5 * kCandidateBlockSize);
+  float* JXL_RESTRICT candidate_blocks = candidate_mem.get();
+  TransformCache* transform_cache = &enc_state->transform_cache;
   size_t bx = rect.x0();
   size_t by = rect.y0();
   JXL_ASSERT(rect.xsize() <= 8);
@@ -814,9 +943,11 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
       const uint8_t best_of_8x8s = FindBest8x8Transform(
           8 * (bx + ix), 8 * (by + iy), static_cast<int>(cparams.speed_tier),
           config, cmap_factors, ac_strategy, block, scratch_space, quantized,
-          &entropy);
+          candidate_blocks, &entropy);
       ac_strategy->Set(bx + ix, by + iy,
                        static_cast<AcStrategy::Type>(best_of_8x8s));
+      transform_cache->Store(AcStrategy::FromRawStrategy(best_of_8x8s),
+                             bx + ix, by + iy, candidate_blocks);
       entropy_estimate[iy * 8 + ix] = entropy * mul8x8;
     }
   }
@@ -890,6 +1021,7 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
   // Priority is a tricky kludge to avoid collisions so that transforms
   // don't overlap.
   uint8_t priority[64] = {};
+  EntropyMemo memo;
   for (auto tx : kTransformsForMerge) {
     if (tx.decoding_speed_tier_max_limit < cparams.decoding_speed_tier) {
       continue;
@@ -907,8 +1039,9 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
             if ((cy | cx) % 8 == 0) {
               FindBestFirstLevelDivisionForSquare(
                   8, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-                  tx.entropy_mul, entropy_mul64X64, entropy_estimate, block,
-                  scratch_space, quantized);
+                  tx.entropy_mul, entropy_mul64X64, entropy_estimate,
+                  candidate_blocks, scratch_space, quantized, &memo,
+                  transform_cache);
             }
             continue;
           } else if (tx.type == AcStrategy::Type::DCT32X16) {
@@ -933,7 +1066,8 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
               FindBestFirstLevelDivisionForSquare(
                   4, enable_32x32, bx, by, cx, cy, config, cmap_factors,
                   ac_strategy, tx.entropy_mul, entropy_mul32X32,
-                  entropy_estimate, block, scratch_space, quantized);
+                  entropy_estimate, candidate_blocks, scratch_space, quantized,
+                  &memo, transform_cache);
             }
             continue;
           } else if (tx.type == AcStrategy::Type::DCT32X16) {
@@ -955,8 +1089,9 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
             if ((cy | cx) % 2 == 0) {
               FindBestFirstLevelDivisionForSquare(
                   2, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-                  tx.entropy_mul, entropy_mul16X16, entropy_estimate, block,
-                  scratch_space, quantized);
+                  tx.entropy_mul, entropy_mul16X16, entropy_estimate,
+                  candidate_blocks, scratch_space, quantized, &memo,
+                  transform_cache);
             }
             continue;
           } else if (tx.type == AcStrategy::Type::DCT16X8) {
@@ -979,7 +1114,7 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
         // normal integral transform merging process.
         TryMergeAcs(tx.type, bx, by, cx, cy, config, cmap_factors, ac_strategy,
                     tx.entropy_mul, tx.priority, &priority[0], entropy_estimate,
-                    block, scratch_space, quantized);
+                    block, scratch_space, quantized, &memo, transform_cache);
       }
     }
   }
@@ -993,8 +1128,9 @@ void ProcessRectACS(PassesEncoderState* JXL_RESTRICT enc_state,
       for (size_t cx = 1 - (ii == 2); cx + 1 < rect.xsize(); cx += 2) {
         FindBestFirstLevelDivisionForSquare(
             2, true, bx, by, cx, cy, config, cmap_factors, ac_strategy,
-            entropy_mul16X8, entropy_mul16X16, entropy_estimate, block,
-            scratch_space, quantized);
+            entropy_mul16X8, entropy_mul16X16, entropy_estimate,
+            candidate_blocks, scratch_space, quantized, &memo,
+            transform_cache);
       }
     }
   }
@@ -1036,6 +1172,16 @@ void AcStrategyHeuristics::Init(const Image3F& src,
     config.masking_field_stride = mask.PixelsPerRow();
   }
 
+  // The transforms of the chosen strategies are kept for ComputeCoefficients
+  // when there is a search.
+  if (cparams.speed_tier <= SpeedTier::kHare && cparams.reuse_acs_transforms) {
+    enc_state->transform_cache.Init(src,
+                                    enc_state->shared.frame_dim.xsize_blocks,
+                                    enc_state->shared.frame_dim.ysize_blocks);
+  } else {
+    enc_state->transform_cache.Clear();
+  }
+
   config.src_rows[0] = src.ConstPlaneRow(0, 0);
   config.src_rows[1] = src.ConstPlaneRow(1, 0);
   config.src_rows[2] = src.ConstPlaneRow(2, 0);
@@ -6,6 +6,7 @@
 #include "lib/jxl/enc_ans.h"
 
 #include <stdint.h>
+#include <string.h>
 
 #include <algorithm>
 #include <array>
@@ -21,6 +22,8 @@
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/enc_cluster.h"
 #include "lib/jxl/enc_context_map.h"
@@ -937,6 +940,28 @@ void ApplyLZ77_RLE(const HistogramParams& params, size_t num_contexts,
   }
 }
 
+// Returns the number of equal leading values of a and b, up to max_len.
+// Compares two values at a time as 64-bit words.
+size_t MatchLength(const uint32_t* JXL_RESTRICT a,
+                   const uint32_t* JXL_RESTRICT b, size_t max_len) {
+  size_t len = 0;
+  for (; len + 2 <= max_len; len += 2) {
+    uint64_t va, vb;
+    memcpy(&va, a + len, sizeof(va));
+    memcpy(&vb, b + len, sizeof(vb));
+    const uint64_t diff = va ^ vb;
+    if (diff != 0) {
+      // Values are stored in native order; the lower address holds the first
+      // value on little-endian and the second one on big-endian machines.
+      const bool first_differs =
+          IsLittleEndian() ? (diff & 0xFFFFFFFFu) != 0 : (diff >> 32) != 0;
+      return first_differs ? len : len + 1;
+    }
+  }
+  if (len < max_len && a[len] == b[len]) len++;
+  return len;
+}
+
 // Hash chain for LZ77 matching
 struct HashChain {
   size_t size_;
@@ -968,12 +993,14 @@ struct HashChain {
   uint32_t maxchainlength = 256;  // window_size_ to allow all
 
   HashChain(const Token* data, size_t size, size_t window_size,
-            size_t min_length, size_t max_length, size_t distance_multiplier)
+            size_t min_length, size_t max_length, size_t distance_multiplier,
+            uint32_t max_chain_length)
       : size_(size),
         window_size_(window_size),
         window_mask_(window_size - 1),
         min_length_(min_length),
-        max_length_(max_length) {
+        max_length_(max_length),
+        maxchainlength(max_chain_length) {
     data_.resize(size);
     for (size_t i = 0; i < size; i++) {
       data_[i] = data[i].value;
@@ -1086,9 +1113,8 @@ struct HashChain {
           i += r;
           j += r;
         }
-        while (i < end && data_[i] == data_[j]) {
-          i++;
-          j++;
+        if (i < end) {
+          i += MatchLength(data_.data() + i, data_.data() + j, end - i);
         }
         len = i - pos;
         // This can trigger even if the new length is slightly smaller than the
@@ -1207,23 +1233,33 @@ float DistCost(size_t dist) {
   return kCostTable[tok] + nbits;
 }
 
-void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
-                    const std::vector<std::vector<Token>>& tokens,
-                    LZ77Params& lz77,
-                    std::vector<std::vector<Token>>& tokens_lz77) {
+Status ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
+                      const std::vector<std::vector<Token>>& tokens,
+                      LZ77Params& lz77,
+                      std::vector<std::vector<Token>>& tokens_lz77) {
   // TODO(veluca): tune heuristics here.
   SymbolCostEstimator sce(num_contexts, params.force_huffman, tokens, lz77);
-  float bit_decrease = 0;
   size_t total_symbols = 0;
+  for (const auto& in : tokens) total_symbols += in.size();
   tokens_lz77.resize(tokens.size());
-  HybridUintConfig uint_config;
-  std::vector<float> sym_cost;
-  for (size_t stream = 0; stream < tokens.size(); stream++) {
+  // Streams are matched independently; the per-stream gains are summed in
+  // stream order afterwards so that the result does not depend on the number
+  // of threads. They are accumulated in double so that the decision below
+  // hardly depends on the order of the additions.
+  std::vector<double> stream_bit_decrease(tokens.size());
+  std::vector<std::vector<float>> thread_sym_cost;
+  const auto init = [&](size_t num_threads) {
+    thread_sym_cost.resize(num_threads);
+    return true;
+  };
+  const auto process_stream = [&](const uint32_t stream, size_t thread) {
+    HybridUintConfig uint_config;
+    std::vector<float>& sym_cost = thread_sym_cost[thread];
+    double& bit_decrease = stream_bit_decrease[stream];
     size_t distance_multiplier =
         params.image_widths.size() > stream ? params.image_widths[stream] : 0;
     const auto& in = tokens[stream];
     auto& out = tokens_lz77[stream];
-    total_symbols += in.size();
     // Cumulative sum of bit costs.
     sym_cost.resize(in.size() + 1);
     for (size_t i = 0; i < in.size(); i++) {
@@ -1245,7 +1281,7 @@ void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
     }
 
     HashChain chain(in.data(), in.size(), window_size, min_length, max_length,
-                    distance_multiplier);
+                    distance_multiplier, params.lz77_max_chain_length);
     size_t len, dist_symbol;
 
     const size_t max_lazy_match_len = 256;  // 0 to disable lazy matching
@@ -1304,29 +1340,46 @@ void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
         // Literal, already pushed
       }
     }
+  };
+  JXL_RETURN_IF_ERROR(RunOnPool(params.pool, 0, tokens.size(), init,
+                                process_stream, "ApplyLZ77"));
+  double bit_decrease = 0;
+  for (double stream_decrease : stream_bit_decrease) {
+    bit_decrease += stream_decrease;
   }
 
   if (bit_decrease > total_symbols * 0.2 + 16) {
     lz77.enabled = true;
   }
+  return true;
 }
 
-void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
-                       const std::vector<std::vector<Token>>& tokens,
-                       LZ77Params& lz77,
-                       std::vector<std::vector<Token>>& tokens_lz77) {
+Status ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
+                         const std::vector<std::vector<Token>>& tokens,
+                         LZ77Params& lz77,
+                         std::vector<std::vector<Token>>& tokens_lz77) {
   std::vector<std::vector<Token>> tokens_for_cost_estimate;
-  ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_for_cost_estimate);
+  JXL_RETURN_IF_ERROR(ApplyLZ77_LZ77(params, num_contexts, tokens, lz77,
+                                     tokens_for_cost_estimate));
   // If greedy-LZ77 does not give better compression than no-lz77, no reason to
   // run the optimal matching.
-  if (!lz77.enabled) return;
+  if (!lz77.enabled) return true;
   SymbolCostEstimator sce(num_contexts + 1, params.force_huffman,
                           tokens_for_cost_estimate, lz77);
   tokens_lz77.resize(tokens.size());
-  HybridUintConfig uint_config;
-  std::vector<float> sym_cost;
-  std::vector<uint32_t> dist_symbols;
-  for (size_t stream = 0; stream < tokens.size(); stream++) {
+  struct ThreadScratch {
+    std::vector<float> sym_cost;
+    std::vector<uint32_t> dist_symbols;
+  };
+  std::vector<ThreadScratch> scratch;
+  const auto init = [&](size_t num_threads) {
+    scratch.resize(num_threads);
+    return true;
+  };
+  const auto process_stream = [&](const uint32_t stream, size_t thread) {
+    HybridUintConfig uint_config;
+    std::vector<float>& sym_cost = scratch[thread].sym_cost;
+    std::vector<uint32_t>& dist_symbols = scratch[thread].dist_symbols;
     size_t distance_multiplier =
         params.image_widths.size() > stream ? params.image_widths[stream] : 0;
     const auto& in = tokens[stream];
@@ -1352,7 +1405,7 @@ void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
     }
 
     HashChain chain(in.data(), in.size(), window_size, min_length, max_length,
-                    distance_multiplier);
+                    distance_multiplier, params.lz77_max_chain_length);
 
     struct MatchInfo {
       uint32_t len;
@@ -1440,12 +1493,15 @@ void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
       pos -= prefix_costs[pos].len;
     }
     std::reverse(out.begin(), out.end());
-  }
+  };
+  return RunOnPool(params.pool, 0, tokens.size(), init, process_stream,
+                   "ApplyLZ77Optimal");
 }
 
-void ApplyLZ77(const HistogramParams& params, size_t num_contexts,
-               const std::vector<std::vector<Token>>& tokens, LZ77Params& lz77,
-               std::vector<std::vector<Token>>& tokens_lz77) {
+Status ApplyLZ77(const HistogramParams& params, size_t num_contexts,
+                 const std::vector<std::vector<Token>>& tokens,
+                 LZ77Params& lz77,
+                 std::vector<std::vector<Token>>& tokens_lz77) {
   lz77.enabled = false;
   if (params.force_huffman) {
     lz77.min_symbol = std::min(PREFIX_MAX_ALPHABET_SIZE - 32, 512);
@@ -1453,13 +1509,14 @@ void ApplyLZ77(const HistogramParams& params, size_t num_contexts,
     lz77.min_symbol = 224;
   }
   if (params.lz77_method == HistogramParams::LZ77Method::kNone) {
-    return;
+    return true;
   } else if (params.lz77_method == HistogramParams::LZ77Method::kRLE) {
     ApplyLZ77_RLE(params, num_contexts, tokens, lz77, tokens_lz77);
+    return true;
   } else if (params.lz77_method == HistogramParams::LZ77Method::kLZ77) {
-    ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_lz77);
+    return ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_lz77);
   } else if (params.lz77_method == HistogramParams::LZ77Method::kOptimal) {
-    ApplyLZ77_Optimal(params, num_contexts, tokens, lz77, tokens_lz77);
+    return ApplyLZ77_Optimal(params, num_contexts, tokens, lz77, tokens_lz77);
   } else {
     JXL_ABORT("Not implemented");
   }
@@ -1476,7 +1533,12 @@ size_t BuildAndEncodeHistograms(const HistogramParams& params,
   size_t total_bits = 0;
   codes->lz77.nonserialized_distance_context = num_contexts;
   std::vector<std::vector<Token>> tokens_lz77;
-  ApplyLZ77(params, num_contexts, tokens, codes->lz77, tokens_lz77);
+  if (!ApplyLZ77(params, num_contexts, tokens, codes->lz77, tokens_lz77)) {
+    // Only the thread pool can fail; the tokens are then stored as they are,
+    // which is always valid.
+    JXL_DEBUG_V(2, "LZ77 failed, encoding without it");
+    codes->lz77.enabled = false;
+  }
   if (ans_fuzzer_friendly_) {
     codes->lz77.length_uint_config = HybridUintConfig(10, 0, 0);
     codes->lz77.min_symbol = 2048;
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/enc_params.h"
 
 namespace jxl {
@@ -69,6 +70,12 @@ struct HistogramParams {
   std::vector<size_t> image_widths;
   size_t max_histograms = ~0;
   bool force_huffman = false;
+  // Maximum number of hash chain entries visited per position by the LZ77
+  // match finders. Lower values are faster at some cost in density.
+  uint32_t lz77_max_chain_length = 256;
+  // Used to run the LZ77 match finders on independent streams and histogram
+  // clustering in parallel.
+  ThreadPool* pool = nullptr;
 };
 
 }  // namespace jxl
@@ -7,6 +7,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <type_traits>
 
@@ -35,6 +36,75 @@
 
 namespace jxl {
 
+void TransformCache::Init(const Image3F& src, size_t xsize_blocks,
+                          size_t ysize_blocks) {
+  if (coeffs_.xsize() != xsize_blocks * kDCTBlockSize ||
+      coeffs_.ysize() != ysize_blocks) {
+    coeffs_ = Image3F(xsize_blocks * kDCTBlockSize, ysize_blocks);
+    strategy_ = ImageB(xsize_blocks, ysize_blocks);
+    owner_ = ImageI(xsize_blocks, ysize_blocks);
+  }
+  ZeroFillImage(&strategy_);
+  ZeroFillImage(&owner_);
+  src_ = src.ConstPlaneRow(0, 0);
+}
+
+void TransformCache::Clear() {
+  coeffs_ = Image3F();
+  strategy_ = ImageB();
+  owner_ = ImageI();
+  src_ = nullptr;
+}
+
+void TransformCache::Store(const AcStrategy& acs, size_t bx, size_t by,
+                           const float* JXL_RESTRICT coeffs) {
+  if (src_ == nullptr) return;
+  const size_t xblocks = acs.covered_blocks_x();
+  const size_t num_blocks = xblocks * acs.covered_blocks_y();
+  const size_t size = num_blocks * kDCTBlockSize;
+  const int32_t owner = by * strategy_.xsize() + bx + 1;
+  for (size_t i = 0; i < num_blocks; i++) {
+    const size_t x = bx + i % xblocks;
+    const size_t y = by + i / xblocks;
+    for (size_t c = 0; c < 3; c++) {
+      memcpy(coeffs_.PlaneRow(c, y) + x * kDCTBlockSize,
+             coeffs + c * size + i * kDCTBlockSize,
+             kDCTBlockSize * sizeof(float));
+    }
+    owner_.Row(y)[x] = owner;
+  }
+  strategy_.Row(by)[bx] = acs.RawStrategy() + 1;
+}
+
+bool TransformCache::Load(const AcStrategy& acs, size_t bx, size_t by,
+                          const Image3F& src,
+                          float* JXL_RESTRICT coeffs) const {
+  if (src_ == nullptr || src_ != src.ConstPlaneRow(0, 0) ||
+      strategy_.ConstRow(by)[bx] != acs.RawStrategy() + 1) {
+    return false;
+  }
+  const size_t xblocks = acs.covered_blocks_x();
+  const size_t num_blocks = xblocks * acs.covered_blocks_y();
+  const size_t size = num_blocks * kDCTBlockSize;
+  // Parts of the transform might have been overwritten by a later one.
+  const int32_t owner = by * strategy_.xsize() + bx + 1;
+  for (size_t i = 0; i < num_blocks; i++) {
+    if (owner_.ConstRow(by + i / xblocks)[bx + i % xblocks] != owner) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < num_blocks; i++) {
+    const size_t x = bx + i % xblocks;
+    const size_t y = by + i / xblocks;
+    for (size_t c = 0; c < 3; c++) {
+      memcpy(coeffs + c * size + i * kDCTBlockSize,
+             coeffs_.ConstPlaneRow(c, y) + x * kDCTBlockSize,
+             kDCTBlockSize * sizeof(float));
+    }
+  }
+  return true;
+}
+
 Status InitializePassesEncoder(const Image3F& opsin, const JxlCmsInterface& cms,
                                ThreadPool* pool, PassesEncoderState* enc_state,
                                ModularFrameEncoder* modular_frame_encoder,
@@ -50,18 +120,8 @@ Status InitializePassesEncoder(const Image3F& opsin, const JxlCmsInterface& cms,
   enc_state->b_qm_multiplier =
       std::pow(1.25f, shared.frame_header.b_qm_scale - 2.0f);
 
-  if (enc_state->coeffs.size() < shared.frame_header.passes.num_passes) {
-    enc_state->coeffs.reserve(shared.frame_header.passes.num_passes);
-    for (size_t i = enc_state->coeffs.size();
-         i < shared.frame_header.passes.num_passes; i++) {
-      // Allocate enough coefficients for each group on every row.
-      enc_state->coeffs.emplace_back(make_unique<ACImageT<int32_t>>(
-          kGroupDim * kGroupDim, shared.frame_dim.num_groups));
-    }
-  }
-  while (enc_state->coeffs.size() > shared.frame_header.passes.num_passes) {
-    enc_state->coeffs.pop_back();
-  }
+  enc_state->InitCoefficients(shared.frame_header.passes.num_passes,
+                              shared.frame_dim.num_groups);
 
   float scale =
       shared.quantizer.ScaleGlobalScale(enc_state->cparams.quant_ac_rescale);
@@ -75,6 +135,8 @@ Status InitializePassesEncoder(const Image3F& opsin, const JxlCmsInterface& cms,
         ComputeCoefficients(group_idx, enc_state, opsin, &dc);
       },
       "Compute coeffs"));
+  // The cached transforms are not needed any more.
+  enc_state->transform_cache.Clear();
 
   if (shared.frame_header.flags & FrameHeader::kUseDcFrame) {
     CompressParams cparams = enc_state->cparams;
@@ -133,6 +195,7 @@ Status InitializePassesEncoder(const Image3F& opsin, const JxlCmsInterface& cms,
     }
     std::unique_ptr<PassesEncoderState> state =
         jxl::make_unique<PassesEncoderState>();
+    state->stage_stats = enc_state->stage_stats;
 
     auto special_frame = std::unique_ptr<BitWriter>(new BitWriter());
     FrameInfo dc_frame_info;
@@ -207,6 +270,91 @@ Status InitializePassesEncoder(const Image3F& opsin, const JxlCmsInterface& cms,
   return true;
 }
 
+void PassesEncoderState::InitCoefficients(size_t num_passes,
+                                          size_t num_groups) {
+  coeffs.resize(num_passes);
+  for (std::unique_ptr<ACImage>& pass_coeffs : coeffs) {
+    // Enough coefficients for each group on every row. Those of a previous
+    // frame with at least as many groups are reused; every coefficient is
+    // written before it is read.
+    if (!pass_coeffs || pass_coeffs->Type() != ACType::k32 ||
+        pass_coeffs->ysize() < num_groups) {
+      pass_coeffs =
+          make_unique<ACImageT<int32_t>>(kGroupDim * kGroupDim, num_groups);
+    }
+  }
+}
+
+void PassesEncoderState::Reset() {
+  shared.metadata = nullptr;
+  shared.frame_header = FrameHeader(nullptr);
+  shared.frame_dim = FrameDimensions();
+  shared.ac_strategy = AcStrategyImage();
+  shared.matrices = DequantMatrices();
+  shared.quantizer = Quantizer(&shared.matrices);
+  shared.raw_quant_field = ImageI();
+  shared.epf_sharpness = ImageB();
+  shared.cmap = ColorCorrelationMap();
+  shared.image_features = ImageFeatures();
+  shared.coeff_order_size = 0;
+  // Zero-filled again up to the needed size, as for a new state.
+  shared.coeff_orders.clear();
+  shared.quant_dc = ImageB();
+  shared.dc_storage = Image3F();
+  shared.dc = &shared.dc_storage;
+  shared.block_ctx_map = BlockCtxMap();
+  for (size_t i = 0; i < 4; i++) {
+    shared.dc_frames[i] = Image3F();
+    shared.reference_frames[i].storage = ImageBundle();
+    shared.reference_frames[i].frame = &shared.reference_frames[i].storage;
+    shared.reference_frames[i].ib_is_in_xyb = false;
+  }
+  shared.num_histograms = 0;
+
+  initial_quant_field = ImageF();
+  initial_quant_masking = ImageF();
+  transform_cache.Clear();
+  special_frames.clear();
+  progressive_splitter = ProgressiveSplitter();
+  cparams = CompressParams();
+  for (PassData& pass : passes) {
+    for (std::vector<Token>& group_tokens : pass.ac_tokens) {
+      group_tokens.clear();
+    }
+    pass.context_map.clear();
+    pass.codes = EntropyEncodingData();
+  }
+  histogram_idx.clear();
+  used_orders.clear();
+  x_qm_multiplier = 1.0f;
+  b_qm_multiplier = 1.0f;
+  stage_stats = nullptr;
+}
+
+size_t PassesEncoderState::RetainedBytes() const {
+  size_t bytes = 0;
+  for (const std::unique_ptr<ACImage>& pass_coeffs : coeffs) {
+    bytes += 3 * pass_coeffs->PixelsPerRow() * pass_coeffs->ysize() *
+             sizeof(int32_t);
+  }
+  for (const PassData& pass : passes) {
+    for (const std::vector<Token>& group_tokens : pass.ac_tokens) {
+      bytes += group_tokens.capacity() * sizeof(Token);
+    }
+  }
+  for (const EncCache& group_cache : group_caches) {
+    bytes += 3 * group_cache.num_nzeroes.PixelsPerRow() *
+             group_cache.num_nzeroes.ysize() * sizeof(int32_t);
+  }
+  return bytes;
+}
+
+void PassesEncoderState::ReleaseBuffers() {
+  coeffs.clear();
+  passes.clear();
+  group_caches.clear();
+}
+
 void EncCache::InitOnce() {
   PROFILER_FUNC;
 
@@ -29,9 +29,50 @@
 #include "lib/jxl/progressive_split.h"
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer.h"
+#include "lib/jxl/stage_stats.h"
 
 namespace jxl {
 
+// Forward transforms of the chosen AC strategies, as computed by the AC
+// strategy search, so that ComputeCoefficients does not have to repeat them.
+class TransformCache {
+ public:
+  // Enables the cache for transforms of `src`, with an empty content. `src`
+  // must not be modified while the cache is in use.
+  void Init(const Image3F& src, size_t xsize_blocks, size_t ysize_blocks);
+  void Clear();
+
+  // Stores the 3 channels of the transform `acs` at block bx, by, that are
+  // contiguous in `coeffs`.
+  void Store(const AcStrategy& acs, size_t bx, size_t by,
+             const float* JXL_RESTRICT coeffs);
+
+  // Copies the transform `acs` of `src` at block bx, by to `coeffs` and
+  // returns true if it is in the cache.
+  bool Load(const AcStrategy& acs, size_t bx, size_t by, const Image3F& src,
+            float* JXL_RESTRICT coeffs) const;
+
+ private:
+  // kDCTBlockSize coefficients per block; a transform covering several blocks
+  // spreads its coefficients over the blocks it covers, in raster order.
+  Image3F coeffs_;
+  // 1 + raw strategy of the last transform stored with its first block here,
+  // 0 if none.
+  ImageB strategy_;
+  // 1 + index of the first block of the last transform stored over each block.
+  ImageI owner_;
+  const float* src_ = nullptr;
+};
+
+// Working area for ComputeCoefficients (per-group!)
+struct EncCache {
+  // Allocates memory when first called, shrinks images to current group size.
+  void InitOnce();
+
+  // TokenizeCoefficients
+  Image3I num_nzeroes;
+};
+
 // Contains encoder state.
 struct PassesEncoderState {
   PassesSharedState shared;
@@ -42,6 +83,9 @@ struct PassesEncoderState {
   // Per-pass DCT coefficients for the image. One row per group.
   std::vector<std::unique_ptr<ACImage>> coeffs;
 
+  // Forward transforms computed by the AC strategy search.
+  TransformCache transform_cache;
+
   // Raw data for special (reference+DC) frames.
   std::vector<std::unique_ptr<BitWriter>> special_frames;
 
@@ -69,6 +113,28 @@ struct PassesEncoderState {
   // Heuristics to be used by the encoder.
   std::unique_ptr<EncoderHeuristics> heuristics =
       make_unique<DefaultEncoderHeuristics>();
+
+  // Per-stage timing and counters, or nullptr if not collected.
+  StageStats* stage_stats = nullptr;
+
+  // Per-thread working areas for tokenizing groups.
+  std::vector<EncCache> group_caches;
+
+  // Makes `coeffs` hold the coefficients of `num_passes` passes of
+  // `num_groups` groups, reusing those of a previous frame where possible.
+  void InitCoefficients(size_t num_passes, size_t num_groups);
+
+  // Prepares for encoding another frame or image as if newly constructed, but
+  // keeps the buffers whose size only depends on the frame size: coefficients,
+  // tokens and group caches. Frames of similar size then reuse them instead of
+  // allocating them again.
+  void Reset();
+
+  // Returns the size of the buffers that Reset keeps.
+  size_t RetainedBytes() const;
+
+  // Frees the buffers that Reset keeps.
+  void ReleaseBuffers();
 };
 
 // Initialize per-frame information.
@@ -79,15 +145,6 @@ Status InitializePassesEncoder(const Image3F& opsin, const JxlCmsInterface& cms,
                                ModularFrameEncoder* modular_frame_encoder,
                                AuxOut* aux_out);
 
-// Working area for ComputeCoefficients (per-group!)
-struct EncCache {
-  // Allocates memory when first called, shrinks images to current group size.
-  void InitOnce();
-
-  // TokenizeCoefficients
-  Image3I num_nzeroes;
-};
-
 }  // namespace jxl
 
 #endif  // LIB_JXL_ENC_CACHE_H_
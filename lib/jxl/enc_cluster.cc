@@ -7,6 +7,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <limits>
 #include <map>
 #include <memory>
@@ -20,6 +21,7 @@
 #include <hwy/highway.h>
 
 #include "lib/jxl/ac_context.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/fast_math-inl.h"
 HWY_BEFORE_NAMESPACE();
@@ -82,9 +84,17 @@ float HistogramDistance(const Histogram& a, const Histogram& b) {
   return total_distance - a.entropy_ - b.entropy_;
 }
 
+// Number of input histograms handled by each task when running on the pool.
+constexpr size_t kHistogramsPerTask = 256;
+
+// Number of histograms whose distances to all the clusters are computed in
+// parallel before assigning them to clusters in order.
+constexpr size_t kHistogramsPerBlock = 16;
+
 // First step of a k-means clustering with a fancy distance metric.
 void FastClusterHistograms(const std::vector<Histogram>& in,
-                           size_t max_histograms, std::vector<Histogram>* out,
+                           size_t max_histograms, ThreadPool* pool,
+                           std::vector<Histogram>* out,
                            std::vector<uint32_t>* histogram_symbols) {
   PROFILER_FUNC;
   out->clear();
@@ -92,7 +102,26 @@ void FastClusterHistograms(const std::vector<Histogram>& in,
   histogram_symbols->clear();
   histogram_symbols->resize(in.size(), max_histograms);
 
+  const size_t num_tasks = DivCeil(in.size(), kHistogramsPerTask);
+  // Calls func(i) for every input histogram, in parallel if there is enough
+  // work to split.
+  const auto for_all_histograms = [&](const std::function<void(size_t)>& func,
+                                      const char* caller) {
+    const auto process_task = [&](const uint32_t task, size_t /*thread*/) {
+      const size_t begin = task * kHistogramsPerTask;
+      const size_t end = std::min(in.size(), begin + kHistogramsPerTask);
+      for (size_t i = begin; i < end; i++) func(i);
+    };
+    JXL_CHECK(RunOnPool(num_tasks > 1 ? pool : nullptr, 0, num_tasks,
+                        ThreadPool::NoInit, process_task, caller));
+  };
+
   std::vector<float> dists(in.size(), std::numeric_limits<float>::max());
+  for_all_histograms(
+      [&](size_t i) {
+        if (in[i].total_count_ != 0) HistogramEntropy(in[i]);
+      },
+      "HistogramEntropy");
   size_t largest_idx = 0;
   for (size_t i = 0; i < in.size(); i++) {
     if (in[i].total_count_ == 0) {
@@ -100,7 +129,6 @@ void FastClusterHistograms(const std::vector<Histogram>& in,
       dists[i] = 0.0f;
       continue;
     }
-    HistogramEntropy(in[i]);
     if (in[i].total_count_ > in[largest_idx].total_count_) {
       largest_idx = i;
     }
@@ -111,17 +139,22 @@ void FastClusterHistograms(const std::vector<Histogram>& in,
     (*histogram_symbols)[largest_idx] = out->size();
     out->push_back(in[largest_idx]);
     dists[largest_idx] = 0.0f;
+    const Histogram& last = out->back();
+    for_all_histograms(
+        [&](size_t i) {
+          if (dists[i] == 0.0f) return;
+          dists[i] = std::min(HistogramDistance(in[i], last), dists[i]);
+        },
+        "HistogramDistance");
     largest_idx = 0;
     for (size_t i = 0; i < in.size(); i++) {
       if (dists[i] == 0.0f) continue;
-      dists[i] = std::min(HistogramDistance(in[i], out->back()), dists[i]);
       if (dists[i] > dists[largest_idx]) largest_idx = i;
     }
     if (dists[largest_idx] < kMinDistanceForDistinct) break;
   }
 
-  for (size_t i = 0; i < in.size(); i++) {
-    if ((*histogram_symbols)[i] != max_histograms) continue;
+  const auto closest_cluster = [&](size_t i) {
     size_t best = 0;
     float best_dist = HistogramDistance(in[i], (*out)[best]);
     for (size_t j = 1; j < out->size(); j++) {
@@ -131,9 +164,65 @@ void FastClusterHistograms(const std::vector<Histogram>& in,
         best_dist = dist;
       }
     }
+    return best;
+  };
+
+  const auto assign = [&](size_t i, size_t best) {
     (*out)[best].AddHistogram(in[i]);
     HistogramEntropy((*out)[best]);
     (*histogram_symbols)[i] = best;
+  };
+
+  if (pool == nullptr || out->size() <= kHistogramsPerBlock) {
+    for (size_t i = 0; i < in.size(); i++) {
+      if ((*histogram_symbols)[i] != max_histograms) continue;
+      assign(i, closest_cluster(i));
+    }
+    return;
+  }
+
+  // Each histogram has to be compared with the clusters as updated by all the
+  // previous assignments. Blocks of histograms are compared with all clusters
+  // in parallel; then, going through the block in order, only the distances
+  // to the clusters that changed within the block are recomputed. This gives
+  // the same result as the sequential loop above.
+  const size_t num_clusters = out->size();
+  std::vector<size_t> block;
+  std::vector<float> block_dists(kHistogramsPerBlock * num_clusters);
+  std::vector<uint8_t> changed(num_clusters);
+  for (size_t begin = 0; begin < in.size();) {
+    block.clear();
+    for (; begin < in.size() && block.size() < kHistogramsPerBlock; begin++) {
+      if ((*histogram_symbols)[begin] == max_histograms) block.push_back(begin);
+    }
+    JXL_CHECK(RunOnPool(
+        pool, 0, block.size(), ThreadPool::NoInit,
+        [&](const uint32_t k, size_t /*thread*/) {
+          for (size_t j = 0; j < num_clusters; j++) {
+            block_dists[k * num_clusters + j] =
+                HistogramDistance(in[block[k]], (*out)[j]);
+          }
+        },
+        "HistogramDistance"));
+    std::fill(changed.begin(), changed.end(), 0);
+    for (size_t k = 0; k < block.size(); k++) {
+      const size_t i = block[k];
+      const float* dists_k = &block_dists[k * num_clusters];
+      const auto dist = [&](size_t j) {
+        return changed[j] ? HistogramDistance(in[i], (*out)[j]) : dists_k[j];
+      };
+      size_t best = 0;
+      float best_dist = dist(best);
+      for (size_t j = 1; j < num_clusters; j++) {
+        float d = dist(j);
+        if (d < best_dist) {
+          best = j;
+          best_dist = d;
+        }
+      }
+      assign(i, best);
+      changed[best] = 1;
+    }
   }
 }
 
@@ -192,13 +281,16 @@ void ClusterHistograms(const HistogramParams params,
   }
 
   HWY_DYNAMIC_DISPATCH(FastClusterHistograms)
-  (in, max_histograms, out, histogram_symbols);
+  (in, max_histograms, params.pool, out, histogram_symbols);
 
   if (params.clustering == HistogramParams::ClusteringType::kBest) {
-    for (size_t i = 0; i < out->size(); i++) {
-      (*out)[i].entropy_ =
-          ANSPopulationCost((*out)[i].data_.data(), (*out)[i].data_.size());
-    }
+    const uint32_t num_clusters = out->size();
+    JXL_CHECK(RunOnPool(
+        params.pool, 0, num_clusters, ThreadPool::NoInit,
+        [&](const uint32_t i, size_t /*thread*/) {
+          (*out)[i].entropy_ = (*out)[i].PopulationCost();
+        },
+        "ClusterEntropy"));
     uint32_t next_version = 2;
     std::vector<uint32_t> version(out->size(), 1);
     std::vector<uint32_t> renumbering(out->size());
@@ -221,24 +313,37 @@ void ClusterHistograms(const HistogramParams params,
       }
     };
 
-    // Create list of all pairs by increasing merging cost.
+    const auto pair_cost = [&](uint32_t i, uint32_t j) {
+      Histogram histo;
+      histo.AddHistogram((*out)[i]);
+      histo.AddHistogram((*out)[j]);
+      return histo.PopulationCost() - (*out)[i].entropy_ - (*out)[j].entropy_;
+    };
+
+    // Create list of all pairs by increasing merging cost. Each task computes
+    // the costs of one row of the (upper triangular) pair matrix.
     std::priority_queue<HistogramPair> pairs_to_merge;
-    for (uint32_t i = 0; i < out->size(); i++) {
-      for (uint32_t j = i + 1; j < out->size(); j++) {
-        Histogram histo;
-        histo.AddHistogram((*out)[i]);
-        histo.AddHistogram((*out)[j]);
-        float cost = ANSPopulationCost(histo.data_.data(), histo.data_.size()) -
-                     (*out)[i].entropy_ - (*out)[j].entropy_;
-        // Avoid enqueueing pairs that are not advantageous to merge.
-        if (cost >= 0) continue;
-        pairs_to_merge.push(
-            HistogramPair{cost, i, j, std::max(version[i], version[j])});
-      }
+    std::vector<std::vector<HistogramPair>> row_pairs(num_clusters);
+    JXL_CHECK(RunOnPool(
+        params.pool, 0, num_clusters, ThreadPool::NoInit,
+        [&](const uint32_t i, size_t /*thread*/) {
+          for (uint32_t j = i + 1; j < num_clusters; j++) {
+            float cost = pair_cost(i, j);
+            // Avoid enqueueing pairs that are not advantageous to merge.
+            if (cost >= 0) continue;
+            row_pairs[i].push_back(
+                HistogramPair{cost, i, j, std::max(version[i], version[j])});
+          }
+        },
+        "ClusterPairCosts"));
+    for (const auto& row : row_pairs) {
+      for (const HistogramPair& pair : row) pairs_to_merge.push(pair);
     }
 
     // Merge the best pair to merge, add new pairs that get formed as a
     // consequence.
+    // Costs of merging the last merged cluster with each other live cluster.
+    std::vector<float> merge_cost(num_clusters);
     while (!pairs_to_merge.empty()) {
       uint32_t first = pairs_to_merge.top().first;
       uint32_t second = pairs_to_merge.top().second;
@@ -249,8 +354,7 @@ void ClusterHistograms(const HistogramParams params,
         continue;
       }
       (*out)[first].AddHistogram((*out)[second]);
-      (*out)[first].entropy_ = ANSPopulationCost((*out)[first].data_.data(),
-                                                 (*out)[first].data_.size());
+      (*out)[first].entropy_ = (*out)[first].PopulationCost();
       for (size_t i = 0; i < renumbering.size(); i++) {
         if (renumbering[i] == second) {
           renumbering[i] = first;
@@ -258,19 +362,20 @@ void ClusterHistograms(const HistogramParams params,
       }
       version[second] = 0;
       version[first] = next_version++;
-      for (uint32_t j = 0; j < out->size(); j++) {
-        if (j == first) continue;
-        if (version[j] == 0) continue;
-        Histogram histo;
-        histo.AddHistogram((*out)[first]);
-        histo.AddHistogram((*out)[j]);
-        float cost = ANSPopulationCost(histo.data_.data(), histo.data_.size()) -
-                     (*out)[first].entropy_ - (*out)[j].entropy_;
+      JXL_CHECK(RunOnPool(
+          params.pool, 0, num_clusters, ThreadPool::NoInit,
+          [&](const uint32_t j, size_t /*thread*/) {
+            merge_cost[j] = (j == first || version[j] == 0)
+                                ? 0.0f
+                                : pair_cost(first, j);
+          },
+          "ClusterMergeCosts"));
+      for (uint32_t j = 0; j < num_clusters; j++) {
         // Avoid enqueueing pairs that are not advantageous to merge.
-        if (cost >= 0) continue;
-        pairs_to_merge.push(
-            HistogramPair{cost, std::min(first, j), std::max(first, j),
-                          std::max(version[first], version[j])});
+        if (merge_cost[j] >= 0) continue;
+        pairs_to_merge.push(HistogramPair{
+            merge_cost[j], std::min(first, j), std::max(first, j),
+            std::max(version[first], version[j])});
       }
     }
     std::vector<uint32_t> reverse_renumbering(out->size(), -1);
@@ -6,6 +6,7 @@
 #include "lib/jxl/enc_detect_dots.h"
 
 #include <stdint.h>
+#include <string.h>
 
 #include <algorithm>
 #include <array>
@@ -298,14 +299,29 @@ Rect BoundingRectangle(const std::vector<Pixel>& pixels) {
 
 std::vector<ConnectedComponent> FindCC(const ImageF& energy, double t_low,
                                        double t_high, uint32_t maxWindow,
-                                       double minScore) {
+                                       double minScore, ThreadPool* pool) {
   PROFILER_FUNC;
   const int kExtraRect = 4;
-  ImageF img = CopyImage(energy);
-  std::vector<ConnectedComponent> ans;
+  ImageF img(energy.xsize(), energy.ysize());
+  // Candidate seeds of each row. Extracting a component only ever clears
+  // pixels, so seeds are found in parallel up front and the (order dependent)
+  // extraction below only visits those.
+  std::vector<std::vector<uint32_t>> seeds(img.ysize());
+  JXL_CHECK(RunOnPool(
+      pool, 0, img.ysize(), ThreadPool::NoInit,
+      [&](const uint32_t y, size_t /*thread*/) {
+        const float* JXL_RESTRICT erow = energy.ConstRow(y);
+        float* JXL_RESTRICT row = img.Row(y);
+        memcpy(row, erow, img.xsize() * sizeof(*row));
+        for (size_t x = 0; x < img.xsize(); x++) {
+          if (row[x] > t_high) seeds[y].push_back(x);
+        }
+      },
+      "FindCCSeeds"));
+  std::vector<ConnectedComponent> candidates;
   for (size_t y = 0; y < img.ysize(); y++) {
     float* JXL_RESTRICT row = img.Row(y);
-    for (size_t x = 0; x < img.xsize(); x++) {
+    for (uint32_t x : seeds[y]) {
       if (row[x] > t_high) {
         std::vector<Pixel> pixels;
         row[x] = 0.0;
@@ -321,20 +337,28 @@ std::vector<ConnectedComponent> FindCC(const ImageF& energy, double t_low,
 #endif  // JXL_DEBUG_DOT_DETECT
         Rect bounds = BoundingRectangle(pixels);
         if (bounds.xsize() < maxWindow && bounds.ysize() < maxWindow) {
-          ConnectedComponent cc{bounds, std::move(pixels)};
-          cc.CompStats(energy, kExtraRect);
-          if (cc.score < minScore) continue;
-          JXL_DEBUG(JXL_DEBUG_DOT_DETECT,
-                    "cc mode: (%d,%d), max: %f, bgMean: %f bgVar: "
-                    "%f bound:(%" PRIuS ",%" PRIuS ",%" PRIuS ",%" PRIuS ")\n",
-                    cc.mode.x, cc.mode.y, cc.maxEnergy, cc.meanEnergy,
-                    cc.varEnergy, cc.bounds.x0(), cc.bounds.y0(),
-                    cc.bounds.xsize(), cc.bounds.ysize());
-          ans.push_back(cc);
+          candidates.emplace_back(bounds, std::move(pixels));
         }
       }
     }
   }
+  JXL_CHECK(RunOnPool(
+      pool, 0, candidates.size(), ThreadPool::NoInit,
+      [&](const uint32_t i, size_t /*thread*/) {
+        candidates[i].CompStats(energy, kExtraRect);
+      },
+      "CompStats"));
+  std::vector<ConnectedComponent> ans;
+  for (ConnectedComponent& cc : candidates) {
+    if (cc.score < minScore) continue;
+    JXL_DEBUG(JXL_DEBUG_DOT_DETECT,
+              "cc mode: (%d,%d), max: %f, bgMean: %f bgVar: "
+              "%f bound:(%" PRIuS ",%" PRIuS ",%" PRIuS ",%" PRIuS ")\n",
+              cc.mode.x, cc.mode.y, cc.maxEnergy, cc.meanEnergy, cc.varEnergy,
+              cc.bounds.x0(), cc.bounds.y0(), cc.bounds.xsize(),
+              cc.bounds.ysize());
+    ans.push_back(std::move(cc));
+  }
   return ans;
 }
 
@@ -555,8 +579,9 @@ std::vector<PatchInfo> DetectGaussianEllipses(
   aux.DumpXybImage("smooth", smooth);
   aux.DumpPlaneNormalized("energy", energy);
 #endif  // JXL_DEBUG_DOT_DETECT
-  std::vector<ConnectedComponent> components = FindCC(
-      energy, params.t_low, params.t_high, params.maxWinSize, params.minScore);
+  std::vector<ConnectedComponent> components =
+      FindCC(energy, params.t_low, params.t_high, params.maxWinSize,
+             params.minScore, pool);
   size_t numCC =
       std::min(params.maxCC, (components.size() * params.percCC) / 100);
   if (components.size() > numCC) {
@@ -567,8 +592,16 @@ std::vector<PatchInfo> DetectGaussianEllipses(
         });
     components.erase(components.begin() + numCC, components.end());
   }
-  for (const auto& cc : components) {
-    GaussianEllipse ellipse = FitGaussian(cc, energy, opsin, smooth);
+  std::vector<GaussianEllipse> ellipses(components.size());
+  JXL_CHECK(RunOnPool(
+      pool, 0, components.size(), ThreadPool::NoInit,
+      [&](const uint32_t i, size_t /*thread*/) {
+        ellipses[i] = FitGaussian(components[i], energy, opsin, smooth);
+      },
+      "FitGaussian"));
+  for (size_t i = 0; i < components.size(); i++) {
+    const ConnectedComponent& cc = components[i];
+    const GaussianEllipse& ellipse = ellipses[i];
     if (ellipse.x < 0.0 ||
         std::ceil(ellipse.x) >= static_cast<double>(opsin.xsize()) ||
         ellipse.y < 0.0 ||
@@ -64,6 +64,7 @@
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer.h"
 #include "lib/jxl/splines.h"
+#include "lib/jxl/stage_stats.h"
 #include "lib/jxl/toc.h"
 
 namespace jxl {
@@ -534,23 +535,36 @@ class LossyFrameEncoder {
       }
     }
 
-    JXL_RETURN_IF_ERROR(enc_state_->heuristics->LossyFrameHeuristics(
-        enc_state_, modular_frame_encoder, linear, opsin, cms_, pool_,
-        aux_out_));
+    StageStats* stage_stats = enc_state_->stage_stats;
+    {
+      StageScope stage(stage_stats, "Lossy heuristics", /*bytes=*/0,
+                       /*pixels=*/opsin->xsize() * opsin->ysize());
+      JXL_RETURN_IF_ERROR(enc_state_->heuristics->LossyFrameHeuristics(
+          enc_state_, modular_frame_encoder, linear, opsin, cms_, pool_,
+          aux_out_));
+    }
 
-    JXL_RETURN_IF_ERROR(InitializePassesEncoder(
-        *opsin, cms, pool_, enc_state_, modular_frame_encoder, aux_out_));
+    {
+      StageScope stage(stage_stats, "Coefficients", /*bytes=*/0,
+                       /*pixels=*/opsin->xsize() * opsin->ysize());
+      JXL_RETURN_IF_ERROR(InitializePassesEncoder(
+          *opsin, cms, pool_, enc_state_, modular_frame_encoder, aux_out_));
+    }
 
     enc_state_->passes.resize(enc_state_->progressive_splitter.GetNumPasses());
     for (PassesEncoderState::PassData& pass : enc_state_->passes) {
       pass.ac_tokens.resize(shared.frame_dim.num_groups);
+      // Tokens are appended; keep the capacity of those of a previous frame.
+      for (std::vector<Token>& group_tokens : pass.ac_tokens) {
+        group_tokens.clear();
+      }
     }
 
     ComputeAllCoeffOrders(shared.frame_dim);
     shared.num_histograms = 1;
 
     const auto tokenize_group_init = [&](const size_t num_threads) {
-      group_caches_.resize(num_threads);
+      enc_state_->group_caches.resize(num_threads);
       return true;
     };
     const auto tokenize_group = [&](const uint32_t group_index,
@@ -566,19 +580,21 @@ class LossyFrameEncoder {
             enc_state_->coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
         };
         // Ensure group cache is initialized.
-        group_caches_[thread].InitOnce();
+        enc_state_->group_caches[thread].InitOnce();
         TokenizeCoefficients(
             &shared.coeff_orders[idx_pass * shared.coeff_order_size], rect,
             ac_rows, shared.ac_strategy, frame_header->chroma_subsampling,
-            &group_caches_[thread].num_nzeroes,
+            &enc_state_->group_caches[thread].num_nzeroes,
             &enc_state_->passes[idx_pass].ac_tokens[group_index],
             enc_state_->shared.quant_dc, enc_state_->shared.raw_quant_field,
             enc_state_->shared.block_ctx_map);
       }
     };
+    StageScope tokenize_stage(stage_stats, "Tokenize");
     JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, shared.frame_dim.num_groups,
                                   tokenize_group_init, tokenize_group,
                                   "TokenizeGroup"));
+    tokenize_stage.Finish();
 
     *frame_header = shared.frame_header;
     return true;
@@ -605,9 +621,7 @@ class LossyFrameEncoder {
     shared.ac_strategy.FillDCT8();
     FillImage(uint8_t(0), &shared.epf_sharpness);
 
-    enc_state_->coeffs.clear();
-    enc_state_->coeffs.emplace_back(make_unique<ACImageT<int32_t>>(
-        kGroupDim * kGroupDim, frame_dim.num_groups));
+    enc_state_->InitCoefficients(/*num_passes=*/1, frame_dim.num_groups);
 
     // convert JPEG quantization table to a Quantizer object
     float dcquantization[3];
@@ -755,28 +769,37 @@ class LossyFrameEncoder {
       ZeroFillImage(&dc);
       enc_state_->coeffs[0]->ZeroFill();
     }
-    // JPEG DC is from -1024 to 1023.
-    std::vector<size_t> dc_counts[3] = {};
-    dc_counts[0].resize(2048);
-    dc_counts[1].resize(2048);
-    dc_counts[2].resize(2048);
-    size_t total_dc[3] = {};
-    for (size_t c : {1, 0, 2}) {
-      if (jpeg_data.components.size() == 1 && c != 1) {
+    if (jpeg_data.components.size() == 1) {
+      for (size_t c : {0, 2}) {
         enc_state_->coeffs[0]->ZeroFillPlane(c);
         ZeroFillImage(&dc.Plane(c));
-        // Ensure no division by 0.
-        dc_counts[c][1024] = 1;
-        total_dc[c] = 1;
-        continue;
       }
-      size_t hshift = frame_header->chroma_subsampling.HShift(c);
-      size_t vshift = frame_header->chroma_subsampling.VShift(c);
-      ImageSB& map = (c == 0 ? shared.cmap.ytox_map : shared.cmap.ytob_map);
-      for (size_t group_index = 0; group_index < frame_dim.num_groups;
-           group_index++) {
-        const size_t gx = group_index % frame_dim.xsize_groups;
-        const size_t gy = group_index / frame_dim.xsize_groups;
+    }
+    // At the fastest speed tiers, use a static block context map instead of
+    // splitting blocks by DC value; this skips the DC histograms entirely.
+    const bool static_ctx_map =
+        enc_state_->cparams.speed_tier >= SpeedTier::kThunder;
+    // JPEG DC is from -1024 to 1023. Histograms are accumulated per thread
+    // and merged after the groups have been converted.
+    std::vector<std::vector<size_t>> thread_dc_counts;
+    const auto convert_group_init = [&](const size_t num_threads) {
+      thread_dc_counts.clear();
+      thread_dc_counts.resize(num_threads,
+                              std::vector<size_t>(static_ctx_map ? 0 : 3 * 2048));
+      return true;
+    };
+    const auto convert_group = [&](const uint32_t group_index,
+                                   const size_t thread) {
+      size_t* JXL_RESTRICT dc_counts =
+          static_ctx_map ? nullptr : thread_dc_counts[thread].data();
+      const size_t gx = group_index % frame_dim.xsize_groups;
+      const size_t gy = group_index / frame_dim.xsize_groups;
+      for (size_t c : {1, 0, 2}) {
+        if (jpeg_data.components.size() == 1 && c != 1) continue;
+        size_t hshift = frame_header->chroma_subsampling.HShift(c);
+        size_t vshift = frame_header->chroma_subsampling.VShift(c);
+        const ImageSB& map =
+            (c == 0 ? shared.cmap.ytox_map : shared.cmap.ytob_map);
         size_t offset = 0;
         int32_t* JXL_RESTRICT ac =
             enc_state_->coeffs[0]->PlaneRow(c, group_index, 0).ptr32;
@@ -798,9 +821,10 @@ class LossyFrameEncoder {
             } else {
               idc = inputjpeg[base] + 1024 / qt[c * 64];
             }
-            dc_counts[c][std::min(static_cast<uint32_t>(idc + 1024),
-                                  uint32_t(2047))]++;
-            total_dc[c]++;
+            if (dc_counts != nullptr) {
+              dc_counts[c * 2048 + std::min(static_cast<uint32_t>(idc + 1024),
+                                            uint32_t(2047))]++;
+            }
             fdc[bx >> hshift] = idc * dcquantization_r[c];
             if (c == 1 || !enc_state_->cparams.force_cfl_jpeg_recompression ||
                 !frame_header->chroma_subsampling.Is444()) {
@@ -834,24 +858,42 @@ class LossyFrameEncoder {
           }
         }
       }
-    }
+    };
+    JXL_RETURN_IF_ERROR(RunOnPool(pool_, 0, frame_dim.num_groups,
+                                  convert_group_init, convert_group,
+                                  "ConvertJPEGCoefficients"));
 
     auto& dct = enc_state_->shared.block_ctx_map.dc_thresholds;
     auto& num_dc_ctxs = enc_state_->shared.block_ctx_map.num_dc_ctxs;
     num_dc_ctxs = 1;
     for (size_t i = 0; i < 3; i++) {
       dct[i].clear();
-      int num_thresholds = (CeilLog2Nonzero(total_dc[i]) - 12) / 2;
+      if (static_ctx_map) continue;
+      std::vector<size_t> dc_counts(2048);
+      size_t total_dc = 0;
+      if (jpeg_data.components.size() == 1 && i != 1) {
+        // Ensure no division by 0.
+        dc_counts[1024] = 1;
+        total_dc = 1;
+      } else {
+        for (const std::vector<size_t>& counts : thread_dc_counts) {
+          for (size_t j = 0; j < 2048; j++) {
+            dc_counts[j] += counts[i * 2048 + j];
+            total_dc += counts[i * 2048 + j];
+          }
+        }
+      }
+      int num_thresholds = (CeilLog2Nonzero(total_dc) - 12) / 2;
       // up to 3 buckets per channel:
       // dark/medium/bright, yellow/unsat/blue, green/unsat/red
       num_thresholds = std::min(std::max(num_thresholds, 0), 2);
       size_t cumsum = 0;
-      size_t cut = total_dc[i] / (num_thresholds + 1);
+      size_t cut = total_dc / (num_thresholds + 1);
       for (int j = 0; j < 2048; j++) {
-        cumsum += dc_counts[i][j];
+        cumsum += dc_counts[j];
         if (cumsum > cut) {
           dct[i].push_back(j - 1025);
-          cut = total_dc[i] * (dct[i].size() + 1) / (num_thresholds + 1);
+          cut = total_dc * (dct[i].size() + 1) / (num_thresholds + 1);
         }
       }
       num_dc_ctxs *= dct[i].size() + 1;
@@ -894,6 +936,10 @@ class LossyFrameEncoder {
     enc_state_->passes.resize(enc_state_->progressive_splitter.GetNumPasses());
     for (PassesEncoderState::PassData& pass : enc_state_->passes) {
       pass.ac_tokens.resize(shared.frame_dim.num_groups);
+      // Tokens are appended; keep the capacity of those of a previous frame.
+      for (std::vector<Token>& group_tokens : pass.ac_tokens) {
+        group_tokens.clear();
+      }
     }
 
     JXL_CHECK(enc_state_->passes.size() ==
@@ -903,7 +949,7 @@ class LossyFrameEncoder {
     shared.num_histograms = 1;
 
     const auto tokenize_group_init = [&](const size_t num_threads) {
-      group_caches_.resize(num_threads);
+      enc_state_->group_caches.resize(num_threads);
       return true;
     };
     const auto tokenize_group = [&](const uint32_t group_index,
@@ -919,11 +965,11 @@ class LossyFrameEncoder {
             enc_state_->coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
         };
         // Ensure group cache is initialized.
-        group_caches_[thread].InitOnce();
+        enc_state_->group_caches[thread].InitOnce();
         TokenizeCoefficients(
             &shared.coeff_orders[idx_pass * shared.coeff_order_size], rect,
             ac_rows, shared.ac_strategy, frame_header->chroma_subsampling,
-            &group_caches_[thread].num_nzeroes,
+            &enc_state_->group_caches[thread].num_nzeroes,
             &enc_state_->passes[idx_pass].ac_tokens[group_index],
             enc_state_->shared.quant_dc, enc_state_->shared.raw_quant_field,
             enc_state_->shared.block_ctx_map);
@@ -989,6 +1035,7 @@ class LossyFrameEncoder {
       if (enc_state_->cparams.decoding_speed_tier >= 1) {
         hist_params.max_histograms = 6;
       }
+      hist_params.pool = pool_;
       BuildAndEncodeHistograms(
           hist_params,
           enc_state_->shared.num_histograms *
@@ -1053,7 +1100,6 @@ class LossyFrameEncoder {
   JxlCmsInterface cms_;
   ThreadPool* pool_;
   AuxOut* aux_out_;
-  std::vector<EncCache> group_caches_;
   bool doing_jpeg_recompression = false;
 };
 
@@ -1104,9 +1150,13 @@ Status EncodeFrame(const CompressParams& cparams_orig,
     float error = 0.0f;
     float best_error = 100.0f;
     float best_rescale = 1.0f;
+    // Each iteration starts from a clean state, but reuses the buffers of the
+    // previous one.
+    std::unique_ptr<PassesEncoderState> state =
+        jxl::make_unique<PassesEncoderState>();
     for (size_t i = 0; i < 10; ++i) {
-      std::unique_ptr<PassesEncoderState> state =
-          jxl::make_unique<PassesEncoderState>();
+      state->Reset();
+      state->stage_stats = passes_enc_state->stage_stats;
       BitWriter bw;
       JXL_CHECK(EncodeFrame(cparams, frame_info, metadata, ib, state.get(), cms,
                             pool, &bw, nullptr));
@@ -1284,6 +1334,8 @@ Status EncodeFrame(const CompressParams& cparams_orig,
       // linear_storage would only be used by the Butteraugli loop (passing
       // linear sRGB avoids a color conversion there). Otherwise, don't
       // fill it to reduce memory usage.
+      StageScope stage(passes_enc_state->stage_stats, "Color transform",
+                       /*bytes=*/0, /*pixels=*/ib.xsize() * ib.ysize());
       ib_or_linear =
           ToXYB(ib, pool, &opsin, cms, want_linear ? &linear_storage : nullptr);
     } else {  // RGB or YCbCr: don't do anything (forward YCbCr is not
@@ -1332,10 +1384,13 @@ Status EncodeFrame(const CompressParams& cparams_orig,
     }
   }
   // needs to happen *AFTER* VarDCT-ComputeEncodingData.
-  JXL_RETURN_IF_ERROR(modular_frame_encoder->ComputeEncodingData(
-      *frame_header, *ib.metadata(), &opsin, *extra_channels,
-      lossy_frame_encoder.State(), cms, pool, aux_out,
-      /* do_color=*/frame_header->encoding == FrameEncoding::kModular));
+  {
+    StageScope stage(passes_enc_state->stage_stats, "Modular");
+    JXL_RETURN_IF_ERROR(modular_frame_encoder->ComputeEncodingData(
+        *frame_header, *ib.metadata(), &opsin, *extra_channels,
+        lossy_frame_encoder.State(), cms, pool, aux_out,
+        /* do_color=*/frame_header->encoding == FrameEncoding::kModular));
+  }
 
   writer->AppendByteAligned(lossy_frame_encoder.State()->special_frames);
   frame_header->UpdateFlag(
@@ -1399,7 +1454,7 @@ Status EncodeFrame(const CompressParams& cparams_orig,
         lossy_frame_encoder.EncodeGlobalDCInfo(*frame_header, get_output(0)));
   }
   JXL_RETURN_IF_ERROR(
-      modular_frame_encoder->EncodeGlobalInfo(get_output(0), aux_out));
+      modular_frame_encoder->EncodeGlobalInfo(get_output(0), aux_out, pool));
   JXL_RETURN_IF_ERROR(modular_frame_encoder->EncodeStream(
       get_output(0), aux_out, kLayerModularGlobal, ModularStreamId::Global()));
 
@@ -1407,6 +1462,8 @@ Status EncodeFrame(const CompressParams& cparams_orig,
                                     const size_t thread) {
     AuxOut* my_aux_out = aux_out ? &aux_outs[thread] : nullptr;
     BitWriter* output = get_output(group_index + 1);
+    StageScope stage(passes_enc_state->stage_stats, "DC group");
+    const size_t bits_before = output->BitsWritten();
     if (frame_header->encoding == FrameEncoding::kVarDCT &&
         !(frame_header->flags & FrameHeader::kUseDcFrame)) {
       BitWriter::Allotment allotment(output, 2);
@@ -1433,6 +1490,7 @@ Status EncodeFrame(const CompressParams& cparams_orig,
           output, my_aux_out, kLayerControlFields,
           ModularStreamId::ACMetadata(group_index)));
     }
+    stage.SetBytes((output->BitsWritten() - bits_before) / kBitsPerByte);
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, frame_dim.num_dc_groups,
                                 resize_aux_outs, process_dc_group,
@@ -1447,8 +1505,13 @@ Status EncodeFrame(const CompressParams& cparams_orig,
   const auto process_group = [&](const uint32_t group_index,
                                  const size_t thread) {
     AuxOut* my_aux_out = aux_out ? &aux_outs[thread] : nullptr;
+    const Rect group_rect = passes_enc_state->shared.GroupRect(group_index);
+    StageScope stage(passes_enc_state->stage_stats, "AC group", /*bytes=*/0,
+                     /*pixels=*/group_rect.xsize() * group_rect.ysize());
+    size_t bits = 0;
 
     for (size_t i = 0; i < num_passes; i++) {
+      const size_t bits_before = ac_group_code(i, group_index)->BitsWritten();
       if (frame_header->encoding == FrameEncoding::kVarDCT) {
         if (!lossy_frame_encoder.EncodeACGroup(
                 i, group_index, ac_group_code(i, group_index), my_aux_out)) {
@@ -1463,7 +1526,9 @@ Status EncodeFrame(const CompressParams& cparams_orig,
         num_errors.fetch_add(1, std::memory_order_relaxed);
         return;
       }
+      bits += ac_group_code(i, group_index)->BitsWritten() - bits_before;
     }
+    stage.SetBytes(bits / kBitsPerByte);
   };
   JXL_RETURN_IF_ERROR(RunOnPool(pool, 0, num_groups, resize_aux_outs,
                                 process_group, "EncodeGroupCoefficients"));
@@ -5,6 +5,8 @@
 
 #include "lib/jxl/enc_group.h"
 
+#include <string.h>
+
 #include <utility>
 
 #include "hwy/aligned_allocator.h"
@@ -234,6 +236,9 @@ void ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
   auto fmem = hwy::AllocateAligned<float>(5 * AcStrategy::kMaxCoeffArea);
   float* JXL_RESTRICT scratch_space =
       fmem.get() + 3 * AcStrategy::kMaxCoeffArea;
+  constexpr size_t kBatch = AcStrategy::kDCT8BatchSize;
+  auto batch_mem = hwy::AllocateAligned<float>(3 * kBatch * kDCTBlockSize);
+  float* JXL_RESTRICT batch_coeffs = batch_mem.get();
   {
     // Only use error diffusion in Squirrel mode or slower.
     const bool error_diffusion = cparams.speed_tier <= SpeedTier::kSquirrel;
@@ -276,6 +281,9 @@ void ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
       };
       AcStrategyRow ac_strategy_row =
           enc_state->shared.ac_strategy.ConstRow(block_group_rect, by);
+      // Blocks of this row whose DCT8 is in batch_coeffs.
+      size_t batch_begin = 0;
+      size_t batch_end = 0;
       for (size_t tx = 0; tx < DivCeil(xsize_blocks, kColorTileDimInBlocks);
            tx++) {
         const auto x_factor =
@@ -294,10 +302,46 @@ void ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
 
           size_t size = kDCTBlockSize * xblocks * yblocks;
 
+          // The AC strategy search might have kept the transforms.
+          bool cached = enc_state->transform_cache.Load(
+              acs, block_group_rect.x0() + bx, block_group_rect.y0() + by,
+              opsin, coeffs_in);
+
+          // Otherwise, runs of DCT8 blocks are transformed kBatch at a time.
+          if (!cached && acs.Strategy() == AcStrategy::Type::DCT) {
+            if (bx >= batch_end && bx + kBatch <= xsize_blocks) {
+              size_t n = 1;
+              while (n < kBatch && ac_strategy_row[bx + n].Strategy() ==
+                                       AcStrategy::Type::DCT) {
+                n++;
+              }
+              if (n == kBatch) {
+                for (size_t c = 0; c < 3; c++) {
+                  TransformFromPixelsDCT8Batch(
+                      opsin_rows[c] + bx * kBlockDim, opsin_stride,
+                      batch_coeffs + c * kBatch * kDCTBlockSize, scratch_space);
+                }
+                batch_begin = bx;
+                batch_end = bx + kBatch;
+              }
+            }
+            if (bx < batch_end) {
+              for (size_t c = 0; c < 3; c++) {
+                memcpy(coeffs_in + c * kDCTBlockSize,
+                       batch_coeffs +
+                           (c * kBatch + bx - batch_begin) * kDCTBlockSize,
+                       kDCTBlockSize * sizeof(float));
+              }
+              cached = true;
+            }
+          }
+
           // DCT Y channel, roundtrip-quantize it and set DC.
           int32_t quant_ac = row_quant_ac[bx];
-          TransformFromPixels(acs.Strategy(), opsin_rows[1] + bx * kBlockDim,
-                              opsin_stride, coeffs_in + size, scratch_space);
+          if (!cached) {
+            TransformFromPixels(acs.Strategy(), opsin_rows[1] + bx * kBlockDim,
+                                opsin_stride, coeffs_in + size, scratch_space);
+          }
           DCFromLowestFrequencies(acs.Strategy(), coeffs_in + size,
                                   dc_rows[1] + bx, dc_stride);
           QuantizeRoundtripYBlockAC(enc_state->shared.quantizer,
@@ -306,10 +350,12 @@ void ComputeCoefficients(size_t group_idx, PassesEncoderState* enc_state,
                                     coeffs_in + size, quantized + size);
 
           // DCT X and B channels
-          for (size_t c : {0, 2}) {
-            TransformFromPixels(acs.Strategy(), opsin_rows[c] + bx * kBlockDim,
-                                opsin_stride, coeffs_in + c * size,
-                                scratch_space);
+          if (!cached) {
+            for (size_t c : {0, 2}) {
+              TransformFromPixels(acs.Strategy(),
+                                  opsin_rows[c] + bx * kBlockDim, opsin_stride,
+                                  coeffs_in + c * size, scratch_space);
+            }
           }
 
           // Unapply color correlation
@@ -705,6 +705,7 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
 
   CompressParams& cparams = enc_state->cparams;
   PassesSharedState& shared = enc_state->shared;
+  StageStats* stage_stats = enc_state->stage_stats;
 
   // Compute parameters for noise synthesis.
   if (shared.frame_header.flags & FrameHeader::kNoise) {
@@ -765,18 +766,20 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
 
   // Find and subtract splines.
   if (cparams.speed_tier <= SpeedTier::kSquirrel) {
+    StageScope stage(stage_stats, "Splines");
     // If we do already have them, they were passed upstream to EncodeFile.
     if (!shared.image_features.splines.HasAny()) {
       shared.image_features.splines = FindSplines(*opsin);
     }
     JXL_RETURN_IF_ERROR(shared.image_features.splines.InitializeDrawCache(
         opsin->xsize(), opsin->ysize(), shared.cmap));
-    shared.image_features.splines.SubtractFrom(opsin);
+    shared.image_features.splines.SubtractFrom(opsin, pool);
   }
 
   // Find and subtract patches/dots.
   if (ApplyOverride(cparams.patches,
                     cparams.speed_tier <= SpeedTier::kSquirrel)) {
+    StageScope stage(stage_stats, "Patches");
     FindBestPatchDictionary(*opsin, enc_state, cms, pool, aux_out);
     PatchDictionaryEncoder::SubtractFrom(shared.image_features.patches, opsin);
   }
@@ -833,6 +836,7 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
                   : kAcQuant / cparams.butteraugli_distance;
     FillImage(q, &enc_state->initial_quant_field);
   } else {
+    StageScope stage(stage_stats, "Initial quant field");
     // Call this here, as it relies on pre-gaborish values.
     float butteraugli_distance_for_iqf = cparams.butteraugli_distance;
     if (!shared.frame_header.loop_filter.gab) {
@@ -848,6 +852,7 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
 
   // Apply inverse-gaborish.
   if (shared.frame_header.loop_filter.gab) {
+    StageScope stage(stage_stats, "Gaborish");
     GaborishInverse(opsin, 0.9908511000000001f, pool);
   }
 
@@ -873,6 +878,7 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
     // For speeds up to Wombat, we only compute the color correlation map
     // once we know the transform type and the quantization map.
     if (cparams.speed_tier <= SpeedTier::kSquirrel) {
+      StageScope stage(stage_stats, "CfL");
       cfl_heuristics.ComputeTile(r, *opsin, enc_state->shared.matrices,
                                  /*ac_strategy=*/nullptr,
                                  /*quantizer=*/nullptr, /*fast=*/false, thread,
@@ -880,11 +886,18 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
     }
 
     // Choose block sizes.
-    acs_heuristics.ProcessRect(r);
+    {
+      StageScope stage(stage_stats, "AC strategy", /*bytes=*/0,
+                       /*pixels=*/r.xsize() * r.ysize() * kDCTBlockSize);
+      acs_heuristics.ProcessRect(r);
+    }
 
     // Choose amount of post-processing smoothing.
     // TODO(veluca): should this go *after* AdjustQuantField?
-    ar_heuristics.RunRect(r, *opsin, enc_state, thread);
+    {
+      StageScope stage(stage_stats, "AR control field");
+      ar_heuristics.RunRect(r, *opsin, enc_state, thread);
+    }
 
     // Always set the initial quant field, so we can compute the CfL map with
     // more accuracy. The initial quant field might change in slower modes, but
@@ -897,6 +910,7 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
 
     // Compute a non-default CfL map if we are at Hare speed, or slower.
     if (cparams.speed_tier <= SpeedTier::kHare) {
+      StageScope stage(stage_stats, "CfL");
       cfl_heuristics.ComputeTile(
           r, *opsin, enc_state->shared.matrices, &enc_state->shared.ac_strategy,
           &enc_state->shared.quantizer,
@@ -923,7 +937,10 @@ Status DefaultEncoderHeuristics::LossyFrameHeuristics(
   }
 
   // Refine quantization levels.
-  FindBestQuantizer(original_pixels, *opsin, enc_state, cms, pool, aux_out);
+  {
+    StageScope stage(stage_stats, "Quantizer search");
+    FindBestQuantizer(original_pixels, *opsin, enc_state, cms, pool, aux_out);
+  }
 
   // Choose a context model that depends on the amount of quantization for AC.
   if (cparams.speed_tier < SpeedTier::kFalcon) {
@@ -481,7 +481,7 @@ Status ModularFrameEncoder::ComputeEncodingData(
   if (do_color && metadata.bit_depth.bits_per_sample <= 16 &&
       cparams_.speed_tier < SpeedTier::kCheetah &&
       cparams_.decoding_speed_tier < 2) {
-    FindBestPatchDictionary(*color, enc_state, cms, nullptr, aux_out,
+    FindBestPatchDictionary(*color, enc_state, cms, pool, aux_out,
                             cparams_.color_transform == ColorTransform::kXYB);
     PatchDictionaryEncoder::SubtractFrom(
         enc_state->shared.image_features.patches, color);
@@ -1125,7 +1125,8 @@ Status ModularFrameEncoder::PrepareEncoding(const FrameHeader& frame_header,
 }
 
 Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
-                                             AuxOut* aux_out) {
+                                             AuxOut* aux_out,
+                                             ThreadPool* pool) {
   BitWriter::Allotment allotment(writer, 1);
   // If we are using brotli, or not using modular mode.
   if (tree_tokens_.empty() || tree_tokens_[0].empty()) {
@@ -1177,6 +1178,10 @@ Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
     params.uint_method = HistogramParams::HybridUintMethod::k000;
     params.force_huffman = true;
   }
+  if (cparams_.options.lz77_max_chain_length != 0) {
+    params.lz77_max_chain_length = cparams_.options.lz77_max_chain_length;
+  }
+  params.pool = pool;
   BuildAndEncodeHistograms(params, kNumTreeContexts, tree_tokens_, &code_,
                            &context_map_, writer, kLayerModularTree, aux_out);
   WriteTokens(tree_tokens_[0], code_, context_map_, writer, kLayerModularTree,
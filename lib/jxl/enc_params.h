@@ -176,6 +176,11 @@ struct CompressParams {
 
   float quant_ac_rescale = 1.0;
 
+  // Keep the transforms computed by the AC strategy search (effort 5 and
+  // higher) for the coefficients. Costs 12 bytes per pixel until the
+  // coefficients are computed; the output is the same either way.
+  bool reuse_acs_transforms = true;
+
   // Codestream level to conform to.
   // -1: don't care
   int level = -1;
@@ -13,6 +13,7 @@
 #include <atomic>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -203,6 +204,22 @@ struct PatchColorspaceInfo {
   }
 };
 
+// Hash of the quantized pixels of a patch; equal patches have equal hashes.
+uint64_t PatchHash(const QuantizedPatch& patch) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&hash](uint64_t v) { hash = (hash ^ v) * 0x100000001b3ull; };
+  mix(patch.xsize);
+  mix(patch.ysize);
+  const size_t num = patch.xsize * patch.ysize;
+  for (size_t c = 0; c < 3; c++) {
+    const int8_t* JXL_RESTRICT row = patch.pixels[c].data();
+    for (size_t i = 0; i < num; i++) mix(static_cast<uint8_t>(row[i]));
+  }
+  return hash;
+}
+
+}  // namespace
+
 std::vector<PatchInfo> FindTextLikePatches(
     const Image3F& opsin, const PassesEncoderState* JXL_RESTRICT state,
     ThreadPool* pool, AuxOut* aux_out, bool is_xyb) {
@@ -401,6 +418,8 @@ std::vector<PatchInfo> FindTextLikePatches(
   constexpr int kHasSimilarRadius = 2;
 
   std::vector<PatchInfo> info;
+  // Patch hash -> indices in `info` of distinct patches with that hash.
+  std::unordered_map<uint64_t, std::vector<size_t>> patch_index;
 
   // Find small CC outside the "similar enough" areas, compute bounding boxes,
   // and run heuristics to exclude some patches.
@@ -512,6 +531,30 @@ std::vector<PatchInfo> FindTextLikePatches(
           ccs.Row(p.second)[p.first] = cc_color;
         }
       }
+      // Merge with an identical patch seen before, if any. Only candidates
+      // with the same hash need to be compared. The occurrence at the smallest
+      // position is kept first and provides the pixels of the patch, as when
+      // all occurrences were sorted and then merged.
+      std::vector<size_t>& bucket = patch_index[PatchHash(patch)];
+      bool merged = false;
+      for (size_t idx : bucket) {
+        if (info[idx].first == patch) {
+          std::vector<std::pair<uint32_t, uint32_t>>& positions =
+              info[idx].second;
+          positions.emplace_back(min_x, min_y);
+          if (positions.back() < positions.front()) {
+            std::swap(positions.back(), positions.front());
+            std::swap(info[idx].first, patch);
+          }
+          merged = true;
+          break;
+        }
+      }
+      if (merged) {
+        info.pop_back();
+      } else {
+        bucket.push_back(info.size() - 1);
+      }
     }
   }
 
@@ -523,25 +566,21 @@ std::vector<PatchInfo> FindTextLikePatches(
     return {};
   }
 
-  // Remove duplicates.
+  // Duplicates were already merged above; drop patches that do not repeat
+  // and sort the rest so that the result does not depend on the scan order.
   constexpr size_t kMinPatchOccurences = 2;
-  std::sort(info.begin(), info.end());
-  size_t unique = 0;
-  for (size_t i = 1; i < info.size(); i++) {
-    if (info[i].first == info[unique].first) {
-      info[unique].second.insert(info[unique].second.end(),
-                                 info[i].second.begin(), info[i].second.end());
-    } else {
-      if (info[unique].second.size() >= kMinPatchOccurences) {
-        unique++;
-      }
-      info[unique] = info[i];
-    }
-  }
-  if (info[unique].second.size() >= kMinPatchOccurences) {
-    unique++;
+  info.erase(std::remove_if(info.begin(), info.end(),
+                            [&](const PatchInfo& p) {
+                              return p.second.size() < kMinPatchOccurences;
+                            }),
+             info.end());
+  for (PatchInfo& p : info) {
+    std::sort(p.second.begin(), p.second.end());
   }
-  info.resize(unique);
+  std::sort(info.begin(), info.end(),
+            [](const PatchInfo& a, const PatchInfo& b) {
+              return a.first < b.first;
+            });
 
   size_t max_patch_size = 0;
 
@@ -557,8 +596,6 @@ std::vector<PatchInfo> FindTextLikePatches(
   return info;
 }
 
-}  // namespace
-
 void FindBestPatchDictionary(const Image3F& opsin,
                              PassesEncoderState* JXL_RESTRICT state,
                              const JxlCmsInterface& cms, ThreadPool* pool,
@@ -93,6 +93,12 @@ class PatchDictionaryEncoder {
   static void SubtractFrom(const PatchDictionary& pdic, Image3F* opsin);
 };
 
+// Finds patches that repeat in a screenshot-like `opsin`. Patches are sorted,
+// and so are the positions of each of them.
+std::vector<PatchInfo> FindTextLikePatches(
+    const Image3F& opsin, const PassesEncoderState* JXL_RESTRICT state,
+    ThreadPool* pool, AuxOut* aux_out, bool is_xyb);
+
 void FindBestPatchDictionary(const Image3F& opsin,
                              PassesEncoderState* JXL_RESTRICT state,
                              const JxlCmsInterface& cms, ThreadPool* pool,
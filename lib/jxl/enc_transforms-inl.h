@@ -688,6 +688,19 @@ HWY_MAYBE_UNUSED void TransformFromPixels(const AcStrategy::Type strategy,
   }
 }
 
+// Equivalent to TransformFromPixels(AcStrategy::Type::DCT, ...) for the
+// AcStrategy::kDCT8BatchSize adjacent blocks starting at `pixels`; the
+// coefficients of block i are stored at coefficients + i * kDCTBlockSize.
+// scratch_space should have space for 2 * AcStrategy::kDCT8BatchSize *
+// kDCTBlockSize floats.
+HWY_MAYBE_UNUSED void TransformFromPixelsDCT8Batch(
+    const float* JXL_RESTRICT pixels, size_t pixels_stride,
+    float* JXL_RESTRICT coefficients, float* JXL_RESTRICT scratch_space) {
+  PROFILER_ZONE("DCT 8 batch");
+  ComputeScaledDCTBatch<8, AcStrategy::kDCT8BatchSize>()(
+      DCTFrom(pixels, pixels_stride), coefficients, scratch_space);
+}
+
 HWY_MAYBE_UNUSED void DCFromLowestFrequencies(const AcStrategy::Type strategy,
                                               const float* block, float* dc,
                                               size_t dc_stride) {
@@ -468,7 +468,7 @@ JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
     }
 
     jxl::BitWriter writer;
-    jxl::PassesEncoderState enc_state;
+    enc_state.Reset();
 
     // EncodeFrame creates jxl::FrameHeader object internally based on the
     // FrameInfo, imagebundle, cparams and metadata. Copy the information to
@@ -531,12 +531,22 @@ JxlEncoderStatus JxlEncoderStruct::RefillOutputByteQueue() {
       ib.origin.y0 = input_frame->option_values.header.layer_info.crop_y0;
     }
     JXL_ASSERT(writer.BitsWritten() == 0);
+    enc_state.stage_stats = GetStageStats();
+    jxl::StageScope stage(enc_state.stage_stats, "Frame", /*bytes=*/0,
+                          /*pixels=*/ib.xsize() * ib.ysize());
     if (!jxl::EncodeFrame(input_frame->option_values.cparams, frame_info,
                           &metadata, input_frame->frame, &enc_state, cms,
                           thread_pool.get(), &writer,
                           /*aux_out=*/nullptr)) {
       return JXL_API_ERROR(this, JXL_ENC_ERR_GENERIC, "Failed to encode frame");
     }
+    stage.SetBytes(jxl::DivCeil(writer.BitsWritten(), 8));
+    stage.Finish();
+    // Only keep the buffers for the next frame.
+    enc_state.Reset();
+    if (enc_state.RetainedBytes() > retained_memory_limit) {
+      enc_state.ReleaseBuffers();
+    }
     codestream_bytes_written_beginning_of_frame =
         codestream_bytes_written_end_of_frame;
     codestream_bytes_written_end_of_frame +=
@@ -1232,6 +1242,14 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetOption(
     case JXL_ENC_FRAME_SETTING_JPEG_COMPRESS_BOXES:
       frame_settings->values.cparams.jpeg_compress_boxes = value;
       return JXL_ENC_SUCCESS;
+    case JXL_ENC_FRAME_SETTING_MODULAR_LZ77_CHAIN_LENGTH:
+      if (value != -1 && (value < 1 || value > (1 << 20))) {
+        return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_API_USAGE,
+                             "Option value has to be -1 or in [1..1048576]");
+      }
+      frame_settings->values.cparams.options.lz77_max_chain_length =
+          value == -1 ? 0 : value;
+      return JXL_ENC_SUCCESS;
     default:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
                            "Unknown option");
@@ -1321,6 +1339,7 @@ JxlEncoderStatus JxlEncoderFrameSettingsSetFloatOption(
     case JXL_ENC_FRAME_SETTING_BROTLI_EFFORT:
     case JXL_ENC_FRAME_SETTING_FILL_ENUM:
     case JXL_ENC_FRAME_SETTING_JPEG_COMPRESS_BOXES:
+    case JXL_ENC_FRAME_SETTING_MODULAR_LZ77_CHAIN_LENGTH:
       return JXL_API_ERROR(frame_settings->enc, JXL_ENC_ERR_NOT_SUPPORTED,
                            "Int option, try setting it with "
                            "JxlEncoderFrameSettingsSetOption");
@@ -1370,6 +1389,8 @@ void JxlEncoderReset(JxlEncoder* enc) {
   enc->use_container = false;
   enc->use_boxes = false;
   enc->codestream_level = -1;
+  enc->collect_stage_stats = false;
+  enc->stage_stats.Clear();
   JxlEncoderInitBasicInfo(&enc->basic_info);
 }
 
@@ -1420,6 +1441,34 @@ int JxlEncoderGetRequiredCodestreamLevel(const JxlEncoder* enc) {
   return VerifyLevelSettings(enc, nullptr);
 }
 
+JxlEncoderStatus JxlEncoderSetCollectStageStats(JxlEncoder* enc,
+                                                JXL_BOOL collect) {
+  enc->collect_stage_stats = !!collect;
+  enc->stage_stats.Clear();
+  return JXL_ENC_SUCCESS;
+}
+
+JxlEncoderStatus JxlEncoderSetRetainedMemoryLimit(JxlEncoder* enc,
+                                                  size_t max_bytes) {
+  enc->retained_memory_limit = max_bytes;
+  if (enc->enc_state.RetainedBytes() > max_bytes) {
+    enc->enc_state.ReleaseBuffers();
+  }
+  return JXL_ENC_SUCCESS;
+}
+
+size_t JxlEncoderGetNumStageStats(const JxlEncoder* enc) {
+  return enc->stage_stats.NumStages();
+}
+
+JxlEncoderStatus JxlEncoderGetStageStats(const JxlEncoder* enc, size_t index,
+                                         JxlStageStats* stats) {
+  if (!enc->stage_stats.Get(index, stats)) {
+    return JXL_API_ERROR_NOSET("Stage index out of range");
+  }
+  return JXL_ENC_SUCCESS;
+}
+
 void JxlEncoderSetCms(JxlEncoder* enc, JxlCmsInterface cms) {
   jxl::msan::MemoryIsInitialized(&cms, sizeof(cms));
   enc->cms = cms;
@@ -15,8 +15,10 @@
 #include "jxl/parallel_runner.h"
 #include "jxl/types.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_frame.h"
 #include "lib/jxl/memory_manager_internal.h"
+#include "lib/jxl/stage_stats.h"
 
 namespace jxl {
 
@@ -241,6 +243,18 @@ struct JxlEncoderStruct {
   bool intensity_target_set;
   int brotli_effort = -1;
 
+  // Per-stage timing and counters, see JxlEncoderGetStageStats.
+  bool collect_stage_stats = false;
+  jxl::StageStats stage_stats;
+  jxl::StageStats* GetStageStats() {
+    return collect_stage_stats ? &stage_stats : nullptr;
+  }
+
+  // Kept between frames and images so that frames reuse the buffers of the
+  // previous ones, see JxlEncoderSetRetainedMemoryLimit.
+  jxl::PassesEncoderState enc_state;
+  size_t retained_memory_limit = 0;
+
   // Takes the first frame in the input_queue, encodes it, and appends
   // the bytes to the output_byte_queue.
   JxlEncoderStatus RefillOutputByteQueue();
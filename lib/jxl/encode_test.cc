@@ -5,6 +5,8 @@
 
 #include "jxl/encode.h"
 
+#include <string>
+
 #include "enc_color_management.h"
 #include "gtest/gtest.h"
 #include "jxl/decode.h"
@@ -251,6 +253,122 @@ TEST(EncodeTest, EncoderResetTest) {
                       false);
 }
 
+namespace {
+// Encodes a test image of the given size with `enc`, then resets it.
+std::vector<uint8_t> EncodeTestImage(JxlEncoder* enc, size_t xsize,
+                                     size_t ysize) {
+  JxlPixelFormat pixel_format = {3, JXL_TYPE_UINT16, JXL_BIG_ENDIAN, 0};
+  std::vector<uint8_t> pixels = jxl::test::GetSomeTestImage(xsize, ysize, 3, 0);
+  JxlBasicInfo basic_info;
+  jxl::test::JxlBasicInfoSetFromPixelFormat(&basic_info, &pixel_format);
+  basic_info.xsize = xsize;
+  basic_info.ysize = ysize;
+  basic_info.uses_original_profile = false;
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetBasicInfo(enc, &basic_info));
+  JxlColorEncoding color_encoding;
+  JxlColorEncodingSetToSRGB(&color_encoding, false);
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetColorEncoding(enc, &color_encoding));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderAddImageFrame(JxlEncoderFrameSettingsCreate(enc, nullptr),
+                                    &pixel_format, pixels.data(),
+                                    pixels.size()));
+  JxlEncoderCloseInput(enc);
+
+  std::vector<uint8_t> compressed = std::vector<uint8_t>(64);
+  uint8_t* next_out = compressed.data();
+  size_t avail_out = compressed.size();
+  JxlEncoderStatus process_result = JXL_ENC_NEED_MORE_OUTPUT;
+  while (process_result == JXL_ENC_NEED_MORE_OUTPUT) {
+    process_result = JxlEncoderProcessOutput(enc, &next_out, &avail_out);
+    if (process_result == JXL_ENC_NEED_MORE_OUTPUT) {
+      size_t offset = next_out - compressed.data();
+      compressed.resize(compressed.size() * 2);
+      next_out = compressed.data() + offset;
+      avail_out = compressed.size() - offset;
+    }
+  }
+  EXPECT_EQ(JXL_ENC_SUCCESS, process_result);
+  compressed.resize(next_out - compressed.data());
+  JxlEncoderReset(enc);
+  return compressed;
+}
+}  // namespace
+
+TEST(EncodeTest, RetainedMemoryTest) {
+  // Each expected output comes from an encoder that never encoded anything.
+  const std::vector<uint8_t> expected_small =
+      EncodeTestImage(JxlEncoderMake(nullptr).get(), 100, 60);
+  const std::vector<uint8_t> expected_large =
+      EncodeTestImage(JxlEncoderMake(nullptr).get(), 300, 270);
+
+  // By default, nothing is kept.
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_EQ(expected_large, EncodeTestImage(enc.get(), 300, 270));
+  EXPECT_EQ(0u, enc->enc_state.RetainedBytes());
+
+  // The buffers kept from a larger or smaller image don't change the output.
+  // The limit survives the JxlEncoderReset at the end of EncodeTestImage.
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetRetainedMemoryLimit(enc.get(), SIZE_MAX));
+  EXPECT_EQ(expected_large, EncodeTestImage(enc.get(), 300, 270));
+  EXPECT_GT(enc->enc_state.RetainedBytes(), 0u);
+  EXPECT_EQ(expected_small, EncodeTestImage(enc.get(), 100, 60));
+  EXPECT_EQ(expected_large, EncodeTestImage(enc.get(), 300, 270));
+  EXPECT_GT(enc->enc_state.RetainedBytes(), 0u);
+
+  // Nothing is kept above the limit.
+  EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderSetRetainedMemoryLimit(enc.get(), 0));
+  EXPECT_EQ(0u, enc->enc_state.RetainedBytes());
+  EXPECT_EQ(expected_large, EncodeTestImage(enc.get(), 300, 270));
+  EXPECT_EQ(0u, enc->enc_state.RetainedBytes());
+  EXPECT_EQ(expected_small, EncodeTestImage(enc.get(), 100, 60));
+  EXPECT_EQ(0u, enc->enc_state.RetainedBytes());
+}
+
+TEST(EncodeTest, StageStatsTest) {
+  JxlEncoderPtr enc = JxlEncoderMake(nullptr);
+  EXPECT_NE(nullptr, enc.get());
+  EXPECT_EQ(0u, JxlEncoderGetNumStageStats(enc.get()));
+  EXPECT_EQ(JXL_ENC_SUCCESS,
+            JxlEncoderSetCollectStageStats(enc.get(), JXL_TRUE));
+  VerifyFrameEncoding(enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr));
+
+  size_t num_stages = JxlEncoderGetNumStageStats(enc.get());
+  EXPECT_GT(num_stages, 0u);
+  bool found_frame = false;
+  bool found_ac_group = false;
+  for (size_t i = 0; i < num_stages; i++) {
+    JxlStageStats stats;
+    EXPECT_EQ(JXL_ENC_SUCCESS, JxlEncoderGetStageStats(enc.get(), i, &stats));
+    EXPECT_GT(stats.count, 0u);
+    EXPECT_GE(stats.wall_seconds, 0.0);
+    EXPECT_GE(stats.cpu_seconds, 0.0);
+    const std::string name = stats.name;
+    if (name == "Frame") {
+      found_frame = true;
+      EXPECT_EQ(1u, stats.count);
+      EXPECT_EQ(63u * 129u, stats.pixels);
+      EXPECT_GT(stats.bytes, 0u);
+    } else if (name == "AC group") {
+      found_ac_group = true;
+      EXPECT_EQ(1u, stats.count);
+    }
+  }
+  EXPECT_TRUE(found_frame);
+  EXPECT_TRUE(found_ac_group);
+  JxlStageStats stats;
+  EXPECT_EQ(JXL_ENC_ERROR,
+            JxlEncoderGetStageStats(enc.get(), num_stages, &stats));
+
+  // Resetting clears the stats and disables collection.
+  JxlEncoderReset(enc.get());
+  EXPECT_EQ(0u, JxlEncoderGetNumStageStats(enc.get()));
+  VerifyFrameEncoding(enc.get(),
+                      JxlEncoderFrameSettingsCreate(enc.get(), nullptr));
+  EXPECT_EQ(0u, JxlEncoderGetNumStageStats(enc.get()));
+}
+
 TEST(EncodeTest, CmsTest) {
   JxlEncoderPtr enc = JxlEncoderMake(nullptr);
   EXPECT_NE(nullptr, enc.get());
@@ -464,12 +582,21 @@ TEST(EncodeTest, frame_settingsTest) {
         JXL_ENC_SUCCESS,
         JxlEncoderFrameSettingsSetOption(
             frame_settings, JXL_ENC_FRAME_SETTING_MODULAR_NB_PREV_CHANNELS, 7));
+    EXPECT_EQ(JXL_ENC_ERROR,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings,
+                  JXL_ENC_FRAME_SETTING_MODULAR_LZ77_CHAIN_LENGTH, 0));
+    EXPECT_EQ(JXL_ENC_SUCCESS,
+              JxlEncoderFrameSettingsSetOption(
+                  frame_settings,
+                  JXL_ENC_FRAME_SETTING_MODULAR_LZ77_CHAIN_LENGTH, 32));
     VerifyFrameEncoding(enc.get(), frame_settings);
     EXPECT_EQ(30, enc->last_used_cparams.colorspace);
     EXPECT_EQ(2, enc->last_used_cparams.modular_group_size_shift);
     EXPECT_EQ(jxl::Predictor::Best, enc->last_used_cparams.options.predictor);
     EXPECT_NEAR(0.77f, enc->last_used_cparams.options.nb_repeats, 1E-6);
     EXPECT_EQ(7, enc->last_used_cparams.options.max_properties);
+    EXPECT_EQ(32u, enc->last_used_cparams.options.lz77_max_chain_length);
   }
 
   {
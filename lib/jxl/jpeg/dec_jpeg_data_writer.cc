@@ -8,11 +8,13 @@
 #include <stdlib.h>
 #include <string.h> /* for memset, memcpy */
 
+#include <algorithm>
 #include <deque>
 #include <string>
 #include <vector>
 
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/jpeg/dec_jpeg_serialization_state.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
@@ -37,6 +39,10 @@ const size_t kJpegBitWriterChunkSize = 16384;
 // DCTCodingState: maximum number of correction bits to buffer
 const int kJPEGMaxCorrectionBits = 1u << 16;
 
+// Parallel scan encoding: number of MCUs handled by a single task. Scans with
+// fewer than two segments worth of MCUs are always encoded serially.
+const int kJpegMcusPerSegment = 1024;
+
 // Returns non-zero if and only if x has a zero byte, i.e. one of
 // x & 0xff, x & 0xff00, ..., x & 0xff00000000000000 is zero.
 static JXL_INLINE uint64_t HasZeroByte(uint64_t x) {
@@ -123,6 +129,56 @@ static JXL_INLINE void WriteBits(JpegBitWriter* bw, int nbits, uint64_t bits) {
   if (bw->put_bits <= 16) DischargeBitBuffer(bw);
 }
 
+// Collects the entropy coded bits of a scan segment that does not start at a
+// byte boundary of the output. The bits are stored without byte stuffing and
+// later appended to the JpegBitWriter of the scan with AppendBits().
+struct RawBitWriter {
+  bool healthy = true;
+  std::vector<uint64_t> words;
+  uint64_t put_buffer = 0;
+  int put_bits = 64;
+};
+
+static JXL_INLINE void WriteBits(RawBitWriter* bw, int nbits, uint64_t bits) {
+  if (nbits == 0) {
+    bw->healthy = false;
+    return;
+  }
+  if (nbits <= bw->put_bits) {
+    bw->put_bits -= nbits;
+    bw->put_buffer |= (bits << bw->put_bits);
+    if (bw->put_bits == 0) {
+      bw->words.push_back(bw->put_buffer);
+      bw->put_buffer = 0;
+      bw->put_bits = 64;
+    }
+  } else {
+    const int rest = nbits - bw->put_bits;
+    bw->words.push_back(bw->put_buffer | (bits >> rest));
+    bw->put_bits = 64 - rest;
+    bw->put_buffer = bits << bw->put_bits;
+  }
+}
+
+// Writes all bits collected in `raw` to `bw`. JpegBitWriter can accept at most
+// 16 bits per WriteBits call, so the words are split accordingly.
+void AppendBits(const RawBitWriter& raw, JpegBitWriter* bw) {
+  for (uint64_t word : raw.words) {
+    WriteBits(bw, 16, word >> 48);
+    WriteBits(bw, 16, (word >> 32) & 0xFFFF);
+    WriteBits(bw, 16, (word >> 16) & 0xFFFF);
+    WriteBits(bw, 16, word & 0xFFFF);
+  }
+  int nbits = 64 - raw.put_bits;
+  uint64_t word = raw.put_buffer;
+  while (nbits > 0) {
+    int n = std::min(nbits, 16);
+    WriteBits(bw, n, word >> (64 - n));
+    word <<= n;
+    nbits -= n;
+  }
+}
+
 void EmitMarker(JpegBitWriter* bw, int marker) {
   Reserve(bw, 2);
   JXL_DASSERT(marker != 0xFF);
@@ -189,9 +245,9 @@ enum OutputModes {
   kModeWrite,
 };
 
-template <int kOutputMode>
+template <int kOutputMode, typename BitWriter>
 static JXL_INLINE void WriteSymbol(int symbol, HuffmanCodeTable* table,
-                                   JpegBitWriter* bw) {
+                                   BitWriter* bw) {
   if (kOutputMode == OutputModes::kModeHistogram) {
     ++table->depth[symbol];
   } else {
@@ -201,8 +257,8 @@ static JXL_INLINE void WriteSymbol(int symbol, HuffmanCodeTable* table,
 
 // Emit all buffered data to the bit stream using the given Huffman code and
 // bit writer.
-template <int kOutputMode>
-static JXL_INLINE void Flush(DCTCodingState* s, JpegBitWriter* bw) {
+template <int kOutputMode, typename BitWriter>
+static JXL_INLINE void Flush(DCTCodingState* s, BitWriter* bw) {
   if (s->eob_run_ > 0) {
     int nbits = FloorLog2Nonzero<uint32_t>(s->eob_run_);
     int symbol = nbits << 4u;
@@ -220,11 +276,11 @@ static JXL_INLINE void Flush(DCTCodingState* s, JpegBitWriter* bw) {
 
 // Buffer some more data at the end-of-band (the last non-zero or newly
 // non-zero coefficient within the [Ss, Se] spectral band).
-template <int kOutputMode>
+template <int kOutputMode, typename BitWriter>
 static JXL_INLINE void BufferEndOfBand(DCTCodingState* s,
                                        HuffmanCodeTable* ac_huff,
                                        const std::vector<int>* new_bits,
-                                       JpegBitWriter* bw) {
+                                       BitWriter* bw) {
   if (s->eob_run_ == 0) {
     s->cur_ac_huff_ = ac_huff;
   }
@@ -480,10 +536,10 @@ bool EncodeInterMarkerData(const JPEGData& jpg, SerializationState* state) {
   return true;
 }
 
-template <int kOutputMode>
+template <int kOutputMode, typename BitWriter>
 bool EncodeDCTBlockSequential(const coeff_t* coeffs, HuffmanCodeTable* dc_huff,
                               HuffmanCodeTable* ac_huff, int num_zero_runs,
-                              coeff_t* last_dc_coeff, JpegBitWriter* bw) {
+                              coeff_t* last_dc_coeff, BitWriter* bw) {
   coeff_t temp2;
   coeff_t temp;
   temp2 = coeffs[0];
@@ -535,12 +591,12 @@ bool EncodeDCTBlockSequential(const coeff_t* coeffs, HuffmanCodeTable* dc_huff,
   return true;
 }
 
-template <int kOutputMode>
+template <int kOutputMode, typename BitWriter>
 bool EncodeDCTBlockProgressive(const coeff_t* coeffs, HuffmanCodeTable* dc_huff,
                                HuffmanCodeTable* ac_huff, int Ss, int Se,
                                int Al, int num_zero_runs,
                                DCTCodingState* coding_state,
-                               coeff_t* last_dc_coeff, JpegBitWriter* bw) {
+                               coeff_t* last_dc_coeff, BitWriter* bw) {
   bool eob_run_allowed = Ss > 0;
   coeff_t temp2;
   coeff_t temp;
@@ -610,10 +666,10 @@ bool EncodeDCTBlockProgressive(const coeff_t* coeffs, HuffmanCodeTable* dc_huff,
   return true;
 }
 
-template <int kOutputMode>
+template <int kOutputMode, typename BitWriter>
 bool EncodeRefinementBits(const coeff_t* coeffs, HuffmanCodeTable* ac_huff,
                           int Ss, int Se, int Al, DCTCodingState* coding_state,
-                          JpegBitWriter* bw) {
+                          BitWriter* bw) {
   bool eob_run_allowed = Ss > 0;
   if (Ss == 0) {
     // Emit next bit of DC component.
@@ -690,6 +746,123 @@ size_t HistogramIndex(const JPEGData& jpg, size_t scan_index,
   return idx + component_index;
 }
 
+int GetNextExtraZeroRunIndex(const JPEGScanInfo& scan_info,
+                             const EncodeScanState& ss) {
+  if (ss.extra_zero_runs_pos < scan_info.extra_zero_runs.size()) {
+    return scan_info.extra_zero_runs[ss.extra_zero_runs_pos].block_idx;
+  } else {
+    return -1;
+  }
+}
+
+int GetNextResetPoint(const JPEGScanInfo& scan_info, EncodeScanState* ss) {
+  if (ss->next_reset_point_pos < scan_info.reset_points.size()) {
+    return scan_info.reset_points[ss->next_reset_point_pos++];
+  } else {
+    return -1;
+  }
+}
+
+bool IsEmpty(const DCTCodingState& s) {
+  return s.eob_run_ == 0 && s.refinement_bits_.empty();
+}
+
+// Flushes the coding state, pads the bit stream to a byte boundary and emits
+// the next restart marker.
+template <int kOutputMode>
+bool EmitRestart(int restart_interval, const uint8_t** pad_bits,
+                 const uint8_t* pad_bits_end, EncodeScanState* ss,
+                 JpegBitWriter* bw) {
+  Flush<kOutputMode>(&ss->coding_state, bw);
+  if (!JumpToByteBoundary(bw, pad_bits, pad_bits_end)) {
+    return false;
+  }
+  EmitMarker(bw, 0xD0 + ss->next_restart_marker);
+  ss->next_restart_marker += 1;
+  ss->next_restart_marker &= 0x7;
+  ss->restarts_to_go = restart_interval;
+  memset(ss->last_dc_coeff, 0, sizeof(ss->last_dc_coeff));
+  return true;
+}
+
+// Encodes the MCU at (mcu_x, mcu_y), using and updating the block position,
+// the DC predictors and the coding state in `ss`.
+template <int kMode, int kOutputMode, typename BitWriter>
+bool EncodeMCU(const JPEGData& jpg, const JPEGScanInfo& scan_info, int Ss,
+               int Se, int Al, int mcu_x, int mcu_y, SerializationState* state,
+               EncodeScanState* ss, BitWriter* bw) {
+  // "Non-interleaved" means color data comes in separate scans, in other words
+  // each scan can contain only one color component.
+  const bool is_interleaved = (scan_info.num_components > 1);
+  DCTCodingState* coding_state = &ss->coding_state;
+  for (size_t i = 0; i < scan_info.num_components; ++i) {
+    const JPEGComponentScanInfo& si = scan_info.components[i];
+    const JPEGComponent& c = jpg.components[si.comp_idx];
+    size_t dc_tbl_idx = (kOutputMode == OutputModes::kModeHistogram
+                             ? HistogramIndex(jpg, state->scan_index, i)
+                             : si.dc_tbl_idx);
+    size_t ac_tbl_idx = (kOutputMode == OutputModes::kModeHistogram
+                             ? HistogramIndex(jpg, state->scan_index, i)
+                             : si.ac_tbl_idx);
+    HuffmanCodeTable* dc_huff = &state->dc_huff_table[dc_tbl_idx];
+    HuffmanCodeTable* ac_huff = &state->ac_huff_table[ac_tbl_idx];
+    int n_blocks_y = is_interleaved ? c.v_samp_factor : 1;
+    int n_blocks_x = is_interleaved ? c.h_samp_factor : 1;
+    for (int iy = 0; iy < n_blocks_y; ++iy) {
+      for (int ix = 0; ix < n_blocks_x; ++ix) {
+        int block_y = mcu_y * n_blocks_y + iy;
+        int block_x = mcu_x * n_blocks_x + ix;
+        int block_idx = block_y * c.width_in_blocks + block_x;
+        if (ss->block_scan_index == ss->next_reset_point) {
+          Flush<kOutputMode>(coding_state, bw);
+          ss->next_reset_point = GetNextResetPoint(scan_info, ss);
+        }
+        int num_zero_runs = 0;
+        if (ss->block_scan_index == ss->next_extra_zero_run_index) {
+          num_zero_runs = scan_info.extra_zero_runs[ss->extra_zero_runs_pos]
+                              .num_extra_zero_runs;
+          ++ss->extra_zero_runs_pos;
+          ss->next_extra_zero_run_index =
+              GetNextExtraZeroRunIndex(scan_info, *ss);
+        }
+        const coeff_t* coeffs = &c.coeffs[block_idx << 6];
+        bool ok;
+        if (kMode == 0) {
+          ok = EncodeDCTBlockSequential<kOutputMode>(
+              coeffs, dc_huff, ac_huff, num_zero_runs,
+              ss->last_dc_coeff + si.comp_idx, bw);
+        } else if (kMode == 1) {
+          ok = EncodeDCTBlockProgressive<kOutputMode>(
+              coeffs, dc_huff, ac_huff, Ss, Se, Al, num_zero_runs,
+              coding_state, ss->last_dc_coeff + si.comp_idx, bw);
+        } else {
+          ok = EncodeRefinementBits<kOutputMode>(coeffs, ac_huff, Ss, Se, Al,
+                                                 coding_state, bw);
+        }
+        if (!ok) return false;
+        ++ss->block_scan_index;
+      }
+    }
+  }
+  return true;
+}
+
+template <int kOutputMode>
+SerializationStatus FinishScan(SerializationState* state) {
+  EncodeScanState& ss = state->scan_state;
+  JpegBitWriter* bw = &ss.bw;
+  Flush<kOutputMode>(&ss.coding_state, bw);
+  if (!JumpToByteBoundary(bw, &state->pad_bits, state->pad_bits_end)) {
+    return SerializationStatus::ERROR;
+  }
+  JpegBitWriterFinish(bw);
+  ss.stage = EncodeScanState::HEAD;
+  state->scan_index++;
+  if (!bw->healthy) return SerializationStatus::ERROR;
+
+  return SerializationStatus::DONE;
+}
+
 template <int kMode, int kOutputMode>
 SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
                                               SerializationState* state) {
@@ -699,22 +872,6 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
   const int restart_interval =
       state->seen_dri_marker ? jpg.restart_interval : 0;
 
-  const auto get_next_extra_zero_run_index = [&ss, &scan_info]() -> int {
-    if (ss.extra_zero_runs_pos < scan_info.extra_zero_runs.size()) {
-      return scan_info.extra_zero_runs[ss.extra_zero_runs_pos].block_idx;
-    } else {
-      return -1;
-    }
-  };
-
-  const auto get_next_reset_point = [&ss, &scan_info]() -> int {
-    if (ss.next_reset_point_pos < scan_info.reset_points.size()) {
-      return scan_info.reset_points[ss.next_reset_point_pos++];
-    } else {
-      return -1;
-    }
-  };
-
   if (ss.stage == EncodeScanState::HEAD) {
     if (!EncodeSOS(jpg, scan_info, state)) return SerializationStatus::ERROR;
     JpegBitWriterInit(&ss.bw, &state->output_queue);
@@ -723,21 +880,17 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
     ss.next_restart_marker = 0;
     ss.block_scan_index = 0;
     ss.extra_zero_runs_pos = 0;
-    ss.next_extra_zero_run_index = get_next_extra_zero_run_index();
+    ss.next_extra_zero_run_index = GetNextExtraZeroRunIndex(scan_info, ss);
     ss.next_reset_point_pos = 0;
-    ss.next_reset_point = get_next_reset_point();
+    ss.next_reset_point = GetNextResetPoint(scan_info, &ss);
     ss.mcu_y = 0;
     memset(ss.last_dc_coeff, 0, sizeof(ss.last_dc_coeff));
     ss.stage = EncodeScanState::BODY;
   }
   JpegBitWriter* bw = &ss.bw;
-  DCTCodingState* coding_state = &ss.coding_state;
 
   JXL_DASSERT(ss.stage == EncodeScanState::BODY);
 
-  // "Non-interleaved" means color data comes in separate scans, in other words
-  // each scan can contain only one color component.
-  const bool is_interleaved = (scan_info.num_components > 1);
   int MCUs_per_row = 0;
   int MCU_rows = 0;
   jpg.CalculateMcuSize(scan_info, &MCUs_per_row, &MCU_rows);
@@ -772,64 +925,15 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
     for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
       // Possibly emit a restart marker.
       if (restart_interval > 0 && ss.restarts_to_go == 0) {
-        Flush<kOutputMode>(coding_state, bw);
-        if (!JumpToByteBoundary(bw, &state->pad_bits, state->pad_bits_end)) {
+        if (!EmitRestart<kOutputMode>(restart_interval, &state->pad_bits,
+                                      state->pad_bits_end, &ss, bw)) {
           return SerializationStatus::ERROR;
         }
-        EmitMarker(bw, 0xD0 + ss.next_restart_marker);
-        ss.next_restart_marker += 1;
-        ss.next_restart_marker &= 0x7;
-        ss.restarts_to_go = restart_interval;
-        memset(ss.last_dc_coeff, 0, sizeof(ss.last_dc_coeff));
       }
       // Encode one MCU
-      for (size_t i = 0; i < scan_info.num_components; ++i) {
-        const JPEGComponentScanInfo& si = scan_info.components[i];
-        const JPEGComponent& c = jpg.components[si.comp_idx];
-        size_t dc_tbl_idx = (kOutputMode == OutputModes::kModeHistogram
-                                 ? HistogramIndex(jpg, state->scan_index, i)
-                                 : si.dc_tbl_idx);
-        size_t ac_tbl_idx = (kOutputMode == OutputModes::kModeHistogram
-                                 ? HistogramIndex(jpg, state->scan_index, i)
-                                 : si.ac_tbl_idx);
-        HuffmanCodeTable* dc_huff = &state->dc_huff_table[dc_tbl_idx];
-        HuffmanCodeTable* ac_huff = &state->ac_huff_table[ac_tbl_idx];
-        int n_blocks_y = is_interleaved ? c.v_samp_factor : 1;
-        int n_blocks_x = is_interleaved ? c.h_samp_factor : 1;
-        for (int iy = 0; iy < n_blocks_y; ++iy) {
-          for (int ix = 0; ix < n_blocks_x; ++ix) {
-            int block_y = ss.mcu_y * n_blocks_y + iy;
-            int block_x = mcu_x * n_blocks_x + ix;
-            int block_idx = block_y * c.width_in_blocks + block_x;
-            if (ss.block_scan_index == ss.next_reset_point) {
-              Flush<kOutputMode>(coding_state, bw);
-              ss.next_reset_point = get_next_reset_point();
-            }
-            int num_zero_runs = 0;
-            if (ss.block_scan_index == ss.next_extra_zero_run_index) {
-              num_zero_runs = scan_info.extra_zero_runs[ss.extra_zero_runs_pos]
-                                  .num_extra_zero_runs;
-              ++ss.extra_zero_runs_pos;
-              ss.next_extra_zero_run_index = get_next_extra_zero_run_index();
-            }
-            const coeff_t* coeffs = &c.coeffs[block_idx << 6];
-            bool ok;
-            if (kMode == 0) {
-              ok = EncodeDCTBlockSequential<kOutputMode>(
-                  coeffs, dc_huff, ac_huff, num_zero_runs,
-                  ss.last_dc_coeff + si.comp_idx, bw);
-            } else if (kMode == 1) {
-              ok = EncodeDCTBlockProgressive<kOutputMode>(
-                  coeffs, dc_huff, ac_huff, Ss, Se, Al, num_zero_runs,
-                  coding_state, ss.last_dc_coeff + si.comp_idx, bw);
-            } else {
-              ok = EncodeRefinementBits<kOutputMode>(coeffs, ac_huff, Ss, Se,
-                                                     Al, coding_state, bw);
-            }
-            if (!ok) return SerializationStatus::ERROR;
-            ++ss.block_scan_index;
-          }
-        }
+      if (!EncodeMCU<kMode, kOutputMode>(jpg, scan_info, Ss, Se, Al, mcu_x,
+                                         ss.mcu_y, state, &ss, bw)) {
+        return SerializationStatus::ERROR;
       }
       --ss.restarts_to_go;
     }
@@ -838,21 +942,226 @@ SerializationStatus JXL_NOINLINE DoEncodeScan(const JPEGData& jpg,
     if (!bw->healthy) return SerializationStatus::ERROR;
     return SerializationStatus::NEEDS_MORE_INPUT;
   }
-  Flush<kOutputMode>(coding_state, bw);
-  if (!JumpToByteBoundary(bw, &state->pad_bits, state->pad_bits_end)) {
+  return FinishScan<kOutputMode>(state);
+}
+
+// Part of a scan that is entropy coded independently of the other parts by
+// DoEncodeScanParallel.
+struct ScanSegment {
+  int mcu_begin;
+  int mcu_end;
+  bool ok;
+  // Block position, DC predictors and coding state at the end of the segment.
+  EncodeScanState state;
+  // Byte stuffed output of segments that start after a restart marker.
+  std::deque<OutputChunk> output;
+  // Output of segments that continue the bit stream of the previous segment.
+  RawBitWriter raw;
+};
+
+// Encodes the MCUs in [mcu_begin, mcu_end), which must not be interrupted by a
+// restart marker.
+template <int kMode, typename BitWriter>
+bool EncodeMCURange(const JPEGData& jpg, const JPEGScanInfo& scan_info, int Ss,
+                    int Se, int Al, int MCUs_per_row, int mcu_begin,
+                    int mcu_end, SerializationState* state,
+                    EncodeScanState* ss, BitWriter* bw) {
+  for (int mcu = mcu_begin; mcu < mcu_end; ++mcu) {
+    if (!EncodeMCU<kMode, OutputModes::kModeWrite>(
+            jpg, scan_info, Ss, Se, Al, mcu % MCUs_per_row, mcu / MCUs_per_row,
+            state, ss, bw)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Prepares `ss` for encoding a scan starting at MCU `mcu_begin`, with an empty
+// coding state. Unless the scan is restarted at `mcu_begin`, the DC predictors
+// are taken from the last blocks of the preceding MCU.
+template <int kMode>
+void InitSegmentState(const JPEGData& jpg, const JPEGScanInfo& scan_info,
+                      int Al, int MCUs_per_row, int restart_interval,
+                      int mcu_begin, EncodeScanState* ss) {
+  const bool is_interleaved = (scan_info.num_components > 1);
+  int blocks_per_mcu = 0;
+  for (size_t i = 0; i < scan_info.num_components; ++i) {
+    const JPEGComponent& c = jpg.components[scan_info.components[i].comp_idx];
+    blocks_per_mcu += is_interleaved ? c.h_samp_factor * c.v_samp_factor : 1;
+  }
+  ss->block_scan_index = mcu_begin * blocks_per_mcu;
+  const auto& zero_runs = scan_info.extra_zero_runs;
+  ss->extra_zero_runs_pos =
+      std::lower_bound(zero_runs.begin(), zero_runs.end(),
+                       ss->block_scan_index,
+                       [](const JPEGScanInfo::ExtraZeroRunInfo& info,
+                          int block_scan_index) {
+                         return static_cast<int>(info.block_idx) <
+                                block_scan_index;
+                       }) -
+      zero_runs.begin();
+  ss->next_extra_zero_run_index = GetNextExtraZeroRunIndex(scan_info, *ss);
+  const auto& reset_points = scan_info.reset_points;
+  ss->next_reset_point_pos =
+      std::lower_bound(reset_points.begin(), reset_points.end(),
+                       static_cast<uint32_t>(ss->block_scan_index)) -
+      reset_points.begin();
+  ss->next_reset_point = GetNextResetPoint(scan_info, ss);
+  // No DCTCodingStateInit here: reserving the maximal number of refinement
+  // bits for every segment would be wasteful.
+  ss->coding_state.eob_run_ = 0;
+  ss->coding_state.cur_ac_huff_ = nullptr;
+  ss->coding_state.refinement_bits_.clear();
+  ss->restarts_to_go = restart_interval;
+  ss->next_restart_marker =
+      restart_interval > 0 ? (mcu_begin / restart_interval) & 0x7 : 0;
+  memset(ss->last_dc_coeff, 0, sizeof(ss->last_dc_coeff));
+  if (restart_interval > 0 || mcu_begin == 0 || kMode == 2) return;
+  const int mcu_y = (mcu_begin - 1) / MCUs_per_row;
+  const int mcu_x = (mcu_begin - 1) % MCUs_per_row;
+  for (size_t i = 0; i < scan_info.num_components; ++i) {
+    const JPEGComponentScanInfo& si = scan_info.components[i];
+    const JPEGComponent& c = jpg.components[si.comp_idx];
+    int n_blocks_y = is_interleaved ? c.v_samp_factor : 1;
+    int n_blocks_x = is_interleaved ? c.h_samp_factor : 1;
+    int block_y = mcu_y * n_blocks_y + n_blocks_y - 1;
+    int block_x = mcu_x * n_blocks_x + n_blocks_x - 1;
+    int block_idx = block_y * c.width_in_blocks + block_x;
+    ss->last_dc_coeff[si.comp_idx] = c.coeffs[block_idx << 6] >> Al;
+  }
+}
+
+// Same as DoEncodeScan in kModeWrite, but the MCUs of the scan are split into
+// segments that are entropy coded in parallel and then stitched in order.
+//
+// With restart markers, segments start at restart intervals, where the coding
+// state and the DC predictors are reset and the output is byte aligned, so the
+// segments are fully independent. Otherwise the segments are encoded into
+// unstuffed bit buffers, with DC predictors taken from the preceding MCU and
+// assuming an empty coding state. The latter always holds for sequential
+// scans; for progressive scans the segment is encoded again serially if the
+// previous one ended with a pending end-of-band run or refinement bits.
+//
+// Requires that the JPEG uses the default (all ones) padding bits.
+template <int kMode>
+SerializationStatus JXL_NOINLINE DoEncodeScanParallel(const JPEGData& jpg,
+                                                      SerializationState* state,
+                                                      ThreadPool* pool) {
+  const JPEGScanInfo& scan_info = jpg.scan_info[state->scan_index];
+  EncodeScanState& ss = state->scan_state;
+  JXL_DASSERT(ss.stage == EncodeScanState::HEAD);
+  JXL_DASSERT(state->pad_bits == nullptr);
+
+  const int restart_interval =
+      state->seen_dri_marker ? jpg.restart_interval : 0;
+  int MCUs_per_row = 0;
+  int MCU_rows = 0;
+  jpg.CalculateMcuSize(scan_info, &MCUs_per_row, &MCU_rows);
+  const bool is_progressive = state->is_progressive;
+  const int Al = is_progressive ? scan_info.Al : 0;
+  const int Ss = is_progressive ? scan_info.Ss : 0;
+  const int Se = is_progressive ? scan_info.Se : 63;
+  const int num_mcus = MCUs_per_row * MCU_rows;
+
+  if (!EncodeSOS(jpg, scan_info, state)) return SerializationStatus::ERROR;
+  JpegBitWriter* bw = &ss.bw;
+  JpegBitWriterInit(bw, &state->output_queue);
+  DCTCodingStateInit(&ss.coding_state);
+  ss.stage = EncodeScanState::BODY;
+
+  int mcus_per_segment = kJpegMcusPerSegment;
+  if (restart_interval > 0) {
+    mcus_per_segment =
+        DivCeil(mcus_per_segment, restart_interval) * restart_interval;
+  }
+  std::vector<ScanSegment> segments(DivCeil(num_mcus, mcus_per_segment));
+
+  const auto encode_segment = [&](const uint32_t task, size_t /*thread*/) {
+    ScanSegment& seg = segments[task];
+    seg.mcu_begin = task * mcus_per_segment;
+    seg.mcu_end = std::min(num_mcus, seg.mcu_begin + mcus_per_segment);
+    EncodeScanState* seg_state = &seg.state;
+    InitSegmentState<kMode>(jpg, scan_info, Al, MCUs_per_row,
+                            restart_interval, seg.mcu_begin, seg_state);
+    if (restart_interval == 0) {
+      seg.ok = EncodeMCURange<kMode>(jpg, scan_info, Ss, Se, Al, MCUs_per_row,
+                                     seg.mcu_begin, seg.mcu_end, state,
+                                     seg_state, &seg.raw);
+      return;
+    }
+    JpegBitWriter* seg_bw = &seg_state->bw;
+    JpegBitWriterInit(seg_bw, &seg.output);
+    seg.ok = true;
+    for (int mcu = seg.mcu_begin; seg.ok && mcu < seg.mcu_end;
+         mcu += restart_interval) {
+      if (mcu != seg.mcu_begin) {
+        const uint8_t* pad_bits = nullptr;
+        seg.ok = EmitRestart<OutputModes::kModeWrite>(
+            restart_interval, &pad_bits, nullptr, seg_state, seg_bw);
+      }
+      seg.ok = seg.ok &&
+               EncodeMCURange<kMode>(
+                   jpg, scan_info, Ss, Se, Al, MCUs_per_row, mcu,
+                   std::min(seg.mcu_end, mcu + restart_interval), state,
+                   seg_state, seg_bw);
+    }
+    // Residual bits stay in the bit buffer and are taken over when stitching.
+    JpegBitWriterFinish(seg_bw);
+  };
+
+  if (!RunOnPool(pool, 0, segments.size(), ThreadPool::NoInit, encode_segment,
+                 "EncodeJpegScan")) {
     return SerializationStatus::ERROR;
   }
-  JpegBitWriterFinish(bw);
-  ss.stage = EncodeScanState::HEAD;
-  state->scan_index++;
-  if (!bw->healthy) return SerializationStatus::ERROR;
 
-  return SerializationStatus::DONE;
+  for (ScanSegment& seg : segments) {
+    if (!seg.ok) return SerializationStatus::ERROR;
+    if (restart_interval > 0) {
+      if (!seg.state.bw.healthy) return SerializationStatus::ERROR;
+      if (seg.mcu_begin > 0) {
+        ss.next_restart_marker = (seg.mcu_begin / restart_interval - 1) & 0x7;
+        if (!EmitRestart<OutputModes::kModeWrite>(restart_interval,
+                                                  &state->pad_bits,
+                                                  state->pad_bits_end, &ss,
+                                                  bw)) {
+          return SerializationStatus::ERROR;
+        }
+      }
+      if (!bw->healthy) return SerializationStatus::ERROR;
+      // The writer is byte aligned now, so the output of the segment can be
+      // moved to the queue as is.
+      JpegBitWriterFinish(bw);
+      for (OutputChunk& chunk : seg.output) {
+        state->output_queue.emplace_back(std::move(chunk));
+      }
+      JpegBitWriterInit(bw, &state->output_queue);
+      bw->put_buffer = seg.state.bw.put_buffer;
+      bw->put_bits = seg.state.bw.put_bits;
+      ss.coding_state = std::move(seg.state.coding_state);
+    } else if (IsEmpty(ss.coding_state)) {
+      if (!seg.raw.healthy) return SerializationStatus::ERROR;
+      AppendBits(seg.raw, bw);
+      ss.coding_state = std::move(seg.state.coding_state);
+    } else {
+      // Speculation failed, encode the segment again from the actual state.
+      DCTCodingState coding_state = std::move(ss.coding_state);
+      InitSegmentState<kMode>(jpg, scan_info, Al, MCUs_per_row, 0,
+                              seg.mcu_begin, &ss);
+      ss.coding_state = std::move(coding_state);
+      if (!EncodeMCURange<kMode>(jpg, scan_info, Ss, Se, Al, MCUs_per_row,
+                                 seg.mcu_begin, seg.mcu_end, state, &ss, bw)) {
+        return SerializationStatus::ERROR;
+      }
+    }
+  }
+  ss.mcu_y = MCU_rows;
+  return FinishScan<OutputModes::kModeWrite>(state);
 }
 
 template <int kOutputMode>
 static SerializationStatus JXL_INLINE EncodeScan(const JPEGData& jpg,
-                                                 SerializationState* state) {
+                                                 SerializationState* state,
+                                                 ThreadPool* pool) {
   const JPEGScanInfo& scan_info = jpg.scan_info[state->scan_index];
   const bool is_progressive = state->is_progressive;
   const int Al = is_progressive ? scan_info.Al : 0;
@@ -861,18 +1170,30 @@ static SerializationStatus JXL_INLINE EncodeScan(const JPEGData& jpg,
   const int Se = is_progressive ? scan_info.Se : 63;
   const bool need_sequential =
       !is_progressive || (Ah == 0 && Al == 0 && Ss == 0 && Se == 63);
+  bool parallel = false;
+  if (kOutputMode == OutputModes::kModeWrite && pool != nullptr &&
+      state->pad_bits == nullptr &&
+      state->scan_state.stage == EncodeScanState::HEAD) {
+    int MCUs_per_row = 0;
+    int MCU_rows = 0;
+    jpg.CalculateMcuSize(scan_info, &MCUs_per_row, &MCU_rows);
+    parallel = MCUs_per_row * MCU_rows >= 2 * kJpegMcusPerSegment;
+  }
   if (need_sequential) {
-    return DoEncodeScan<0, kOutputMode>(jpg, state);
+    return parallel ? DoEncodeScanParallel<0>(jpg, state, pool)
+                    : DoEncodeScan<0, kOutputMode>(jpg, state);
   } else if (Ah == 0) {
-    return DoEncodeScan<1, kOutputMode>(jpg, state);
+    return parallel ? DoEncodeScanParallel<1>(jpg, state, pool)
+                    : DoEncodeScan<1, kOutputMode>(jpg, state);
   } else {
-    return DoEncodeScan<2, kOutputMode>(jpg, state);
+    return parallel ? DoEncodeScanParallel<2>(jpg, state, pool)
+                    : DoEncodeScan<2, kOutputMode>(jpg, state);
   }
 }
 
 template <int kOutputMode>
 SerializationStatus SerializeSection(uint8_t marker, SerializationState* state,
-                                     const JPEGData& jpg) {
+                                     const JPEGData& jpg, ThreadPool* pool) {
   const auto to_status = [](bool result) {
     return result ? SerializationStatus::DONE : SerializationStatus::ERROR;
   };
@@ -903,7 +1224,7 @@ SerializationStatus SerializeSection(uint8_t marker, SerializationState* state,
       return to_status(EncodeEOI(jpg, state));
 
     case 0xDA:
-      return EncodeScan<kOutputMode>(jpg, state);
+      return EncodeScan<kOutputMode>(jpg, state, pool);
 
     case 0xDB:
       return to_status(EncodeDQT(jpg, state));
@@ -940,10 +1261,12 @@ SerializationStatus SerializeSection(uint8_t marker, SerializationState* state,
   }
 }
 
-// TODO(veluca): add streaming support again.
+// Serializes `jpg` to `out`, continuing from `ss`. When `out` accepts no more
+// bytes, returns kNotEnoughBytes with the pending output kept in `ss`, so that
+// a later call with the same `ss` resumes where this one stopped.
 template <int kOutputMode>
 Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
-                         SerializationState* ss) {
+                         SerializationState* ss, ThreadPool* pool) {
   const auto maybe_push_output = [&]() -> Status {
     if (ss->stage != SerializationState::ERROR) {
       while (!ss->output_queue.empty()) {
@@ -953,6 +1276,7 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
           return StatusMessage(Status(StatusCode::kNotEnoughBytes),
                                "Failed to write output");
         }
+        chunk.next += num_written;
         chunk.len -= num_written;
         if (chunk.len == 0) {
           ss->output_queue.pop_front();
@@ -962,6 +1286,9 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
     return true;
   };
 
+  // Output that did not fit in a previous call goes first.
+  JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
+
   while (true) {
     switch (ss->stage) {
       case SerializationState::INIT: {
@@ -990,8 +1317,8 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
         }
 
         EncodeSOI(ss);
-        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         ss->stage = SerializationState::SERIALIZE_SECTION;
+        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         break;
       }
 
@@ -1002,13 +1329,12 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
         }
         uint8_t marker = jpg.marker_order[ss->section_index];
         SerializationStatus status =
-            SerializeSection<kOutputMode>(marker, ss, jpg);
+            SerializeSection<kOutputMode>(marker, ss, jpg, pool);
         if (status == SerializationStatus::ERROR) {
           JXL_WARNING("Failed to encode marker 0x%.2x", marker);
           ss->stage = SerializationState::ERROR;
           break;
         }
-        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         if (status == SerializationStatus::NEEDS_MORE_INPUT) {
           return JXL_FAILURE("Incomplete serialization data");
         } else if (status != SerializationStatus::DONE) {
@@ -1016,7 +1342,10 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
           ss->stage = SerializationState::ERROR;
           break;
         }
+        // The section is complete, so that a call resuming after running out
+        // of output space continues with the next one.
         ++ss->section_index;
+        JXL_QUIET_RETURN_IF_ERROR(maybe_push_output());
         break;
       }
 
@@ -1037,12 +1366,18 @@ Status WriteJpegInternal(const JPEGData& jpg, const JPEGOutput& out,
 
 Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out) {
   SerializationState ss;
-  return WriteJpegInternal<OutputModes::kModeWrite>(jpg, out, &ss);
+  return WriteJpegInternal<OutputModes::kModeWrite>(jpg, out, &ss, nullptr);
+}
+
+Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out,
+                 SerializationState* ss, ThreadPool* pool) {
+  return WriteJpegInternal<OutputModes::kModeWrite>(jpg, out, ss, pool);
 }
 
 Status ProcessJpeg(const JPEGData& jpg, SerializationState* ss) {
   auto nullout = [](const uint8_t* buf, size_t len) { return len; };
-  return WriteJpegInternal<OutputModes::kModeHistogram>(jpg, nullout, ss);
+  return WriteJpegInternal<OutputModes::kModeHistogram>(jpg, nullout, ss,
+                                                        nullptr);
 }
 
 Status EncodeImageJPGCoefficients(const CodecInOut* io, PaddedBytes* bytes) {
@@ -13,6 +13,7 @@
 
 #include <functional>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/jpeg/dec_jpeg_serialization_state.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
@@ -26,6 +27,15 @@ using JPEGOutput = std::function<size_t(const uint8_t* buf, size_t len)>;
 
 Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out);
 
+// Same as WriteJpeg, but keeps the serialization progress in `ss`. If `out`
+// stops accepting bytes, returns a StatusCode::kNotEnoughBytes status; calling
+// it again with the same `ss` continues where the previous call stopped. The
+// output is passed to `out` as soon as each marker segment or scan is
+// complete. If `pool` is not null, the entropy coding of large scans is
+// parallelized.
+Status WriteJpeg(const JPEGData& jpg, const JPEGOutput& out,
+                 SerializationState* ss, ThreadPool* pool);
+
 // Same as WriteJpeg, but instead of writing to the output, collects statistics
 // about the bit-stream into `ss`.
 Status ProcessJpeg(const JPEGData& jpg, SerializationState* ss);
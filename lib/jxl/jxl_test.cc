@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <algorithm>
 #include <array>
 #include <future>
 #include <string>
@@ -107,6 +108,30 @@ TEST(JxlTest, RoundtripTinyFast) {
   EXPECT_NEAR(Roundtrip(t.ppf(), cparams, {}, pool, &ppf_out), 201, 5);
 }
 
+TEST(JxlTest, ReuseAcsTransformsKeepsOutput) {
+  ThreadPoolInternal pool(4);
+  const PaddedBytes orig = ReadTestData("jxl/flower/flower.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, &pool));
+  io.ShrinkTo(io.xsize() / 4, io.ysize() / 4);
+
+  for (SpeedTier speed_tier : {SpeedTier::kHare, SpeedTier::kSquirrel,
+                               SpeedTier::kKitten}) {
+    CompressParams cparams;
+    cparams.speed_tier = speed_tier;
+    PaddedBytes compressed[2];
+    for (bool reuse : {false, true}) {
+      cparams.reuse_acs_transforms = reuse;
+      PassesEncoderState enc_state;
+      EXPECT_TRUE(EncodeFile(cparams, &io, &enc_state, &compressed[reuse],
+                             GetJxlCms(), /*aux_out=*/nullptr, &pool));
+    }
+    ASSERT_EQ(compressed[0].size(), compressed[1].size());
+    EXPECT_TRUE(std::equal(compressed[0].begin(), compressed[0].end(),
+                           compressed[1].begin()));
+  }
+}
+
 TEST(JxlTest, RoundtripSmallD1) {
   ThreadPool* pool = nullptr;
   const PaddedBytes orig =
@@ -1118,6 +1143,96 @@ TEST(JxlTest, RoundtripLossless8Gray) {
   EXPECT_EQ(ppf_out.info.bits_per_sample, 8);
 }
 
+TEST(JxlTest, RoundtripAnimationCropUnchanged) {
+  ThreadPool* pool = nullptr;
+  TestImage t;
+  t.SetDimensions(64, 64);
+  t.ppf().info.have_animation = JXL_TRUE;
+  t.ppf().info.animation.tps_numerator = 10;
+  t.ppf().info.animation.tps_denominator = 1;
+  t.AddFrame().RandomFill();
+  // Identical to the first frame.
+  t.AddFrame().RandomFill();
+  // Only a small block differs from the previous frame.
+  TestImage::Frame frame = t.AddFrame();
+  frame.RandomFill();
+  for (size_t y = 20; y < 24; ++y) {
+    for (size_t x = 30; x < 34; ++x) {
+      for (size_t c = 0; c < 3; ++c) frame.SetValue(y, x, c, 0.0f);
+    }
+  }
+  for (auto& f : t.ppf().frames) f.frame_info.duration = 1;
+
+  JXLCompressParams cparams = CompressParamsForLossless();
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(t.ppf().frames[0].color.format);
+
+  PackedPixelFile ppf_full;
+  const size_t full_size =
+      Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_full);
+  cparams.crop_unchanged_regions = true;
+  PackedPixelFile ppf_out;
+  const size_t cropped_size =
+      Roundtrip(t.ppf(), cparams, dparams, pool, &ppf_out);
+  EXPECT_LT(cropped_size * 2, full_size);
+
+  ASSERT_EQ(ppf_out.frames.size(), t.ppf().frames.size());
+  for (size_t i = 0; i < ppf_out.frames.size(); ++i) {
+    const extras::PackedImage& expected = t.ppf().frames[i].color;
+    const extras::PackedImage& actual = ppf_out.frames[i].color;
+    ASSERT_EQ(actual.pixels_size, expected.pixels_size);
+    EXPECT_EQ(0, memcmp(actual.pixels(), expected.pixels(),
+                        expected.pixels_size));
+  }
+}
+
+// Appends the rows it receives to `rows`.
+class CollectRowSink : public extras::RowSink {
+ public:
+  CollectRowSink(std::vector<uint8_t>* rows, bool* finished)
+      : rows_(rows), finished_(finished) {}
+  Status WriteRows(const uint8_t* rows, size_t num_rows,
+                   size_t stride) override {
+    rows_->insert(rows_->end(), rows, rows + num_rows * stride);
+    return true;
+  }
+  Status Finish(const PackedPixelFile& ppf) override {
+    *finished_ = true;
+    return true;
+  }
+
+ private:
+  std::vector<uint8_t>* rows_;
+  bool* finished_;
+};
+
+TEST(JxlTest, RoundtripLosslessRowSink) {
+  ThreadPoolInternal pool(4);
+  TestImage t;
+  t.SetDimensions(600, 300).AddFrame().RandomFill();
+
+  JXLCompressParams cparams = CompressParamsForLossless();
+  JXLDecompressParams dparams;
+  dparams.accepted_formats.push_back(t.ppf().frames[0].color.format);
+  std::vector<uint8_t> rows;
+  bool finished = false;
+  dparams.row_sink_factory = [&](const PackedPixelFile& ppf,
+                                 const JxlPixelFormat& format) {
+    return std::unique_ptr<extras::RowSink>(
+        new CollectRowSink(&rows, &finished));
+  };
+
+  PackedPixelFile ppf_out;
+  Roundtrip(t.ppf(), cparams, dparams, &pool, &ppf_out);
+  ASSERT_EQ(ppf_out.frames.size(), 1);
+  // The rows went to the sink, in order, instead of to the frame.
+  EXPECT_EQ(ppf_out.frames[0].color.ysize, 0);
+  EXPECT_TRUE(finished);
+  const extras::PackedImage& expected = t.ppf().frames[0].color;
+  ASSERT_EQ(rows.size(), expected.pixels_size);
+  EXPECT_EQ(0, memcmp(rows.data(), expected.pixels(), expected.pixels_size));
+}
+
 #if JPEGXL_ENABLE_GIF
 
 TEST(JxlTest, RoundtripAnimation) {
@@ -1187,12 +1302,14 @@ TEST(JxlTest, RoundtripAnimationPatches) {
 
 #endif  // JPEGXL_ENABLE_GIF
 
-size_t RoundtripJpeg(const PaddedBytes& jpeg_in, ThreadPool* pool) {
+size_t RoundtripJpeg(const PaddedBytes& jpeg_in,
+                     const extras::JXLCompressParams& cparams,
+                     ThreadPool* pool) {
   std::vector<uint8_t> jpeg_bytes(jpeg_in.data(),
                                   jpeg_in.data() + jpeg_in.size());
   std::vector<uint8_t> compressed;
-  EXPECT_TRUE(extras::EncodeImageJXL({}, extras::PackedPixelFile(), &jpeg_bytes,
-                                     &compressed));
+  EXPECT_TRUE(extras::EncodeImageJXL(cparams, extras::PackedPixelFile(),
+                                     &jpeg_bytes, &compressed));
 
   jxl::JXLDecompressParams dparams;
   test::SetThreadParallelRunner(dparams, pool);
@@ -1214,6 +1331,10 @@ size_t RoundtripJpeg(const PaddedBytes& jpeg_in, ThreadPool* pool) {
   return compressed.size();
 }
 
+size_t RoundtripJpeg(const PaddedBytes& jpeg_in, ThreadPool* pool) {
+  return RoundtripJpeg(jpeg_in, extras::JXLCompressParams(), pool);
+}
+
 void RoundtripJpegToPixels(const PaddedBytes& jpeg_in,
                            JXLDecompressParams dparams, ThreadPool* pool,
                            PackedPixelFile* ppf_out) {
@@ -1366,6 +1487,39 @@ TEST(JxlTest, JXL_TRANSCODE_JPEG_TEST(RoundtripJpegRecompression420Progr)) {
   EXPECT_NEAR(RoundtripJpeg(orig, &pool), 455499u, 10);
 }
 
+TEST(JxlTest, JXL_TRANSCODE_JPEG_TEST(RoundtripJpegRecompression420Restarts)) {
+  ThreadPoolInternal pool(8);
+  const PaddedBytes orig =
+      ReadTestData("jxl/flower/flower.png.im_q85_420_R13B.jpg");
+  // The scans of this JPEG have restart markers, which makes the
+  // reconstruction encode restart intervals in parallel.
+  RoundtripJpeg(orig, &pool);
+}
+
+TEST(JxlTest, JXL_TRANSCODE_JPEG_TEST(RoundtripJpegRecompressionFast)) {
+  ThreadPoolInternal pool(8);
+  const PaddedBytes orig = ReadTestData("jxl/flower/flower.png.im_q85_420.jpg");
+  const auto roundtrip = [&](int effort, ThreadPool* encode_pool) {
+    extras::JXLCompressParams cparams;
+    cparams.AddOption(JXL_ENC_FRAME_SETTING_EFFORT, effort);
+    if (encode_pool) {
+      cparams.runner = encode_pool->runner();
+      cparams.runner_opaque = encode_pool->runner_opaque();
+    }
+    return RoundtripJpeg(orig, cparams, &pool);
+  };
+  // Efforts 1 and 2 use a static block context map instead of the one chosen
+  // from the DC histograms, which are merged from one per thread.
+  const size_t size3 = roundtrip(3, &pool);
+  for (int effort : {1, 2}) {
+    const size_t size = roundtrip(effort, &pool);
+    EXPECT_EQ(size, roundtrip(effort, nullptr)) << "effort " << effort;
+    EXPECT_LT(size, orig.size()) << "effort " << effort;
+    EXPECT_LE(size, size3 * 1.05) << "effort " << effort;
+  }
+  EXPECT_EQ(size3, roundtrip(3, nullptr));
+}
+
 TEST(JxlTest, RoundtripProgressive) {
   ThreadPoolInternal pool(4);
   const PaddedBytes orig = ReadTestData("jxl/flower/flower.png");
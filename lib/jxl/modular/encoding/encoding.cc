@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <algorithm>
 #include <queue>
 
 #include "lib/jxl/base/printf_macros.h"
@@ -188,20 +189,24 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         }
       } else {
         JXL_DEBUG_V(8, "Fast track.");
+        // Residuals do not depend on previous pixels, so decode a whole row
+        // of tokens at once and unpack them in place.
         if (multiplier == 1 && offset == 0) {
           for (size_t y = 0; y < channel.h; y++) {
             pixel_type *JXL_RESTRICT r = channel.Row(y);
+            uint32_t *v = reinterpret_cast<uint32_t *>(r);
+            reader->ReadHybridUintClusteredBatch(ctx_id, br, v, channel.w);
             for (size_t x = 0; x < channel.w; x++) {
-              uint32_t v = reader->ReadHybridUintClustered(ctx_id, br);
-              r[x] = UnpackSigned(v);
+              r[x] = UnpackSigned(v[x]);
             }
           }
         } else {
           for (size_t y = 0; y < channel.h; y++) {
             pixel_type *JXL_RESTRICT r = channel.Row(y);
+            uint32_t *v = reinterpret_cast<uint32_t *>(r);
+            reader->ReadHybridUintClusteredBatch(ctx_id, br, v, channel.w);
             for (size_t x = 0; x < channel.w; x++) {
-              uint32_t v = reader->ReadHybridUintClustered(ctx_id, br);
-              r[x] = make_pixel(v, multiplier, offset);
+              r[x] = make_pixel(v[x], multiplier, offset);
             }
           }
         }
@@ -422,6 +427,16 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
 
 GroupHeader::GroupHeader() { Bundle::Init(this); }
 
+bool UsesBatchDecoding(const Tree &tree) {
+  // The "Fast track" of DecodeModularChannelMAANS is taken for channels whose
+  // filtered tree is a single leaf with the zero predictor.
+  return std::any_of(tree.begin(), tree.end(),
+                     [](const PropertyDecisionNode &node) {
+                       return node.property < 0 &&
+                              node.predictor == Predictor::Zero;
+                     });
+}
+
 Status ValidateChannelDimensions(const Image &image,
                                  const ModularOptions &options) {
   size_t nb_channels = image.channel.size();
@@ -536,6 +551,7 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
     JXL_RETURN_IF_ERROR(DecodeTree(br, &tree_storage, max_tree_size));
     JXL_RETURN_IF_ERROR(DecodeHistograms(br, (tree_storage.size() + 1) / 2,
                                          &code_storage, &context_map_storage));
+    if (UsesBatchDecoding(tree_storage)) code_storage.BuildMultiSymbolTables();
   } else {
     if (!global_tree || !global_code || !global_ctx_map ||
         global_tree->empty()) {
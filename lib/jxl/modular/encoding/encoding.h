@@ -122,6 +122,10 @@ bool TreeToLookupTable(const FlatTree &tree,
 Status ValidateChannelDimensions(const Image &image,
                                  const ModularOptions &options);
 
+// Whether channels decoded with `tree` read their residuals in batches, so
+// that the code of the tree needs ANSCode::BuildMultiSymbolTables.
+bool UsesBatchDecoding(const Tree &tree);
+
 Status ModularGenericDecompress(BitReader *br, Image &image,
                                 GroupHeader *header, size_t group_id,
                                 ModularOptions *options,
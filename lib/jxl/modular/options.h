@@ -110,6 +110,10 @@ struct ModularOptions {
 
   // Ignore the image and just pretend all tokens are zeroes
   bool zero_tokens = false;
+
+  // Maximum LZ77 hash chain depth used when entropy coding the tokens; trades
+  // encoding speed for density. 0 keeps the default of HistogramParams.
+  uint32_t lz77_max_chain_length = 0;
 };
 
 }  // namespace jxl
@@ -3,10 +3,19 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include <cmath>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "lib/extras/codec.h"
+#include "lib/jxl/base/random.h"
+#include "lib/jxl/base/thread_pool_internal.h"
+#include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/enc_butteraugli_comparator.h"
+#include "lib/jxl/enc_cache.h"
+#include "lib/jxl/enc_dot_dictionary.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/enc_patch_dictionary.h"
 #include "lib/jxl/image_test_utils.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testdata.h"
@@ -32,6 +41,49 @@ TEST(PatchDictionaryTest, GrayscaleModular) {
   VerifyRelativeError(*io.Main().color(), *io2.Main().color(), 1e-7f, 0);
 }
 
+TEST(PatchDictionaryTest, GrayscaleModularThreads) {
+  ThreadPoolInternal pool(4);
+  const PaddedBytes orig = ReadTestData("jxl/grayscale_patches.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, &pool));
+
+  CompressParams cparams;
+  cparams.SetLossless();
+  cparams.patches = jxl::Override::kOn;
+
+  CodecInOut io2;
+  EXPECT_LE(Roundtrip(&io, cparams, {}, &pool, &io2), 8000u);
+  VerifyRelativeError(*io.Main().color(), *io2.Main().color(), 1e-7f, 0);
+}
+
+TEST(PatchDictionaryTest, GrayscaleModularLossyPalette) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig = ReadTestData("jxl/grayscale_patches.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, pool));
+
+  CompressParams cparams;
+  cparams.SetLossless();
+  cparams.lossy_palette = true;
+  cparams.palette_colors = 0;
+  cparams.patches = jxl::Override::kOff;
+
+  CodecInOut io2;
+  Roundtrip(&io, cparams, {}, pool, &io2);
+  const float distance_no_patches =
+      ButteraugliDistance(io, io2, cparams.ba_params, GetJxlCms(),
+                          /*distmap=*/nullptr, pool);
+
+  // The patch frame is lossy too, so the patches must be subtracted from what
+  // the decoder reconstructs, not from the encoder input.
+  cparams.patches = jxl::Override::kOn;
+  CodecInOut io3;
+  Roundtrip(&io, cparams, {}, pool, &io3);
+  EXPECT_LE(ButteraugliDistance(io, io3, cparams.ba_params, GetJxlCms(),
+                                /*distmap=*/nullptr, pool),
+            distance_no_patches * 1.1f + 0.05f);
+}
+
 TEST(PatchDictionaryTest, GrayscaleVarDCT) {
   ThreadPool* pool = nullptr;
   const PaddedBytes orig = ReadTestData("jxl/grayscale_patches.png");
@@ -50,5 +102,101 @@ TEST(PatchDictionaryTest, GrayscaleVarDCT) {
             1.1);
 }
 
+TEST(PatchDictionaryTest, GrayscaleVarDCTHare) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig = ReadTestData("jxl/grayscale_patches.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, pool));
+
+  CompressParams cparams;
+  cparams.speed_tier = SpeedTier::kHare;
+
+  CodecInOut io2;
+  const size_t size_default = Roundtrip(&io, cparams, {}, pool, &io2);
+  cparams.patches = jxl::Override::kOn;
+  const size_t size_patches = Roundtrip(&io, cparams, {}, pool, &io2);
+  // Patches are off by default at this speed tier, but can be enabled.
+  EXPECT_LT(size_patches, size_default);
+}
+
+TEST(PatchDictionaryTest, TextLikePatchesAreSorted) {
+  const PaddedBytes orig = ReadTestData("jxl/grayscale_patches.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, nullptr));
+  PassesEncoderState state;
+  state.cparams.patches = jxl::Override::kOn;
+
+  const std::vector<PatchInfo> patches =
+      FindTextLikePatches(*io.Main().color(), &state, /*pool=*/nullptr,
+                          /*aux_out=*/nullptr, /*is_xyb=*/false);
+  ASSERT_FALSE(patches.empty());
+  for (size_t i = 0; i < patches.size(); i++) {
+    // Each distinct patch appears once, in increasing order, and repeats at
+    // distinct positions that are in increasing order too.
+    if (i > 0) EXPECT_TRUE(patches[i - 1].first < patches[i].first);
+    const auto& positions = patches[i].second;
+    ASSERT_GE(positions.size(), 2u);
+    for (size_t j = 1; j < positions.size(); j++) {
+      EXPECT_LT(positions[j - 1], positions[j]);
+    }
+  }
+
+  ThreadPoolInternal pool(4);
+  const std::vector<PatchInfo> patches_pool =
+      FindTextLikePatches(*io.Main().color(), &state, &pool,
+                          /*aux_out=*/nullptr, /*is_xyb=*/false);
+  ASSERT_EQ(patches.size(), patches_pool.size());
+  for (size_t i = 0; i < patches.size(); i++) {
+    EXPECT_TRUE(patches[i].first == patches_pool[i].first);
+    EXPECT_EQ(patches[i].second, patches_pool[i].second);
+  }
+}
+
+// Dot detection splits its work across the pool; the dots it finds must not
+// depend on that.
+TEST(PatchDictionaryTest, DotsDoNotDependOnThreads) {
+  constexpr size_t kSize = 128;
+  constexpr size_t kSpacing = 16;
+  // Noisy XYB background with small Gaussian dots in Y.
+  Image3F opsin(kSize, kSize);
+  Rng rng(0);
+  for (size_t y = 0; y < kSize; y++) {
+    for (size_t x = 0; x < kSize; x++) {
+      opsin.PlaneRow(0, y)[x] = rng.UniformF(-0.002f, 0.002f);
+      opsin.PlaneRow(1, y)[x] = 0.4f + rng.UniformF(-0.002f, 0.002f);
+      opsin.PlaneRow(2, y)[x] = 0.4f + rng.UniformF(-0.002f, 0.002f);
+    }
+  }
+  for (size_t cy = kSpacing / 2; cy < kSize; cy += kSpacing) {
+    for (size_t cx = kSpacing / 2; cx < kSize; cx += kSpacing) {
+      const float intensity = rng.UniformF(0.3f, 0.4f);
+      for (size_t y = cy - 3; y <= cy + 3; y++) {
+        for (size_t x = cx - 3; x <= cx + 3; x++) {
+          const float dx = static_cast<float>(x) - cx;
+          const float dy = static_cast<float>(y) - cy;
+          opsin.PlaneRow(1, y)[x] +=
+              intensity * std::exp(-(dx * dx + dy * dy));
+        }
+      }
+    }
+  }
+
+  CompressParams cparams;
+  cparams.dots = jxl::Override::kOn;
+  const ColorCorrelationMap cmap(kSize, kSize);
+  const std::vector<PatchInfo> dots =
+      FindDotDictionary(cparams, opsin, cmap, /*pool=*/nullptr);
+  EXPECT_FALSE(dots.empty());
+
+  ThreadPoolInternal pool(4);
+  const std::vector<PatchInfo> dots_pool =
+      FindDotDictionary(cparams, opsin, cmap, &pool);
+  ASSERT_EQ(dots.size(), dots_pool.size());
+  for (size_t i = 0; i < dots.size(); i++) {
+    EXPECT_TRUE(dots[i].first == dots_pool[i].first);
+    EXPECT_EQ(dots[i].second, dots_pool[i].second);
+  }
+}
+
 }  // namespace
 }  // namespace jxl
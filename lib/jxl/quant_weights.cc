@@ -1163,45 +1163,13 @@ const QuantEncoding* DequantMatrices::Library() {
   return reinterpret_cast<const QuantEncoding*>(kDequantLibrary.data());
 }
 
-DequantMatrices::DequantMatrices() {
+DequantMatrices::DequantMatrices() : cache_(DequantTableCache::Global()) {
   encodings_.resize(size_t(QuantTable::kNum), QuantEncoding::Library(0));
-  size_t pos = 0;
-  size_t offsets[kNum * 3];
-  for (size_t i = 0; i < size_t(QuantTable::kNum); i++) {
-    size_t num = required_size_[i] * kDCTBlockSize;
-    for (size_t c = 0; c < 3; c++) {
-      offsets[3 * i + c] = pos + c * num;
-    }
-    pos += 3 * num;
-  }
-  for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
-    for (size_t c = 0; c < 3; c++) {
-      table_offsets_[i * 3 + c] = offsets[kQuantTable[i] * 3 + c];
-    }
-  }
 }
 
 Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
   const QuantEncoding* library = Library();
 
-  if (!table_storage_) {
-    table_storage_ = hwy::AllocateAligned<float>(2 * kTotalTableSize);
-    table_ = table_storage_.get();
-    inv_table_ = table_storage_.get() + kTotalTableSize;
-  }
-
-  size_t offsets[kNum * 3 + 1];
-  size_t pos = 0;
-  for (size_t i = 0; i < kNum; i++) {
-    size_t num = required_size_[i] * kDCTBlockSize;
-    for (size_t c = 0; c < 3; c++) {
-      offsets[3 * i + c] = pos + c * num;
-    }
-    pos += 3 * num;
-  }
-  offsets[kNum * 3] = pos;
-  JXL_ASSERT(pos == kTotalTableSize);
-
   uint32_t kind_mask = 0;
   for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
     if (acs_mask & (1u << i)) {
@@ -1217,24 +1185,119 @@ Status DequantMatrices::EnsureComputed(uint32_t acs_mask) {
   for (size_t table = 0; table < kNum; table++) {
     if ((1 << table) & computed_kind_mask) continue;
     if ((1 << table) & ~kind_mask) continue;
-    size_t pos = offsets[table * 3];
-    if (encodings_[table].mode == QuantEncoding::kQuantModeLibrary) {
-      JXL_CHECK(HWY_DYNAMIC_DISPATCH(ComputeQuantTable)(
-          library[table], table_storage_.get(),
-          table_storage_.get() + kTotalTableSize, table, QuantTable(table),
-          &pos));
-    } else {
+    const bool is_library =
+        encodings_[table].mode == QuantEncoding::kQuantModeLibrary;
+    const QuantEncoding& encoding =
+        is_library ? library[table] : encodings_[table];
+    const size_t num = required_size_[table] * kDCTBlockSize;
+    const bool use_cache = is_library || !cache_->library_only();
+    const std::string key =
+        use_cache ? DequantTableCache::Key(encoding, QuantTable(table)) : "";
+    const float* tables = use_cache ? cache_->Find(key) : nullptr;
+    if (tables == nullptr) {
+      hwy::AlignedFreeUniquePtr<float[]> storage =
+          hwy::AllocateAligned<float>(6 * num);
+      size_t pos = 0;
       JXL_RETURN_IF_ERROR(HWY_DYNAMIC_DISPATCH(ComputeQuantTable)(
-          encodings_[table], table_storage_.get(),
-          table_storage_.get() + kTotalTableSize, table, QuantTable(table),
-          &pos));
+          encoding, storage.get(), storage.get() + 3 * num, table,
+          QuantTable(table), &pos));
+      JXL_ASSERT(pos == 3 * num);
+      if (use_cache) tables = cache_->Insert(key, 6 * num, &storage);
+      if (tables == nullptr) {
+        own_tables_[table] = std::move(storage);
+        tables = own_tables_[table].get();
+      }
+    }
+    for (size_t i = 0; i < AcStrategy::kNumValidStrategies; i++) {
+      if (kQuantTable[i] != table) continue;
+      for (size_t c = 0; c < 3; c++) {
+        table_[i * 3 + c] = tables + c * num;
+        inv_table_[i * 3 + c] = tables + (3 + c) * num;
+      }
     }
-    JXL_ASSERT(pos == offsets[table * 3 + 3]);
   }
   computed_mask_ |= acs_mask;
 
   return true;
 }
 
+DequantTableCache* DequantTableCache::Global() {
+  static DequantTableCache* cache =
+      new DequantTableCache(kDefaultMaxBytes, /*library_only=*/true);
+  return cache;
+}
+
+std::string DequantTableCache::Key(const QuantEncoding& encoding,
+                                   DequantMatrices::QuantTable kind) {
+  std::string key;
+  const auto append = [&key](const void* data, size_t size) {
+    key.append(static_cast<const char*>(data), size);
+  };
+  const auto append_dct_params = [&append](const DctQuantWeightParams& params) {
+    append(&params.num_distance_bands, sizeof(params.num_distance_bands));
+    const size_t num_bands = std::min(params.num_distance_bands,
+                                      DctQuantWeightParams::kMaxDistanceBands);
+    for (size_t c = 0; c < 3; c++) {
+      append(params.distance_bands[c].data(), num_bands * sizeof(float));
+    }
+  };
+  const uint8_t header[2] = {static_cast<uint8_t>(kind),
+                             static_cast<uint8_t>(encoding.mode)};
+  append(header, sizeof(header));
+  switch (encoding.mode) {
+    case QuantEncoding::kQuantModeLibrary:
+      append(&encoding.predefined, sizeof(encoding.predefined));
+      break;
+    case QuantEncoding::kQuantModeID:
+      append(&encoding.idweights, sizeof(encoding.idweights));
+      break;
+    case QuantEncoding::kQuantModeDCT2:
+      append(&encoding.dct2weights, sizeof(encoding.dct2weights));
+      break;
+    case QuantEncoding::kQuantModeDCT4:
+      append_dct_params(encoding.dct_params);
+      append(&encoding.dct4multipliers, sizeof(encoding.dct4multipliers));
+      break;
+    case QuantEncoding::kQuantModeDCT4X8:
+      append_dct_params(encoding.dct_params);
+      append(&encoding.dct4x8multipliers, sizeof(encoding.dct4x8multipliers));
+      break;
+    case QuantEncoding::kQuantModeDCT:
+      append_dct_params(encoding.dct_params);
+      break;
+    case QuantEncoding::kQuantModeAFV:
+      append_dct_params(encoding.dct_params);
+      append_dct_params(encoding.dct_params_afv_4x4);
+      append(&encoding.afv_weights, sizeof(encoding.afv_weights));
+      break;
+    case QuantEncoding::kQuantModeRAW:
+      append(&encoding.qraw.qtable_den, sizeof(encoding.qraw.qtable_den));
+      if (encoding.qraw.qtable) {
+        append(encoding.qraw.qtable->data(),
+               encoding.qraw.qtable->size() * sizeof(int));
+      }
+      break;
+  }
+  return key;
+}
+
+const float* DequantTableCache::Find(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = tables_.find(key);
+  return it == tables_.end() ? nullptr : it->second.get();
+}
+
+const float* DequantTableCache::Insert(
+    const std::string& key, size_t num_floats,
+    hwy::AlignedFreeUniquePtr<float[]>* tables) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = tables_.find(key);
+  if (it != tables_.end()) return it->second.get();
+  const size_t bytes = num_floats * sizeof(float);
+  if (bytes_ + bytes > max_bytes_) return nullptr;
+  bytes_ += bytes;
+  return (tables_[key] = std::move(*tables)).get();
+}
+
 }  // namespace jxl
 #endif
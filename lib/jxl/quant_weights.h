@@ -11,6 +11,9 @@
 
 #include <array>
 #include <hwy/aligned_allocator.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -26,12 +29,6 @@
 
 namespace jxl {
 
-template <typename T, size_t N>
-constexpr T ArraySum(T (&a)[N], size_t i = N - 1) {
-  static_assert(N > 0, "Trying to compute the sum of an empty array");
-  return i == 0 ? a[0] : a[i] + ArraySum(a, i - 1);
-}
-
 static constexpr size_t kMaxQuantTableSize = AcStrategy::kMaxCoeffArea;
 static constexpr size_t kNumPredefinedTables = 1;
 static constexpr size_t kCeilLog2NumPredefinedTables = 0;
@@ -315,6 +312,8 @@ const float kDCQuant[3] = {
 class ModularFrameEncoder;
 class ModularFrameDecoder;
 
+class DequantTableCache;
+
 class DequantMatrices {
  public:
   enum QuantTable : size_t {
@@ -378,13 +377,13 @@ class DequantMatrices {
   JXL_INLINE const float* Matrix(size_t quant_kind, size_t c) const {
     JXL_DASSERT(quant_kind < AcStrategy::kNumValidStrategies);
     JXL_DASSERT((1 << quant_kind) & computed_mask_);
-    return &table_[table_offsets_[quant_kind * 3 + c]];
+    return table_[quant_kind * 3 + c];
   }
 
   JXL_INLINE const float* InvMatrix(size_t quant_kind, size_t c) const {
     JXL_DASSERT(quant_kind < AcStrategy::kNumValidStrategies);
     JXL_DASSERT((1 << quant_kind) & computed_mask_);
-    return &inv_table_[table_offsets_[quant_kind * 3 + c]];
+    return inv_table_[quant_kind * 3 + c];
   }
 
   // DC quants are used in modular mode for XYB multipliers.
@@ -423,25 +422,87 @@ class DequantMatrices {
   static_assert(kNum == sizeof(required_size_y) / sizeof(*required_size_y),
                 "Update this array when adding or removing quant tables.");
 
+  // Computes the tables of the kinds used by the strategies in `acs_mask` that
+  // aren't yet, or takes them from the cache.
   Status EnsureComputed(uint32_t acs_mask);
 
+  // Sets the cache that EnsureComputed takes tables from and adds them to, by
+  // default DequantTableCache::Global(), which only holds library tables.
+  // `cache` must outlive this object.
+  void SetCache(DequantTableCache* cache) {
+    cache_ = cache;
+    computed_mask_ = 0;
+  }
+
  private:
+  friend class DequantTableCache;
+
   static constexpr size_t required_size_[] = {
       1, 1, 1, 1, 4, 16, 2, 4, 8, 1, 1, 64, 32, 256, 128, 1024, 512};
   static_assert(kNum == sizeof(required_size_) / sizeof(*required_size_),
                 "Update this array when adding or removing quant tables.");
-  static constexpr size_t kTotalTableSize =
-      ArraySum(required_size_) * kDCTBlockSize * 3;
 
   uint32_t computed_mask_ = 0;
-  // kTotalTableSize entries followed by kTotalTableSize for inv_table
-  hwy::AlignedFreeUniquePtr<float[]> table_storage_;
-  const float* table_;
-  const float* inv_table_;
+  // Per strategy and channel, valid for the strategies in computed_mask_ and
+  // all others of the same kinds. They point into own_tables_ or the cache.
+  const float* table_[AcStrategy::kNumValidStrategies * 3];
+  const float* inv_table_[AcStrategy::kNumValidStrategies * 3];
+  // Tables of the kinds that didn't fit in the cache.
+  hwy::AlignedFreeUniquePtr<float[]> own_tables_[kNum];
   float dc_quant_[3] = {kDCQuant[0], kDCQuant[1], kDCQuant[2]};
   float inv_dc_quant_[3] = {kInvDCQuant[0], kInvDCQuant[1], kInvDCQuant[2]};
-  size_t table_offsets_[AcStrategy::kNumValidStrategies * 3];
   std::vector<QuantEncoding> encodings_;
+  DequantTableCache* cache_;
+};
+
+// Tables of single kinds keyed by the parameters of their encoding, so that
+// frames and images with the same encodings, e.g. the library ones, compute
+// each table only once. Tables are never evicted: once `max_bytes` are used,
+// further tables are computed per DequantMatrices instead. Thread-safe.
+class DequantTableCache {
+ public:
+  static constexpr size_t kDefaultMaxBytes = 16 << 20;
+
+  // With `library_only`, only the tables of library encodings are stored,
+  // which are few; custom tables are then computed per DequantMatrices.
+  explicit DequantTableCache(size_t max_bytes = kDefaultMaxBytes,
+                             bool library_only = false)
+      : max_bytes_(max_bytes), library_only_(library_only) {}
+
+  DequantTableCache(const DequantTableCache&) = delete;
+  DequantTableCache& operator=(const DequantTableCache&) = delete;
+
+  // The cache of all DequantMatrices that don't set another one. It only
+  // stores library tables, so that custom tables of untrusted images don't
+  // stay allocated for the lifetime of the process.
+  static DequantTableCache* Global();
+
+  bool library_only() const { return library_only_; }
+
+  // Returns a key that only equal encodings of `kind` share.
+  static std::string Key(const QuantEncoding& encoding,
+                         DequantMatrices::QuantTable kind);
+
+  // Returns the tables stored for `key`, or nullptr.
+  const float* Find(const std::string& key);
+
+  // Stores `tables` for `key` and returns the stored tables, which are those
+  // of another caller if it was faster. Returns nullptr and leaves `tables`
+  // untouched if the cache is full.
+  const float* Insert(const std::string& key, size_t num_floats,
+                      hwy::AlignedFreeUniquePtr<float[]>* tables);
+
+  size_t bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+ private:
+  const size_t max_bytes_;
+  const bool library_only_;
+  mutable std::mutex mutex_;
+  size_t bytes_ = 0;
+  std::unordered_map<std::string, hwy::AlignedFreeUniquePtr<float[]>> tables_;
 };
 
 }  // namespace jxl
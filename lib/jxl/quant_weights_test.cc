@@ -11,6 +11,7 @@
 #include <hwy/base.h>  // HWY_ALIGN_MAX
 #include <hwy/tests/test_util-inl.h>
 #include <numeric>
+#include <string>
 
 #include "lib/jxl/base/random.h"
 #include "lib/jxl/dct_for_test.h"
@@ -157,6 +158,77 @@ TEST(QuantWeightsTest, RAW) {
   RoundtripMatrices(encodings);
 }
 
+TEST(QuantWeightsTest, CacheKey) {
+  float weights[3][2] = {{0.25f, 0}, {0.25f, 0}, {0.25f, 0}};
+  const QuantEncoding a = QuantEncoding::DCT(DctQuantWeightParams(weights));
+  weights[1][1] = 0.5f;
+  const QuantEncoding b = QuantEncoding::DCT(DctQuantWeightParams(weights));
+  const std::string key_a =
+      DequantTableCache::Key(a, DequantMatrices::DCT16X16);
+  EXPECT_EQ(key_a, DequantTableCache::Key(QuantEncoding(a),
+                                          DequantMatrices::DCT16X16));
+  EXPECT_NE(key_a, DequantTableCache::Key(b, DequantMatrices::DCT16X16));
+  EXPECT_NE(key_a, DequantTableCache::Key(a, DequantMatrices::DCT32X32));
+}
+
+TEST(QuantWeightsTest, CacheSharesUsedKinds) {
+  DequantTableCache cache;
+  DequantMatrices a;
+  DequantMatrices b;
+  a.SetCache(&cache);
+  b.SetCache(&cache);
+  const uint32_t dct8 = 1u << AcStrategy::DCT;
+  ASSERT_TRUE(a.EnsureComputed(dct8));
+  // Only the tables of the requested kind are computed.
+  EXPECT_EQ(6 * kDCTBlockSize * sizeof(float), cache.bytes());
+  ASSERT_TRUE(b.EnsureComputed(dct8 | (1u << AcStrategy::DCT16X16)));
+  EXPECT_EQ(a.Matrix(AcStrategy::DCT, 1), b.Matrix(AcStrategy::DCT, 1));
+  EXPECT_EQ(6 * 5 * kDCTBlockSize * sizeof(float), cache.bytes());
+
+  // Without room in the cache, the tables are computed per instance.
+  DequantTableCache full(/*max_bytes=*/0);
+  DequantMatrices c;
+  c.SetCache(&full);
+  ASSERT_TRUE(c.EnsureComputed(1u << AcStrategy::DCT16X16));
+  EXPECT_EQ(0u, full.bytes());
+  EXPECT_NE(b.Matrix(AcStrategy::DCT16X16, 2),
+            c.Matrix(AcStrategy::DCT16X16, 2));
+  for (size_t i = 0; i < 4 * kDCTBlockSize; i++) {
+    EXPECT_EQ(b.Matrix(AcStrategy::DCT16X16, 2)[i],
+              c.Matrix(AcStrategy::DCT16X16, 2)[i]);
+    EXPECT_EQ(b.InvMatrix(AcStrategy::DCT16X16, 2)[i],
+              c.InvMatrix(AcStrategy::DCT16X16, 2)[i]);
+  }
+}
+
+TEST(QuantWeightsTest, LibraryOnlyCache) {
+  DequantTableCache cache(DequantTableCache::kDefaultMaxBytes,
+                          /*library_only=*/true);
+  std::vector<QuantEncoding> encodings(DequantMatrices::kNum,
+                                       QuantEncoding::Library(0));
+  float weights[3][2] = {{0.25f, 0}, {0.25f, 0}, {0.25f, 0}};
+  encodings[DequantMatrices::DCT16X16] =
+      QuantEncoding::DCT(DctQuantWeightParams(weights));
+  DequantMatrices a;
+  DequantMatrices b;
+  a.SetCache(&cache);
+  b.SetCache(&cache);
+  a.SetEncodings(encodings);
+  b.SetEncodings(encodings);
+  const uint32_t mask = (1u << AcStrategy::DCT) | (1u << AcStrategy::DCT16X16);
+  ASSERT_TRUE(a.EnsureComputed(mask));
+  ASSERT_TRUE(b.EnsureComputed(mask));
+  // The library DCT8 tables are shared, the custom DCT16 ones are not.
+  EXPECT_EQ(6 * kDCTBlockSize * sizeof(float), cache.bytes());
+  EXPECT_EQ(a.Matrix(AcStrategy::DCT, 1), b.Matrix(AcStrategy::DCT, 1));
+  EXPECT_NE(a.Matrix(AcStrategy::DCT16X16, 1),
+            b.Matrix(AcStrategy::DCT16X16, 1));
+  for (size_t i = 0; i < 4 * kDCTBlockSize; i++) {
+    EXPECT_EQ(a.Matrix(AcStrategy::DCT16X16, 1)[i],
+              b.Matrix(AcStrategy::DCT16X16, 1)[i]);
+  }
+}
+
 class QuantWeightsTargetTest : public hwy::TestWithParamTarget {};
 HWY_TARGET_INSTANTIATE_TEST_SUITE_P(QuantWeightsTargetTest);
 
@@ -674,6 +674,13 @@ void LowMemoryRenderPipeline::RenderRect(size_t thread_id,
   int num_extra_rows = *std::max_element(virtual_ypadding_for_output_.begin(),
                                          virtual_ypadding_for_output_.end());
 
+  // The stages are interleaved row by row; their times are summed here and
+  // added to the stage stats once for the whole group.
+  std::vector<StageTotals> stage_totals(stage_stats_ ? stages_.size() : 0);
+  auto totals = [&](size_t i) {
+    return stage_totals.empty() ? nullptr : &stage_totals[i];
+  };
+
   for (int vy = -num_extra_rows;
        vy < int(image_area_rect.ysize()) + num_extra_rows; vy++) {
     for (size_t i = 0; i < first_trailing_stage_; i++) {
@@ -699,9 +706,9 @@ void LowMemoryRenderPipeline::RenderRect(size_t thread_id,
       prepare_io_rows(y, i);
 
       // Produce output rows.
-      stages_[i]->ProcessRow(input_rows[i], output_rows,
-                             xpadding_for_output_[i], group_rect[i].xsize(),
-                             group_rect[i].x0(), image_y, thread_id);
+      ProcessStageRow(i, input_rows[i], output_rows, xpadding_for_output_[i],
+                      group_rect[i].xsize(), group_rect[i].x0(), image_y,
+                      thread_id, totals(i));
     }
 
     // Process trailing stages, i.e. the final set of non-kInOut stages; they
@@ -740,11 +747,12 @@ void LowMemoryRenderPipeline::RenderRect(size_t thread_id,
           i < first_image_dim_stage_ ? full_image_x0 - frame_x0 : full_image_x0;
       size_t y =
           i < first_image_dim_stage_ ? full_image_y - frame_y0 : full_image_y;
-      stages_[i]->ProcessRow(input_rows[first_trailing_stage_], output_rows,
-                             /*xextra=*/0, full_image_x1 - full_image_x0, x0, y,
-                             thread_id);
+      ProcessStageRow(i, input_rows[first_trailing_stage_], output_rows,
+                      /*xextra=*/0, full_image_x1 - full_image_x0, x0, y,
+                      thread_id, totals(i));
     }
   }
+  AddStageTotals(stage_totals);
 }
 
 void LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
@@ -757,15 +765,18 @@ void LowMemoryRenderPipeline::RenderPadding(size_t thread_id, Rect rect) {
     input_rows[c][0] = out_of_frame_data_[thread_id].Row(c);
   }
 
+  std::vector<StageTotals> stage_totals(stage_stats_ ? stages_.size() : 0);
   for (size_t y = 0; y < rect.ysize(); y++) {
     stages_[first_image_dim_stage_ - 1]->ProcessPaddingRow(
         input_rows, rect.xsize(), rect.x0(), rect.y0() + y);
     for (size_t i = first_image_dim_stage_; i < stages_.size(); i++) {
-      stages_[i]->ProcessRow(input_rows, output_rows,
-                             /*xextra=*/0, rect.xsize(), rect.x0(),
-                             rect.y0() + y, thread_id);
+      ProcessStageRow(i, input_rows, output_rows,
+                      /*xextra=*/0, rect.xsize(), rect.x0(), rect.y0() + y,
+                      thread_id,
+                      stage_totals.empty() ? nullptr : &stage_totals[i]);
     }
   }
+  AddStageTotals(stage_totals);
 }
 
 void LowMemoryRenderPipeline::ProcessBuffers(size_t group_id,
@@ -10,6 +10,7 @@
 
 #include "lib/jxl/image.h"
 #include "lib/jxl/render_pipeline/render_pipeline_stage.h"
+#include "lib/jxl/stage_stats.h"
 
 namespace jxl {
 
@@ -102,7 +103,38 @@ class RenderPipeline {
 
   virtual void ClearDone(size_t i) {}
 
+  // If `stats` is not nullptr, the time spent in each stage is added to it,
+  // under the name of the stage.
+  void SetStageStats(StageStats* stats) { stage_stats_ = stats; }
+
  protected:
+  // Calls ProcessRow of stage `i`, adding its elapsed time to `totals` if not
+  // nullptr. Only the steady clock is read, as this runs once per row.
+  void ProcessStageRow(size_t i,
+                       const RenderPipelineStage::RowInfo& input_rows,
+                       const RenderPipelineStage::RowInfo& output_rows,
+                       size_t xextra, size_t xsize, size_t xpos, size_t ypos,
+                       size_t thread_id, StageTotals* totals) const {
+    if (!totals) {
+      stages_[i]->ProcessRow(input_rows, output_rows, xextra, xsize, xpos, ypos,
+                             thread_id);
+      return;
+    }
+    const double start = StageTime::WallNow();
+    stages_[i]->ProcessRow(input_rows, output_rows, xextra, xsize, xpos, ypos,
+                           thread_id);
+    totals->AddWall(StageTime::WallNow() - start, /*pixels=*/xsize);
+  }
+
+  // Adds per-stage totals, indexed like stages_, to the stage stats.
+  void AddStageTotals(const std::vector<StageTotals>& totals) const {
+    if (!stage_stats_) return;
+    for (size_t i = 0; i < totals.size(); i++) {
+      if (totals[i].count == 0) continue;
+      stage_stats_->Add(stages_[i]->GetName(), totals[i]);
+    }
+  }
+
   std::vector<std::unique_ptr<RenderPipelineStage>> stages_;
   // Shifts for every channel at the input of each stage.
   std::vector<std::vector<std::pair<size_t, size_t>>> channel_shifts_;
@@ -115,6 +147,8 @@ class RenderPipeline {
 
   std::vector<uint8_t> group_completed_passes_;
 
+  StageStats* stage_stats_ = nullptr;
+
   friend class RenderPipelineInput;
 
  private:
@@ -159,6 +159,8 @@ void SimpleRenderPipeline::ProcessBuffers(size_t group_id, size_t thread_id) {
 
     // Run the pipeline.
     {
+      StageScope stage_scope(stage_stats_, stage->GetName(), /*bytes=*/0,
+                             /*pixels=*/xsize * ysize);
       stage->SetInputSizes(input_sizes);
       int border_y = stage->settings_.border_y;
       for (size_t y = 0; y < ysize; y++) {
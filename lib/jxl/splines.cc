@@ -579,8 +579,17 @@ void Splines::AddToRow(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
   return ApplyToRow</*add=*/true>(row_x, row_y, row_b, image_row);
 }
 
-void Splines::SubtractFrom(Image3F* const opsin) const {
-  return Apply</*add=*/false>(opsin, Rect(*opsin), Rect(*opsin));
+void Splines::SubtractFrom(Image3F* const opsin, ThreadPool* pool) const {
+  if (segments_.empty()) return;
+  // Each row only depends on the segments that cross it.
+  JXL_CHECK(RunOnPool(
+      pool, 0, opsin->ysize(), ThreadPool::NoInit,
+      [&](const uint32_t y, size_t /*thread*/) {
+        ApplyToRow</*add=*/false>(opsin->PlaneRow(0, y), opsin->PlaneRow(1, y),
+                                  opsin->PlaneRow(2, y),
+                                  Rect(0, y, opsin->xsize(), 1));
+      },
+      "SubtractSplines"));
 }
 
 Status Splines::InitializeDrawCache(const size_t image_xsize,
@@ -15,6 +15,7 @@
 #include "lib/jxl/ans_params.h"
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/aux_out_fwd.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/dec_ans.h"
@@ -111,7 +112,8 @@ class Splines {
              const Rect& image_rect) const;
   void AddToRow(float* JXL_RESTRICT row_x, float* JXL_RESTRICT row_y,
                 float* JXL_RESTRICT row_b, const Rect& image_row) const;
-  void SubtractFrom(Image3F* opsin) const;
+  // Rows are processed in parallel on `pool`.
+  void SubtractFrom(Image3F* opsin, ThreadPool* pool = nullptr) const;
 
   const std::vector<QuantizedSpline>& QuantizedSplines() const {
     return splines_;
@@ -0,0 +1,72 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/stage_stats.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <chrono>
+
+namespace jxl {
+
+StageTime StageTime::Now() {
+  StageTime t;
+  t.wall = WallNow();
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+    t.cpu = ts.tv_sec + ts.tv_nsec * 1E-9;
+  }
+#endif
+  return t;
+}
+
+double StageTime::WallNow() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void StageStats::Add(const char* name, const StageTotals& totals) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  JxlStageStats* stage = nullptr;
+  for (JxlStageStats& s : stages_) {
+    if (s.name == name || strcmp(s.name, name) == 0) {
+      stage = &s;
+      break;
+    }
+  }
+  if (!stage) {
+    stages_.emplace_back();
+    stage = &stages_.back();
+    memset(stage, 0, sizeof(*stage));
+    stage->name = name;
+  }
+  stage->count += totals.count;
+  stage->wall_seconds += totals.wall;
+  stage->cpu_seconds += totals.cpu;
+  stage->bytes += totals.bytes;
+  stage->pixels += totals.pixels;
+}
+
+size_t StageStats::NumStages() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stages_.size();
+}
+
+bool StageStats::Get(size_t index, JxlStageStats* stats) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index >= stages_.size()) return false;
+  *stats = stages_[index];
+  return true;
+}
+
+void StageStats::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stages_.clear();
+}
+
+}  // namespace jxl
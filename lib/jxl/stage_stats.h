@@ -0,0 +1,120 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_STAGE_STATS_H_
+#define LIB_JXL_STAGE_STATS_H_
+
+// Opt-in, per-instance timing and counters of named processing stages, exposed
+// through JxlDecoderGetStageStats and JxlEncoderGetStageStats. Unlike the
+// PROFILER_ZONE machinery this is always compiled in; when collection is
+// disabled, the StageStats pointer is null and instrumented code only pays for
+// a pointer check.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include "jxl/types.h"
+
+namespace jxl {
+
+// A point in time, both elapsed and CPU time of the calling thread.
+struct StageTime {
+  static StageTime Now();
+  // Elapsed time only, in seconds; much cheaper than Now() where the thread
+  // CPU time needs a system call.
+  static double WallNow();
+
+  double wall = 0.0;  // seconds
+  double cpu = 0.0;   // seconds, or 0 if not available.
+};
+
+// Totals of one stage, accumulated locally before being added to StageStats,
+// e.g. for stages that run many times within one group.
+struct StageTotals {
+  void Add(const StageTime& start, const StageTime& end, uint64_t bytes = 0,
+           uint64_t pixels = 0) {
+    wall += end.wall - start.wall;
+    cpu += end.cpu - start.cpu;
+    count++;
+    this->bytes += bytes;
+    this->pixels += pixels;
+  }
+  // Adds a run of which only the elapsed time is known.
+  void AddWall(double seconds, uint64_t pixels = 0) {
+    wall += seconds;
+    count++;
+    this->pixels += pixels;
+  }
+
+  double wall = 0.0;
+  double cpu = 0.0;
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+  uint64_t pixels = 0;
+};
+
+// Thread-safe collection of StageTotals, indexed by stage name. Stages are
+// reported in the order in which they were first seen.
+class StageStats {
+ public:
+  // `name` must be a string literal (or otherwise outlive this object); stages
+  // are matched by string contents.
+  void Add(const char* name, const StageTotals& totals);
+
+  size_t NumStages() const;
+  // Returns false if `index` is out of range.
+  bool Get(size_t index, JxlStageStats* stats) const;
+  void Clear();
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<JxlStageStats> stages_;
+};
+
+// Times its own scope as one run of the stage `name`; does nothing if `stats`
+// is null.
+class StageScope {
+ public:
+  StageScope(StageStats* stats, const char* name, uint64_t bytes = 0,
+             uint64_t pixels = 0)
+      : stats_(stats), name_(name), bytes_(bytes), pixels_(pixels) {
+    if (stats_) start_ = StageTime::Now();
+  }
+  StageScope(const StageScope&) = delete;
+  StageScope& operator=(const StageScope&) = delete;
+
+  ~StageScope() { Finish(); }
+
+  // For counts that are only known at the end of the stage.
+  void SetBytes(uint64_t bytes) { bytes_ = bytes; }
+  void SetPixels(uint64_t pixels) { pixels_ = pixels; }
+
+  // Ends the stage before the end of the scope.
+  void Finish() {
+    if (!stats_) return;
+    StageTotals totals;
+    totals.Add(start_, StageTime::Now(), bytes_, pixels_);
+    stats_->Add(name_, totals);
+    stats_ = nullptr;
+  }
+
+  // Does not record this run, e.g. if the stage has to be retried once more
+  // input is available.
+  void Discard() { stats_ = nullptr; }
+
+ private:
+  StageStats* stats_;
+  const char* name_;
+  uint64_t bytes_;
+  uint64_t pixels_;
+  StageTime start_;
+};
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_STAGE_STATS_H_
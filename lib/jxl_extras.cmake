@@ -37,6 +37,7 @@ set(JPEGXL_EXTRAS_SOURCES
   extras/packed_image_convert.h
   extras/render_hdr.cc
   extras/render_hdr.h
+  extras/run_parallel.h
   extras/time.cc
   extras/time.h
   extras/tone_mapping.cc
@@ -69,6 +70,7 @@ set(JPEGXL_EXTRAS_CODEC_SOURCES
   extras/exif.cc
   extras/exif.h
   extras/packed_image.h
+  extras/run_parallel.h
   extras/time.cc
   extras/time.h
 )
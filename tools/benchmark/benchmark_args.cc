@@ -199,6 +199,10 @@ Status BenchmarkArgs::AddCommandLineOptions() {
            "a good value to start exploring for asymmetry.",
            0.8f);
   AddFlag(&profiler, "profiler", "If true, print profiler results.", false);
+  AddString(&trace_out, "trace_out",
+            "If not empty, records the parallel regions of all encoders and "
+            "decoders, writes them to this file as Chrome trace JSON and "
+            "prints a per-region utilization summary.");
 
   AddFlag(&show_progress, "show_progress",
           "Show activity dots per completed file during benchmark.", false);
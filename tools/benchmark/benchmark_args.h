@@ -149,6 +149,7 @@ struct BenchmarkArgs {
   ButteraugliParams ba_params;
 
   bool profiler;
+  std::string trace_out;
   double error_pnorm;
   bool show_progress;
 
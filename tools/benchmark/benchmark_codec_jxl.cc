@@ -189,6 +189,9 @@ class JxlCodec : public ImageCodec {
       cparams_.palette_colors = strtol(param.substr(1).c_str(), nullptr, 10);
     } else if (param == "lp") {
       cparams_.lossy_palette = true;
+    } else if (param.substr(0, 9) == "lz77chain") {
+      cparams_.options.lz77_max_chain_length =
+          strtol(param.substr(9).c_str(), nullptr, 10);
     } else if (param[0] == 'C') {
       cparams_.colorspace = strtol(param.substr(1).c_str(), nullptr, 10);
     } else if (param[0] == 'c') {
@@ -59,7 +59,9 @@ class PNGCodec : public ImageCodec {
     extras::PackedPixelFile ppf;
     const double start = Now();
     JXL_RETURN_IF_ERROR(extras::DecodeImageAPNG(
-        compressed, extras::ColorHints(), SizeConstraints(), &ppf));
+        compressed, extras::ColorHints(), SizeConstraints(), &ppf,
+        pool ? pool->runner() : nullptr,
+        pool ? pool->runner_opaque() : nullptr));
     const double end = Now();
     speed_stats->NotifyElapsed(end - start);
     JXL_RETURN_IF_ERROR(ConvertPackedPixelFileToCodecInOut(ppf, pool, io));
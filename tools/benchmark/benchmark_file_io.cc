@@ -16,27 +16,7 @@
 #include <unistd.h>
 #endif
 
-#ifndef HAS_GLOB
-#define HAS_GLOB 0
-#if defined __has_include
-// <glob.h> is included in previous APIs but glob() function is not defined
-// until API 28.
-#if __has_include(<glob.h>) && \
-    (!defined(__ANDROID_API__) || __ANDROID_API__ >= 28)
-#undef HAS_GLOB
-#define HAS_GLOB 1
-#endif  // __has_include(<glob.h>)
-#endif  // __has_include
-#endif  // HAS_GLOB
-
-#if HAS_GLOB
-#include <glob.h>
-#endif  // HAS_GLOB
-
-// There is no "user" in embedded filesystems.
-#ifndef GLOB_TILDE
-#define GLOB_TILDE 0
-#endif
+#include "tools/glob_support.h"
 
 namespace jxl {
 
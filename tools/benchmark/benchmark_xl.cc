@@ -27,6 +27,7 @@
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/file_io.h"
 #include "lib/jxl/base/padded_bytes.h"
+#include "lib/jxl/base/parallel_trace.h"
 #include "lib/jxl/base/printf_macros.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/base/random.h"
@@ -812,6 +813,9 @@ class Benchmark {
       const std::vector<CodecInOut> loaded_images = LoadImages(
           fnames, all_color_aware, jpeg_transcoding_requested, pool.get());
 
+      if (!Args()->trace_out.empty()) {
+        ParallelTrace::Get()->SetEnabled(true);
+      }
       if (RunTasks(methods, extra_metrics_names, extra_metrics_commands, fnames,
                    loaded_images, pool.get(), inner_pools, &tasks) != 0) {
         ret = EXIT_FAILURE;
@@ -819,6 +823,13 @@ class Benchmark {
           fprintf(stderr, "There were error(s) in the benchmark.\n");
         }
       }
+      if (!Args()->trace_out.empty()) {
+        ParallelTrace::Get()->SetEnabled(false);
+        PrintParallelTraceSummary();
+        if (!WriteFile(ParallelTrace::Get()->ToJSON(), Args()->trace_out)) {
+          ret = EXIT_FAILURE;
+        }
+      }
     }
 
     // Must have exited profiler zone above before calling.
@@ -830,6 +841,29 @@ class Benchmark {
   }
 
  private:
+  // Regions with the most idle thread time first: these are the ones that
+  // benefit least from more threads.
+  static void PrintParallelTraceSummary() {
+    std::vector<ParallelTrace::Summary> summaries =
+        ParallelTrace::Get()->Summarize();
+    std::sort(summaries.begin(), summaries.end(),
+              [](const ParallelTrace::Summary& a,
+                 const ParallelTrace::Summary& b) { return a.idle > b.idle; });
+    fprintf(stderr, "%-24s %8s %9s %7s %10s %10s %10s %6s %10s\n", "Region",
+            "Calls", "Tasks", "Threads", "Wall[ms]", "Busy[ms]", "Idle[ms]",
+            "Util", "Crit[ms]");
+    for (const ParallelTrace::Summary& s : summaries) {
+      const double capacity = s.busy + s.idle;
+      fprintf(stderr,
+              "%-24s %8" PRIuS " %9" PRIuS " %7" PRIuS
+              " %10.2f %10.2f %10.2f %5.1f%% %10.2f\n",
+              s.caller, s.regions, s.tasks, s.threads, s.wall * 1E-3,
+              s.busy * 1E-3, s.idle * 1E-3,
+              capacity > 0 ? 100.0 * s.busy / capacity : 0.0,
+              s.critical_path * 1E-3);
+    }
+  }
+
   static int NumOuterThreads(const int num_hw_threads, const int num_tasks) {
     int num_threads = Args()->num_threads;
     // Default to #cores
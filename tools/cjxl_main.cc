@@ -13,6 +13,7 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <functional>
@@ -26,6 +27,7 @@
 #include "jxl/codestream_header.h"
 #include "jxl/encode.h"
 #include "jxl/encode_cxx.h"
+#include "jxl/parallel_trace.h"
 #include "jxl/thread_parallel_runner.h"
 #include "jxl/thread_parallel_runner_cxx.h"
 #include "jxl/types.h"
@@ -45,7 +47,9 @@
 #include "tools/args.h"
 #include "tools/cmdline.h"
 #include "tools/codec_config.h"
+#include "tools/file_batch.h"
 #include "tools/file_io.h"
+#include "tools/parallel_trace_file.h"
 #include "tools/speed_stats.h"
 
 namespace jpegxl {
@@ -58,6 +62,7 @@ inline bool ParsePhotonNoiseParameter(const char* arg, float* out) {
 inline bool ParseIntensityTarget(const char* arg, float* out) {
   return ParseFloat(arg, out) && *out > 0;
 }
+
 }  // namespace
 
 enum CjxlRetCode : int {
@@ -151,6 +156,12 @@ struct CompressArgs {
         "(not provided = default, 0 = disable, 1 = enable).",
         &compress_boxes, &ParseOverride, 1);
 
+    cmdline->AddOptionValue(
+        '\0', "crop_unchanged", "0|1",
+        "For animations made of full frames, encode only the region of each "
+        "frame that changed since the previous frame (default: 0).",
+        &crop_unchanged, &ParseOverride, 1);
+
     cmdline->AddOptionValue(
         '\0', "brotli_effort", "B_EFFORT",
         "Brotli effort setting. Range: 0 .. 11.\n"
@@ -355,6 +366,12 @@ struct CompressArgs {
         "[modular encoding] number of extra MA tree properties to use",
         &modular_nb_prev_channels, &ParseInt64, 2);
 
+    cmdline->AddOptionValue(
+        '\0', "modular_lz77_chain_length", "K",
+        "[modular encoding] maximum LZ77 match candidates visited per symbol, "
+        "lower is faster: -1 == default (256), or 1 to 1048576.",
+        &modular_lz77_chain_length, &ParseInt64, 2);
+
     cmdline->AddOptionValue(
         '\0', "modular_palette_colors", "K",
         "[modular encoding] Use color palette if number of colors is smaller "
@@ -411,6 +428,36 @@ struct CompressArgs {
         "the frame index box.",
         &frame_indexing, &ParseString, 1);
 
+    cmdline->AddOptionValue(
+        '\0', "trace_out", "FILENAME",
+        "If specified, records the parallel regions of the encoder and "
+        "writes them to this file as Chrome trace JSON, with per-region "
+        "task counts, per-thread busy and idle time and the longest task.",
+        &trace_out, &ParseString, 1);
+
+    cmdline->AddOptionValue(
+        '\0', "batch_in", "PATTERN|@LIST",
+        "Batch mode: encodes all files matching the glob PATTERN, or listed "
+        "one per line in the file LIST, with one encoder and thread pool; "
+        "INPUT and OUTPUT are not used. Reading and writing files overlaps "
+        "with encoding, and the aggregate throughput is reported at the end.",
+        &batch_in, &ParseString, 1);
+
+    cmdline->AddOptionValue(
+        '\0', "batch_out", "TEMPLATE",
+        "Output filename for each file of --batch_in, where each %s is "
+        "replaced by the input filename without directory and extension, "
+        "e.g. out/%s.jxl. Must contain at least one %s, and inputs must "
+        "have distinct names.",
+        &batch_out, &ParseString, 1);
+
+    cmdline->AddOptionValue(
+        '\0', "batch_retained_mb", "MB",
+        "Batch mode: the encoder keeps up to MB megabytes of working buffers "
+        "from one file to the next, instead of allocating them for every "
+        "file; 0 frees them after every file. (default: 256)",
+        &batch_retained_mb, &ParseUnsigned, 1);
+
     cmdline->AddOptionFlag(
         'v', "verbose",
         "Verbose output; can be repeated, also applies to help (!).", &verbose,
@@ -461,6 +508,7 @@ struct CompressArgs {
   jxl::Override gaborish = jxl::Override::kDefault;
   jxl::Override group_order = jxl::Override::kDefault;
   jxl::Override compress_boxes = jxl::Override::kDefault;
+  jxl::Override crop_unchanged = jxl::Override::kDefault;
 
   size_t faster_decoding = 0;
   int64_t resampling = -1;
@@ -475,6 +523,7 @@ struct CompressArgs {
   float modular_channel_colors_group_percent = -1.f;
   int64_t modular_palette_colors = -1;
   int64_t modular_nb_prev_channels = -1;
+  int64_t modular_lz77_chain_length = -1;
   float modular_ma_tree_learning_percent = -1.f;
   float photon_noise_iso = 0;
   int64_t codestream_level = -1;
@@ -483,6 +532,10 @@ struct CompressArgs {
   size_t effort = 7;
   size_t brotli_effort = 9;
   std::string frame_indexing;
+  std::string trace_out;
+  std::string batch_in;
+  std::string batch_out;
+  size_t batch_retained_mb = 256;
 
   // Will get passed on to AuxOut.
   // jxl::InspectorImage3F inspector_image3f;
@@ -542,22 +595,22 @@ void PrintMode(jxl::extras::PackedPixelFile& ppf, const double decode_mps,
   fprintf(stderr, "], \n");
 }
 
-bool IsJPG(const std::vector<uint8_t>& image_data) {
+bool IsJPG(const jxl::Span<const uint8_t> image_data) {
   return (image_data.size() >= 2 && image_data[0] == 0xFF &&
           image_data[1] == 0xD8);
 }
 
 // TODO(tfish): Replace with non-C-API library function.
 // Implementation is in extras/.
-jxl::Status GetPixeldata(const std::vector<uint8_t>& image_data,
+jxl::Status GetPixeldata(const jxl::Span<const uint8_t> image_data,
                          const jxl::extras::ColorHints& color_hints,
                          jxl::extras::PackedPixelFile& ppf,
-                         jxl::extras::Codec& codec) {
+                         jxl::extras::Codec& codec, void* runner) {
   // Any valid encoding is larger (ensures codecs can read the first few bytes).
   constexpr size_t kMinBytes = 9;
 
   if (image_data.size() < kMinBytes) return JXL_FAILURE("Input too small.");
-  jxl::Span<const uint8_t> encoded(image_data);
+  const jxl::Span<const uint8_t> encoded = image_data;
 
   ppf.info.orientation = JXL_ORIENT_IDENTITY;
   jxl::SizeConstraints size_constraints;
@@ -565,15 +618,15 @@ jxl::Status GetPixeldata(const std::vector<uint8_t>& image_data,
   const auto choose_codec = [&]() {
 #if JPEGXL_ENABLE_APNG
     if (jxl::extras::DecodeImageAPNG(encoded, color_hints, size_constraints,
-                                     &ppf)) {
+                                     &ppf, JxlThreadParallelRunner, runner)) {
       return jxl::extras::Codec::kPNG;
     }
 #endif
     if (jxl::extras::DecodeImagePGX(encoded, color_hints, size_constraints,
                                     &ppf)) {
       return jxl::extras::Codec::kPGX;
-    } else if (jxl::extras::DecodeImagePNM(encoded, color_hints,
-                                           size_constraints, &ppf)) {
+    } else if (jxl::extras::DecodeImagePNMNoCopy(encoded, color_hints,
+                                                 size_constraints, &ppf)) {
       return jxl::extras::Codec::kPNM;
     }
 #if JPEGXL_ENABLE_GIF
@@ -824,6 +877,14 @@ void ProcessFlags(const jxl::extras::Codec codec,
                            : "Invalid --modular_nb_prev_channels. Valid "
                              "range is {-1, 0, 1, ..., 11}.\n";
               });
+  ProcessFlag("modular_lz77_chain_length", args->modular_lz77_chain_length,
+              JXL_ENC_FRAME_SETTING_MODULAR_LZ77_CHAIN_LENGTH, params,
+              [](int64_t x) -> std::string {
+                return (x == -1 || (1 <= x && x <= (1 << 20)))
+                           ? ""
+                           : "Invalid --modular_lz77_chain_length. Valid "
+                             "values are -1 and {1, 2, ..., 1048576}.\n";
+              });
   if (args->modular_lossy_palette) {
     if (args->progressive || args->qprogressive_ac) {
       fprintf(stderr,
@@ -886,152 +947,201 @@ void ProcessFlags(const jxl::extras::Codec codec,
   params->codestream_level = args->codestream_level;
   params->premultiply = args->premultiply;
   params->compress_boxes = args->compress_boxes != jxl::Override::kOff;
+  params->crop_unchanged_regions = args->crop_unchanged == jxl::Override::kOn;
   if (codec == jxl::extras::Codec::kPNM) {
     params->input_bitdepth.type = JXL_BIT_DEPTH_FROM_CODESTREAM;
   }
 }
 
-}  // namespace tools
-}  // namespace jpegxl
-
-int main(int argc, char** argv) {
-  std::string version = jpegxl::tools::CodecConfigString(JxlEncoderVersion());
-  jpegxl::tools::CompressArgs args;
-  jpegxl::tools::CommandLineParser cmdline;
-  args.AddCommandLineOptions(&cmdline);
-
-  if (!cmdline.Parse(argc, const_cast<const char**>(argv))) {
-    // Parse already printed the actual error cause.
-    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
-    return jpegxl::tools::CjxlRetCode::ERR_PARSE;
-  }
+// Encodes the pixels of `ppf`, or `jpeg_bytes` if not null, decoded from
+// `input_size` bytes of the given codec.
+bool EncodePixels(jxl::extras::Codec codec,
+                  const std::vector<uint8_t>* jpeg_bytes, size_t input_size,
+                  double decode_mps, CommandLineParser* cmdline,
+                  CompressArgs* args, void* runner, JxlEncoder* encoder,
+                  SpeedStats* stats, jxl::extras::PackedPixelFile* ppf,
+                  std::vector<uint8_t>* compressed) {
+  jxl::extras::JXLCompressParams params;
+  ProcessFlags(codec, *ppf, jpeg_bytes, cmdline, args, &params);
 
-  if (args.version) {
-    fprintf(stdout, "cjxl %s\n", version.c_str());
-    fprintf(stdout, "Copyright (c) the JPEG XL Project\n");
-    return jpegxl::tools::CjxlRetCode::OK;
+  if (!ppf->metadata.exif.empty() || !ppf->metadata.xmp.empty() ||
+      !ppf->metadata.jumbf.empty() || !ppf->metadata.iptc.empty() ||
+      (args->lossless_jpeg && args->jpeg_store_metadata)) {
+    args->container = jxl::Override::kOn;
   }
 
-  if (!args.quiet) {
-    fprintf(stderr, "JPEG XL encoder %s\n", version.c_str());
+  if (!ppf->metadata.exif.empty()) {
+    jxl::InterpretExif(ppf->metadata.exif, &ppf->info.orientation);
   }
 
-  if (cmdline.HelpFlagPassed() || !args.file_in) {
-    cmdline.PrintHelp();
-    return jpegxl::tools::CjxlRetCode::OK;
+  if (!args->quiet) {
+    PrintMode(*ppf, decode_mps, input_size, *args);
   }
 
-  if (!args.file_out && !args.disable_output) {
-    std::cerr
-        << "No output file specified and --disable_output flag not passed."
-        << std::endl;
-    exit(EXIT_FAILURE);
-  }
+  params.runner = JxlThreadParallelRunner;
+  params.runner_opaque = runner;
+  params.encoder = encoder;
 
-  if (args.file_out && args.disable_output && !args.quiet) {
-    fprintf(stderr,
-            "Encoding will be performed, but the result will be discarded.\n");
+  for (size_t num_rep = 0; num_rep < args->num_reps; ++num_rep) {
+    const double t0 = jxl::Now();
+    if (!EncodeImageJXL(params, *ppf, jpeg_bytes, compressed)) {
+      fprintf(stderr, "EncodeImageJXL() failed.\n");
+      return false;
+    }
+    const double t1 = jxl::Now();
+    if (stats) {
+      stats->NotifyElapsed(t1 - t0);
+      stats->SetImageSize(ppf->info.xsize, ppf->info.ysize);
+    }
   }
+  return true;
+}
 
-  // Loading the input.
+// Encodes `image_data`, adjusting `args` to the input, e.g. disabling
+// lossless_jpeg for non-JPEG inputs. `stats` may be null. PNM pixels are used
+// in place, so `image_data` must be writable memory.
+bool CompressImage(const jxl::Span<const uint8_t> image_data,
+                   CommandLineParser* cmdline, CompressArgs* args, void* runner,
+                   JxlEncoder* encoder, SpeedStats* stats,
+                   std::vector<uint8_t>* compressed, size_t* pixels,
+                   size_t* num_frames) {
   // Depending on flags-settings, we want to either load a JPEG and
   // faithfully convert it to JPEG XL, or load (JPEG or non-JPEG)
   // pixel data.
-  std::vector<uint8_t> image_data;
   jxl::extras::PackedPixelFile ppf;
   jxl::extras::Codec codec = jxl::extras::Codec::kUnknown;
   double decode_mps = 0;
-  size_t pixels = 0;
-  if (!jpegxl::tools::ReadFile(args.file_in, &image_data)) {
-    std::cerr << "Reading image data failed." << std::endl;
-    exit(EXIT_FAILURE);
-  }
-  if (!jpegxl::tools::IsJPG(image_data)) args.lossless_jpeg = 0;
-  if (!args.lossless_jpeg) {
+  *pixels = 0;
+  *num_frames = 1;
+  if (!IsJPG(image_data)) args->lossless_jpeg = 0;
+  if (!args->lossless_jpeg) {
     const double t0 = jxl::Now();
     jxl::Status status =
-        jpegxl::tools::GetPixeldata(image_data, args.color_hints, ppf, codec);
+        GetPixeldata(image_data, args->color_hints, ppf, codec, runner);
     if (!status) {
       std::cerr << "Getting pixel data failed." << std::endl;
-      exit(EXIT_FAILURE);
+      return false;
     }
     if (ppf.frames.empty()) {
       std::cerr << "No frames on input file." << std::endl;
-      exit(EXIT_FAILURE);
+      return false;
     }
 
     const double t1 = jxl::Now();
-    pixels = ppf.info.xsize * ppf.info.ysize;
-    decode_mps = pixels * ppf.info.num_color_channels * 1E-6 / (t1 - t0);
+    *pixels = ppf.info.xsize * ppf.info.ysize;
+    *num_frames = ppf.frames.size();
+    decode_mps = *pixels * ppf.info.num_color_channels * 1E-6 / (t1 - t0);
   }
-  std::vector<uint8_t>* jpeg_bytes = nullptr;
-  if (args.lossless_jpeg && jpegxl::tools::IsJPG(image_data)) {
-    if (!cmdline.GetOption(args.opt_lossless_jpeg_id)->matched()) {
+  std::vector<uint8_t> jpeg_data;
+  const std::vector<uint8_t>* jpeg_bytes = nullptr;
+  if (args->lossless_jpeg && IsJPG(image_data)) {
+    if (!cmdline->GetOption(args->opt_lossless_jpeg_id)->matched() &&
+        !args->quiet) {
       std::cerr << "Note: Implicit-default for JPEG is lossless-transcoding. "
                 << "To silence this message, set --lossless_jpeg=(1|0)."
                 << std::endl;
     }
-    jpeg_bytes = &image_data;
+    jpeg_data.assign(image_data.data(), image_data.data() + image_data.size());
+    jpeg_bytes = &jpeg_data;
   }
 
-  jxl::extras::JXLCompressParams params;
-  ProcessFlags(codec, ppf, jpeg_bytes, &cmdline, &args, &params);
-
-  if (!ppf.metadata.exif.empty() || !ppf.metadata.xmp.empty() ||
-      !ppf.metadata.jumbf.empty() || !ppf.metadata.iptc.empty() ||
-      (args.lossless_jpeg && args.jpeg_store_metadata)) {
-    args.container = jxl::Override::kOn;
-  }
+  return EncodePixels(codec, jpeg_bytes, image_data.size(), decode_mps, cmdline,
+                      args, runner, encoder, stats, &ppf, compressed);
+}
 
-  if (!ppf.metadata.exif.empty()) {
-    jxl::InterpretExif(ppf.metadata.exif, &ppf.info.orientation);
-  }
+// PFM rows are stored bottom to top and PAM may interleave extra channels, so
+// their rasters can't be used in place; rather than holding the whole file in
+// memory next to the pixels, such inputs are decoded in strips from the file.
+// The file is recognized by its magic, whatever its name; anything else, or a
+// file that can't be read, goes through the usual path.
+bool DecodeInStrips(const char* filename) {
+  FILE* file = fopen(filename, "rb");
+  if (!file) return false;
+  char magic[2];
+  const bool has_magic = fread(magic, 1, sizeof(magic), file) == sizeof(magic);
+  fclose(file);
+  return has_magic && magic[0] == 'P' &&
+         (magic[1] == 'F' || magic[1] == 'f' || magic[1] == '7');
+}
 
-  if (!args.quiet) {
-    PrintMode(ppf, decode_mps, image_data.size(), args);
+bool CompressImageInStrips(const char* filename, CommandLineParser* cmdline,
+                           CompressArgs* args, void* runner, SpeedStats* stats,
+                           std::vector<uint8_t>* compressed, size_t* pixels,
+                           size_t* num_frames) {
+  FILE* file = fopen(filename, "rb");
+  if (!file) {
+    std::cerr << "Reading image data failed." << std::endl;
+    return false;
   }
-
-  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
-  int64_t flag_num_worker_threads = args.num_threads;
-  if (flag_num_worker_threads > -1) {
-    num_worker_threads = flag_num_worker_threads;
+  // Strips of this many rows are read directly into the frame.
+  constexpr size_t kStripRows = 64;
+  jxl::extras::PackedPixelFile ppf;
+  jxl::extras::ChunkedPNMDecoder decoder;
+  const double t0 = jxl::Now();
+  const bool ok =
+      decoder.Init(file, args->color_hints, jxl::SizeConstraints(), &ppf) &&
+      decoder.ReadFrame(kStripRows, &ppf);
+  const double t1 = jxl::Now();
+  const long input_size = ftell(file);
+  fclose(file);
+  if (!ok) {
+    std::cerr << "Getting pixel data failed." << std::endl;
+    return false;
   }
-  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
-      /*memory_manager=*/nullptr, num_worker_threads);
-  params.runner = JxlThreadParallelRunner;
-  params.runner_opaque = runner.get();
+  args->lossless_jpeg = 0;
+  *pixels = ppf.info.xsize * ppf.info.ysize;
+  *num_frames = 1;
+  const double decode_mps =
+      *pixels * ppf.info.num_color_channels * 1E-6 / (t1 - t0);
+  return EncodePixels(jxl::extras::Codec::kPNM, /*jpeg_bytes=*/nullptr,
+                      input_size < 0 ? 0 : input_size, decode_mps, cmdline,
+                      args, runner, /*encoder=*/nullptr, stats, &ppf,
+                      compressed);
+}
 
-  jpegxl::tools::SpeedStats stats;
+int CompressSingleFile(CompressArgs* args, CommandLineParser* cmdline,
+                       void* runner, size_t num_worker_threads) {
+  SpeedStats stats;
   std::vector<uint8_t> compressed;
-  for (size_t num_rep = 0; num_rep < args.num_reps; ++num_rep) {
-    const double t0 = jxl::Now();
-    if (!EncodeImageJXL(params, ppf, jpeg_bytes, &compressed)) {
-      fprintf(stderr, "EncodeImageJXL() failed.\n");
+  size_t pixels;
+  size_t num_frames;
+  if (DecodeInStrips(args->file_in)) {
+    if (!CompressImageInStrips(args->file_in, cmdline, args, runner, &stats,
+                               &compressed, &pixels, &num_frames)) {
+      return EXIT_FAILURE;
+    }
+  } else {
+    // Memory-mapped if possible, so that e.g. PPM pixels are never copied.
+    InputFile input;
+    if (!input.Open(args->file_in)) {
+      std::cerr << "Reading image data failed." << std::endl;
+      return EXIT_FAILURE;
+    }
+    const jxl::Span<const uint8_t> image_data(input.data(), input.size());
+    if (!CompressImage(image_data, cmdline, args, runner, /*encoder=*/nullptr,
+                       &stats, &compressed, &pixels, &num_frames)) {
       return EXIT_FAILURE;
     }
-    const double t1 = jxl::Now();
-    stats.NotifyElapsed(t1 - t0);
-    stats.SetImageSize(ppf.info.xsize, ppf.info.ysize);
   }
 
-  if (args.file_out && !args.disable_output) {
-    if (!jpegxl::tools::WriteFile(args.file_out, compressed)) {
+  if (args->file_out && !args->disable_output) {
+    if (!WriteFile(args->file_out, compressed)) {
       std::cerr << "Could not write jxl file." << std::endl;
       return EXIT_FAILURE;
     }
   }
-  if (!args.quiet) {
+  if (!args->quiet) {
     fprintf(stderr, "Compressed to %" PRIuS " bytes ", compressed.size());
     // For lossless jpeg-reconstruction, we don't print some stats, since we
     // don't have easy access to the image dimensions.
-    if (args.container == jxl::Override::kOn) {
+    if (args->container == jxl::Override::kOn) {
       fprintf(stderr, "including container ");
     }
-    if (!args.lossless_jpeg) {
+    if (!args->lossless_jpeg) {
       const double bpp =
           static_cast<double>(compressed.size() * jxl::kBitsPerByte) / pixels;
-      fprintf(stderr, "(%.3f bpp%s).\n", bpp / ppf.frames.size(),
-              ppf.frames.size() == 1 ? "" : "/frame");
+      fprintf(stderr, "(%.3f bpp%s).\n", bpp / num_frames,
+              num_frames == 1 ? "" : "/frame");
       JXL_CHECK(stats.Print(num_worker_threads));
     } else {
       fprintf(stderr, "\n");
@@ -1039,3 +1149,156 @@ int main(int argc, char** argv) {
   }
   return EXIT_SUCCESS;
 }
+
+// Encodes all files of --batch_in with one encoder. Files are read ahead and
+// written behind on separate threads, so that I/O overlaps with encoding.
+int CompressBatch(const CompressArgs& args, CommandLineParser* cmdline,
+                  void* runner) {
+  std::vector<std::string> inputs;
+  if (!ExpandBatchInput(args.batch_in, &inputs)) return EXIT_FAILURE;
+  if (!args.disable_output && !CheckBatchOutputs(args.batch_out, inputs)) {
+    return EXIT_FAILURE;
+  }
+
+  JxlEncoderPtr encoder = JxlEncoderMake(/*memory_manager=*/nullptr);
+  // Files of a batch are often of similar sizes, so the buffers of one file
+  // fit the next one.
+  if (JXL_ENC_SUCCESS !=
+      JxlEncoderSetRetainedMemoryLimit(encoder.get(),
+                                       args.batch_retained_mb << 20)) {
+    fprintf(stderr, "JxlEncoderSetRetainedMemoryLimit failed\n");
+    return EXIT_FAILURE;
+  }
+  BatchReader reader(inputs, /*max_ahead=*/4);
+  BatchWriter writer(/*max_pending=*/4);
+
+  // Whether each input failed to be read, encoded or written.
+  std::vector<bool> failed(inputs.size(), false);
+  size_t input_bytes = 0;
+  size_t output_bytes = 0;
+  size_t pixels = 0;
+  const double t0 = jxl::Now();
+  std::string filename;
+  std::vector<uint8_t> image_data;
+  bool read_ok;
+  for (size_t i = 0; reader.Next(&filename, &image_data, &read_ok); ++i) {
+    if (!read_ok) {
+      fprintf(stderr, "Reading %s failed.\n", filename.c_str());
+      failed[i] = true;
+      continue;
+    }
+    // Each file starts from the flags as given on the command line.
+    CompressArgs file_args = args;
+    file_args.quiet = true;
+    std::vector<uint8_t> compressed;
+    size_t file_pixels;
+    size_t num_frames;
+    if (!CompressImage(jxl::Span<const uint8_t>(image_data), cmdline,
+                       &file_args, runner, encoder.get(), /*stats=*/nullptr,
+                       &compressed, &file_pixels, &num_frames)) {
+      fprintf(stderr, "Encoding %s failed.\n", filename.c_str());
+      failed[i] = true;
+      continue;
+    }
+    input_bytes += image_data.size();
+    output_bytes += compressed.size();
+    pixels += file_pixels * num_frames;
+    if (!args.disable_output) {
+      std::string filename_out = BatchOutputFilename(args.batch_out, filename);
+      if (args.verbose) {
+        fprintf(stderr, "%s -> %s: %" PRIuS " bytes\n", filename.c_str(),
+                filename_out.c_str(), compressed.size());
+      }
+      writer.Write(i, std::move(filename_out), std::move(compressed));
+    }
+  }
+  for (size_t i : writer.Finish()) failed[i] = true;
+  const size_t num_failed = std::count(failed.begin(), failed.end(), true);
+  const double elapsed = jxl::Now() - t0;
+
+  if (!args.quiet) {
+    fprintf(stderr,
+            "Compressed %" PRIuS " files (%" PRIuS " failed), %" PRIuS
+            " -> %" PRIuS " bytes in %.3f s: %.2f files/s, %.3f MP/s\n",
+            inputs.size() - num_failed, num_failed, input_bytes, output_bytes,
+            elapsed, (inputs.size() - num_failed) / elapsed,
+            pixels * 1E-6 / elapsed);
+  }
+  return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
+
+int main(int argc, char** argv) {
+  std::string version = jpegxl::tools::CodecConfigString(JxlEncoderVersion());
+  jpegxl::tools::CompressArgs args;
+  jpegxl::tools::CommandLineParser cmdline;
+  args.AddCommandLineOptions(&cmdline);
+
+  if (!cmdline.Parse(argc, const_cast<const char**>(argv))) {
+    // Parse already printed the actual error cause.
+    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
+    return jpegxl::tools::CjxlRetCode::ERR_PARSE;
+  }
+
+  if (args.version) {
+    fprintf(stdout, "cjxl %s\n", version.c_str());
+    fprintf(stdout, "Copyright (c) the JPEG XL Project\n");
+    return jpegxl::tools::CjxlRetCode::OK;
+  }
+
+  if (!args.quiet) {
+    fprintf(stderr, "JPEG XL encoder %s\n", version.c_str());
+  }
+
+  if (cmdline.HelpFlagPassed() || (!args.file_in && args.batch_in.empty())) {
+    cmdline.PrintHelp();
+    return jpegxl::tools::CjxlRetCode::OK;
+  }
+
+  const bool has_output = args.batch_in.empty() ? args.file_out != nullptr
+                                                : !args.batch_out.empty();
+  if (!has_output && !args.disable_output) {
+    std::cerr
+        << "No output file specified and --disable_output flag not passed."
+        << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  // Without %s, all the files of the batch would overwrite the same output.
+  if (!args.batch_in.empty() && !args.batch_out.empty() &&
+      args.batch_out.find("%s") == std::string::npos) {
+    fprintf(stderr, "--batch_out must contain %%s.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (has_output && args.disable_output && !args.quiet) {
+    fprintf(stderr,
+            "Encoding will be performed, but the result will be discarded.\n");
+  }
+
+  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+  int64_t flag_num_worker_threads = args.num_threads;
+  if (flag_num_worker_threads > -1) {
+    num_worker_threads = flag_num_worker_threads;
+  }
+  JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(
+      /*memory_manager=*/nullptr, num_worker_threads);
+
+  if (!args.trace_out.empty()) {
+    JxlParallelTraceEnable(JXL_TRUE);
+  }
+
+  int ret;
+  if (!args.batch_in.empty()) {
+    ret = jpegxl::tools::CompressBatch(args, &cmdline, runner.get());
+  } else {
+    ret = jpegxl::tools::CompressSingleFile(&args, &cmdline, runner.get(),
+                                            num_worker_threads);
+  }
+  if (ret == EXIT_SUCCESS && !args.trace_out.empty() &&
+      !jpegxl::tools::WriteParallelTrace(args.trace_out)) {
+    return EXIT_FAILURE;
+  }
+  return ret;
+}
@@ -3,18 +3,22 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include <algorithm>
 #include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 
 #include "jxl/decode.h"
+#include "jxl/decode_cxx.h"
+#include "jxl/parallel_trace.h"
 #include "jxl/thread_parallel_runner.h"
 #include "jxl/thread_parallel_runner_cxx.h"
 #include "jxl/types.h"
@@ -25,9 +29,12 @@
 #include "lib/extras/packed_image.h"
 #include "lib/extras/time.h"
 #include "lib/jxl/base/printf_macros.h"
+#include "lib/jxl/base/span.h"
 #include "tools/cmdline.h"
 #include "tools/codec_config.h"
+#include "tools/file_batch.h"
 #include "tools/file_io.h"
+#include "tools/parallel_trace_file.h"
 #include "tools/speed_stats.h"
 
 namespace jpegxl {
@@ -147,6 +154,29 @@ struct DecompressArgs {
         "JSON format. Used by the conformance test script",
         &metadata_out, &ParseString);
 
+    cmdline->AddOptionValue(
+        '\0', "trace_out", "FILENAME",
+        "If specified, records the parallel regions of the decoder and "
+        "writes them to this file as Chrome trace JSON, with per-region "
+        "task counts, per-thread busy and idle time and the longest task.",
+        &trace_out, &ParseString);
+
+    cmdline->AddOptionValue(
+        '\0', "batch_in", "PATTERN|@LIST",
+        "Batch mode: decodes all files matching the glob PATTERN, or listed "
+        "one per line in the file LIST, with one decoder and thread pool; "
+        "INPUT and OUTPUT are not used. Reading and writing files overlaps "
+        "with decoding, and the aggregate throughput is reported at the end.",
+        &batch_in, &ParseString);
+
+    cmdline->AddOptionValue(
+        '\0', "batch_out", "TEMPLATE",
+        "Output filename for each file of --batch_in, where each %s is "
+        "replaced by the input filename without directory and extension, "
+        "e.g. out/%s.png. Must contain at least one %s, and inputs must "
+        "have distinct names.",
+        &batch_out, &ParseString);
+
     cmdline->AddOptionFlag('\0', "print_read_bytes",
                            "Print total number of decoded bytes.",
                            &print_read_bytes, &SetBooleanTrue);
@@ -158,7 +188,7 @@ struct DecompressArgs {
   // Validate the passed arguments, checking whether all passed options are
   // compatible. Returns whether the validation was successful.
   bool ValidateArgs(const CommandLineParser& cmdline) {
-    if (file_in == nullptr) {
+    if (file_in == nullptr && batch_in.empty()) {
       fprintf(stderr, "Missing INPUT filename.\n");
       return false;
     }
@@ -184,6 +214,9 @@ struct DecompressArgs {
   std::string icc_out;
   std::string orig_icc_out;
   std::string metadata_out;
+  std::string trace_out;
+  std::string batch_in;
+  std::string batch_out;
   bool print_read_bytes = false;
   bool quiet = false;
   // References (ids) of specific options to check if they were matched.
@@ -229,8 +262,9 @@ std::string Filename(const std::string& base, const std::string& extension,
 }
 
 bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
-                                  const std::vector<uint8_t>& compressed,
-                                  void* runner,
+                                  const jxl::Span<const uint8_t> compressed,
+                                  void* runner, JxlDecoder* decoder,
+                                  JxlDecoderContext* context,
                                   std::vector<uint8_t>* jpeg_bytes,
                                   jpegxl::tools::SpeedStats* stats) {
   const double t0 = jxl::Now();
@@ -238,6 +272,8 @@ bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
   jxl::extras::JXLDecompressParams dparams;
   dparams.runner = JxlThreadParallelRunner;
   dparams.runner_opaque = runner;
+  dparams.decoder = decoder;
+  dparams.context = context;
   if (!jxl::extras::DecodeImageJXL(compressed.data(), compressed.size(),
                                    dparams, nullptr, &ppf, jpeg_bytes)) {
     return false;
@@ -253,8 +289,10 @@ bool DecompressJxlReconstructJPEG(const jpegxl::tools::DecompressArgs& args,
 
 bool DecompressJxlToPackedPixelFile(
     const jpegxl::tools::DecompressArgs& args,
-    const std::vector<uint8_t>& compressed,
+    const jxl::Span<const uint8_t> compressed,
     const std::vector<JxlPixelFormat>& accepted_formats, void* runner,
+    JxlDecoder* decoder, JxlDecoderContext* context,
+    const jxl::extras::RowSinkFactory& row_sink_factory,
     jxl::extras::PackedPixelFile* ppf, size_t* decoded_bytes,
     jpegxl::tools::SpeedStats* stats) {
   jxl::extras::JXLDecompressParams dparams;
@@ -265,7 +303,10 @@ bool DecompressJxlToPackedPixelFile(
   dparams.render_spotcolors = args.render_spotcolors;
   dparams.runner = JxlThreadParallelRunner;
   dparams.runner_opaque = runner;
+  dparams.decoder = decoder;
+  dparams.context = context;
   dparams.allow_partial_input = args.allow_partial_files;
+  dparams.row_sink_factory = row_sink_factory;
   if (args.bits_per_sample == 0) {
     dparams.output_bitdepth.type = JXL_BIT_DEPTH_FROM_CODESTREAM;
   } else if (args.bits_per_sample > 0) {
@@ -285,99 +326,20 @@ bool DecompressJxlToPackedPixelFile(
   return true;
 }
 
-}  // namespace
-
-int main(int argc, const char* argv[]) {
-  std::string version = jpegxl::tools::CodecConfigString(JxlDecoderVersion());
-  jpegxl::tools::DecompressArgs args;
-  jpegxl::tools::CommandLineParser cmdline;
-  args.AddCommandLineOptions(&cmdline);
-
-  if (!cmdline.Parse(argc, argv)) {
-    // Parse already printed the actual error cause.
-    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
-    return EXIT_FAILURE;
-  }
-
-  if (args.version) {
-    fprintf(stdout, "djxl %s\n", version.c_str());
-    fprintf(stdout, "Copyright (c) the JPEG XL Project\n");
-    return EXIT_SUCCESS;
-  }
-  if (!args.quiet) {
-    fprintf(stderr, "JPEG XL decoder %s\n", version.c_str());
-  }
-
-  if (cmdline.HelpFlagPassed()) {
-    cmdline.PrintHelp();
-    return EXIT_SUCCESS;
-  }
-
-  if (!args.ValidateArgs(cmdline)) {
-    // ValidateArgs already printed the actual error cause.
-    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
-    return EXIT_FAILURE;
-  }
-
-  std::vector<uint8_t> compressed;
-  // Reading compressed JPEG XL input
-  if (!jpegxl::tools::ReadFile(args.file_in, &compressed)) {
-    fprintf(stderr, "couldn't load %s\n", args.file_in);
-    return EXIT_FAILURE;
-  }
-  if (!args.quiet) {
-    fprintf(stderr, "Read %" PRIuS " compressed bytes.\n", compressed.size());
-  }
-
-  if (!args.file_out && !args.disable_output) {
-    std::cerr
-        << "No output file specified and --disable_output flag not passed."
-        << std::endl;
-    return EXIT_FAILURE;
-  }
-
-  if (args.file_out && args.disable_output && !args.quiet) {
-    fprintf(stderr,
-            "Decoding will be performed, but the result will be discarded.\n");
-  }
-
-  std::string filename_out;
-  std::string base;
-  std::string extension;
-  if (args.file_out && !args.disable_output) {
-    filename_out = std::string(args.file_out);
-    size_t pos = filename_out.find_last_of('.');
-    if (pos < filename_out.size()) {
-      base = filename_out.substr(0, pos);
-      extension = filename_out.substr(pos);
-    } else {
-      base = filename_out;
-    }
-  }
+// Decodes `compressed` and, if `extension` is not empty, passes the output
+// files named after `base` to `write`. If `allow_streaming`, a single-frame
+// PNG or PNM output may instead be written to its file while the image is
+// decoded, bypassing `write`.
+bool DecompressImage(
+    const jpegxl::tools::DecompressArgs& args,
+    const jpegxl::tools::CommandLineParser& cmdline,
+    const jxl::Span<const uint8_t> compressed, const std::string& base,
+    const std::string& extension, void* runner, JxlDecoder* decoder,
+    JxlDecoderContext* context, bool allow_streaming,
+    jpegxl::tools::SpeedStats* stats,
+    const std::function<bool(const std::string&, std::vector<uint8_t>)>&
+        write) {
   const jxl::extras::Codec codec = jxl::extras::CodecFromExtension(extension);
-  if (codec == jxl::extras::Codec::kEXR) {
-    std::string force_colorspace = "RGB_D65_SRG_Rel_Lin";
-    if (!args.color_space.empty() && args.color_space != force_colorspace) {
-      fprintf(stderr, "Warning: colorspace ignored for EXR output\n");
-    }
-    args.color_space = force_colorspace;
-  }
-  if (codec == jxl::extras::Codec::kPNM && extension != ".pfm" &&
-      !cmdline.GetOption(args.opt_jpeg_quality_id)->matched()) {
-    args.bits_per_sample = 0;
-  }
-
-  jpegxl::tools::SpeedStats stats;
-  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
-  {
-    int64_t flag_num_worker_threads = args.num_threads;
-    if (flag_num_worker_threads != 0) {
-      num_worker_threads = flag_num_worker_threads;
-    }
-  }
-  auto runner = JxlThreadParallelRunnerMake(
-      /*memory_manager=*/nullptr, num_worker_threads);
-
   bool decode_to_pixels = (codec != jxl::extras::Codec::kJPG);
 #if JPEGXL_ENABLE_JPEG
   if (args.pixels_to_jpeg ||
@@ -390,8 +352,8 @@ int main(int argc, const char* argv[]) {
   if (!decode_to_pixels) {
     std::vector<uint8_t> bytes;
     for (size_t i = 0; i < num_reps; ++i) {
-      if (!DecompressJxlReconstructJPEG(args, compressed, runner.get(), &bytes,
-                                        &stats)) {
+      if (!DecompressJxlReconstructJPEG(args, compressed, runner, decoder,
+                                        context, &bytes, stats)) {
         if (bytes.empty()) {
           if (!args.quiet) {
             fprintf(stderr,
@@ -401,42 +363,28 @@ int main(int argc, const char* argv[]) {
           decode_to_pixels = true;
           break;
         }
-        return EXIT_FAILURE;
+        return false;
       }
     }
     if (!bytes.empty()) {
       if (!args.quiet) fprintf(stderr, "Reconstructed to JPEG.\n");
-      if (!filename_out.empty() &&
-          !jpegxl::tools::WriteFile(filename_out.c_str(), bytes)) {
-        return EXIT_FAILURE;
+      if (!extension.empty() && !write(base + extension, std::move(bytes))) {
+        return false;
       }
     }
   }
   if (decode_to_pixels) {
     std::vector<JxlPixelFormat> accepted_formats;
     std::unique_ptr<jxl::extras::Encoder> encoder;
-    if (!filename_out.empty()) {
+    if (!extension.empty()) {
       encoder = jxl::extras::Encoder::FromExtension(extension);
       if (encoder == nullptr) {
         fprintf(stderr, "can't decode to the file extension '%s'\n",
                 extension.c_str());
-        return EXIT_FAILURE;
+        return false;
       }
       accepted_formats = encoder->AcceptedFormats();
-    }
-    jxl::extras::PackedPixelFile ppf;
-    size_t decoded_bytes = 0;
-    for (size_t i = 0; i < num_reps; ++i) {
-      if (!DecompressJxlToPackedPixelFile(args, compressed, accepted_formats,
-                                          runner.get(), &ppf, &decoded_bytes,
-                                          &stats)) {
-        fprintf(stderr, "DecompressJxlToPackedPixelFile failed\n");
-        return EXIT_FAILURE;
-      }
-    }
-    if (!args.quiet) fprintf(stderr, "Decoded to pixels.\n");
-    if (args.print_read_bytes) {
-      fprintf(stderr, "Decoded bytes: %" PRIuS "\n", decoded_bytes);
+      encoder->SetParallelRunner(JxlThreadParallelRunner, runner);
     }
 #if JPEGXL_ENABLE_JPEG
     if (encoder) {
@@ -450,36 +398,328 @@ int main(int argc, const char* argv[]) {
       encoder->SetOption("jpeg_encoder", "sjpeg");
     }
 #endif
+    // Writing the output while decoding avoids holding the whole decoded
+    // image in memory, as long as nothing else needs it. The rows go to a
+    // temporary file that only replaces the output once decoding succeeded.
+    jxl::extras::RowSinkFactory row_sink_factory;
+    std::unique_ptr<FILE, int (*)(FILE*)> stream_file(nullptr, fclose);
+    const std::string filename_out = base + extension;
+    const std::string stream_filename = filename_out + ".partial";
+    if (allow_streaming && encoder && num_reps == 1 &&
+        args.preview_out.empty() && args.metadata_out.empty()) {
+      row_sink_factory = [&](const jxl::extras::PackedPixelFile& ppf,
+                             const JxlPixelFormat& format)
+          -> std::unique_ptr<jxl::extras::RowSink> {
+        std::unique_ptr<jxl::extras::RowSink> sink;
+        FILE* file = fopen(stream_filename.c_str(), "wb");
+        if (!file) return sink;  // Reported when writing the whole image.
+        sink = encoder->CreateRowSink(ppf, format, file);
+        if (sink) {
+          stream_file.reset(file);
+        } else {
+          fclose(file);
+          remove(stream_filename.c_str());
+        }
+        return sink;
+      };
+    }
+    jxl::extras::PackedPixelFile ppf;
+    size_t decoded_bytes = 0;
+    for (size_t i = 0; i < num_reps; ++i) {
+      if (!DecompressJxlToPackedPixelFile(args, compressed, accepted_formats,
+                                          runner, decoder, context,
+                                          row_sink_factory, &ppf,
+                                          &decoded_bytes, stats)) {
+        fprintf(stderr, "DecompressJxlToPackedPixelFile failed\n");
+        if (stream_file) {
+          stream_file.reset();
+          remove(stream_filename.c_str());
+        }
+        return false;
+      }
+    }
+    if (!args.quiet) fprintf(stderr, "Decoded to pixels.\n");
+    if (args.print_read_bytes) {
+      fprintf(stderr, "Decoded bytes: %" PRIuS "\n", decoded_bytes);
+    }
+    if (stream_file) {
+      // rename() does not replace an existing file on every platform.
+      if (fclose(stream_file.release()) != 0 ||
+          (rename(stream_filename.c_str(), filename_out.c_str()) != 0 &&
+           (remove(filename_out.c_str()) != 0 ||
+            rename(stream_filename.c_str(), filename_out.c_str()) != 0))) {
+        fprintf(stderr, "Could not write %s\n", filename_out.c_str());
+        remove(stream_filename.c_str());
+        return false;
+      }
+      // Everything but the ICC profiles has been written already.
+      return WriteOptionalOutput(args.icc_out, ppf.icc) &&
+             WriteOptionalOutput(args.orig_icc_out, ppf.orig_icc);
+    }
     jxl::extras::EncodedImage encoded_image;
     if (encoder) {
       if (!encoder->Encode(ppf, &encoded_image)) {
         fprintf(stderr, "Encode failed\n");
-        return EXIT_FAILURE;
+        return false;
       }
     }
     size_t nlayers = 1 + encoded_image.extra_channel_bitstreams.size();
     size_t nframes = encoded_image.bitstreams.size();
     for (size_t i = 0; i < nlayers; ++i) {
       for (size_t j = 0; j < nframes; ++j) {
-        const std::vector<uint8_t>& bitstream =
+        std::vector<uint8_t>& bitstream =
             (i == 0 ? encoded_image.bitstreams[j]
                     : encoded_image.extra_channel_bitstreams[i - 1][j]);
         std::string fn = Filename(base, extension, i, j, nlayers, nframes);
-        if (!jpegxl::tools::WriteFile(fn.c_str(), bitstream)) {
-          return EXIT_FAILURE;
+        if (!write(fn, std::move(bitstream))) {
+          return false;
         }
       }
     }
-    if (!WriteOptionalOutput(args.preview_out,
-                             encoded_image.preview_bitstream) ||
-        !WriteOptionalOutput(args.icc_out, ppf.icc) ||
-        !WriteOptionalOutput(args.orig_icc_out, ppf.orig_icc) ||
-        !WriteOptionalOutput(args.metadata_out, encoded_image.metadata)) {
-      return EXIT_FAILURE;
+    // Not meaningful for a batch, where every file would overwrite them.
+    if (args.batch_in.empty() &&
+        (!WriteOptionalOutput(args.preview_out,
+                              encoded_image.preview_bitstream) ||
+         !WriteOptionalOutput(args.icc_out, ppf.icc) ||
+         !WriteOptionalOutput(args.orig_icc_out, ppf.orig_icc) ||
+         !WriteOptionalOutput(args.metadata_out, encoded_image.metadata))) {
+      return false;
     }
   }
+  return true;
+}
+
+void SplitExtension(const std::string& filename, std::string* base,
+                    std::string* extension) {
+  size_t pos = filename.find_last_of('.');
+  if (pos < filename.size()) {
+    *base = filename.substr(0, pos);
+    *extension = filename.substr(pos);
+  } else {
+    *base = filename;
+    extension->clear();
+  }
+}
+
+int DecompressSingleFile(const jpegxl::tools::DecompressArgs& args,
+                         const jpegxl::tools::CommandLineParser& cmdline,
+                         void* runner, size_t num_worker_threads) {
+  // Reading compressed JPEG XL input, memory-mapped if possible.
+  jpegxl::tools::InputFile input;
+  if (!input.Open(args.file_in)) {
+    fprintf(stderr, "couldn't load %s\n", args.file_in);
+    return EXIT_FAILURE;
+  }
+  const jxl::Span<const uint8_t> compressed(input.data(), input.size());
+  if (!args.quiet) {
+    fprintf(stderr, "Read %" PRIuS " compressed bytes.\n", compressed.size());
+  }
+
+  std::string base;
+  std::string extension;
+  if (args.file_out && !args.disable_output) {
+    SplitExtension(args.file_out, &base, &extension);
+  }
+  jpegxl::tools::SpeedStats stats;
+  const auto write = [](const std::string& filename,
+                        std::vector<uint8_t> bytes) {
+    return jpegxl::tools::WriteFile(filename.c_str(), bytes);
+  };
+  // With several worker threads, PNG rows are faster deflated in parallel
+  // bands once the whole image is decoded than streamed through libpng on the
+  // thread that writes the rows.
+  const bool allow_streaming =
+      num_worker_threads <= 1 ||
+      jxl::extras::CodecFromExtension(extension) != jxl::extras::Codec::kPNG;
+  if (!DecompressImage(args, cmdline, compressed, base, extension, runner,
+                       /*decoder=*/nullptr, /*context=*/nullptr,
+                       allow_streaming, &stats, write)) {
+    return EXIT_FAILURE;
+  }
   if (!args.quiet) {
     stats.Print(num_worker_threads);
   }
   return EXIT_SUCCESS;
 }
+
+// Decodes all files of --batch_in with one decoder. Files are read ahead and
+// written behind on separate threads, so that I/O overlaps with decoding.
+int DecompressBatch(const jpegxl::tools::DecompressArgs& args,
+                    const jpegxl::tools::CommandLineParser& cmdline,
+                    void* runner) {
+  std::vector<std::string> inputs;
+  if (!jpegxl::tools::ExpandBatchInput(args.batch_in, &inputs)) {
+    return EXIT_FAILURE;
+  }
+  if (!args.disable_output &&
+      !jpegxl::tools::CheckBatchOutputs(args.batch_out, inputs)) {
+    return EXIT_FAILURE;
+  }
+
+  JxlDecoderPtr decoder = JxlDecoderMake(/*memory_manager=*/nullptr);
+  // Keeps the tables computed for one file, e.g. for non-default quantization
+  // tables, for the next ones.
+  JxlDecoderContext* context =
+      JxlDecoderContextCreate(/*memory_manager=*/nullptr);
+  if (context == nullptr) {
+    fprintf(stderr, "JxlDecoderContextCreate failed\n");
+    return EXIT_FAILURE;
+  }
+  jpegxl::tools::BatchReader reader(inputs, /*max_ahead=*/4);
+  jpegxl::tools::BatchWriter writer(/*max_pending=*/4);
+  jpegxl::tools::DecompressArgs file_args = args;
+  file_args.quiet = true;
+  file_args.print_read_bytes = false;
+
+  // Whether each input failed to be read, decoded or written.
+  std::vector<bool> failed(inputs.size(), false);
+  size_t input_bytes = 0;
+  size_t output_bytes = 0;
+  size_t pixels = 0;
+  const double t0 = jxl::Now();
+  std::string filename;
+  std::vector<uint8_t> compressed;
+  bool read_ok;
+  for (size_t i = 0; reader.Next(&filename, &compressed, &read_ok); ++i) {
+    if (!read_ok) {
+      fprintf(stderr, "couldn't load %s\n", filename.c_str());
+      failed[i] = true;
+      continue;
+    }
+    std::string base;
+    std::string extension;
+    if (!args.disable_output) {
+      SplitExtension(jpegxl::tools::BatchOutputFilename(args.batch_out,
+                                                        filename),
+                     &base, &extension);
+    }
+    jpegxl::tools::SpeedStats stats;
+    const auto write = [&](const std::string& filename_out,
+                           std::vector<uint8_t> bytes) {
+      output_bytes += bytes.size();
+      writer.Write(i, filename_out, std::move(bytes));
+      return true;
+    };
+    if (!DecompressImage(file_args, cmdline,
+                         jxl::Span<const uint8_t>(compressed), base, extension,
+                         runner, decoder.get(), context,
+                         /*allow_streaming=*/false, &stats, write)) {
+      fprintf(stderr, "Decoding %s failed.\n", filename.c_str());
+      failed[i] = true;
+      continue;
+    }
+    input_bytes += compressed.size();
+    pixels += stats.NumPixels();
+  }
+  for (size_t i : writer.Finish()) failed[i] = true;
+  JxlDecoderContextDestroy(context);
+  const size_t num_failed = std::count(failed.begin(), failed.end(), true);
+  const double elapsed = jxl::Now() - t0;
+
+  if (!args.quiet) {
+    fprintf(stderr,
+            "Decompressed %" PRIuS " files (%" PRIuS " failed), %" PRIuS
+            " -> %" PRIuS " bytes in %.3f s: %.2f files/s, %.3f MP/s\n",
+            inputs.size() - num_failed, num_failed, input_bytes, output_bytes,
+            elapsed, (inputs.size() - num_failed) / elapsed,
+            pixels * 1E-6 / elapsed);
+  }
+  return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  std::string version = jpegxl::tools::CodecConfigString(JxlDecoderVersion());
+  jpegxl::tools::DecompressArgs args;
+  jpegxl::tools::CommandLineParser cmdline;
+  args.AddCommandLineOptions(&cmdline);
+
+  if (!cmdline.Parse(argc, argv)) {
+    // Parse already printed the actual error cause.
+    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (args.version) {
+    fprintf(stdout, "djxl %s\n", version.c_str());
+    fprintf(stdout, "Copyright (c) the JPEG XL Project\n");
+    return EXIT_SUCCESS;
+  }
+  if (!args.quiet) {
+    fprintf(stderr, "JPEG XL decoder %s\n", version.c_str());
+  }
+
+  if (cmdline.HelpFlagPassed()) {
+    cmdline.PrintHelp();
+    return EXIT_SUCCESS;
+  }
+
+  if (!args.ValidateArgs(cmdline)) {
+    // ValidateArgs already printed the actual error cause.
+    fprintf(stderr, "Use '%s -h' for more information\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const bool batch = !args.batch_in.empty();
+  const bool has_output =
+      batch ? !args.batch_out.empty() : args.file_out != nullptr;
+  if (!has_output && !args.disable_output) {
+    std::cerr
+        << "No output file specified and --disable_output flag not passed."
+        << std::endl;
+    return EXIT_FAILURE;
+  }
+  // Without %s, all the files of the batch would overwrite the same output.
+  if (batch && has_output && args.batch_out.find("%s") == std::string::npos) {
+    fprintf(stderr, "--batch_out must contain %%s.\n");
+    return EXIT_FAILURE;
+  }
+
+  if (has_output && args.disable_output && !args.quiet) {
+    fprintf(stderr,
+            "Decoding will be performed, but the result will be discarded.\n");
+  }
+
+  std::string base;
+  std::string extension;
+  if (has_output && !args.disable_output) {
+    SplitExtension(batch ? args.batch_out : args.file_out, &base, &extension);
+  }
+  const jxl::extras::Codec codec = jxl::extras::CodecFromExtension(extension);
+  if (codec == jxl::extras::Codec::kEXR) {
+    std::string force_colorspace = "RGB_D65_SRG_Rel_Lin";
+    if (!args.color_space.empty() && args.color_space != force_colorspace) {
+      fprintf(stderr, "Warning: colorspace ignored for EXR output\n");
+    }
+    args.color_space = force_colorspace;
+  }
+  if (codec == jxl::extras::Codec::kPNM && extension != ".pfm" &&
+      !cmdline.GetOption(args.opt_jpeg_quality_id)->matched()) {
+    args.bits_per_sample = 0;
+  }
+
+  if (!args.trace_out.empty()) {
+    JxlParallelTraceEnable(JXL_TRUE);
+  }
+
+  size_t num_worker_threads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+  {
+    int64_t flag_num_worker_threads = args.num_threads;
+    if (flag_num_worker_threads != 0) {
+      num_worker_threads = flag_num_worker_threads;
+    }
+  }
+  auto runner = JxlThreadParallelRunnerMake(
+      /*memory_manager=*/nullptr, num_worker_threads);
+
+  const int ret =
+      batch ? DecompressBatch(args, cmdline, runner.get())
+            : DecompressSingleFile(args, cmdline, runner.get(),
+                                   num_worker_threads);
+  if (ret == EXIT_SUCCESS && !args.trace_out.empty() &&
+      !jpegxl::tools::WriteParallelTrace(args.trace_out)) {
+    return EXIT_FAILURE;
+  }
+  return ret;
+}
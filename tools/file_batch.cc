@@ -0,0 +1,205 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/file_batch.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <utility>
+
+#include "tools/file_io.h"
+#include "tools/glob_support.h"
+
+namespace jpegxl {
+namespace tools {
+
+bool ExpandBatchInput(const std::string& spec,
+                      std::vector<std::string>* filenames) {
+  filenames->clear();
+  if (!spec.empty() && spec[0] == '@') {
+    std::ifstream list(spec.substr(1));
+    if (!list) {
+      fprintf(stderr, "Could not read the file list %s\n", spec.c_str() + 1);
+      return false;
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (!line.empty()) filenames->push_back(line);
+    }
+  } else {
+#if HAS_GLOB
+    glob_t g;
+    memset(&g, 0, sizeof(g));
+    if (glob(spec.c_str(), GLOB_TILDE, nullptr, &g) == 0) {
+      for (size_t i = 0; i < g.gl_pathc; ++i) {
+        filenames->push_back(g.gl_pathv[i]);
+      }
+    }
+    globfree(&g);
+#else
+    if (spec.find_first_of("*?[") != std::string::npos) {
+      fprintf(stderr, "Glob patterns are not supported on this platform.\n");
+      return false;
+    }
+    filenames->push_back(spec);
+#endif  // HAS_GLOB
+  }
+  if (filenames->empty()) {
+    fprintf(stderr, "No input files in %s\n", spec.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string BatchOutputFilename(const std::string& output_template,
+                                const std::string& input) {
+  std::string name = input;
+  const size_t slash = name.find_last_of("/\\");
+  if (slash != std::string::npos) name = name.substr(slash + 1);
+  const size_t dot = name.find_last_of('.');
+  if (dot != std::string::npos && dot != 0) name = name.substr(0, dot);
+
+  std::string out;
+  for (size_t i = 0; i < output_template.size(); ++i) {
+    if (output_template.compare(i, 2, "%s") == 0) {
+      out += name;
+      ++i;
+    } else {
+      out += output_template[i];
+    }
+  }
+  return out;
+}
+
+bool CheckBatchOutputs(const std::string& output_template,
+                       const std::vector<std::string>& inputs) {
+  std::vector<std::pair<std::string, size_t>> outputs;
+  outputs.reserve(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    outputs.emplace_back(BatchOutputFilename(output_template, inputs[i]), i);
+  }
+  std::sort(outputs.begin(), outputs.end());
+  bool ok = true;
+  for (size_t i = 1; i < outputs.size(); ++i) {
+    if (outputs[i].first != outputs[i - 1].first) continue;
+    fprintf(stderr, "%s and %s would both be written to %s\n",
+            inputs[outputs[i - 1].second].c_str(),
+            inputs[outputs[i].second].c_str(), outputs[i].first.c_str());
+    ok = false;
+  }
+  return ok;
+}
+
+BatchReader::BatchReader(std::vector<std::string> filenames, size_t max_ahead)
+    : filenames_(std::move(filenames)),
+      max_ahead_(max_ahead == 0 ? 1 : max_ahead),
+      thread_(&BatchReader::Run, this) {}
+
+BatchReader::~BatchReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void BatchReader::Run() {
+  for (const std::string& filename : filenames_) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || ready_.size() < max_ahead_; });
+      if (stop_) return;
+    }
+    Item item;
+    item.filename = filename;
+    item.read_ok = ReadFile(filename.c_str(), &item.bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ready_.push_back(std::move(item));
+    }
+    cv_.notify_all();
+  }
+}
+
+bool BatchReader::Next(std::string* filename, std::vector<uint8_t>* bytes,
+                       bool* read_ok) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (next_ == filenames_.size()) return false;
+  cv_.wait(lock, [this] { return !ready_.empty(); });
+  Item& item = ready_.front();
+  *filename = std::move(item.filename);
+  *bytes = std::move(item.bytes);
+  *read_ok = item.read_ok;
+  ready_.pop_front();
+  ++next_;
+  lock.unlock();
+  cv_.notify_all();
+  return true;
+}
+
+BatchWriter::BatchWriter(size_t max_pending)
+    : max_pending_(max_pending == 0 ? 1 : max_pending),
+      thread_(&BatchWriter::Run, this) {}
+
+BatchWriter::~BatchWriter() {
+  Finish();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void BatchWriter::Run() {
+  for (;;) {
+    Item item;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+      if (pending_.empty()) return;  // stop_ and nothing left to write.
+      item = std::move(pending_.front());
+      pending_.pop_front();
+      ++in_progress_;
+    }
+    cv_.notify_all();
+    const bool ok = WriteFile(item.filename.c_str(), item.bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --in_progress_;
+      if (!ok) {
+        const auto it = std::lower_bound(failed_inputs_.begin(),
+                                         failed_inputs_.end(), item.input);
+        if (it == failed_inputs_.end() || *it != item.input) {
+          failed_inputs_.insert(it, item.input);
+        }
+      }
+    }
+    cv_.notify_all();
+  }
+}
+
+void BatchWriter::Write(size_t input, std::string filename,
+                        std::vector<uint8_t> bytes) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return pending_.size() < max_pending_; });
+  pending_.push_back(Item{input, std::move(filename), std::move(bytes)});
+  lock.unlock();
+  cv_.notify_all();
+}
+
+std::vector<size_t> BatchWriter::Finish() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return pending_.empty() && in_progress_ == 0; });
+  return failed_inputs_;
+}
+
+}  // namespace tools
+}  // namespace jpegxl
@@ -0,0 +1,119 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_FILE_BATCH_H_
+#define TOOLS_FILE_BATCH_H_
+
+// Helpers for the batch mode of cjxl and djxl, which process many files in
+// one process: expanding the list of inputs, naming the outputs, and reading
+// and writing files on separate threads while the current file is encoded or
+// decoded.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace jpegxl {
+namespace tools {
+
+// Expands the input of a batch: "@FILE" is a text file listing one input path
+// per line, anything else is a glob pattern such as "in/*.png". Returns false
+// if the list can't be read or the pattern doesn't match any file.
+bool ExpandBatchInput(const std::string& spec,
+                      std::vector<std::string>* filenames);
+
+// Returns `output_template` with each "%s" replaced by the name of `input`
+// without directory and extension, e.g. "out/%s.jxl" for "in/a.png" gives
+// "out/a.jxl".
+std::string BatchOutputFilename(const std::string& output_template,
+                                const std::string& input);
+
+// Returns false, after printing them, if several of `inputs` have the same
+// output name, e.g. "a/x.png" and "b/x.png" with "out/%s.jxl".
+bool CheckBatchOutputs(const std::string& output_template,
+                       const std::vector<std::string>& inputs);
+
+// Reads the files of a batch in order on a separate thread, staying at most
+// `max_ahead` files ahead of the consumer.
+class BatchReader {
+ public:
+  BatchReader(std::vector<std::string> filenames, size_t max_ahead);
+  ~BatchReader();
+
+  BatchReader(const BatchReader&) = delete;
+  BatchReader& operator=(const BatchReader&) = delete;
+
+  // Returns the next file and its contents, or false after the last file.
+  // `read_ok` is false if the file could not be read.
+  bool Next(std::string* filename, std::vector<uint8_t>* bytes,
+            bool* read_ok);
+
+ private:
+  struct Item {
+    std::string filename;
+    std::vector<uint8_t> bytes;
+    bool read_ok;
+  };
+
+  void Run();
+
+  const std::vector<std::string> filenames_;
+  const size_t max_ahead_;
+  size_t next_ = 0;  // index of the next file returned by Next()
+  std::deque<Item> ready_;
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+};
+
+// Writes the outputs of a batch on a separate thread; Write() only blocks
+// while `max_pending` writes are queued.
+class BatchWriter {
+ public:
+  explicit BatchWriter(size_t max_pending);
+  // Calls Finish().
+  ~BatchWriter();
+
+  BatchWriter(const BatchWriter&) = delete;
+  BatchWriter& operator=(const BatchWriter&) = delete;
+
+  // Queues an output of the input with index `input`; an input may have
+  // several outputs.
+  void Write(size_t input, std::string filename, std::vector<uint8_t> bytes);
+
+  // Waits until all queued writes are done and returns the indices of the
+  // inputs with at least one failed write so far, in increasing order.
+  std::vector<size_t> Finish();
+
+ private:
+  struct Item {
+    size_t input;
+    std::string filename;
+    std::vector<uint8_t> bytes;
+  };
+
+  void Run();
+
+  const size_t max_pending_;
+  std::deque<Item> pending_;
+  size_t in_progress_ = 0;
+  std::vector<size_t> failed_inputs_;  // sorted, no duplicates
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+};
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_FILE_BATCH_H_
@@ -10,18 +10,55 @@
 #include <stdio.h>
 #include <string.h>
 
+#if defined(_WIN32) || defined(_WIN64)
+#include <fcntl.h>
+#include <io.h>
+#define JXL_TOOLS_HAS_MMAP 0
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define JXL_TOOLS_HAS_MMAP 1
+#endif
+
 namespace jpegxl {
 namespace tools {
 
+namespace {
+
+// Reads `file` from its current position until its end.
+bool ReadStream(FILE* file, std::vector<uint8_t>* out) {
+  out->clear();
+  constexpr size_t kChunkSize = 1 << 20;
+  for (;;) {
+    const size_t pos = out->size();
+    out->resize(pos + kChunkSize);
+    const size_t read = fread(out->data() + pos, 1, kChunkSize, file);
+    out->resize(pos + read);
+    if (read < kChunkSize) break;
+  }
+  return ferror(file) == 0;
+}
+
+}  // namespace
+
 bool ReadFile(const char* filename, std::vector<uint8_t>* out) {
+  if (strcmp(filename, "-") == 0) {
+#if defined(_WIN32) || defined(_WIN64)
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    return ReadStream(stdin, out);
+  }
   FILE* file = fopen(filename, "rb");
   if (!file) {
     return false;
   }
 
   if (fseek(file, 0, SEEK_END) != 0) {
-    fclose(file);
-    return false;
+    // Not seekable, e.g. a pipe.
+    const bool ok = ReadStream(file, out);
+    return fclose(file) == 0 && ok;
   }
 
   long size = ftell(file);
@@ -45,6 +82,48 @@ bool ReadFile(const char* filename, std::vector<uint8_t>* out) {
   return readsize == static_cast<size_t>(size);
 }
 
+InputFile::~InputFile() { Close(); }
+
+void InputFile::Close() {
+#if JXL_TOOLS_HAS_MMAP
+  if (mapped_) munmap(data_, size_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+  buffer_.clear();
+}
+
+bool InputFile::Open(const char* filename) {
+  Close();
+#if JXL_TOOLS_HAS_MMAP
+  if (strcmp(filename, "-") != 0) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+#if defined(MADV_SEQUENTIAL)
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+        close(fd);
+        data_ = static_cast<uint8_t*>(map);
+        size_ = st.st_size;
+        mapped_ = true;
+        return true;
+      }
+    }
+    close(fd);
+  }
+#endif  // JXL_TOOLS_HAS_MMAP
+  if (!ReadFile(filename, &buffer_)) return false;
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+  return true;
+}
+
 bool WriteFile(const char* filename, const std::vector<uint8_t>& bytes) {
   FILE* file = fopen(filename, "wb");
   if (!file) {
@@ -6,6 +6,7 @@
 #ifndef TOOLS_FILE_IO_H_
 #define TOOLS_FILE_IO_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <vector>
@@ -13,8 +14,37 @@
 namespace jpegxl {
 namespace tools {
 
+// Reads the whole file; "-" reads stdin. Pipes and other files that can't be
+// seeked are read in chunks until their end.
 bool ReadFile(const char* filename, std::vector<uint8_t>* out);
 
+// Contents of an input file. Regular files are memory-mapped where supported,
+// so that decoders can use them without reading them into a buffer first; the
+// mapping is private, so the contents may be modified in memory. Anything
+// else, e.g. pipes and stdin ("-"), falls back to ReadFile.
+class InputFile {
+ public:
+  InputFile() = default;
+  ~InputFile();
+
+  InputFile(const InputFile&) = delete;
+  InputFile& operator=(const InputFile&) = delete;
+
+  bool Open(const char* filename);
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool mapped() const { return mapped_; }
+
+ private:
+  void Close();
+
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::vector<uint8_t> buffer_;
+};
+
 bool WriteFile(const char* filename, const std::vector<uint8_t>& bytes);
 
 }  // namespace tools
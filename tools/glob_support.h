@@ -0,0 +1,34 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_GLOB_SUPPORT_H_
+#define TOOLS_GLOB_SUPPORT_H_
+
+// Defines HAS_GLOB to 1 and includes <glob.h> where glob() is available; it
+// can be forced to 0 by the build, e.g. for MinGW.
+
+#ifndef HAS_GLOB
+#define HAS_GLOB 0
+#if defined __has_include
+// <glob.h> is included in previous APIs but glob() function is not defined
+// until API 28.
+#if __has_include(<glob.h>) && \
+    (!defined(__ANDROID_API__) || __ANDROID_API__ >= 28)
+#undef HAS_GLOB
+#define HAS_GLOB 1
+#endif  // __has_include(<glob.h>)
+#endif  // __has_include
+#endif  // HAS_GLOB
+
+#if HAS_GLOB
+#include <glob.h>
+#endif  // HAS_GLOB
+
+// There is no "user" in embedded filesystems.
+#ifndef GLOB_TILDE
+#define GLOB_TILDE 0
+#endif
+
+#endif  // TOOLS_GLOB_SUPPORT_H_
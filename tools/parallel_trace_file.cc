@@ -0,0 +1,32 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "tools/parallel_trace_file.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "jxl/parallel_trace.h"
+#include "tools/file_io.h"
+
+namespace jpegxl {
+namespace tools {
+
+bool WriteParallelTrace(const std::string& filename) {
+  std::vector<uint8_t> json;
+  size_t size = JxlParallelTraceGetJSON(nullptr, 0);
+  while (size > json.size()) {
+    json.resize(size);
+    size = JxlParallelTraceGetJSON(reinterpret_cast<char*>(json.data()),
+                                   json.size());
+  }
+  json.resize(size - 1);  // nul terminator
+  return WriteFile(filename.c_str(), json);
+}
+
+}  // namespace tools
+}  // namespace jpegxl
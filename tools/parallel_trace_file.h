@@ -0,0 +1,21 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef TOOLS_PARALLEL_TRACE_FILE_H_
+#define TOOLS_PARALLEL_TRACE_FILE_H_
+
+#include <string>
+
+namespace jpegxl {
+namespace tools {
+
+// Writes the parallel regions recorded so far (see jxl/parallel_trace.h) to
+// `filename` as Chrome trace JSON. Returns false if the file can't be written.
+bool WriteParallelTrace(const std::string& filename);
+
+}  // namespace tools
+}  // namespace jpegxl
+
+#endif  // TOOLS_PARALLEL_TRACE_FILE_H_
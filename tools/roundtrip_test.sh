@@ -102,6 +102,40 @@ roundtrip_test() {
   fi
 }
 
+# Lossless roundtrip of the depth N PPM, PGM and PAM files of flower_small,
+# given as a list, through the batch mode of cjxl and djxl.
+roundtrip_batch_test() {
+  local depth="$1"
+  local indir="${JPEGXL_TEST_DATA_PATH}/jxl/flower"
+  local jxldir="$(mktemp -d -p "$tmpdir")"
+  local outdir="$(mktemp -d -p "$tmpdir")"
+
+  local names="rgb.depth${depth}.ppm g.depth${depth}.pgm ga.depth${depth}.pam
+      rgba.depth${depth}.pam"
+  for name in ${names}; do
+    echo "${indir}/flower_small.${name}"
+  done > "${jxldir}/inputs.txt"
+  "${encoder}" --batch_in "@${jxldir}/inputs.txt" \
+      --batch_out "${jxldir}/%s.jxl" -d 0
+  # Without %s, all the inputs would be written to the same file.
+  if "${encoder}" --batch_in "@${jxldir}/inputs.txt" \
+      --batch_out "${jxldir}/out.jxl" -d 0; then
+    return 1
+  fi
+  # djxl picks the output format from the extension of --batch_out, so decode
+  # each kind of PNM in its own batch.
+  for ext in ppm pgm pam; do
+    grep "\.${ext}\$" "${jxldir}/inputs.txt" |
+        sed -e 's|.*/\(.*\)\.'"${ext}"'$|'"${jxldir}"'/\1.jxl|' \
+        > "${jxldir}/${ext}.txt"
+    "${decoder}" --batch_in "@${jxldir}/${ext}.txt" \
+        --batch_out "${outdir}/%s.${ext}"
+  done
+  while read -r infn; do
+    diff "${infn}" "${outdir}/$(basename "${infn}")"
+  done < "${jxldir}/inputs.txt"
+}
+
 main() {
   local tmpdir=$(mktemp -d)
   CLEANUP_FILES+=("${tmpdir}")
@@ -133,6 +167,7 @@ main() {
       roundtrip_lossless_pnm_test "jxl/flower/flower_small.ga.depth$i.pam"
       roundtrip_lossless_pnm_test "jxl/flower/flower_small.rgba.depth$i.pam"
   done
+  roundtrip_batch_test 8
 }
 
 main "$@"
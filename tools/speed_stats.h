@@ -38,6 +38,9 @@ class SpeedStats {
     ysize_ = ysize;
   }
 
+  // Returns the number of pixels given to SetImageSize(), or 0.
+  size_t NumPixels() const { return xsize_ * ysize_; }
+
   // Sets the file size to allow computing MB/s values.
   void SetFileSize(size_t file_size) { file_size_ = file_size; }
 